@@ -1,4 +1,8 @@
 // Necessary because of this issue: https://github.com/rust-lang/cargo/issues/9641
 fn main() -> anyhow::Result<()> {
+    // host builds (host/CMakeLists.txt) have no ESP-IDF to propagate
+    if std::env::var("CARGO_CFG_TARGET_OS").as_deref() != Ok("espidf") {
+        return Ok(());
+    }
     embuild::build::CfgArgs::output_propagated("ESP_IDF")
 }
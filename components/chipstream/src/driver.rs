@@ -3,11 +3,17 @@
 mod meta;
 mod vgmplay;
 mod xgmplay;
+mod vgmloader;
+mod vgmevent;
 mod vgmmeta;
 mod xgmmeta;
 mod gd3meta;
+mod vgmindex;
 
 pub use crate::driver::vgmplay::VgmPlay as VgmPlay;
 pub use crate::driver::vgmplay::VGM_TICK_RATE as VGM_TICK_RATE;
 pub use crate::driver::xgmplay::XgmPlay as XgmPlay;
 pub use crate::driver::xgmplay::XGM_NTSC_TICK_RATE as XGM_NTSC_TICK_RATE;
+pub use crate::driver::vgmindex::get_gd3_strings;
+pub use crate::driver::vgmindex::VgmMetaInfo;
+pub use crate::driver::vgmindex::VgmMetaReader;
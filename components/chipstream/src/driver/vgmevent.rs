@@ -0,0 +1,368 @@
+// license:BSD-3-Clause
+// copyright-holders:Hiromasa Tanaka
+
+///
+/// Compiled VGM event stream
+///
+/// VgmPlay compiles the command stream once after loading into a flat array
+/// of 8-byte events, which play walks instead of parsing the commands.
+/// An event is done at once and is followed by wait ticks.
+///
+///  handle < EVENT_END: write reg/data to the device of the sound slot handle
+///  EVENT_END: end of data, or back to the loop event
+///  EVENT_COMMAND: run the vgm command at offset (reg | data << 16) by the parser
+///  EVENT_WAIT: wait only
+///
+/// Writes between two waits are grouped by device (in order per device),
+/// commands and the loop point are not moved over.
+///
+pub const EVENT_END: u8 = 0xfd;
+pub const EVENT_COMMAND: u8 = 0xfe;
+pub const EVENT_WAIT: u8 = 0xff;
+
+///
+/// Saved form (little endian)
+///
+///  magic "VGME", version u16, reserved u16
+///  vgm_data_len u32, vgm_data_offset u32: the command stream compiled
+///  loop_event u32 (EVENT_NO_LOOP without loop)
+///  devices u32, then devices x (sound chip type u8, sound chip index u8), padded to 4 bytes
+///  events u32, then events x 8 bytes (wait u16, handle u8, 0 u8, reg u16, data u16)
+///
+const EVENT_MAGIC: &[u8; 4] = b"VGME";
+const EVENT_VERSION: u16 = 1;
+const EVENT_NO_LOOP: u32 = 0xffffffff;
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+#[repr(C)]
+pub struct VgmEvent {
+    pub wait: u16,
+    pub handle: u8,
+    pub reserved: u8,
+    pub reg: u16,
+    pub data: u16,
+}
+
+impl VgmEvent {
+    fn new(handle: u8, reg: u16, data: u16) -> Self {
+        VgmEvent {
+            wait: 0,
+            handle,
+            reserved: 0,
+            reg,
+            data,
+        }
+    }
+
+    ///
+    /// Offset of the vgm command of EVENT_COMMAND
+    ///
+    #[inline]
+    pub fn get_offset(&self) -> usize {
+        self.reg as usize | (self.data as usize) << 16
+    }
+}
+
+///
+/// What the events were compiled from
+///
+/// devices holds the sound chip type and index of each device handle.
+///
+#[derive(PartialEq, Eq, Debug)]
+pub struct VgmEventSource {
+    pub vgm_data_len: u32,
+    pub vgm_data_offset: u32,
+    pub devices: Vec<(u8, u8)>,
+}
+
+///
+/// Compiled events
+///
+/// loop_tick and end_tick are the ticks from the start to the loop event
+/// and to the end (not in the saved form).
+///
+#[derive(Default)]
+pub struct VgmEvents {
+    pub events: Vec<VgmEvent>,
+    pub loop_event: Option<usize>,
+    pub loop_tick: usize,
+    pub end_tick: usize,
+}
+
+impl VgmEvents {
+    fn new(events: Vec<VgmEvent>, loop_event: Option<usize>) -> Self {
+        let tick_until =
+            |end: usize| -> usize { events[..end].iter().map(|event| event.wait as usize).sum() };
+        let loop_tick = loop_event.map_or(0, tick_until);
+        let end_tick = tick_until(events.len());
+        VgmEvents {
+            events,
+            loop_event,
+            loop_tick,
+            end_tick,
+        }
+    }
+
+    ///
+    /// Serialize to the saved form.
+    ///
+    pub fn to_bytes(&self, source: &VgmEventSource) -> Vec<u8> {
+        let mut bytes = Vec::with_capacity(32 + source.devices.len() * 2 + self.events.len() * 8);
+        bytes.extend_from_slice(EVENT_MAGIC);
+        bytes.extend_from_slice(&EVENT_VERSION.to_le_bytes());
+        bytes.extend_from_slice(&0_u16.to_le_bytes());
+        bytes.extend_from_slice(&source.vgm_data_len.to_le_bytes());
+        bytes.extend_from_slice(&source.vgm_data_offset.to_le_bytes());
+        let loop_event = match self.loop_event {
+            Some(loop_event) => loop_event as u32,
+            None => EVENT_NO_LOOP,
+        };
+        bytes.extend_from_slice(&loop_event.to_le_bytes());
+        bytes.extend_from_slice(&(source.devices.len() as u32).to_le_bytes());
+        for &(sound_chip_type, sound_chip_index) in source.devices.iter() {
+            bytes.push(sound_chip_type);
+            bytes.push(sound_chip_index);
+        }
+        bytes.resize((bytes.len() + 3) & !3, 0);
+        bytes.extend_from_slice(&(self.events.len() as u32).to_le_bytes());
+        for event in self.events.iter() {
+            bytes.extend_from_slice(&event.wait.to_le_bytes());
+            bytes.push(event.handle);
+            bytes.push(0);
+            bytes.extend_from_slice(&event.reg.to_le_bytes());
+            bytes.extend_from_slice(&event.data.to_le_bytes());
+        }
+        bytes
+    }
+
+    ///
+    /// Deserialize the saved form compiled from source.
+    ///
+    /// Handles and the loop event are checked, so that play cannot run off
+    /// the events; the offsets of EVENT_COMMAND are checked by the caller.
+    ///
+    pub fn from_bytes(bytes: &[u8], source: &VgmEventSource) -> Result<Self, &'static str> {
+        let mut reader = ByteReader { bytes, pos: 0 };
+        if reader.take(4)? != EVENT_MAGIC || reader.u16()? != EVENT_VERSION {
+            return Err("not a vgm event stream.");
+        }
+        reader.u16()?;
+        let vgm_data_len = reader.u32()?;
+        let vgm_data_offset = reader.u32()?;
+        let loop_event = reader.u32()?;
+        let device_count = reader.u32()? as usize;
+        let mut devices = Vec::with_capacity(device_count.min(256));
+        for _ in 0..device_count {
+            let device = reader.take(2)?;
+            devices.push((device[0], device[1]));
+        }
+        reader.take(((device_count * 2 + 3) & !3) - device_count * 2)?;
+        let compiled = VgmEventSource {
+            vgm_data_len,
+            vgm_data_offset,
+            devices,
+        };
+        if compiled != *source {
+            return Err("vgm event stream of another vgm.");
+        }
+        let event_count = reader.u32()? as usize;
+        if event_count == 0 || bytes.len() - reader.pos != event_count * 8 {
+            return Err("vgm event stream is broken.");
+        }
+        let mut events = Vec::with_capacity(event_count);
+        for _ in 0..event_count {
+            let wait = reader.u16()?;
+            let handle = reader.take(2)?[0];
+            let reg = reader.u16()?;
+            let data = reader.u16()?;
+            if handle < EVENT_END && handle as usize >= device_count {
+                return Err("vgm event stream is broken.");
+            }
+            events.push(VgmEvent {
+                wait,
+                handle,
+                reserved: 0,
+                reg,
+                data,
+            });
+        }
+        let loop_event = match loop_event {
+            EVENT_NO_LOOP => None,
+            loop_event => Some(loop_event as usize),
+        };
+        if events[event_count - 1].handle != EVENT_END
+            || loop_event.map_or(false, |loop_event| loop_event >= event_count)
+        {
+            return Err("vgm event stream is broken.");
+        }
+        Ok(VgmEvents::new(events, loop_event))
+    }
+}
+
+struct ByteReader<'a> {
+    bytes: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> ByteReader<'a> {
+    fn take(&mut self, length: usize) -> Result<&'a [u8], &'static str> {
+        if self.bytes.len() - self.pos < length {
+            return Err("vgm event stream is broken.");
+        }
+        self.pos += length;
+        Ok(&self.bytes[self.pos - length..self.pos])
+    }
+
+    fn u16(&mut self) -> Result<u16, &'static str> {
+        Ok(u16::from_le_bytes(self.take(2)?.try_into().unwrap()))
+    }
+
+    fn u32(&mut self) -> Result<u32, &'static str> {
+        Ok(u32::from_le_bytes(self.take(4)?.try_into().unwrap()))
+    }
+}
+
+///
+/// Build events in command order
+///
+#[derive(Default)]
+pub struct VgmEventBuilder {
+    events: Vec<VgmEvent>,
+    // writes from here are at the same tick and can be grouped
+    group_start: usize,
+    // waits are added to the events from here (the loop event is jumped to)
+    wait_start: usize,
+    loop_event: Option<usize>,
+}
+
+impl VgmEventBuilder {
+    pub fn write(&mut self, handle: u8, reg: u16, data: u16) {
+        self.events.push(VgmEvent::new(handle, reg, data));
+    }
+
+    ///
+    /// Command run by the parser, followed by wait ticks.
+    ///
+    pub fn command(&mut self, offset: usize, wait: u32) {
+        self.group();
+        self.events.push(VgmEvent::new(
+            EVENT_COMMAND,
+            offset as u16,
+            (offset >> 16) as u16,
+        ));
+        self.group_start = self.events.len();
+        self.wait(wait);
+    }
+
+    pub fn wait(&mut self, mut wait: u32) {
+        self.group();
+        while wait > 0 {
+            let len = self.events.len();
+            if len == self.wait_start || self.events[len - 1].wait == u16::MAX {
+                self.events.push(VgmEvent::new(EVENT_WAIT, 0, 0));
+                self.group_start = self.events.len();
+            }
+            let event = self.events.last_mut().unwrap();
+            let add = wait.min((u16::MAX - event.wait) as u32);
+            event.wait += add as u16;
+            wait -= add;
+        }
+    }
+
+    ///
+    /// The next event is the loop event.
+    ///
+    pub fn loop_point(&mut self) {
+        self.group();
+        self.loop_event = Some(self.events.len());
+        self.wait_start = self.events.len();
+    }
+
+    pub fn end(mut self) -> VgmEvents {
+        self.group();
+        self.events.push(VgmEvent::new(EVENT_END, 0, 0));
+        self.events.shrink_to_fit();
+        VgmEvents::new(self.events, self.loop_event)
+    }
+
+    ///
+    /// Group the writes of the same tick by device (stable).
+    ///
+    fn group(&mut self) {
+        self.events[self.group_start..].sort_by_key(|event| event.handle);
+        self.group_start = self.events.len();
+    }
+}
+
+///
+/// cargo test -- --nocapture
+///
+#[cfg(test)]
+mod tests {
+    use super::{VgmEventBuilder, VgmEventSource, VgmEvents, EVENT_COMMAND, EVENT_END, EVENT_WAIT};
+
+    #[test]
+    fn build() {
+        let mut builder = VgmEventBuilder::default();
+        builder.write(1, 0x10, 1);
+        builder.write(0, 0x20, 2);
+        builder.write(1, 0x11, 3);
+        builder.wait(10);
+        builder.loop_point();
+        builder.wait(0x18000);
+        builder.write(0, 0x21, 4);
+        builder.command(0x1234_5678, 3);
+        builder.write(1, 0x12, 5);
+        let vgm_events = builder.end();
+        let events: Vec<(u8, u16, u16, u16)> = vgm_events
+            .events
+            .iter()
+            .map(|event| (event.handle, event.reg, event.data, event.wait))
+            .collect();
+        assert_eq!(
+            events,
+            vec![
+                // grouped by device, the wait on the last write
+                (0, 0x20, 2, 0),
+                (1, 0x10, 1, 0),
+                (1, 0x11, 3, 10),
+                // not added to the event before the loop point
+                (EVENT_WAIT, 0, 0, 0xffff),
+                (EVENT_WAIT, 0, 0, 0x8001),
+                (0, 0x21, 4, 0),
+                (EVENT_COMMAND, 0x5678, 0x1234, 3),
+                (1, 0x12, 5, 0),
+                (EVENT_END, 0, 0, 0),
+            ]
+        );
+        assert_eq!(vgm_events.loop_event, Some(3));
+        assert_eq!(vgm_events.events[6].get_offset(), 0x1234_5678);
+        assert_eq!(vgm_events.loop_tick, 10);
+        assert_eq!(vgm_events.end_tick, 10 + 0x18000 + 3);
+
+        // saved form
+        let source = VgmEventSource {
+            vgm_data_len: 0x2000_0000,
+            vgm_data_offset: 0x80,
+            devices: vec![(13, 0), (6, 0), (6, 1)],
+        };
+        let bytes = vgm_events.to_bytes(&source);
+        let loaded = VgmEvents::from_bytes(&bytes, &source).unwrap();
+        assert_eq!(loaded.events, vgm_events.events);
+        assert_eq!(loaded.loop_event, vgm_events.loop_event);
+        assert_eq!(loaded.end_tick, vgm_events.end_tick);
+        let other = VgmEventSource {
+            vgm_data_len: 0x2000_0001,
+            ..source
+        };
+        assert!(VgmEvents::from_bytes(&bytes, &other).is_err());
+        let source = VgmEventSource {
+            vgm_data_len: 0x2000_0000,
+            ..other
+        };
+        assert!(VgmEvents::from_bytes(&bytes[..bytes.len() - 1], &source).is_err());
+        let mut broken = bytes.clone();
+        broken[bytes.len() - 8 * 2 + 2] = 3; // handle of a device not in the slot
+        assert!(VgmEvents::from_bytes(&broken, &source).is_err());
+    }
+}
@@ -0,0 +1,476 @@
+// license:BSD-3-Clause
+// copyright-holders:Hiromasa Tanaka
+use flate2::write::GzDecoder;
+use std::io::Write;
+
+use crate::driver::gd3meta::{parse_gd3, Gd3};
+use crate::driver::vgmmeta::{parse_vgm_header_meta, VgmHeader};
+
+///
+/// Header bytes kept (up to the VGM data, where the extra header is)
+///
+const VGM_META_HEADER_LIMIT: usize = 0x400;
+
+///
+/// GD3 bytes kept (the notes at the end may be cut)
+///
+const VGM_META_GD3_LIMIT: usize = 0x1000;
+
+///
+/// Bits of VgmMetaInfo chips, in the order VgmPlay adds the chips
+///
+pub const VGM_META_CHIP_YM2612: u32 = 1 << 0;
+pub const VGM_META_CHIP_YM2151: u32 = 1 << 1;
+pub const VGM_META_CHIP_YM2203: u32 = 1 << 2;
+pub const VGM_META_CHIP_YM2413: u32 = 1 << 3;
+pub const VGM_META_CHIP_AY8910: u32 = 1 << 4;
+pub const VGM_META_CHIP_YM2608: u32 = 1 << 5;
+pub const VGM_META_CHIP_YM2610: u32 = 1 << 6;
+pub const VGM_META_CHIP_YM3812: u32 = 1 << 7;
+pub const VGM_META_CHIP_YM3526: u32 = 1 << 8;
+pub const VGM_META_CHIP_Y8950: u32 = 1 << 9;
+pub const VGM_META_CHIP_YMF262: u32 = 1 << 10;
+pub const VGM_META_CHIP_YMF278B: u32 = 1 << 11;
+pub const VGM_META_CHIP_SN76489: u32 = 1 << 12;
+pub const VGM_META_CHIP_PWM: u32 = 1 << 13;
+pub const VGM_META_CHIP_SEGAPCM: u32 = 1 << 14;
+pub const VGM_META_CHIP_OKIM6258: u32 = 1 << 15;
+pub const VGM_META_CHIP_C140: u32 = 1 << 16;
+pub const VGM_META_CHIP_C219: u32 = 1 << 17;
+pub const VGM_META_CHIP_OKIM6295: u32 = 1 << 18;
+///
+/// Chips in the header that are not played
+///
+pub const VGM_META_CHIP_OTHER: u32 = 1 << 31;
+
+///
+/// Summary of a VGM header for the library index (C layout)
+///
+///  version: BCD version as decimal (e.g. 171)
+///  chips: VGM_META_CHIP_* of the chips played
+///  dual_chips: VGM_META_CHIP_* of the chips played as two
+///
+#[repr(C)]
+#[derive(Default, Debug, PartialEq)]
+pub struct VgmMetaInfo {
+    pub version: u32,
+    pub total_samples: u32,
+    pub loop_samples: u32,
+    pub chips: u32,
+    pub dual_chips: u32,
+}
+
+///
+/// Input format
+///
+enum VgmMetaInput {
+    Detect,
+    Vgm,
+    Vgz(GzDecoder<Vec<u8>>),
+}
+
+///
+/// VGM header and GD3 reader
+///
+/// Reads a .vgm/.vgz by chunks for the library index, keeping only the
+/// header and the GD3. A .vgm is read from next_offset, which skips to
+/// the GD3 once the header has been read. A .vgz is inflated through
+/// and the inflated data is dropped.
+///
+pub struct VgmMetaReader {
+    input: VgmMetaInput,
+    file_pos: usize,
+    data_pos: usize,
+    header: Vec<u8>,
+    header_end: usize,
+    gd3: Vec<u8>,
+    gd3_pos: usize,
+    gd3_end: usize,
+}
+
+impl Default for VgmMetaReader {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl VgmMetaReader {
+    pub fn new() -> Self {
+        VgmMetaReader {
+            input: VgmMetaInput::Detect,
+            file_pos: 0,
+            data_pos: 0,
+            header: Vec::new(),
+            header_end: 0x38,
+            gd3: Vec::new(),
+            gd3_pos: 0,
+            gd3_end: 0,
+        }
+    }
+
+    ///
+    /// Load a chunk of the file read from next_offset.
+    ///
+    pub fn load(&mut self, chunk: &[u8]) -> Result<(), &'static str> {
+        if let VgmMetaInput::Detect = self.input {
+            if chunk.len() < 2 {
+                return Err("vgm header parse error.");
+            }
+            // gzip magic number
+            self.input = if chunk[0] == 0x1f && chunk[1] == 0x8b {
+                VgmMetaInput::Vgz(GzDecoder::new(Vec::new()))
+            } else {
+                VgmMetaInput::Vgm
+            };
+        }
+        match &mut self.input {
+            VgmMetaInput::Vgz(decoder) => {
+                self.file_pos += chunk.len();
+                if decoder.write_all(chunk).is_err() {
+                    return Err("vgz inflate error.");
+                }
+                let inflated = std::mem::take(decoder.get_mut());
+                let result = self.consume(&inflated);
+                // reuse the inflate buffer
+                let mut inflated = inflated;
+                inflated.clear();
+                if let VgmMetaInput::Vgz(decoder) = &mut self.input {
+                    *decoder.get_mut() = inflated;
+                }
+                result
+            }
+            _ => {
+                self.data_pos = self.next_offset().unwrap_or(self.data_pos);
+                self.file_pos = self.data_pos + chunk.len();
+                self.consume(chunk)
+            }
+        }
+    }
+
+    ///
+    /// File offset of the next chunk, None when the header and the GD3 have been read.
+    ///
+    pub fn next_offset(&self) -> Option<usize> {
+        if self.is_complete() {
+            return None;
+        }
+        match self.input {
+            VgmMetaInput::Vgm if self.header.len() == self.header_end => {
+                Some(self.data_pos.max(self.gd3_pos + self.gd3.len()))
+            }
+            VgmMetaInput::Vgm => Some(self.data_pos),
+            _ => Some(self.file_pos),
+        }
+    }
+
+    ///
+    /// Finish reading (at the end of the file or when complete).
+    ///
+    /// A GD3 that could not be read is blank.
+    ///
+    pub fn finish(&mut self) -> Result<(VgmHeader, Gd3), &'static str> {
+        if let VgmMetaInput::Vgz(decoder) = &mut self.input {
+            if decoder.try_finish().is_ok() {
+                let inflated = std::mem::take(decoder.get_mut());
+                self.consume(&inflated)?;
+            }
+        }
+        if self.header.len() != self.header_end {
+            return Err("vgm header parse error.");
+        }
+        let header = parse_vgm_header_meta(&self.header)?;
+        let gd3 = match parse_gd3(&self.gd3) {
+            Ok((_, gd3)) => gd3,
+            Err(_) => Gd3::default(), // blank values
+        };
+
+        Ok((header, gd3))
+    }
+
+    fn is_complete(&self) -> bool {
+        self.header.len() == self.header_end
+            && self.header_end > 0x38
+            && (self.gd3_pos == 0 || self.gd3.len() == self.gd3_end - self.gd3_pos)
+    }
+
+    ///
+    /// Keep the header and GD3 bytes of data (at data_pos).
+    ///
+    fn consume(&mut self, data: &[u8]) -> Result<(), &'static str> {
+        let start = self.data_pos;
+        self.data_pos += data.len();
+        if Self::collect(&mut self.header, 0, self.header_end, start, data) {
+            if &self.header[..4] != b"Vgm " {
+                return Err("vgm header parse error.");
+            }
+            if self.header_end == 0x38 {
+                // the header goes up to the VGM data (0x40 before 1.50)
+                let data_offset = get_u32(&self.header, 0x34);
+                self.header_end = if data_offset == 0 {
+                    0x40
+                } else {
+                    data_offset
+                        .saturating_add(0x34)
+                        .clamp(0x40, VGM_META_HEADER_LIMIT)
+                };
+                // no GD3 (or a broken offset)
+                let gd3_pos = get_u32(&self.header, 0x14).saturating_add(0x14);
+                if gd3_pos > 0x14 && gd3_pos < usize::MAX - VGM_META_GD3_LIMIT {
+                    self.gd3_pos = gd3_pos;
+                    self.gd3_end = gd3_pos + 12;
+                }
+                Self::collect(&mut self.header, 0, self.header_end, start, data);
+            }
+        }
+        if self.gd3_pos != 0
+            && Self::collect(&mut self.gd3, self.gd3_pos, self.gd3_end, start, data)
+        {
+            if self.gd3_end == self.gd3_pos + 12 {
+                // "Gd3 ", version and length
+                self.gd3_end += get_u32(&self.gd3, 8).min(VGM_META_GD3_LIMIT - 12);
+                Self::collect(&mut self.gd3, self.gd3_pos, self.gd3_end, start, data);
+            }
+        }
+        Ok(())
+    }
+
+    ///
+    /// Append the bytes of [begin, end) in data (at start) to buffer.
+    ///
+    /// Returns true when buffer holds all of them.
+    ///
+    fn collect(buffer: &mut Vec<u8>, begin: usize, end: usize, start: usize, data: &[u8]) -> bool {
+        let from = begin + buffer.len();
+        if from < end && from >= start && from < start + data.len() {
+            let to = end.min(start + data.len());
+            buffer.extend_from_slice(&data[(from - start)..(to - start)]);
+        }
+        buffer.len() == end - begin
+    }
+}
+
+impl VgmMetaInfo {
+    pub fn new(header: &VgmHeader) -> Self {
+        // dual chips as VgmPlay::number_of_chip (not for SN76489, PWM and SegaPCM)
+        let clocks = [
+            (VGM_META_CHIP_YM2612, header.clock_ym2612, true),
+            (VGM_META_CHIP_YM2151, header.clock_ym2151, true),
+            (VGM_META_CHIP_YM2203, header.clock_ym2203, true),
+            (VGM_META_CHIP_YM2413, header.clock_ym2413, true),
+            (VGM_META_CHIP_AY8910, header.clock_ay8910, true),
+            (VGM_META_CHIP_YM2608, header.clock_ym2608, true),
+            (VGM_META_CHIP_YM2610, header.clock_ym2610_b, true),
+            (VGM_META_CHIP_YM3812, header.clock_ym3812, true),
+            (VGM_META_CHIP_YM3526, header.clock_ym3526, true),
+            (VGM_META_CHIP_Y8950, header.clock_y8950, true),
+            (VGM_META_CHIP_YMF262, header.clock_ymf262, true),
+            (VGM_META_CHIP_YMF278B, header.clock_ymf278_b, true),
+            (VGM_META_CHIP_SN76489, header.clock_sn76489, false),
+            (VGM_META_CHIP_PWM, header.clock_pwm, false),
+            (VGM_META_CHIP_SEGAPCM, header.clock_sega_pcm, false),
+            (VGM_META_CHIP_OKIM6258, header.clock_okim6258, true),
+            (
+                if header.c140_chip_type == 0x02 {
+                    VGM_META_CHIP_C219
+                } else {
+                    VGM_META_CHIP_C140
+                },
+                header.clock_c140,
+                true,
+            ),
+            (VGM_META_CHIP_OKIM6295, header.clock_okim6295, true),
+        ];
+        let mut info = VgmMetaInfo {
+            version: header.version,
+            total_samples: header.total_samples,
+            loop_samples: header.loop_samples,
+            ..Default::default()
+        };
+        for (chip, clock, dual) in clocks {
+            if clock != 0 {
+                info.chips |= chip;
+                if dual && clock & 0xc0000000 != 0 {
+                    info.dual_chips |= chip;
+                }
+            }
+        }
+        let others = [
+            header.clock_rf5c68,
+            header.clock_ym271,
+            header.clock_ymz280b,
+            header.clock_rf5c164,
+            header.clock_gb_dmg,
+            header.clock_nes_apu,
+            header.clock_multi_pcm,
+            header.clock_upd7759,
+            header.clock_k051649,
+            header.clock_k054539,
+            header.clock_huc6280,
+            header.clock_k053260,
+            header.clock_pokey,
+            header.clock_qsound,
+            header.clock_scsp,
+            header.clock_wonder_swan,
+            header.clock_vsu,
+            header.clock_saa1099,
+            header.clock_es5503,
+            header.clock_es5506,
+            header.clock_x1_010,
+            header.clock_c352,
+            header.clock_ga20,
+        ];
+        if others.iter().any(|clock| *clock != 0) {
+            info.chips |= VGM_META_CHIP_OTHER;
+        }
+        info
+    }
+}
+
+///
+/// Track, game, system, author and date of the GD3 as NUL terminated UTF-8
+///
+/// The Japanese name is used where the English one is blank.
+///
+pub fn get_gd3_strings(gd3: &Gd3) -> Vec<u8> {
+    let mut strings = Vec::new();
+    for (name, name_j) in [
+        (&gd3.track_name, &gd3.track_name_j),
+        (&gd3.game_name, &gd3.game_name_j),
+        (&gd3.system_name, &gd3.system_name_j),
+        (&gd3.track_author, &gd3.track_author_j),
+        (&gd3.date, &gd3.date),
+    ] {
+        let name = if name.is_empty() { name_j } else { name };
+        strings.extend_from_slice(name.replace('\0', "").as_bytes());
+        strings.push(0);
+    }
+    strings
+}
+
+fn get_u32(data: &[u8], offset: usize) -> usize {
+    u32::from_le_bytes(data[offset..(offset + 4)].try_into().unwrap()) as usize
+}
+
+///
+/// cargo test -- --nocapture
+///
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use flate2::write::GzEncoder;
+    use flate2::Compression;
+
+    ///
+    /// VGM 1.71 with YM2612, a dual YM2151 and a GD3 after a long command stream
+    ///
+    fn create_vgm() -> Vec<u8> {
+        let mut vgm = vec![0_u8; 0x100];
+        vgm[0..4].copy_from_slice(b"Vgm ");
+        vgm[0x08..0x0c].copy_from_slice(&0x171_u32.to_le_bytes());
+        vgm[0x18..0x1c].copy_from_slice(&441000_u32.to_le_bytes());
+        vgm[0x20..0x24].copy_from_slice(&44100_u32.to_le_bytes());
+        vgm[0x2c..0x30].copy_from_slice(&7670453_u32.to_le_bytes());
+        vgm[0x30..0x34].copy_from_slice(&(3579545_u32 | 0x40000000).to_le_bytes());
+        vgm[0x34..0x38].copy_from_slice(&(0x100_u32 - 0x34).to_le_bytes());
+        // waits
+        for _ in 0..0x4000 {
+            vgm.extend_from_slice(&[0x61, 0xff, 0xff]);
+        }
+        vgm.push(0x66);
+        let gd3_pos = vgm.len();
+        vgm[0x14..0x18].copy_from_slice(&((gd3_pos - 0x14) as u32).to_le_bytes());
+        let mut strings = Vec::new();
+        for string in [
+            "Track",
+            "",
+            "",
+            "ゲーム",
+            "System",
+            "",
+            "",
+            "",
+            "2023",
+            "",
+            "",
+        ] {
+            for c in string.encode_utf16() {
+                strings.extend_from_slice(&c.to_le_bytes());
+            }
+            strings.extend_from_slice(&[0, 0]);
+        }
+        vgm.extend_from_slice(b"Gd3 ");
+        vgm.extend_from_slice(&0x100_u32.to_le_bytes());
+        vgm.extend_from_slice(&(strings.len() as u32).to_le_bytes());
+        vgm.extend_from_slice(&strings);
+        let eof = vgm.len() - 4;
+        vgm[4..8].copy_from_slice(&(eof as u32).to_le_bytes());
+        vgm
+    }
+
+    ///
+    /// Read as main.cpp does, returns the bytes read
+    ///
+    fn read(file: &[u8], reader: &mut VgmMetaReader, chunk_size: usize) -> usize {
+        let mut read = 0;
+        while let Some(offset) = reader.next_offset() {
+            if offset >= file.len() {
+                break;
+            }
+            let end = file.len().min(offset + chunk_size);
+            reader.load(&file[offset..end]).unwrap();
+            read += end - offset;
+        }
+        read
+    }
+
+    fn check(reader: &mut VgmMetaReader) {
+        let (header, gd3) = reader.finish().unwrap();
+        let info = VgmMetaInfo::new(&header);
+        assert_eq!(
+            info,
+            VgmMetaInfo {
+                version: 171,
+                total_samples: 441000,
+                loop_samples: 44100,
+                chips: VGM_META_CHIP_YM2612 | VGM_META_CHIP_YM2151,
+                dual_chips: VGM_META_CHIP_YM2151,
+            }
+        );
+        assert_eq!(
+            get_gd3_strings(&gd3),
+            "Track\0ゲーム\0System\0\02023\0".as_bytes()
+        );
+    }
+
+    #[test]
+    fn vgm() {
+        let vgm = create_vgm();
+        for chunk_size in [0x40, 0x101, 4096] {
+            let mut reader = VgmMetaReader::new();
+            // the commands are skipped
+            assert!(read(&vgm, &mut reader, chunk_size) < 0x400 + chunk_size * 2);
+            check(&mut reader);
+        }
+    }
+
+    #[test]
+    fn vgz() {
+        let mut vgz = GzEncoder::new(Vec::new(), Compression::default());
+        vgz.write_all(&create_vgm()).unwrap();
+        let vgz = vgz.finish().unwrap();
+        for chunk_size in [0x40, 4096] {
+            let mut reader = VgmMetaReader::new();
+            read(&vgz, &mut reader, chunk_size);
+            check(&mut reader);
+        }
+    }
+
+    #[test]
+    fn not_vgm() {
+        let mut reader = VgmMetaReader::new();
+        assert!(reader.load(&[0_u8; 0x100]).is_err());
+        let mut reader = VgmMetaReader::new();
+        reader.load(&create_vgm()[..0x20]).unwrap();
+        assert!(reader.finish().is_err());
+    }
+}
@@ -0,0 +1,433 @@
+// license:BSD-3-Clause
+// copyright-holders:Hiromasa Tanaka
+use flate2::write::GzDecoder;
+use std::io::Write;
+
+///
+/// Minimum VGM header size
+///
+const VGM_HEADER_MIN_SIZE: usize = 0x40;
+
+///
+/// Receiver of VGM stream loading
+///
+pub(crate) trait VgmLoadSink {
+    ///
+    /// Called once when the VGM header (up to the command stream) is loaded.
+    ///
+    fn load_header(&mut self, vgm_header: &[u8]) -> Result<(), &'static str>;
+
+    ///
+    /// Called for each 0x67 data block in the command stream.
+    ///
+    fn load_data_block(&mut self, data_type: u8, sound_chip_index: usize, data: &[u8]);
+}
+
+///
+/// Input format
+///
+enum VgmInput {
+    Detect(Vec<u8>),
+    Vgm,
+    Vgz(GzDecoder<Vec<u8>>),
+}
+
+///
+/// VGM stream loader
+///
+/// Loads .vgm/.vgz by chunks. A .vgz is inflated incrementally, and
+/// 0x67 data blocks are handed to VgmLoadSink instead of being kept in
+/// the command stream, so that only the commands are held in memory.
+/// The loop, GD3 and EOF offsets in the header are adjusted accordingly.
+///
+pub(crate) struct VgmLoader {
+    input: VgmInput,
+    parser: VgmParser,
+}
+
+impl VgmLoader {
+    pub fn new() -> Self {
+        VgmLoader {
+            input: VgmInput::Detect(Vec::new()),
+            parser: VgmParser::new(),
+        }
+    }
+
+    ///
+    /// Load a chunk of .vgm/.vgz file.
+    ///
+    pub fn load(&mut self, chunk: &[u8], sink: &mut dyn VgmLoadSink) -> Result<(), &'static str> {
+        if let VgmInput::Detect(magic) = &mut self.input {
+            // gzip magic number
+            magic.extend_from_slice(chunk);
+            if magic.len() < 2 {
+                return Ok(());
+            }
+            let head = std::mem::take(magic);
+            self.input = if head[0] == 0x1f && head[1] == 0x8b {
+                VgmInput::Vgz(GzDecoder::new(Vec::new()))
+            } else {
+                VgmInput::Vgm
+            };
+            return self.load(&head, sink);
+        }
+        match &mut self.input {
+            VgmInput::Vgz(decoder) => {
+                if decoder.write_all(chunk).is_err() {
+                    return Err("vgz inflate error.");
+                }
+                Self::parse_inflated(decoder, &mut self.parser, sink)
+            }
+            _ => self.parser.parse(chunk, sink),
+        }
+    }
+
+    ///
+    /// Finish loading and return the command stream and its start offset.
+    ///
+    pub fn finish(mut self, sink: &mut dyn VgmLoadSink) -> Result<(Vec<u8>, usize), &'static str> {
+        match &mut self.input {
+            VgmInput::Detect(magic) => {
+                let head = std::mem::take(magic);
+                self.parser.parse(&head, sink)?;
+            }
+            VgmInput::Vgz(decoder) => {
+                if decoder.try_finish().is_err() {
+                    return Err("vgz inflate error.");
+                }
+                Self::parse_inflated(decoder, &mut self.parser, sink)?;
+            }
+            VgmInput::Vgm => {}
+        }
+        self.parser.finish()
+    }
+
+    fn parse_inflated(
+        decoder: &mut GzDecoder<Vec<u8>>,
+        parser: &mut VgmParser,
+        sink: &mut dyn VgmLoadSink,
+    ) -> Result<(), &'static str> {
+        // reuse the inflate buffer
+        let mut inflated = std::mem::take(decoder.get_mut());
+        let result = parser.parse(&inflated, sink);
+        inflated.clear();
+        *decoder.get_mut() = inflated;
+        result
+    }
+}
+
+///
+/// VGM command stream parser
+///
+struct VgmParser {
+    vgm_data: Vec<u8>,
+    vgm_pos: usize,
+    data_offset: usize,
+    header_loaded: bool,
+    stream_end: usize,
+    command_end: usize,
+    loop_pos: usize,
+    gd3_pos: usize,
+    loop_out: Option<usize>,
+    gd3_out: Option<usize>,
+    command: Vec<u8>,
+    data_block: Vec<u8>,
+    data_block_remain: usize,
+    data_block_type: u8,
+    data_block_chip_index: usize,
+}
+
+impl VgmParser {
+    fn new() -> Self {
+        VgmParser {
+            vgm_data: Vec::new(),
+            vgm_pos: 0,
+            data_offset: 0,
+            header_loaded: false,
+            stream_end: std::usize::MAX,
+            command_end: std::usize::MAX,
+            loop_pos: 0,
+            gd3_pos: 0,
+            loop_out: None,
+            gd3_out: None,
+            command: Vec::with_capacity(16),
+            data_block: Vec::new(),
+            data_block_remain: 0,
+            data_block_type: 0,
+            data_block_chip_index: 0,
+        }
+    }
+
+    fn parse(&mut self, mut i: &[u8], sink: &mut dyn VgmLoadSink) -> Result<(), &'static str> {
+        while !i.is_empty() {
+            if !self.header_loaded {
+                i = self.parse_header(i, sink)?;
+            } else if self.data_block_remain > 0 {
+                i = self.parse_data_block(i, sink);
+            } else if self.vgm_pos < self.command_end {
+                // command boundary
+                if self.command.is_empty() && self.vgm_pos == self.loop_pos {
+                    self.loop_out = Some(self.vgm_data.len());
+                }
+                self.command.push(i[0]);
+                self.vgm_pos += 1;
+                i = &i[1..];
+                if self.command.len() == get_command_length(self.command[0]) {
+                    self.end_command();
+                }
+            } else {
+                // GD3 and the rest
+                if self.vgm_pos == self.gd3_pos && self.gd3_out.is_none() {
+                    self.flush_command();
+                    self.gd3_out = Some(self.vgm_data.len());
+                }
+                self.vgm_data.extend_from_slice(i);
+                self.vgm_pos += i.len();
+                i = &[];
+            }
+        }
+        Ok(())
+    }
+
+    fn parse_header<'a>(
+        &mut self,
+        i: &'a [u8],
+        sink: &mut dyn VgmLoadSink,
+    ) -> Result<&'a [u8], &'static str> {
+        // header size is known after the minimum header
+        let header_size = if self.vgm_data.len() < VGM_HEADER_MIN_SIZE {
+            VGM_HEADER_MIN_SIZE
+        } else {
+            self.data_offset
+        };
+        let len = (header_size - self.vgm_data.len()).min(i.len());
+        self.vgm_data.extend_from_slice(&i[..len]);
+        self.vgm_pos += len;
+        if self.vgm_data.len() < header_size {
+            return Ok(&i[len..]);
+        }
+        if header_size == VGM_HEADER_MIN_SIZE && self.data_offset == 0 {
+            if &self.vgm_data[0..4] != b"Vgm " {
+                return Err("vgm header parse error.");
+            }
+            let eof = self.get_header_u32(0x04);
+            let offset_gd3 = self.get_header_u32(0x14);
+            let offset_loop = self.get_header_u32(0x1c);
+            let vgm_data_offset = self.get_header_u32(0x34);
+            self.data_offset = (0x34 + vgm_data_offset).max(VGM_HEADER_MIN_SIZE);
+            self.loop_pos = if offset_loop != 0 { 0x1c + offset_loop } else { 0 };
+            self.gd3_pos = if offset_gd3 != 0 { 0x14 + offset_gd3 } else { 0 };
+            if eof != 0 {
+                self.stream_end = 0x04 + eof;
+            }
+            if self.gd3_pos != 0 {
+                self.command_end = self.gd3_pos;
+            } else if eof != 0 {
+                self.command_end = 0x04 + eof;
+            }
+            if self.vgm_data.len() < self.data_offset {
+                return Ok(&i[len..]);
+            }
+        }
+        sink.load_header(&self.vgm_data)?;
+        self.header_loaded = true;
+        Ok(&i[len..])
+    }
+
+    fn parse_data_block<'a>(&mut self, i: &'a [u8], sink: &mut dyn VgmLoadSink) -> &'a [u8] {
+        let len = self.data_block_remain.min(i.len());
+        self.data_block.extend_from_slice(&i[..len]);
+        self.data_block_remain -= len;
+        self.vgm_pos += len;
+        if self.data_block_remain == 0 {
+            sink.load_data_block(
+                self.data_block_type,
+                self.data_block_chip_index,
+                &self.data_block,
+            );
+            // release the data block memory
+            self.data_block = Vec::new();
+        }
+        &i[len..]
+    }
+
+    fn end_command(&mut self) {
+        if self.command[0] == 0x67 {
+            // 0x67 0x66 tt ss ss ss ss (data)
+            let mut data_length = u32::from_le_bytes(self.command[3..7].try_into().unwrap()) as usize;
+            // dual sound chip
+            self.data_block_chip_index = if data_length & 0x80000000 != 0 { 1 } else { 0 };
+            data_length &= 0x7fffffff;
+            self.data_block_type = self.command[2];
+            self.data_block_remain = data_length;
+            // the length is of the file; reserve no more than the stream has left,
+            // and let the block grow as data arrives if that can not be reserved
+            let stream_left = self.stream_end.saturating_sub(self.vgm_pos);
+            let _ = self
+                .data_block
+                .try_reserve_exact(data_length.min(stream_left));
+            self.command.clear();
+        } else {
+            self.flush_command();
+        }
+    }
+
+    fn flush_command(&mut self) {
+        self.vgm_data.extend_from_slice(&self.command);
+        self.command.clear();
+    }
+
+    fn finish(mut self) -> Result<(Vec<u8>, usize), &'static str> {
+        if !self.header_loaded {
+            return Err("vgm header parse error.");
+        }
+        self.flush_command();
+        // relocate offsets in the header
+        let eof = self.vgm_data.len() - 0x04;
+        self.set_header_u32(0x04, eof);
+        match self.gd3_out {
+            Some(gd3_out) => self.set_header_u32(0x14, gd3_out - 0x14),
+            None => self.set_header_u32(0x14, 0),
+        }
+        match self.loop_out {
+            Some(loop_out) if self.loop_pos != 0 => self.set_header_u32(0x1c, loop_out - 0x1c),
+            _ => self.set_header_u32(0x1c, 0),
+        }
+        Ok((self.vgm_data, self.data_offset))
+    }
+
+    fn get_header_u32(&self, offset: usize) -> usize {
+        u32::from_le_bytes(self.vgm_data[offset..offset + 4].try_into().unwrap()) as usize
+    }
+
+    fn set_header_u32(&mut self, offset: usize, value: usize) {
+        self.vgm_data[offset..offset + 4].copy_from_slice(&(value as u32).to_le_bytes());
+    }
+}
+
+///
+/// Return the length of the vgm command including operands.
+///
+pub(crate) fn get_command_length(command: u8) -> usize {
+    match command {
+        0x30..=0x3f | 0x4f | 0x50 | 0x94 => 2,
+        0x40..=0x4e | 0x51..=0x5f | 0x61 | 0xa0..=0xbf => 3,
+        0xc0..=0xdf => 4,
+        0x90 | 0x91 | 0x95 | 0xe0..=0xff => 5,
+        0x92 => 6,
+        0x67 => 7,
+        0x93 => 11,
+        0x68 => 12,
+        _ => 1,
+    }
+}
+
+///
+/// cargo test -- --nocapture
+///
+#[cfg(test)]
+mod tests {
+    use super::{VgmLoadSink, VgmLoader};
+    use flate2::write::GzEncoder;
+    use flate2::Compression;
+    use std::io::Write;
+
+    struct TestSink {
+        header_size: usize,
+        data_blocks: Vec<(u8, usize, Vec<u8>)>,
+    }
+
+    impl VgmLoadSink for TestSink {
+        fn load_header(&mut self, vgm_header: &[u8]) -> Result<(), &'static str> {
+            self.header_size = vgm_header.len();
+            Ok(())
+        }
+
+        fn load_data_block(&mut self, data_type: u8, sound_chip_index: usize, data: &[u8]) {
+            self.data_blocks.push((data_type, sound_chip_index, data.to_vec()));
+        }
+    }
+
+    ///
+    /// header(0x80) | 0x67 block | loop: 0x67 block | commands | 0x66 | GD3
+    ///
+    fn create_vgm() -> Vec<u8> {
+        let mut vgm = vec![0_u8; 0x80];
+        vgm[0..4].copy_from_slice(b"Vgm ");
+        vgm[0x08..0x0c].copy_from_slice(&0x151_u32.to_le_bytes());
+        vgm[0x34..0x38].copy_from_slice(&(0x80_u32 - 0x34).to_le_bytes());
+        vgm.extend_from_slice(&[0x67, 0x66, 0x00, 0x04, 0x00, 0x00, 0x00, 1, 2, 3, 4]);
+        let loop_pos = vgm.len();
+        vgm.extend_from_slice(&[0x67, 0x66, 0x82, 0x0a, 0x00, 0x00, 0x80]);
+        vgm.extend_from_slice(&[0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xaa, 0xbb]);
+        vgm.extend_from_slice(&[0x58, 0x10, 0x20, 0x61, 0x00, 0x01, 0xe0, 0, 0, 0, 0, 0x70, 0x66]);
+        let gd3_pos = vgm.len();
+        vgm.extend_from_slice(b"Gd3 \x00\x01\x00\x00\x00\x00\x00\x00");
+        let eof = vgm.len() - 0x04;
+        vgm[0x04..0x08].copy_from_slice(&(eof as u32).to_le_bytes());
+        vgm[0x14..0x18].copy_from_slice(&((gd3_pos - 0x14) as u32).to_le_bytes());
+        vgm[0x1c..0x20].copy_from_slice(&((loop_pos - 0x1c) as u32).to_le_bytes());
+        vgm
+    }
+
+    fn load(vgm_file: &[u8], chunk_size: usize) -> (Vec<u8>, usize, TestSink) {
+        let mut sink = TestSink {
+            header_size: 0,
+            data_blocks: Vec::new(),
+        };
+        let mut loader = VgmLoader::new();
+        for chunk in vgm_file.chunks(chunk_size) {
+            loader.load(chunk, &mut sink).unwrap();
+        }
+        let (vgm_data, data_offset) = loader.finish(&mut sink).unwrap();
+        (vgm_data, data_offset, sink)
+    }
+
+    fn u32_at(vgm_data: &[u8], offset: usize) -> usize {
+        u32::from_le_bytes(vgm_data[offset..offset + 4].try_into().unwrap()) as usize
+    }
+
+    #[test]
+    fn strip_data_block() {
+        let vgm = create_vgm();
+        let mut vgz = GzEncoder::new(Vec::new(), Compression::default());
+        vgz.write_all(&vgm).unwrap();
+        let vgz = vgz.finish().unwrap();
+
+        for vgm_file in [&vgm, &vgz] {
+            let (expect, _, _) = load(vgm_file, vgm_file.len());
+            for chunk_size in [1, 2, 3, 7, 64, 4096] {
+                let (vgm_data, data_offset, sink) = load(vgm_file, chunk_size);
+                assert_eq!(vgm_data, expect);
+                assert_eq!(data_offset, 0x80);
+                assert_eq!(sink.header_size, 0x80);
+                // data blocks are routed to sink
+                assert_eq!(sink.data_blocks.len(), 2);
+                assert_eq!(sink.data_blocks[0], (0x00, 0, vec![1, 2, 3, 4]));
+                assert_eq!(sink.data_blocks[1].0, 0x82);
+                assert_eq!(sink.data_blocks[1].1, 1);
+                assert_eq!(sink.data_blocks[1].2.len(), 10);
+                // command stream without data blocks
+                assert_eq!(vgm_data[0x80], 0x58);
+                assert_eq!(0x1c + u32_at(&vgm_data, 0x1c), 0x80);
+                assert_eq!(&vgm_data[0x14 + u32_at(&vgm_data, 0x14)..][..4], b"Gd3 ");
+                assert_eq!(0x04 + u32_at(&vgm_data, 0x04), vgm_data.len());
+            }
+        }
+    }
+
+    #[test]
+    fn data_block_reserve() {
+        // a data block claiming 2GB in a file of a few bytes
+        let mut vgm = create_vgm();
+        vgm[0x80 + 3..0x80 + 7].copy_from_slice(&0x7fff_ffff_u32.to_le_bytes());
+        let mut sink = TestSink {
+            header_size: 0,
+            data_blocks: Vec::new(),
+        };
+        let mut loader = VgmLoader::new();
+        loader.load(&vgm, &mut sink).unwrap();
+        assert!(loader.parser.data_block.capacity() <= vgm.len());
+        assert!(sink.data_blocks.is_empty());
+    }
+}
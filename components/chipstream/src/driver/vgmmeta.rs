@@ -402,9 +402,9 @@ fn parse_extra_header_volume(mut i: &[u8]) -> IResult<&[u8], Vec<ChipVolume>> {
 }
 
 ///
-/// Parse VGM meta
+/// Parse VGM header
 ///
-pub(crate) fn parse_vgm_meta(vgmdata: &[u8]) -> Result<(VgmHeader, Gd3), &'static str> {
+pub(crate) fn parse_vgm_header_meta(vgmdata: &[u8]) -> Result<VgmHeader, &'static str> {
     // clean header
     let mut vgm_data_offset: usize =
         (u32::from_le_bytes(vgmdata[0x34..=0x37].try_into().unwrap()) + 0x34) as usize;
@@ -421,12 +421,24 @@ pub(crate) fn parse_vgm_meta(vgmdata: &[u8]) -> Result<(VgmHeader, Gd3), &'stati
     };
     // Parse extra header
     if header.version >= 170 && header.extra_hdr_ofs != 0 {
-        let extra_header = &vgmdata[(0xbc + header.extra_hdr_ofs as usize)..];
-        header = match parse_extra_header(extra_header, header) {
+        let extra_hdr_ofs = 0xbc + header.extra_hdr_ofs as usize;
+        if extra_hdr_ofs >= vgmdata.len() {
+            return Err("vgm extra header parse error.");
+        }
+        header = match parse_extra_header(&vgmdata[extra_hdr_ofs..], header) {
             Ok((_, header)) => header,
             Err(_) => return Err("vgm extra header parse error."),
         }
     }
+
+    Ok(header)
+}
+
+///
+/// Parse VGM meta
+///
+pub(crate) fn parse_vgm_meta(vgmdata: &[u8]) -> Result<(VgmHeader, Gd3), &'static str> {
+    let header = parse_vgm_header_meta(vgmdata)?;
     // Parse GD3
     let gd3 = match parse_gd3(&vgmdata[(0x14 + header.offset_gd3 as usize)..]) {
         Ok((_, gd3)) => gd3,
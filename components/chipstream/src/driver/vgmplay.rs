@@ -1,18 +1,38 @@
 // license:BSD-3-Clause
 // copyright-holders:Hiromasa Tanaka
-use flate2::read::GzDecoder;
 use std::collections::HashMap;
-use std::io::prelude::*;
 
 use crate::driver::gd3meta::Gd3;
 use crate::driver::meta::Jsonlize;
+use crate::driver::vgmevent::{
+    VgmEventBuilder, VgmEventSource, VgmEvents, EVENT_COMMAND, EVENT_END, EVENT_WAIT,
+};
+use crate::driver::vgmloader::{get_command_length, VgmLoadSink, VgmLoader};
 use crate::driver::vgmmeta;
 use crate::driver::vgmmeta::VgmHeader;
 use crate::driver::vgmmeta::ChipVolume;
-use crate::sound::{RomBusType, RomIndex, SoundChipType, SoundSlot};
+use crate::sound::{cycles, RomBusType, RomIndex, SoundChipType, SoundSlot, SoundSlotState, Stage};
 
 pub const VGM_TICK_RATE: u32 = 44100;
 
+///
+/// Ticks between seek keyframes (a seek renders less than this)
+///
+const KEYFRAME_INTERVAL: usize = VGM_TICK_RATE as usize * 2;
+
+///
+/// State of the driver and the sound slot at a seek keyframe
+///
+struct VgmKeyframe {
+    vgm_event_pos: usize,
+    remain_tick_count: usize,
+    ym2612_pcm_pos: usize,
+    ym2612_pcm_offset: usize,
+    hack_sega32x_channel: i32,
+    data_stream: HashMap<usize, (SoundChipType, usize)>,
+    sound_slot: SoundSlotState,
+}
+
 ///
 /// VGM Driver
 ///
@@ -24,6 +44,10 @@ pub struct VgmPlay {
     vgm_loop_count: usize,
     vgm_end: bool,
     vgm_data: Vec<u8>,
+    vgm_data_offset: usize,
+    vgm_events: VgmEvents,
+    vgm_event_pos: usize,
+    vgm_started: bool,
     vgm_header: Option<VgmHeader>,
     vgm_gd3: Option<Gd3>,
     data_block_id: usize,
@@ -32,6 +56,10 @@ pub struct VgmPlay {
     ym2612_pcm_offset: usize,
     remain_tick_count: usize,
     hack_sega32x_channel: i32,
+    vgm_loader: Option<VgmLoader>,
+    vgm_tick_pos: usize,
+    vgm_loop_tick: usize,
+    vgm_keyframes: Vec<VgmKeyframe>,
 }
 
 impl VgmPlay {
@@ -39,7 +67,20 @@ impl VgmPlay {
     /// Create sound driver.
     ///
     pub fn new(sound_slot: SoundSlot, vgm_file: &[u8]) -> Result<Self, &'static str> {
-        let mut vgmplay = VgmPlay {
+        let mut vgmplay = Self::new_stream(sound_slot);
+        vgmplay.load_stream(vgm_file)?;
+        vgmplay.end_stream()?;
+        // parsed as is if the commands cannot be compiled
+        let _ = vgmplay.compile_events();
+
+        Ok(vgmplay)
+    }
+
+    ///
+    /// Create sound driver to be loaded by load_stream.
+    ///
+    pub fn new_stream(sound_slot: SoundSlot) -> Self {
+        VgmPlay {
             sound_slot,
             vgm_pos: 0,
             vgm_loop: 0,
@@ -47,6 +88,10 @@ impl VgmPlay {
             vgm_loop_count: 0,
             vgm_end: false,
             vgm_data: Vec::new(),
+            vgm_data_offset: 0,
+            vgm_events: VgmEvents::default(),
+            vgm_event_pos: 0,
+            vgm_started: false,
             vgm_header: None,
             vgm_gd3: None,
             data_block_id: 0,
@@ -55,11 +100,185 @@ impl VgmPlay {
             ym2612_pcm_offset: 0,
             remain_tick_count: 0,
             hack_sega32x_channel: 0,
+            vgm_loader: Some(VgmLoader::new()),
+            vgm_tick_pos: 0,
+            vgm_loop_tick: 0,
+            vgm_keyframes: Vec::new(),
+        }
+    }
+
+    ///
+    /// Load a chunk of vgm/vgz file.
+    ///
+    /// Sound chips are initialized by the header, and data blocks are
+    /// added to them while loading.
+    ///
+    pub fn load_stream(&mut self, vgm_chunk: &[u8]) -> Result<(), &'static str> {
+        let mut vgm_loader = match self.vgm_loader.take() {
+            Some(vgm_loader) => vgm_loader,
+            None => return Err("vgm is already loaded."),
         };
-        // clone vgm_file and soundchip init
-        vgmplay.init(vgm_file)?;
+        let result = vgm_loader.load(vgm_chunk, self);
+        self.vgm_loader = Some(vgm_loader);
+        result
+    }
 
-        Ok(vgmplay)
+    ///
+    /// Finish loading and initialize sound driver.
+    ///
+    /// The commands are parsed on play until compile_events or set_events.
+    ///
+    pub fn end_stream(&mut self) -> Result<(), &'static str> {
+        let vgm_loader = match self.vgm_loader.take() {
+            Some(vgm_loader) => vgm_loader,
+            None => return Err("vgm is already loaded."),
+        };
+        let (vgm_data, vgm_data_offset) = vgm_loader.finish(self)?;
+        self.vgm_data = vgm_data;
+
+        // parse vgm header (offsets are relocated by loader)
+        let (vgm_header, vgm_gd3) = vgmmeta::parse_vgm_meta(&self.vgm_data)?;
+
+        self.vgm_loop = vgm_header.offset_loop as usize;
+        self.vgm_loop_offset = (0x1c + vgm_header.offset_loop) as usize;
+        self.vgm_pos = vgm_data_offset;
+        self.vgm_data_offset = vgm_data_offset;
+
+        self.vgm_header = Some(vgm_header);
+        self.vgm_gd3 = Some(vgm_gd3);
+
+        Ok(())
+    }
+
+    ///
+    /// Compile the command stream into events (see vgmevent) to be walked
+    /// by play instead of parsing the commands.
+    ///
+    /// Call after end_stream and before play. Returns Err (and the commands
+    /// are parsed) if the stream has a command the events cannot hold.
+    ///
+    pub fn compile_events(&mut self) -> Result<(), &'static str> {
+        if self.vgm_loader.is_some() || self.vgm_started {
+            return Err("vgm is not loaded or already played.");
+        }
+        let mut builder = VgmEventBuilder::default();
+        let mut pos = self.vgm_data_offset;
+        loop {
+            if self.vgm_loop != 0 && pos == self.vgm_loop_offset {
+                builder.loop_point();
+            }
+            let command = match self.vgm_data.get(pos) {
+                Some(&command) => command,
+                None => return Err("no end of vgm data."),
+            };
+            let length = match command {
+                // data blocks are added to sound chips by VgmLoader
+                0x67 => 1,
+                _ => get_command_length(command),
+            };
+            if pos + length > self.vgm_data.len() {
+                return Err("no end of vgm data.");
+            }
+            if let Some((sound_chip_type, sound_chip_index, port, data)) =
+                self.decode_write(command, pos + 1)
+            {
+                // a write to a sound chip not in the slot does nothing
+                if let Some(handle) = self
+                    .sound_slot
+                    .get_device_handle(sound_chip_type, sound_chip_index)
+                {
+                    if handle >= EVENT_END as usize {
+                        return Err("too many sound chips.");
+                    }
+                    builder.write(handle as u8, port as u16, data as u16);
+                }
+            } else {
+                match command {
+                    0x61 => builder.wait(
+                        u16::from_le_bytes([self.vgm_data[pos + 1], self.vgm_data[pos + 2]]).into(),
+                    ),
+                    0x62 => builder.wait(735),
+                    0x63 => builder.wait(882),
+                    0x66 => break,
+                    0x70..=0x7f => builder.wait(((command & 0x0f) + 1).into()),
+                    // state of the parser (YM2612 PCM, data streams, PWM hack)
+                    0x80..=0x8f => builder.command(pos, (command & 0x0f).into()),
+                    0x90..=0x95 | 0xb2 | 0xe0 => builder.command(pos, 0),
+                    // unsupported commands are skipped
+                    0x30..=0x4f
+                    | 0x5d
+                    | 0x67
+                    | 0xb0..=0xb6
+                    | 0xb9..=0xbf
+                    | 0xc1..=0xcf
+                    | 0xd1..=0xd3
+                    | 0xd5..=0xdf => {}
+                    _ => return Err("unknown vgm command."),
+                }
+            }
+            pos += length;
+        }
+        let vgm_events = builder.end();
+        if self.vgm_loop != 0 && vgm_events.loop_event.is_none() {
+            return Err("loop offset is not at a command.");
+        }
+        self.vgm_loop_tick = vgm_events.loop_tick;
+        self.vgm_events = vgm_events;
+        self.vgm_event_pos = 0;
+
+        Ok(())
+    }
+
+    ///
+    /// Return the compiled events in the saved form (empty if not compiled).
+    ///
+    pub fn get_events(&self) -> Vec<u8> {
+        if self.vgm_events.events.is_empty() {
+            return Vec::new();
+        }
+        self.vgm_events.to_bytes(&self.get_event_source())
+    }
+
+    ///
+    /// Set events saved by get_events for the same vgm, instead of compile_events.
+    ///
+    pub fn set_events(&mut self, events: &[u8]) -> Result<(), &'static str> {
+        if self.vgm_loader.is_some() || self.vgm_started {
+            return Err("vgm is not loaded or already played.");
+        }
+        let vgm_events = VgmEvents::from_bytes(events, &self.get_event_source())?;
+        // commands run by the parser must be whole commands of the stream
+        for event in vgm_events.events.iter() {
+            if event.handle != EVENT_COMMAND {
+                continue;
+            }
+            let offset = event.get_offset();
+            match self.vgm_data.get(offset) {
+                Some(&command @ (0x80..=0x95 | 0xb2 | 0xe0))
+                    if offset + get_command_length(command) <= self.vgm_data.len() => {}
+                _ => return Err("vgm event stream is broken."),
+            }
+        }
+        self.vgm_loop_tick = vgm_events.loop_tick;
+        self.vgm_events = vgm_events;
+        self.vgm_event_pos = 0;
+
+        Ok(())
+    }
+
+    fn get_event_source(&self) -> VgmEventSource {
+        VgmEventSource {
+            vgm_data_len: self.vgm_data.len() as u32,
+            vgm_data_offset: self.vgm_data_offset as u32,
+            devices: self
+                .sound_slot
+                .get_device_keys()
+                .iter()
+                .map(|&(sound_chip_type, sound_chip_index)| {
+                    (sound_chip_type as u8, sound_chip_index as u8)
+                })
+                .collect(),
+        }
     }
 
     ///
@@ -83,6 +302,13 @@ impl VgmPlay {
         self.sound_slot.get_output_sampling_s16le_ref()
     }
 
+    ///
+    /// Return the number of valid samples in the last streamed chunk.
+    ///
+    pub fn get_output_sample_stream_size(&self) -> usize {
+        self.sound_slot.get_output_sample_stream_size()
+    }
+
     ///
     /// Return s16le sampling buffer referance.
     ///
@@ -90,6 +316,20 @@ impl VgmPlay {
         self.sound_slot.get_output_sampling_s16le(s16le);
     }
 
+    ///
+    /// Copy cycles per render stage since the last call and clear them.
+    ///
+    pub fn take_stage_cycles(&mut self, cycles: &mut [u32]) {
+        self.sound_slot.take_stage_cycles(cycles);
+    }
+
+    ///
+    /// Set render quality level (see SoundSlot::set_quality).
+    ///
+    pub fn set_quality(&mut self, quality: u32) {
+        self.sound_slot.set_quality(quality);
+    }
+
     ///
     /// Get VGM meta.
     ///
@@ -118,16 +358,32 @@ impl VgmPlay {
     /// Play Sound.
     ///
     pub fn play(&mut self, repeat: bool) -> usize {
+        if !self.vgm_started {
+            self.vgm_started = true;
+            // the first seek keyframe
+            if !self.vgm_events.events.is_empty() {
+                self.save_keyframe();
+            }
+        }
         while !self.sound_slot.is_stream_filled() && !self.vgm_end {
-            for _ in 0..self.remain_tick_count {
-                self.sound_slot.update(1);
-                self.remain_tick_count -= 1;
-                if self.sound_slot.is_stream_filled() {
-                    break;
-                }
+            if self.remain_tick_count > 0 {
+                // update until the next command or until the stream is filled
+                let tick_count = self.sound_slot.get_tickable_count(self.remain_tick_count);
+                self.sound_slot.update(tick_count);
+                self.remain_tick_count -= tick_count;
+                self.vgm_tick_pos += tick_count;
             }
             if self.remain_tick_count == 0 {
-                self.remain_tick_count = self.parse_vgm(repeat) as usize;
+                let start = cycles();
+                self.remain_tick_count = if self.vgm_events.events.is_empty() {
+                    if self.vgm_pos == self.vgm_loop_offset {
+                        self.vgm_loop_tick = self.vgm_tick_pos;
+                    }
+                    self.parse_vgm(repeat) as usize
+                } else {
+                    self.play_events(repeat)
+                };
+                self.sound_slot.add_stage_cycles(Stage::Parse, start);
             };
         }
         self.sound_slot.stream();
@@ -143,60 +399,67 @@ impl VgmPlay {
     }
 
     ///
-    /// Extract vgz and initialize sound driver.
+    /// Do events until one with a wait, and return the wait.
     ///
-    fn init(&mut self, vgm_file: &[u8]) -> Result<(), &'static str> {
-        // try vgz extract to vgm_data
-        self.extract(vgm_file);
-
-        // parse vgm header
-        let vgm_header: VgmHeader;
-        let vgm_gd3: Gd3;
-        match vgmmeta::parse_vgm_meta(&self.vgm_data) {
-            Ok((header, gd3)) => {
-                vgm_header = header;
-                vgm_gd3 = gd3;
+    fn play_events(&mut self, repeat: bool) -> usize {
+        loop {
+            let event = self.vgm_events.events[self.vgm_event_pos];
+            self.vgm_event_pos += 1;
+            match event.handle {
+                EVENT_WAIT => {}
+                EVENT_COMMAND => {
+                    // the wait of the command is in the event
+                    self.vgm_pos = event.get_offset();
+                    self.parse_vgm(repeat);
+                }
+                EVENT_END => match self.vgm_events.loop_event {
+                    Some(loop_event) if repeat => {
+                        self.vgm_event_pos = loop_event;
+                        self.vgm_tick_pos = self.vgm_loop_tick;
+                        self.vgm_loop_count += 1;
+                    }
+                    _ => {
+                        self.vgm_end = true;
+                        return 0;
+                    }
+                },
+                handle => self.sound_slot.write_device(
+                    handle as usize,
+                    event.reg.into(),
+                    event.data.into(),
+                ),
             }
-            Err(message) => return Err(message),
-        };
-
-        self.vgm_loop = vgm_header.offset_loop as usize;
-        self.vgm_loop_offset = (0x1c + vgm_header.offset_loop) as usize;
-        self.vgm_pos = (0x34 + vgm_header.vgm_data_offset) as usize;
-
-        self.add_sound_device(&vgm_header);
-        self.set_sound_device_volume(&vgm_header.extra_hdr.chip_volume);
-
-        self.vgm_header = Some(vgm_header);
-        self.vgm_gd3 = Some(vgm_gd3);
-
-        Ok(())
+            if event.wait > 0 {
+                return event.wait as usize;
+            }
+        }
     }
 
-    fn add_sound_device(&mut self, header: &VgmHeader) {
+    fn add_sound_device(&mut self, header: &VgmHeader) -> bool {
+        let mut added = true;
         if header.clock_ym2612 != 0 {
-            self.sound_slot.add_sound_device(
+            added &= self.sound_slot.add_sound_device(
                 SoundChipType::YM2612,
                 self.number_of_chip(header.clock_ym2612),
                 header.clock_ym2612 & 0x3fffffff,
             );
         }
         if header.clock_ym2151 != 0 {
-            self.sound_slot.add_sound_device(
+            added &= self.sound_slot.add_sound_device(
                 SoundChipType::YM2151,
                 self.number_of_chip(header.clock_ym2151),
                 header.clock_ym2151 & 0x3fffffff,
             );
         }
         if header.clock_ym2203 != 0 {
-            self.sound_slot.add_sound_device(
+            added &= self.sound_slot.add_sound_device(
                 SoundChipType::YM2203,
                 self.number_of_chip(header.clock_ym2203),
                 header.clock_ym2203 & 0x3fffffff,
             );
         }
         if header.clock_ym2413 != 0 {
-            self.sound_slot.add_sound_device(
+            added &= self.sound_slot.add_sound_device(
                 SoundChipType::YM2413,
                 self.number_of_chip(header.clock_ym2413),
                 header.clock_ym2413 & 0x3fffffff,
@@ -213,75 +476,78 @@ impl VgmPlay {
             } else {
                 clock_ay8910 = header.clock_ay8910 * 2;
             }
-            self.sound_slot.add_sound_device(
+            added &= self.sound_slot.add_sound_device(
                 SoundChipType::YM2149,
                 self.number_of_chip(header.clock_ay8910),
                 clock_ay8910 & 0x3fffffff,
             );
         }
         if header.clock_ym2608 != 0 {
-            self.sound_slot.add_sound_device(
+            added &= self.sound_slot.add_sound_device(
                 SoundChipType::YM2608,
                 self.number_of_chip(header.clock_ym2608),
                 header.clock_ym2608 & 0x3fffffff,
             );
         }
         if header.clock_ym2610_b != 0 {
-            self.sound_slot.add_sound_device(
+            added &= self.sound_slot.add_sound_device(
                 SoundChipType::YM2610, // TODO:
                 self.number_of_chip(header.clock_ym2610_b),
                 header.clock_ym2610_b & 0x3fffffff,
             );
         }
         if header.clock_ym3812 != 0 {
-            self.sound_slot.add_sound_device(
+            added &= self.sound_slot.add_sound_device(
                 SoundChipType::YM3812,
                 self.number_of_chip(header.clock_ym3812),
                 header.clock_ym3812 & 0x3fffffff,
             );
         }
         if header.clock_ym3526 != 0 {
-            self.sound_slot.add_sound_device(
+            added &= self.sound_slot.add_sound_device(
                 SoundChipType::YM3526,
                 self.number_of_chip(header.clock_ym3526),
                 header.clock_ym3526 & 0x3fffffff,
             );
         }
         if header.clock_y8950 != 0 {
-            self.sound_slot.add_sound_device(
+            added &= self.sound_slot.add_sound_device(
                 SoundChipType::Y8950,
                 self.number_of_chip(header.clock_y8950),
                 header.clock_y8950 & 0x3fffffff,
             );
         }
         if header.clock_ymf262 != 0 {
-            self.sound_slot.add_sound_device(
+            added &= self.sound_slot.add_sound_device(
                 SoundChipType::YMF262,
                 self.number_of_chip(header.clock_ymf262),
                 header.clock_ymf262 & 0x3fffffff,
             );
         }
         if header.clock_ymf278_b != 0 {
-            self.sound_slot.add_sound_device(
+            added &= self.sound_slot.add_sound_device(
                 SoundChipType::YMF278B,
                 self.number_of_chip(header.clock_ymf278_b),
                 header.clock_ymf278_b & 0x3fffffff,
             );
         }
         if header.clock_sn76489 != 0 {
-            self.sound_slot
-                .add_sound_device(SoundChipType::SEGAPSG, 1, header.clock_sn76489);
+            added &=
+                self.sound_slot
+                    .add_sound_device(SoundChipType::SEGAPSG, 1, header.clock_sn76489);
         }
         if header.clock_pwm != 0 {
-            self.sound_slot
+            added &= self
+                .sound_slot
                 .add_sound_device(SoundChipType::PWM, 1, header.clock_pwm);
         }
         if header.clock_sega_pcm != 0 {
-            self.sound_slot
-                .add_sound_device(SoundChipType::SEGAPCM, 1, header.clock_sega_pcm);
+            added &=
+                self.sound_slot
+                    .add_sound_device(SoundChipType::SEGAPCM, 1, header.clock_sega_pcm);
         }
         if header.clock_okim6258 != 0 {
-            self.sound_slot.add_sound_device(
+            added &= self.sound_slot.add_sound_device(
                 SoundChipType::OKIM6258,
                 self.number_of_chip(header.clock_okim6258),
                 header.clock_okim6258 & 0x3fffffff,
@@ -317,7 +583,7 @@ impl VgmPlay {
             };
             // select chip type
             if Some(RomBusType::C219_TYPE_ASIC219) == rom_bus_type {
-                self.sound_slot.add_sound_device(
+                added &= self.sound_slot.add_sound_device(
                     SoundChipType::C219,
                     self.number_of_chip(header.clock_c140),
                     header.clock_c140 & 0x3fffffff,
@@ -332,7 +598,7 @@ impl VgmPlay {
                     );
                 }
             } else {
-                self.sound_slot.add_sound_device(
+                added &= self.sound_slot.add_sound_device(
                     SoundChipType::C140,
                     self.number_of_chip(header.clock_c140),
                     header.clock_c140 & 0x3fffffff,
@@ -349,7 +615,7 @@ impl VgmPlay {
             }
         }
         if header.clock_okim6295 != 0 {
-            self.sound_slot.add_sound_device(
+            added &= self.sound_slot.add_sound_device(
                 SoundChipType::OKIM6295,
                 self.number_of_chip(header.clock_okim6295),
                 header.clock_okim6295 & 0x3fffffff,
@@ -364,19 +630,13 @@ impl VgmPlay {
                 );
             }
         }
+        added
     }
 
     fn set_sound_device_volume(&mut self, _volume: &[ChipVolume]) {
         // unsupported chip volumes
     }
 
-    fn extract(&mut self, vgm_file: &[u8]) {
-        let mut d = GzDecoder::new(vgm_file);
-        if d.read_to_end(&mut self.vgm_data).is_err() {
-            self.vgm_data = vgm_file.to_vec();
-        }
-    }
-
     fn get_vgm_u8(&mut self) -> u8 {
         let ret = self.vgm_data[self.vgm_pos];
         self.vgm_pos += 1;
@@ -404,162 +664,133 @@ impl VgmPlay {
         }
     }
 
-    fn parse_vgm(&mut self, repeat: bool) -> u16 {
-        let mut wait: u16 = 0;
+    ///
+    /// Return the play position in ticks from the start (back to the loop
+    /// point on each loop).
+    ///
+    pub fn get_position(&self) -> usize {
+        self.vgm_tick_pos
+    }
 
-        let command = self.get_vgm_u8();
-        match command {
-            0x50 => {
-                let dat = self.get_vgm_u8();
-                self.sound_slot
-                    .write(SoundChipType::SEGAPSG, 0, 0, dat.into());
-            }
-            0x51 | 0xa1 => {
-                let reg = self.get_vgm_u8();
-                let dat = self.get_vgm_u8();
-                self.sound_slot.write(
-                    SoundChipType::YM2413,
-                    (command >> 7) as usize,
-                    reg as u32,
-                    dat.into(),
-                );
-            }
-            0x52 | 0xa2 => {
-                let reg = self.get_vgm_u8();
-                let dat = self.get_vgm_u8();
-                self.sound_slot.write(
-                    SoundChipType::YM2612,
-                    (command >> 7) as usize,
-                    reg as u32,
-                    dat.into(),
-                );
-            }
-            0x53 | 0xa3 => {
-                let reg = self.get_vgm_u8();
-                let dat = self.get_vgm_u8();
-                self.sound_slot.write(
-                    SoundChipType::YM2612,
-                    (command >> 7) as usize,
-                    reg as u32 | 0x100,
-                    dat.into(),
-                );
-            }
-            0x54 | 0xa4 => {
-                let reg = self.get_vgm_u8();
-                let dat = self.get_vgm_u8();
-                self.sound_slot.write(
-                    SoundChipType::YM2151,
-                    (command >> 7) as usize,
-                    reg as u32,
-                    dat.into(),
-                );
-            }
-            0x55 | 0xa5 => {
-                let reg = self.get_vgm_u8();
-                let dat = self.get_vgm_u8();
-                self.sound_slot.write(
-                    SoundChipType::YM2203,
-                    (command >> 7) as usize,
-                    reg as u32,
-                    dat.into(),
-                );
-            }
-            0x56 | 0xa6 => {
-                // YM2608 port 0 write
-                let reg = self.get_vgm_u8();
-                let dat = self.get_vgm_u8();
-                self.sound_slot.write(
-                    SoundChipType::YM2608,
-                    (command >> 7) as usize,
-                    reg as u32,
-                    dat.into(),
-                );
-            }
-            0x57 | 0xa7 => {
-                // YM2608 port 1 write
-                let reg = self.get_vgm_u8();
-                let dat = self.get_vgm_u8();
-                self.sound_slot.write(
-                    SoundChipType::YM2608,
-                    (command >> 7) as usize,
-                    reg as u32 | 0x100,
-                    dat.into(),
-                );
-            }
-            0x58 | 0xa8 => {
-                // YM2610 port 0 write
-                let reg = self.get_vgm_u8();
-                let dat = self.get_vgm_u8();
-                self.sound_slot.write(
-                    SoundChipType::YM2610,
-                    (command >> 7) as usize,
-                    reg as u32,
-                    dat.into(),
-                );
-            }
-            0x59 | 0xa9 => {
-                // YM2610 port 1 write
-                let reg = self.get_vgm_u8();
-                let dat = self.get_vgm_u8();
-                self.sound_slot.write(
-                    SoundChipType::YM2610,
-                    (command >> 7) as usize,
-                    reg as u32 | 0x100,
-                    dat.into(),
-                );
-            }
-            0x5a | 0xaa => {
-                let reg = self.get_vgm_u8();
-                let dat = self.get_vgm_u8();
-                self.sound_slot.write(
-                    SoundChipType::YM3812,
-                    (command >> 7) as usize,
-                    reg as u32 | 0x100,
-                    dat.into(),
-                );
-            }
-            0x5b | 0xab => {
-                let reg = self.get_vgm_u8();
-                let dat = self.get_vgm_u8();
-                self.sound_slot.write(
-                    SoundChipType::YM3526,
-                    (command >> 7) as usize,
-                    reg as u32,
-                    dat.into(),
-                );
+    ///
+    /// Return the ticks from the start to the end (0 if not compiled).
+    ///
+    pub fn get_length(&self) -> usize {
+        self.vgm_events.end_tick
+    }
+
+    ///
+    /// Seek to tick_pos ticks from the start.
+    ///
+    /// The state of all sound chips is saved as a keyframe every
+    /// KEYFRAME_INTERVAL ticks, by a fast-forward that applies the register
+    /// writes without rendering (keyframes are added as seeks go further).
+    /// The nearest keyframe before tick_pos is restored, and the rest is
+    /// rendered and dropped. Needs the compiled events and a play.
+    ///
+    pub fn seek(&mut self, tick_pos: usize) -> Result<(), &'static str> {
+        if self.vgm_keyframes.is_empty() {
+            return Err("vgm is not played or not compiled.");
+        }
+        if tick_pos >= self.vgm_events.end_tick {
+            return Err("seek position is over the end.");
+        }
+        let index = tick_pos / KEYFRAME_INTERVAL;
+        self.restore_keyframe(index.min(self.vgm_keyframes.len() - 1))?;
+        self.fast_forward(index * KEYFRAME_INTERVAL);
+        self.replay(tick_pos);
+        Ok(())
+    }
+
+    fn save_keyframe(&mut self) {
+        if let Some(sound_slot) = self.sound_slot.save_state() {
+            self.vgm_keyframes.push(VgmKeyframe {
+                vgm_event_pos: self.vgm_event_pos,
+                remain_tick_count: self.remain_tick_count,
+                ym2612_pcm_pos: self.ym2612_pcm_pos,
+                ym2612_pcm_offset: self.ym2612_pcm_offset,
+                hack_sega32x_channel: self.hack_sega32x_channel,
+                data_stream: self.data_stream.clone(),
+                sound_slot,
+            });
+        }
+    }
+
+    fn restore_keyframe(&mut self, index: usize) -> Result<(), &'static str> {
+        let keyframe = &self.vgm_keyframes[index];
+        if !self.sound_slot.restore_state(&keyframe.sound_slot) {
+            return Err("keyframe is not of the sound slot.");
+        }
+        self.vgm_event_pos = keyframe.vgm_event_pos;
+        self.remain_tick_count = keyframe.remain_tick_count;
+        self.ym2612_pcm_pos = keyframe.ym2612_pcm_pos;
+        self.ym2612_pcm_offset = keyframe.ym2612_pcm_offset;
+        self.hack_sega32x_channel = keyframe.hack_sega32x_channel;
+        self.data_stream.clone_from(&keyframe.data_stream);
+        self.vgm_tick_pos = index * KEYFRAME_INTERVAL;
+        self.vgm_loop_count = 0;
+        self.vgm_end = false;
+        Ok(())
+    }
+
+    ///
+    /// Do events without rendering up to tick_pos, saving keyframes on the way.
+    ///
+    fn fast_forward(&mut self, tick_pos: usize) {
+        while self.vgm_tick_pos < tick_pos && !self.vgm_end {
+            if self.remain_tick_count > 0 {
+                let next_keyframe = (self.vgm_tick_pos / KEYFRAME_INTERVAL + 1) * KEYFRAME_INTERVAL;
+                let tick_count = self
+                    .remain_tick_count
+                    .min(next_keyframe - self.vgm_tick_pos);
+                self.sound_slot.skip(tick_count);
+                self.remain_tick_count -= tick_count;
+                self.vgm_tick_pos += tick_count;
+                if self.vgm_tick_pos == next_keyframe
+                    && self.vgm_keyframes.len() == next_keyframe / KEYFRAME_INTERVAL
+                {
+                    self.save_keyframe();
+                }
             }
-            0x5c | 0xac => {
-                let reg = self.get_vgm_u8();
-                let dat = self.get_vgm_u8();
-                self.sound_slot.write(
-                    SoundChipType::Y8950,
-                    (command >> 7) as usize,
-                    reg as u32,
-                    dat.into(),
-                );
+            if self.remain_tick_count == 0 && self.vgm_tick_pos < tick_pos {
+                self.remain_tick_count = self.play_events(false);
             }
-            0x5e | 0xae => {
-                // YMF262 port 0 write
-                let reg = self.get_vgm_u8();
-                let dat = self.get_vgm_u8();
-                self.sound_slot.write(
-                    SoundChipType::YMF262,
-                    (command >> 7) as usize,
-                    reg as u32,
-                    dat.into(),
-                );
+        }
+    }
+
+    ///
+    /// Render up to tick_pos and drop the samples.
+    ///
+    fn replay(&mut self, tick_pos: usize) {
+        while self.vgm_tick_pos < tick_pos && !self.vgm_end {
+            if self.remain_tick_count > 0 {
+                let tick_count = self
+                    .sound_slot
+                    .get_tickable_count(self.remain_tick_count.min(tick_pos - self.vgm_tick_pos));
+                self.sound_slot.update(tick_count);
+                self.sound_slot.discard_stream();
+                self.remain_tick_count -= tick_count;
+                self.vgm_tick_pos += tick_count;
             }
-            0x5f | 0xaf => {
-                // YMF262 port 1 write
-                let reg = self.get_vgm_u8();
-                let dat = self.get_vgm_u8();
-                self.sound_slot.write(
-                    SoundChipType::YMF262,
-                    (command >> 7) as usize,
-                    reg as u32 | 0x100,
-                    dat.into(),
-                );
+            if self.remain_tick_count == 0 && self.vgm_tick_pos < tick_pos {
+                self.remain_tick_count = self.play_events(false);
             }
+        }
+    }
+
+    fn parse_vgm(&mut self, repeat: bool) -> u16 {
+        let mut wait: u16 = 0;
+
+        let command = self.get_vgm_u8();
+        if let Some((sound_chip_type, sound_chip_index, port, data)) =
+            self.decode_write(command, self.vgm_pos)
+        {
+            self.vgm_pos += get_command_length(command) - 1;
+            self.sound_slot
+                .write(sound_chip_type, sound_chip_index, port, data);
+            return wait;
+        }
+        match command {
             0x61 => {
                 wait = self.get_vgm_u16();
             }
@@ -574,61 +805,14 @@ impl VgmPlay {
                     self.vgm_end = true;
                 } else if repeat {
                     self.vgm_pos = self.vgm_loop_offset;
+                    self.vgm_tick_pos = self.vgm_loop_tick;
                     self.vgm_loop_count += 1;
                 } else {
                     self.vgm_end = true;
                 }
             }
             0x67 => {
-                // 0x66 compatibility command to make older players stop parsing the stream
-                self.get_vgm_u8();
-                let data_type = self.get_vgm_u8();
-                let mut data_length = self.get_vgm_u32() as usize;
-                // dual sound chip
-                let sound_chip_index = if data_length & 0x80000000 != 0 { 1 } else { 0 };
-                data_length &= 0x7fffffff;
-                // data position
-                let data_block_pos = self.vgm_pos;
-                self.vgm_pos += data_length;
-                // handle data block
-                if (0x00..=0x3f).contains(&data_type) {
-                    // add data block (support uncompressed)
-                    self.sound_slot.add_data_block(
-                        self.data_block_id,
-                        &self.vgm_data[data_block_pos..data_block_pos + data_length],
-                    );
-                    // data_block_id is a sequence id in vgm
-                    self.data_block_id += 1;
-                } else if (0x80..=0xbf).contains(&data_type) {
-                    // ROM/RAM Image dumps
-                    let _real_rom_size = u32::from_le_bytes(
-                        self.vgm_data[data_block_pos..(data_block_pos + 4)]
-                            .try_into()
-                            .unwrap(),
-                    );
-                    let start_address = u32::from_le_bytes(
-                        self.vgm_data[(data_block_pos + 4)..(data_block_pos + 8)]
-                            .try_into()
-                            .unwrap(),
-                    );
-                    let mut data_size = data_length - 8;
-                    if data_size == 0 {
-                        data_size = 1;
-                    }
-                    let start_address = start_address as usize;
-                    let (rom_index, sound_chip_type): (RomIndex, Option<SoundChipType>) =
-                        self.get_rom_index(data_type);
-                    if rom_index != RomIndex::NOT_SUPPOTED {
-                        self.sound_slot.add_rom(
-                            sound_chip_type.unwrap(),
-                            sound_chip_index,
-                            rom_index,
-                            &self.vgm_data[(data_block_pos + 8)..(data_block_pos + 8) + data_size],
-                            start_address,
-                            start_address + data_size - 1,
-                        );
-                    }
-                }
+                // data blocks are added to sound chips by VgmLoader
             }
             0x70..=0x7f => {
                 wait = ((command & 0x0f) + 1).into();
@@ -750,13 +934,6 @@ impl VgmPlay {
                     );
                 }
             }
-            0xa0 => {
-                // TODO: YM2149 as AY8910, write
-                let reg = self.get_vgm_u8();
-                let dat = self.get_vgm_u8();
-                self.sound_slot
-                    .write(SoundChipType::YM2149, 0, reg as u32, dat.into());
-            }
             0xb2 => {
                 // PWM, write value ddd to register a (d is MSB, dd is LSB)
                 let offset = self.get_vgm_u8();
@@ -781,66 +958,6 @@ impl VgmPlay {
                 self.sound_slot
                     .write(SoundChipType::PWM, 0, channel as u32, data.into());
             }
-            0xb7 => {
-                // OKIM6258, write value dd to register aa
-                let offset = self.get_vgm_u8();
-                let dat = self.get_vgm_u8();
-                if offset & 0x80 != 0 {
-                    self.sound_slot.write(
-                        SoundChipType::OKIM6258,
-                        1,
-                        (offset & 0x7f) as u32,
-                        dat.into(),
-                    );
-                } else {
-                    self.sound_slot.write(
-                        SoundChipType::OKIM6258,
-                        0,
-                        (offset & 0x7f) as u32,
-                        dat.into(),
-                    );
-                }
-            }
-            0xb8 => {
-                // OKIM6295, write value dd to register aa
-                let offset = self.get_vgm_u8();
-                let dat = self.get_vgm_u8();
-                if offset & 0x80 != 0 {
-                    self.sound_slot.write(
-                        SoundChipType::OKIM6295,
-                        1,
-                        (offset & 0x7f) as u32,
-                        dat.into(),
-                    );
-                } else {
-                    self.sound_slot.write(
-                        SoundChipType::OKIM6295,
-                        0,
-                        (offset & 0x7f) as u32,
-                        dat.into(),
-                    );
-                }
-            }
-            0xc0 => {
-                let offset = self.get_vgm_u16();
-                let dat = self.get_vgm_u8();
-                self.sound_slot
-                    .write(SoundChipType::SEGAPCM, 0, u32::from(offset), dat.into());
-            }
-            0xd4 => {
-                // C140, write value dd to register ppaa
-                let offset = u16::from(self.get_vgm_u8()) << 8 | u16::from(self.get_vgm_u8());
-                let dat = self.get_vgm_u8();
-                // select chip type
-                let sound_chip_type = self.get_c140_chip_type();
-                if offset & 0x8000 != 0 {
-                    self.sound_slot
-                        .write(sound_chip_type, 1, (offset & 0x7fff) as u32, dat.into());
-                } else {
-                    self.sound_slot
-                        .write(sound_chip_type, 0, (offset & 0x7fff) as u32, dat.into());
-                }
-            }
             0xe0 => {
                 // YM2612 data block 0
                 let pcm_pos = self.get_vgm_u32() as usize;
@@ -899,6 +1016,86 @@ impl VgmPlay {
         wait
     }
 
+    ///
+    /// Decode a register write to a sound chip (operands at pos).
+    ///
+    /// Returns the sound chip type, index, port and data, or None if the
+    /// command is not a plain register write. Shared by parse_vgm and
+    /// compile_events.
+    ///
+    fn decode_write(&self, command: u8, pos: usize) -> Option<(SoundChipType, usize, u32, u32)> {
+        let vgm = &self.vgm_data;
+        let index = (command >> 7) as usize;
+        let sound_chip_type = match command {
+            0x50 => return Some((SoundChipType::SEGAPSG, 0, 0, vgm[pos].into())),
+            0x51 | 0xa1 => SoundChipType::YM2413,
+            0x52 | 0xa2 | 0x53 | 0xa3 => SoundChipType::YM2612,
+            0x54 | 0xa4 => SoundChipType::YM2151,
+            0x55 | 0xa5 => SoundChipType::YM2203,
+            0x56 | 0xa6 | 0x57 | 0xa7 => SoundChipType::YM2608,
+            0x58 | 0xa8 | 0x59 | 0xa9 => SoundChipType::YM2610,
+            0x5a | 0xaa => SoundChipType::YM3812,
+            0x5b | 0xab => SoundChipType::YM3526,
+            0x5c | 0xac => SoundChipType::Y8950,
+            0x5e | 0xae | 0x5f | 0xaf => SoundChipType::YMF262,
+            0xa0 => {
+                // TODO: YM2149 as AY8910, write
+                return Some((
+                    SoundChipType::YM2149,
+                    0,
+                    vgm[pos].into(),
+                    vgm[pos + 1].into(),
+                ));
+            }
+            0xb7 | 0xb8 => {
+                // OKIM6258/OKIM6295, write value dd to register aa
+                let sound_chip_type = if command == 0xb7 {
+                    SoundChipType::OKIM6258
+                } else {
+                    SoundChipType::OKIM6295
+                };
+                let offset = vgm[pos];
+                return Some((
+                    sound_chip_type,
+                    (offset >> 7) as usize,
+                    (offset & 0x7f).into(),
+                    vgm[pos + 1].into(),
+                ));
+            }
+            0xc0 => {
+                let offset = u16::from_le_bytes([vgm[pos], vgm[pos + 1]]);
+                return Some((
+                    SoundChipType::SEGAPCM,
+                    0,
+                    offset.into(),
+                    vgm[pos + 2].into(),
+                ));
+            }
+            0xd4 => {
+                // C140, write value dd to register ppaa
+                let offset = u16::from(vgm[pos]) << 8 | u16::from(vgm[pos + 1]);
+                return Some((
+                    self.get_c140_chip_type(),
+                    (offset >> 15) as usize,
+                    (offset & 0x7fff).into(),
+                    vgm[pos + 2].into(),
+                ));
+            }
+            _ => return None,
+        };
+        // port 1 (and YM3812) writes are at 0x100
+        let port = match command & 0x0f {
+            0x3 | 0x7 | 0x9 | 0xa | 0xf => 0x100,
+            _ => 0,
+        };
+        Some((
+            sound_chip_type,
+            index,
+            vgm[pos] as u32 | port,
+            vgm[pos + 1].into(),
+        ))
+    }
+
     fn get_c140_chip_type(&self) -> SoundChipType {
         if self.vgm_header.as_ref().unwrap().c140_chip_type == /* C219_TYPE_ASIC219 */ 0x2 {
             SoundChipType::C219
@@ -970,6 +1167,55 @@ impl VgmPlay {
     }
 }
 
+impl VgmLoadSink for VgmPlay {
+    fn load_header(&mut self, vgm_header: &[u8]) -> Result<(), &'static str> {
+        let vgm_header = vgmmeta::parse_vgm_header_meta(vgm_header)?;
+
+        if !self.add_sound_device(&vgm_header) {
+            return Err("sound chip could not be added.");
+        }
+        self.set_sound_device_volume(&vgm_header.extra_hdr.chip_volume);
+
+        // referenced by data blocks
+        self.vgm_header = Some(vgm_header);
+
+        Ok(())
+    }
+
+    fn load_data_block(&mut self, data_type: u8, sound_chip_index: usize, data: &[u8]) {
+        if (0x00..=0x3f).contains(&data_type) {
+            // add data block (support uncompressed)
+            self.sound_slot.add_data_block(self.data_block_id, data);
+            // data_block_id is a sequence id in vgm
+            self.data_block_id += 1;
+        } else if (0x80..=0xbf).contains(&data_type) {
+            // ROM/RAM Image dumps
+            if data.len() < 8 {
+                return;
+            }
+            let _real_rom_size = u32::from_le_bytes(data[0..4].try_into().unwrap());
+            let start_address = u32::from_le_bytes(data[4..8].try_into().unwrap());
+            let data_size = data.len() - 8;
+            if data_size == 0 {
+                return;
+            }
+            let start_address = start_address as usize;
+            let (rom_index, sound_chip_type): (RomIndex, Option<SoundChipType>) =
+                self.get_rom_index(data_type);
+            if rom_index != RomIndex::NOT_SUPPOTED {
+                self.sound_slot.add_rom(
+                    sound_chip_type.unwrap(),
+                    sound_chip_index,
+                    rom_index,
+                    &data[8..],
+                    start_address,
+                    start_address + data_size - 1,
+                );
+            }
+        }
+    }
+}
+
 ///
 /// cargo test -- --nocapture
 ///
@@ -983,6 +1229,110 @@ mod tests {
 
     const MAX_SAMPLE_SIZE: usize = 2048;
 
+    ///
+    /// header(0x80) | 0x67 block | writes and waits | loop: writes and waits | 0x66
+    ///
+    fn create_vgm() -> Vec<u8> {
+        let mut vgm = vec![0_u8; 0x80];
+        vgm[0..4].copy_from_slice(b"Vgm ");
+        vgm[0x08..0x0c].copy_from_slice(&0x151_u32.to_le_bytes());
+        vgm[0x0c..0x10].copy_from_slice(&3579545_u32.to_le_bytes());
+        vgm[0x2c..0x30].copy_from_slice(&7670453_u32.to_le_bytes());
+        vgm[0x34..0x38].copy_from_slice(&(0x80_u32 - 0x34).to_le_bytes());
+        vgm.extend_from_slice(&[
+            0x67, 0x66, 0x00, 0x04, 0x00, 0x00, 0x00, 0x10, 0x80, 0xf0, 0x40,
+        ]);
+        // SEGAPSG and YM2612 writes at the same tick, skipped commands
+        vgm.extend_from_slice(&[0x50, 0x8e, 0x52, 0x2b, 0x80, 0x50, 0x0f, 0x4f, 0xff]);
+        vgm.extend_from_slice(&[0x53, 0x30, 0x71, 0x50, 0x90, 0xb3, 0x00, 0x00]);
+        vgm.extend_from_slice(&[0x61, 0x10, 0x27, 0x62, 0x7f]);
+        // YM2612 PCM (commands of the parser) between writes
+        vgm.extend_from_slice(&[
+            0xe0, 0x00, 0x00, 0x00, 0x00, 0x81, 0x50, 0xa5, 0x82, 0x50, 0x03,
+        ]);
+        vgm.extend_from_slice(&[0x61, 0xff, 0xff, 0x61, 0xff, 0xff, 0x63]);
+        let loop_pos = vgm.len();
+        vgm.extend_from_slice(&[0x50, 0x92, 0x52, 0x28, 0xf0, 0x70, 0x50, 0x9f, 0x62]);
+        vgm.extend_from_slice(&[0x50, 0xc4, 0x50, 0x01, 0x50, 0xb1, 0x63, 0x63, 0x63]);
+        vgm.push(0x66);
+        let eof = vgm.len() as u32 - 4;
+        vgm[0x04..0x08].copy_from_slice(&eof.to_le_bytes());
+        vgm[0x1c..0x20].copy_from_slice(&(loop_pos as u32 - 0x1c).to_le_bytes());
+        vgm
+    }
+
+    fn render(vgmplay: &mut VgmPlay, loops: usize) -> Vec<i16> {
+        let mut s16le = Vec::new();
+        while vgmplay.play(true) < loops {
+            let sampling = vgmplay.get_output_sampling_s16le_ref();
+            s16le.extend_from_slice(unsafe { std::slice::from_raw_parts(sampling, 256 * 2) });
+        }
+        s16le
+    }
+
+    #[test]
+    fn events() {
+        let vgm = create_vgm();
+        // parsed
+        let mut vgmplay = VgmPlay::new_stream(SoundSlot::new(44100, 44100, 256));
+        vgmplay.load_stream(&vgm).unwrap();
+        vgmplay.end_stream().unwrap();
+        assert!(vgmplay.get_events().is_empty());
+        let parsed = render(&mut vgmplay, 3);
+        // compiled by new
+        let mut vgmplay = VgmPlay::new(SoundSlot::new(44100, 44100, 256), &vgm).unwrap();
+        let events = vgmplay.get_events();
+        assert!(!events.is_empty());
+        assert_eq!(render(&mut vgmplay, 3), parsed);
+        assert!(vgmplay.compile_events().is_err());
+        // saved events
+        let mut vgmplay = VgmPlay::new_stream(SoundSlot::new(44100, 44100, 256));
+        vgmplay.load_stream(&vgm).unwrap();
+        vgmplay.end_stream().unwrap();
+        vgmplay.set_events(&events).unwrap();
+        assert_eq!(render(&mut vgmplay, 3), parsed);
+        // saved events of another vgm
+        let mut other = vgm.clone();
+        other.insert(other.len() - 1, 0x62);
+        let eof = other.len() as u32 - 4;
+        other[0x04..0x08].copy_from_slice(&eof.to_le_bytes());
+        let mut vgmplay = VgmPlay::new_stream(SoundSlot::new(44100, 44100, 256));
+        vgmplay.load_stream(&other).unwrap();
+        vgmplay.end_stream().unwrap();
+        assert!(vgmplay.set_events(&events).is_err());
+    }
+
+    #[test]
+    fn seek() {
+        let vgm = create_vgm();
+        let mut vgmplay = VgmPlay::new(SoundSlot::new(44100, 44100, 256), &vgm).unwrap();
+        assert!(vgmplay.seek(0).is_err());
+        let length = vgmplay.get_length();
+        let mut chunks = 0;
+        while vgmplay.play(false) != std::usize::MAX {
+            chunks += 1;
+        }
+        assert_eq!(vgmplay.get_position(), length);
+        assert!(vgmplay.seek(length).is_err());
+        // forward over a keyframe built by the fast-forward, then back
+        for tick_pos in [256 * 400, 256 * 10, 0, length - 1] {
+            vgmplay.seek(tick_pos).unwrap();
+            assert_eq!(vgmplay.get_position(), tick_pos);
+            let mut rest = 0;
+            while vgmplay.play(false) != std::usize::MAX {
+                rest += 1;
+            }
+            assert_eq!(vgmplay.get_position(), length);
+            assert_eq!(rest, chunks - tick_pos / 256);
+        }
+        assert_eq!(vgmplay.vgm_keyframes.len(), 256 * 400 / super::KEYFRAME_INTERVAL + 1);
+        // looped back to the loop point
+        vgmplay.seek(0).unwrap();
+        while vgmplay.play(true) < 1 {}
+        assert!(vgmplay.get_position() < length);
+        assert!(vgmplay.get_position() >= vgmplay.vgm_loop_tick);
+    }
+
     #[test]
     fn sn76489_1() {
         play("./docs/vgm/segapsg-2.vgz")
@@ -82,6 +82,13 @@ impl XgmPlay {
         self.sound_slot.get_output_sampling_s16le_ref()
     }
 
+    ///
+    /// Return the number of valid samples in the last streamed chunk.
+    ///
+    pub fn get_output_sample_stream_size(&self) -> usize {
+        self.sound_slot.get_output_sample_stream_size()
+    }
+
     ///
     /// Get XGM meta.
     ///
@@ -111,12 +118,11 @@ impl XgmPlay {
     ///
     pub fn play(&mut self, repeat: bool) -> usize {
         while !self.sound_slot.is_stream_filled() && !self.xgm_end {
-            for _ in 0..self.remain_tick_count {
-                self.sound_slot.update(1);
-                self.remain_tick_count -= 1;
-                if self.sound_slot.is_stream_filled() {
-                    break;
-                }
+            if self.remain_tick_count > 0 {
+                // update until the next command or until the stream is filled
+                let tick_count = self.sound_slot.get_tickable_count(self.remain_tick_count);
+                self.sound_slot.update(tick_count);
+                self.remain_tick_count -= tick_count;
             }
             if self.remain_tick_count == 0 {
                 self.remain_tick_count = self.parse_xgm(repeat) as usize;
@@ -168,10 +174,15 @@ impl XgmPlay {
         }
 
         // add sound chip
-        self.sound_slot
-            .add_sound_device(SoundChipType::YM2612, 1, clock_ym2612);
-        self.sound_slot
-            .add_sound_device(SoundChipType::SEGAPSG, 1, clock_sn76489);
+        if !self
+            .sound_slot
+            .add_sound_device(SoundChipType::YM2612, 1, clock_ym2612)
+            || !self
+                .sound_slot
+                .add_sound_device(SoundChipType::SEGAPSG, 1, clock_sn76489)
+        {
+            return Err("sound chip could not be added.");
+        }
 
         // set up YM2612 data stream
         // 4 PCM channels (8 bits signed at 14 Khz)
@@ -6,6 +6,8 @@ mod sound_chip;
 mod stream;
 mod rom;
 mod data_stream;
+mod profile;
+mod kernel;
 
 mod chip_ymfm;
 mod chip_sn76496;
@@ -17,6 +19,10 @@ mod chip_okim6295;
 
 pub use crate::sound::sound_chip::SoundChipType as SoundChipType;
 pub use crate::sound::slot::SoundSlot as SoundSlot;
+pub use crate::sound::slot::SoundSlotState as SoundSlotState;
 pub use crate::sound::rom::RomIndex as RomIndex;
 pub use crate::sound::rom::RomBusType as RomBusType;
 pub use crate::sound::device::DataStreamMode as DataStreamMode;
+pub use crate::sound::profile::Stage as Stage;
+pub use crate::sound::profile::cycles as cycles;
+pub use crate::sound::profile::STAGES as STAGES;
@@ -60,10 +60,10 @@ TODO:
     2006.01.08  R. Belmont   added support for NA-1/2 "219" derivative
     2020.05.06  cam900       Implement some features from QuattroPlay sources, by superctr
 */
-use std::{cell::RefCell, rc::Rc};
+use std::{any::Any, cell::RefCell, rc::Rc};
 use super::{
     rom::{read_word, Decoder, RomBank, set_rom_bus, RomBus},
-    sound_chip::SoundChip,
+    sound_chip::{restore_clone, save_clone, SoundChip},
     stream::{convert_sample_i2f, SoundStream},
     RomBusType, RomIndex, SoundChipType,
 };
@@ -72,6 +72,7 @@ const MAX_VOICE: usize = 24;
 const ASIC_219_BANKS: [i16; 4] = [0x1f7, 0x1f1, 0x1f3, 0x1f5];
 
 #[allow(non_snake_case)]
+#[derive(Clone)]
 pub struct C140 {
     sample_rate: i32,
     baserate: i32,
@@ -329,6 +330,7 @@ impl C140 {
     }
 }
 
+#[derive(Clone)]
 pub struct C219 {
     sample_rate: i32,
     baserate: i32,
@@ -682,6 +684,14 @@ impl SoundChip for C140 {
         // type state
         self.rom_decoder = Some(rom_decoder);
     }
+
+    fn save_state(&mut self) -> Option<Box<dyn Any>> {
+        save_clone(self)
+    }
+
+    fn restore_state(&mut self, state: &dyn Any, _: &mut dyn SoundStream) -> bool {
+        restore_clone(self, state)
+    }
 }
 
 impl SoundChip for C219 {
@@ -729,4 +739,12 @@ impl SoundChip for C219 {
         // type state
         self.rom_decoder = Some(rom_decoder);
     }
+
+    fn save_state(&mut self) -> Option<Box<dyn Any>> {
+        save_clone(self)
+    }
+
+    fn restore_state(&mut self, state: &dyn Any, _: &mut dyn SoundStream) -> bool {
+        restore_clone(self, state)
+    }
 }
@@ -26,9 +26,10 @@
  *   Recording?
  *
  **********************************************************************************************/
+use std::any::Any;
 use super::{
     rom::RomBank,
-    sound_chip::SoundChip,
+    sound_chip::{restore_clone, save_clone, SoundChip},
     stream::{convert_sample_i2f, OutputChannel, SoundStream},
     RomIndex, RomBusType,
 };
@@ -44,6 +45,7 @@ const DIVIDERS: [u32; 4] = [1024, 768, 512, 512];
 /* step size index shift table */
 const INDEX_SHIFT: [i32; 8] = [-1, -1, -1, -1, 2, 4, 6, 8];
 
+#[derive(Clone)]
 pub struct OKIM6258 {
     clock: u32,
     status: u8,
@@ -57,6 +59,7 @@ pub struct OKIM6258 {
     step: i32,
     diff_lookup: [i32; 49 * 16], /* lookup table for the precomputed difference */
     data_state: Vec<u8>,
+    output_channel: u32, /* last output channel written (for restore_state) */
 }
 
 impl OKIM6258 {
@@ -74,6 +77,7 @@ impl OKIM6258 {
             step: 0,
             diff_lookup: [0; 49 * 16],
             data_state: Vec::new(),
+            output_channel: 0,
         }
     }
 
@@ -172,6 +176,18 @@ impl OKIM6258 {
         }
     }
 
+    fn set_output_channel(data: u32, sound_stream: &mut dyn SoundStream) {
+        match data {
+            0 => sound_stream.set_output_channel(OutputChannel::Stereo),
+            1 => sound_stream.set_output_channel(OutputChannel::Left),
+            2 => sound_stream.set_output_channel(OutputChannel::Right),
+            3 => sound_stream.set_output_channel(OutputChannel::Mute),
+            _ => {
+                /* panic!("ignore set_output_channel ({})", data) */
+            }
+        }
+    }
+
     pub fn set_divider(&mut self, val: u32) -> u32 {
         self.divider = DIVIDERS[val as usize];
         // return sampling rate
@@ -261,15 +277,12 @@ impl SoundChip for OKIM6258 {
         match offset {
             0x0 => self.ctrl_w((data & 0xff) as u8),
             0x1 => self.data_w((data & 0xff) as u8),
-            0x2 => match data {
-                0 => sound_stream.set_output_channel(OutputChannel::Stereo),
-                1 => sound_stream.set_output_channel(OutputChannel::Left),
-                2 => sound_stream.set_output_channel(OutputChannel::Right),
-                3 => sound_stream.set_output_channel(OutputChannel::Mute),
-                _ => {
-                    /* panic!("ignore set_output_channel ({})", data) */
+            0x2 => {
+                if data <= 3 {
+                    self.output_channel = data;
                 }
-            },
+                Self::set_output_channel(data, sound_stream);
+            }
             0x8 | 0x9 | 0xa => { /* todo!("change data clock") */ },
             0xb => { /* todo!("change data clock") */ },
             0xc => {
@@ -304,4 +317,26 @@ impl SoundChip for OKIM6258 {
     fn set_rom_bus(&mut self, _: Option<RomBusType>) {
         /* nothing to do */
     }
+
+    fn skip(&mut self) {
+        // data written while skipping would have been played out
+        if let Some(&data_in) = self.data_state.last() {
+            self.data_in = data_in;
+            self.data_state.clear();
+        }
+    }
+
+    fn save_state(&mut self) -> Option<Box<dyn Any>> {
+        save_clone(self)
+    }
+
+    fn restore_state(&mut self, state: &dyn Any, sound_stream: &mut dyn SoundStream) -> bool {
+        if !restore_clone(self, state) {
+            return false;
+        }
+        // the output channel and the divider are kept by the sound stream
+        Self::set_output_channel(self.output_channel, sound_stream);
+        sound_stream.change_sampling_rate(self.clock / self.divider);
+        true
+    }
 }
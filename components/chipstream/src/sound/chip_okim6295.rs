@@ -58,7 +58,7 @@
     RD, which limits its ROM addressing to one megabit instead of two.
 
 ***************************************************************************/
-use std::{cell::RefCell, rc::Rc};
+use std::{any::Any, cell::RefCell, rc::Rc};
 use super::{
     rom::{read_byte, set_rom_bus, Decoder, RomBank, RomBus},
     sound_chip::SoundChip,
@@ -70,6 +70,7 @@ const OKIM6295_VOICES: usize = 4;
 const PIN7_LOW: u8 = 0;
 const PIN7_HIGH: u8 = 1;
 
+#[derive(Clone)]
 struct OkiAdpcmState {
     signal: i32,
     step: i32,
@@ -184,6 +185,7 @@ impl OkiAdpcmState {
     }
 }
 
+#[derive(Clone)]
 struct OkiVoice {
     adpcm: OkiAdpcmState,
     playing: bool,
@@ -231,6 +233,7 @@ impl OkiVoice {
     }
 }
 
+#[derive(Clone)]
 pub struct OKIM6295 {
     voice: [OkiVoice; OKIM6295_VOICES],
     command: i32,
@@ -403,6 +406,7 @@ impl OKIM6295 {
     }
 }
 
+#[derive(Clone)]
 struct OKIM6295RomDecoder {
     nmk112_enable: u8,
     bank: u8,
@@ -519,4 +523,27 @@ impl SoundChip for OKIM6295 {
             self.rom_decoder = Some(rom_decoder);
         }
     }
+
+    fn save_state(&mut self) -> Option<Box<dyn Any>> {
+        // bank registers are in the rom decoder shared with the rom set
+        let rom_decoder = self
+            .rom_decoder
+            .as_ref()
+            .map(|decoder| decoder.as_ref().borrow().clone());
+        Some(Box::new((self.clone(), rom_decoder)))
+    }
+
+    fn restore_state(&mut self, state: &dyn Any, sound_stream: &mut dyn SoundStream) -> bool {
+        match state.downcast_ref::<(OKIM6295, Option<OKIM6295RomDecoder>)>() {
+            Some((chip, rom_decoder)) => {
+                self.clone_from(chip);
+                if let (Some(decoder), Some(rom_decoder)) = (&self.rom_decoder, rom_decoder) {
+                    decoder.as_ref().borrow_mut().clone_from(rom_decoder);
+                }
+                sound_stream.change_sampling_rate(self.device_clock_changed());
+                true
+            }
+            None => false,
+        }
+    }
 }
@@ -17,9 +17,10 @@
 // license:BSD-3-Clause
 // copyright-holders:David Haywood
 
+use std::any::Any;
 use super::{
     rom::RomBank,
-    sound_chip::SoundChip,
+    sound_chip::{restore_clone, save_clone, SoundChip},
     stream::SoundStream,
     RomIndex, SoundChipType, RomBusType,
 };
@@ -27,6 +28,7 @@ use super::{
 const PWM_FIFO_SIZE: usize = 3;
 const EMU_SAMPLING_RATE: u32 = 22050; /* 22050 / 15611 After Burner Complete */
 
+#[derive(Clone)]
 #[allow(clippy::upper_case_acronyms)]
 pub struct PWM {
     clock: u32,
@@ -295,4 +297,12 @@ impl SoundChip for PWM {
     fn set_rom_bus(&mut self, _: Option<RomBusType>) {
         /* nothing to do */
     }
+
+    fn save_state(&mut self) -> Option<Box<dyn Any>> {
+        save_clone(self)
+    }
+
+    fn restore_state(&mut self, state: &dyn Any, _: &mut dyn SoundStream) -> bool {
+        restore_clone(self, state)
+    }
 }
@@ -18,13 +18,15 @@
 // copyright-holders:Hiromitsu Shioya, Olivier Galibert
 
 use crate::sound::SoundChipType;
+use std::any::Any;
 use super::{
     rom::{read_byte, RomBank},
-    sound_chip::SoundChip,
+    sound_chip::{restore_clone, save_clone, SoundChip},
     stream::{convert_sample_i2f, SoundStream},
     RomIndex, RomBusType,
 };
 
+#[derive(Clone)]
 #[allow(clippy::upper_case_acronyms)]
 pub struct SEGAPCM {
     clock: u32,
@@ -163,4 +165,12 @@ impl SoundChip for SEGAPCM {
     fn set_rom_bus(&mut self, _: Option<RomBusType>) {
         /* nothing to do */
     }
+
+    fn save_state(&mut self) -> Option<Box<dyn Any>> {
+        save_clone(self)
+    }
+
+    fn restore_state(&mut self, state: &dyn Any, _: &mut dyn SoundStream) -> bool {
+        restore_clone(self, state)
+    }
 }
@@ -154,15 +154,17 @@
           regs 1,3,5,6,7 if 0x80 is not set. This needs to be verified on real hardware.
 
 ***************************************************************************/
+use std::any::Any;
 use super::{
     rom::RomBank,
-    sound_chip::SoundChip,
+    sound_chip::{restore_clone, save_clone, SoundChip},
     stream::{convert_sample_i2f, SoundStream},
     RomIndex, SoundChipType, RomBusType,
 };
 
 const MAX_OUTPUT: i32 = 0x7fff;
 
+#[derive(Clone)]
 #[allow(non_snake_case)]
 pub struct SN76496 {
     clock: u32,
@@ -534,4 +536,12 @@ impl SoundChip for SN76496 {
     fn set_rom_bus(&mut self, _: Option<RomBusType>) {
         /* nothing to do */
     }
+
+    fn save_state(&mut self) -> Option<Box<dyn Any>> {
+        save_clone(self)
+    }
+
+    fn restore_state(&mut self, state: &dyn Any, _: &mut dyn SoundStream) -> bool {
+        restore_clone(self, state)
+    }
 }
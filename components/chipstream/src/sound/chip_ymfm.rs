@@ -2,21 +2,32 @@
 // copyright-holders:Hiromasa Tanaka
 use super::{
     rom::{get_rom_ref, RomBank},
-    sound_chip::SoundChip,
-    stream::{convert_sample_i2f, SoundStream},
+    sound_chip::{RenderBlock, Resample, SoundChip},
+    stream::SoundStream,
     RomIndex, SoundChipType, RomBusType,
 };
-use std::collections::HashMap;
+use std::{any::Any, collections::HashMap, ffi::c_void};
 
 #[link(name = "ymfm")]
 extern "C" {
     fn ymfm_add_chip(chip_num: u16, clock: u32) -> u32;
-    fn ymfm_write(chip_num: u16, index: u16, reg: u32, data: u8);
-    fn ymfm_generate(chip_num: u16, index: u16, buffer: *const i32);
-    fn ymfm_remove_chip(chip_num: u16);
-    // void ymfm_add_rom_data(uint16_t chip_num, uint16_t access_type, uint8_t *buffer, uint32_t length, uint32_t start_address)
+    fn ymfm_get_sample_rate(handle: u32) -> u32;
+    fn ymfm_write_batch(handle: u32, packed: *const u32, count: u32);
+    fn ymfm_generate(handle: u32, buffer: *const i32);
+    fn ymfm_get_block_buffer(handle: u32, frames: u32) -> *mut i32;
+    fn ymfm_generate_blocks_begin(blocks: *const RenderBlock, count: u32) -> bool;
+    fn ymfm_generate_blocks_end();
+    fn ymfm_remove_chip(handle: u32);
+    fn ymfm_set_low_rate(handle: u32, low_rate: bool) -> u32;
+    fn ymfm_set_mute(handle: u32, mute: bool);
+    fn ymfm_set_output_rate(handle: u32, output_rate: u32, quality: u8) -> u32;
+    fn ymfm_skip(handle: u32);
+    fn ymfm_save_state(handle: u32) -> *mut c_void;
+    fn ymfm_restore_state(handle: u32, state: *const c_void) -> bool;
+    fn ymfm_free_state(state: *mut c_void);
+    // void ymfm_add_rom_data(uint32_t handle, uint16_t access_type, uint8_t *buffer, uint32_t length, uint32_t start_address)
     fn ymfm_add_rom_data(
-        chip_num: u16,
+        handle: u32,
         access_type: u16,
         buffer: *const u8,
         length: u32,
@@ -43,19 +54,37 @@ pub enum ChipType {
     CHIP_YMF278B = 11,
 }
 
+///
+/// Upper limit of frames rendered by one render block
+///
+const GENERATE_BLOCK_MAX_FRAMES: usize = 1024;
+
+///
+/// Initial capacity of the register write batch
+///
+const WRITE_BATCH_CAPACITY: usize = 64;
+
 pub struct YmFm {
     chip_type: ChipType,
-    clock: u32,
+    handle: u32,
     sampling_rate: u32,
     rom_bank: HashMap<RomIndex, RomBank>,
+    write_batch: Vec<u32>,
+    generate_buffer: *const i32,
+    generate_pos: usize,
+    generate_frames: usize,
 }
 
 impl YmFm {
     fn init(&mut self, clock: u32) -> u32 {
         unsafe {
-            self.sampling_rate = ymfm_add_chip(self.chip_type as u16, clock);
+            self.handle = ymfm_add_chip(self.chip_type as u16, clock);
+            // ymfm chip table is full (the device is not added)
+            if self.handle == 0 {
+                return 0;
+            }
+            self.sampling_rate = ymfm_get_sample_rate(self.handle);
         }
-        self.clock = clock;
         // ymfm YM2149 internal sampling rate
         if self.chip_type == ChipType::CHIP_YM2149 {
             self.sampling_rate *= 4
@@ -63,31 +92,96 @@ impl YmFm {
         self.sampling_rate
     }
 
-    fn write_chip(&self, index: usize, offset: u32, data: u8) {
+    fn write_chip(&mut self, offset: u32, data: u8) {
+        // batched until the next generate
+        self.write_batch.push(offset << 8 | data as u32);
+    }
+
+    ///
+    /// Pass the batched writes to the chip, where they land before the next
+    /// frame generated; so it is called before every render, which places
+    /// the writes at the tick they were made.
+    ///
+    fn flush_write_batch(&mut self) {
+        if self.write_batch.is_empty() {
+            return;
+        }
         unsafe {
-            ymfm_write(self.chip_type as u16, index as u16, offset, data);
+            ymfm_write_batch(
+                self.handle,
+                self.write_batch.as_ptr(),
+                self.write_batch.len() as u32,
+            );
         }
+        self.write_batch.clear();
     }
 
     #[allow(clippy::missing_safety_doc)]
-    fn generate(&mut self, index: usize, buffer: &mut [i32; 2]) {
+    fn generate(&mut self, buffer: &mut [i32; 2]) {
+        // rendered in advance by generate_block
+        if self.generate_pos < self.generate_frames {
+            unsafe {
+                buffer[0] = *self.generate_buffer.add(self.generate_pos * 2);
+                buffer[1] = *self.generate_buffer.add(self.generate_pos * 2 + 1);
+            }
+            self.generate_pos += 1;
+            return;
+        }
+        self.flush_write_batch();
         let generate_buffer: [i32; 2] = [0, 0];
         unsafe {
-            ymfm_generate(
-                self.chip_type as u16,
-                index as u16,
-                generate_buffer.as_ptr(),
-            );
+            ymfm_generate(self.handle, generate_buffer.as_ptr());
         }
         buffer[0] = generate_buffer[0];
         buffer[1] = generate_buffer[1];
     }
+
+    ///
+    /// Prepare generate_buffer to be rendered by generate_blocks.
+    ///
+    /// The buffer is owned by the ymfm chip (in internal DRAM when it fits).
+    ///
+    fn generate_block(&mut self, frames: usize) -> Option<RenderBlock> {
+        // keep frames that have not been consumed yet
+        if self.generate_pos < self.generate_frames {
+            return None;
+        }
+        self.flush_write_batch();
+        let frames = frames.min(GENERATE_BLOCK_MAX_FRAMES);
+        let buffer = unsafe { ymfm_get_block_buffer(self.handle, frames as u32) };
+        if buffer.is_null() {
+            // out of memory; render on each tick
+            self.generate_frames = 0;
+            return None;
+        }
+        self.generate_buffer = buffer;
+        self.generate_pos = 0;
+        self.generate_frames = frames;
+        Some(RenderBlock {
+            handle: self.handle,
+            frames: frames as u32,
+            buffer,
+        })
+    }
+}
+
+///
+/// ymfm chip state of a seek keyframe (in PSRAM, owned by ymfmffi.cpp)
+///
+struct YmFmState {
+    state: *mut c_void,
+}
+
+impl Drop for YmFmState {
+    fn drop(&mut self) {
+        unsafe { ymfm_free_state(self.state) }
+    }
 }
 
 impl Drop for YmFm {
     fn drop(&mut self) {
-        if self.clock != 0 {
-            unsafe { ymfm_remove_chip(self.chip_type as u16) }
+        if self.handle != 0 {
+            unsafe { ymfm_remove_chip(self.handle) }
         }
     }
 }
@@ -111,9 +205,13 @@ impl SoundChip for YmFm {
         };
         YmFm {
             chip_type,
-            clock: 0,
+            handle: 0,
             sampling_rate: 0,
             rom_bank: HashMap::new(),
+            write_batch: Vec::with_capacity(WRITE_BATCH_CAPACITY),
+            generate_buffer: std::ptr::null(),
+            generate_pos: 0,
+            generate_frames: 0,
         }
     }
 
@@ -125,14 +223,15 @@ impl SoundChip for YmFm {
         todo!("not impliments");
     }
 
-    fn write(&mut self, index: usize, offset: u32, data: u32, _: &mut dyn SoundStream) {
-        self.write_chip(index, offset, data as u8);
+    fn write(&mut self, _: usize, offset: u32, data: u32, _: &mut dyn SoundStream) {
+        self.write_chip(offset, data as u8);
     }
 
-    fn tick(&mut self, index: usize, sound_stream: &mut dyn SoundStream) {
+    fn tick(&mut self, _: usize, sound_stream: &mut dyn SoundStream) {
         let mut buffer: [i32; 2] = [0, 0];
-        self.generate(index, &mut buffer);
-        sound_stream.push(convert_sample_i2f(buffer[0]), convert_sample_i2f(buffer[1]));
+        self.generate(&mut buffer);
+        // integer samples are passed through to the mixing bus with integer_mix
+        sound_stream.push_i32(buffer[0], buffer[1]);
     }
 
     fn set_rom_bank(&mut self, rom_index: RomIndex, rom_bank: RomBank) {
@@ -151,7 +250,7 @@ impl SoundChip for YmFm {
                 | RomIndex::YMF278B_RAM
                 | RomIndex::Y8950_ROM => unsafe {
                     ymfm_add_rom_data(
-                        self.chip_type as u16,
+                        self.handle,
                         rom_index as u16,
                         memory,
                         length as u32,
@@ -170,4 +269,82 @@ impl SoundChip for YmFm {
     fn set_rom_bus(&mut self, _: Option<RomBusType>) {
         /* nothing to do */
     }
+
+    fn render_ahead(&mut self, _: usize, tick_count: usize) -> Option<RenderBlock> {
+        self.generate_block(tick_count)
+    }
+
+    fn set_low_rate(&mut self, low_rate: bool) -> Option<u32> {
+        // writes batched at the current rate land before the change
+        self.flush_write_batch();
+        let sampling_rate = unsafe { ymfm_set_low_rate(self.handle, low_rate) };
+        if sampling_rate == 0 {
+            return None;
+        }
+        self.sampling_rate = sampling_rate;
+        Some(sampling_rate)
+    }
+
+    fn set_mute(&mut self, mute: bool) -> bool {
+        unsafe { ymfm_set_mute(self.handle, mute) };
+        true
+    }
+
+    fn set_output_rate(&mut self, output_rate: u32, resample: Resample) -> Option<u32> {
+        // resampled in blocks by ymfm_resampler.h, one tick per output sample
+        self.flush_write_batch();
+        let sampling_rate =
+            unsafe { ymfm_set_output_rate(self.handle, output_rate, resample as u8) };
+        if sampling_rate == 0 {
+            return None;
+        }
+        self.sampling_rate = sampling_rate;
+        Some(sampling_rate)
+    }
+
+    fn skip(&mut self) {
+        self.flush_write_batch();
+        unsafe { ymfm_skip(self.handle) };
+    }
+
+    fn save_state(&mut self) -> Option<Box<dyn Any>> {
+        self.flush_write_batch();
+        let state = unsafe { ymfm_save_state(self.handle) };
+        if state.is_null() {
+            return None;
+        }
+        Some(Box::new(YmFmState { state }))
+    }
+
+    fn restore_state(&mut self, state: &dyn Any, _: &mut dyn SoundStream) -> bool {
+        let state = match state.downcast_ref::<YmFmState>() {
+            Some(state) => state,
+            None => return false,
+        };
+        self.write_batch.clear();
+        if !unsafe { ymfm_restore_state(self.handle, state.state) } {
+            return false;
+        }
+        // frames rendered ahead are of the old position
+        self.generate_pos = 0;
+        self.generate_frames = 0;
+        true
+    }
+}
+
+///
+/// Start rendering blocks requested by render_ahead.
+///
+/// Returns true when the ymfm render worker (on the other core) has started
+/// on them. The chips of the blocks must not be used until generate_blocks_end.
+///
+pub fn generate_blocks_begin(blocks: &[RenderBlock]) -> bool {
+    unsafe { ymfm_generate_blocks_begin(blocks.as_ptr(), blocks.len() as u32) }
+}
+
+///
+/// Render the blocks not taken by the worker and wait for the worker.
+///
+pub fn generate_blocks_end() {
+    unsafe { ymfm_generate_blocks_end() }
 }
@@ -16,6 +16,7 @@ impl DataBlock {
     }
 }
 
+#[derive(Clone)]
 pub struct DataStream {
     data_block_id: Option<usize>,
     frequency: u32,
@@ -71,6 +72,19 @@ impl DataStream {
         result
     }
 
+    ///
+    /// Advance tick_count ticks without writing (seek fast-forward)
+    ///
+    pub fn skip(&mut self, tick_count: f64) {
+        let pos =
+            self.data_stream_sampling_pos as f64 + self.data_stream_sample_step as f64 * tick_count;
+        let passed = pos.floor();
+        self.data_stream_sampling_pos = (pos - passed) as f32;
+        let passed = (passed as usize).min(self.data_block_length);
+        self.data_block_length -= passed;
+        self.data_block_pos += passed;
+    }
+
     ///
     /// Set data stream frequency
     ///
@@ -80,6 +94,15 @@ impl DataStream {
         self.data_stream_sample_step = frequency as f32 / sampling_rate as f32;
     }
 
+    ///
+    /// Re-calc rate for the new sampling rate of the sound chip
+    ///
+    pub fn change_sampling_rate(&mut self, sampling_rate: u32) {
+        if self.frequency != 0 {
+            self.data_stream_sample_step = self.frequency as f32 / sampling_rate as f32;
+        }
+    }
+
     ///
     /// Assign data data stream to data block
     ///
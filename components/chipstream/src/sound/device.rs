@@ -2,12 +2,13 @@
 // copyright-holders:Hiromasa Tanaka
 use super::{
     data_stream::{DataBlock, DataStream},
+    kernel::mix_gain,
     rom::RomSet,
-    sound_chip::{SoundChip},
-    stream::{SoundStream, Tick},
+    sound_chip::{RenderBlock, Resample, SoundChip},
+    stream::{MixSample, SoundStream, Tick},
     RomBusType, RomIndex,
 };
-use std::{cell::RefCell, collections::HashMap, rc::Rc};
+use std::{any::Any, cell::RefCell, collections::HashMap, rc::Rc};
 
 #[derive(PartialEq, Eq)]
 pub enum DataStreamMode {
@@ -15,6 +16,14 @@ pub enum DataStreamMode {
     MergeS8le,
 }
 
+///
+/// Saved state of a sound device (seek keyframe)
+///
+pub struct SoundDeviceState {
+    sound_chip: Box<dyn Any>,
+    data_stream: HashMap<usize, DataStream>,
+}
+
 ///
 /// Sound Device
 ///
@@ -22,9 +31,14 @@ pub struct SoundDevice {
     sound_chip: Box<dyn SoundChip>,
     sound_stream: Box<dyn SoundStream>,
     output_level_rate: f32,
+    peak_level: MixSample,
+    muted: bool,
     sound_rom_set: HashMap<RomIndex, Rc<RefCell<RomSet>>>,
     data_stream_mode: DataStreamMode,
     data_stream: HashMap<usize, DataStream>,
+    generated: Vec<(MixSample, MixSample)>,
+    generated_pos: usize,
+    rendering_ahead: bool,
 }
 
 impl SoundDevice {
@@ -49,9 +63,14 @@ impl SoundDevice {
             sound_chip,
             sound_stream,
             output_level_rate: 1.0,
+            peak_level: MixSample::default(),
+            muted: false,
             sound_rom_set,
             data_stream_mode: DataStreamMode::Parallel,
             data_stream: HashMap::new(),
+            generated: Vec::new(),
+            generated_pos: 0,
+            rendering_ahead: false,
         }
     }
 
@@ -59,11 +78,19 @@ impl SoundDevice {
     /// Generates a waveform for one sample according to
     /// the output sampling rate of the sound stream.
     ///
-    pub fn generate(
+    /// The output level rate is applied by generate_block.
+    ///
+    fn generate(
         &mut self,
         sound_chip_index: usize,
         data_block: &HashMap<usize, DataBlock>,
-    ) -> (f32, f32) {
+    ) -> (MixSample, MixSample) {
+        // generated in advance by generate_ahead
+        if self.generated_pos < self.generated.len() {
+            let sample = self.generated[self.generated_pos];
+            self.generated_pos += 1;
+            return sample;
+        }
         let mut is_tick;
         while {
             is_tick = self.sound_stream.is_tick();
@@ -81,9 +108,161 @@ impl SoundDevice {
             break;
         }
         // Get sample
-        let (l, r) = self.sound_stream.drain();
+        self.sound_stream.drain_mix()
+    }
+
+    ///
+    /// Generates a block of samples (the length of sampling_l) at the output
+    /// level rate.
+    ///
+    pub fn generate_block(
+        &mut self,
+        sound_chip_index: usize,
+        data_block: &HashMap<usize, DataBlock>,
+        sampling_l: &mut [MixSample],
+        sampling_r: &mut [MixSample],
+    ) {
+        for (l, r) in sampling_l.iter_mut().zip(sampling_r.iter_mut()) {
+            (*l, *r) = self.generate(sound_chip_index, data_block);
+        }
         // Apply output level rate
-        (l * self.output_level_rate, r * self.output_level_rate)
+        mix_gain(sampling_l, self.output_level_rate);
+        mix_gain(sampling_r, self.output_level_rate);
+        // level meter for the quality governor
+        for (l, r) in sampling_l.iter().zip(sampling_r.iter()) {
+            self.peak_level = self.peak_level.max(l.abs()).max(r.abs());
+        }
+    }
+
+    ///
+    /// Generate output_count samples in advance (returned by generate).
+    ///
+    /// Used while the ymfm render worker renders the blocks of other chips.
+    ///
+    pub fn generate_ahead(
+        &mut self,
+        sound_chip_index: usize,
+        data_block: &HashMap<usize, DataBlock>,
+        output_count: usize,
+    ) {
+        let mut generated = std::mem::take(&mut self.generated);
+        generated.clear();
+        self.generated_pos = 0;
+        for _ in 0..output_count {
+            generated.push(self.generate(sound_chip_index, data_block));
+        }
+        self.generated = generated;
+    }
+
+    ///
+    /// Request a block of the ticks needed for output_count samples to be rendered at once.
+    ///
+    pub fn render_ahead(
+        &mut self,
+        sound_chip_index: usize,
+        output_count: usize,
+    ) -> Option<RenderBlock> {
+        self.rendering_ahead = false;
+        // data streams write to the sound chip on every tick
+        if self
+            .data_stream
+            .values()
+            .any(|data_stream| !data_stream.is_stop_data_stream())
+        {
+            return None;
+        }
+        let tick_count = self.sound_stream.get_tick_count_hint(output_count);
+        if tick_count <= 1 {
+            return None;
+        }
+        let render_block = self.sound_chip.render_ahead(sound_chip_index, tick_count);
+        self.rendering_ahead = render_block.is_some();
+        render_block
+    }
+
+    ///
+    /// Whether the block requested by the last render_ahead is being rendered.
+    ///
+    pub fn is_rendering_ahead(&self) -> bool {
+        self.rendering_ahead
+    }
+
+    ///
+    /// Return the sampling rate of the sound chip.
+    ///
+    pub fn get_sound_chip_sampling_rate(&self) -> u32 {
+        self.sound_stream.get_sampling_rate()
+    }
+
+    ///
+    /// Replace the sound stream (e.g. with a cheaper resampling method).
+    ///
+    pub fn set_sound_stream(&mut self, sound_stream: Box<dyn SoundStream>) {
+        self.sound_stream = sound_stream;
+    }
+
+    ///
+    /// Lower (or restore) the internal sampling rate of the sound chip.
+    ///
+    /// Returns the new sampling rate if the sound chip supports it,
+    /// the sound stream must then be replaced for the new rate.
+    ///
+    pub fn set_low_rate(&mut self, low_rate: bool) -> Option<u32> {
+        let sampling_rate = self.sound_chip.set_low_rate(low_rate)?;
+        self.change_data_stream_sampling_rate(sampling_rate);
+        Some(sampling_rate)
+    }
+
+    ///
+    /// Let the sound chip resample its output to output_sampling_rate.
+    ///
+    /// Returns the new sampling rate if the sound chip supports it,
+    /// the sound stream must then be replaced for the new rate.
+    ///
+    pub fn set_output_rate(
+        &mut self,
+        output_sampling_rate: u32,
+        resample: Resample,
+    ) -> Option<u32> {
+        let sampling_rate = self
+            .sound_chip
+            .set_output_rate(output_sampling_rate, resample)?;
+        self.change_data_stream_sampling_rate(sampling_rate);
+        Some(sampling_rate)
+    }
+
+    fn change_data_stream_sampling_rate(&mut self, sampling_rate: u32) {
+        for data_stream in self.data_stream.values_mut() {
+            data_stream.change_sampling_rate(sampling_rate);
+        }
+    }
+
+    ///
+    /// Stop (or restart) rendering the sound chip.
+    ///
+    /// Register writes are still applied while muted.
+    /// Returns false if the sound chip can not be muted.
+    ///
+    pub fn set_mute(&mut self, mute: bool) -> bool {
+        if !self.sound_chip.set_mute(mute) {
+            return false;
+        }
+        self.muted = mute;
+        true
+    }
+
+    ///
+    /// Whether the sound chip has been muted by set_mute.
+    ///
+    pub fn is_muted(&self) -> bool {
+        self.muted
+    }
+
+    ///
+    /// Return the peak output level since the last call and clear it.
+    ///
+    pub fn take_peak_level(&mut self) -> MixSample {
+        std::mem::take(&mut self.peak_level)
     }
 
     ///
@@ -210,6 +389,51 @@ impl SoundDevice {
         true
     }
 
+    ///
+    /// Let the ticks of output_count samples pass without rendering (seek fast-forward).
+    ///
+    /// Register writes are applied, data streams advance without writing.
+    ///
+    pub fn skip(&mut self, output_count: usize, output_sampling_rate: u32) {
+        self.sound_chip.skip();
+        let tick_count = output_count as f64 * self.sound_stream.get_sampling_rate() as f64
+            / output_sampling_rate as f64;
+        for data_stream in self.data_stream.values_mut() {
+            data_stream.skip(tick_count);
+        }
+    }
+
+    ///
+    /// Save the state of the sound chip and the data streams.
+    ///
+    /// Returns None if the sound chip can not save its state.
+    ///
+    pub fn save_state(&mut self) -> Option<SoundDeviceState> {
+        Some(SoundDeviceState {
+            sound_chip: self.sound_chip.save_state()?,
+            data_stream: self.data_stream.clone(),
+        })
+    }
+
+    ///
+    /// Restore a state saved by save_state.
+    ///
+    pub fn restore_state(&mut self, state: &SoundDeviceState) -> bool {
+        if !self
+            .sound_chip
+            .restore_state(&*state.sound_chip, &mut *self.sound_stream)
+        {
+            return false;
+        }
+        self.data_stream.clone_from(&state.data_stream);
+        // the internal sampling rate may have been changed since
+        self.change_data_stream_sampling_rate(self.sound_stream.get_sampling_rate());
+        // samples generated ahead are of the old position
+        self.generated.clear();
+        self.generated_pos = 0;
+        true
+    }
+
     ///
     /// Write data stream
     ///
@@ -0,0 +1,124 @@
+// license:BSD-3-Clause
+// copyright-holders:Hiromasa Tanaka
+use super::stream::MixSample;
+
+// Mixing bus kernels (components/ymfm/ffi/ymfm_kernels.h)
+//
+// The reference, generic and ESP32-S3 PIE paths of the kernels give the
+// same bits; the path is selected when the ymfm component is built.
+#[link(name = "ymfm")]
+extern "C" {
+    #[cfg(feature = "integer_mix")]
+    fn ymfm_mix_accumulate_i32(dst: *mut i32, src: *const i32, count: u32);
+    #[cfg(not(feature = "integer_mix"))]
+    fn ymfm_mix_accumulate_f32(dst: *mut f32, src: *const f32, count: u32);
+    #[cfg(feature = "integer_mix")]
+    fn ymfm_gain_i32(buffer: *mut i32, count: u32, gain: f32);
+    #[cfg(not(feature = "integer_mix"))]
+    fn ymfm_gain_f32(buffer: *mut f32, count: u32, gain: f32);
+    #[cfg(feature = "integer_mix")]
+    fn ymfm_saturate_interleave_i32(
+        left: *const i32,
+        right: *const i32,
+        s16le: *mut i16,
+        frames: u32,
+    );
+    #[cfg(not(feature = "integer_mix"))]
+    fn ymfm_saturate_interleave_f32(
+        left: *const f32,
+        right: *const f32,
+        s16le: *mut i16,
+        frames: u32,
+    );
+}
+
+///
+/// Four bus samples (one 128-bit vector)
+///
+#[derive(Clone, Copy, Default)]
+#[repr(C, align(16))]
+struct Lanes([MixSample; 4]);
+
+///
+/// Block of mixing bus samples, 16-byte aligned for the vector kernels
+///
+#[derive(Default)]
+pub struct MixBlock {
+    lanes: Vec<Lanes>,
+    len: usize,
+}
+
+impl MixBlock {
+    ///
+    /// Resize to len samples of silence.
+    ///
+    pub fn reset(&mut self, len: usize) {
+        self.lanes.clear();
+        self.lanes.resize((len + 3) / 4, Lanes::default());
+        self.len = len;
+    }
+
+    pub fn as_slice(&self) -> &[MixSample] {
+        unsafe { std::slice::from_raw_parts(self.lanes.as_ptr() as *const MixSample, self.len) }
+    }
+
+    pub fn as_mut_slice(&mut self) -> &mut [MixSample] {
+        unsafe {
+            std::slice::from_raw_parts_mut(self.lanes.as_mut_ptr() as *mut MixSample, self.len)
+        }
+    }
+}
+
+///
+/// dst += src (saturated on the integer bus)
+///
+pub fn mix_accumulate(dst: &mut [MixSample], src: &[MixSample]) {
+    assert_eq!(dst.len(), src.len());
+    #[cfg(feature = "integer_mix")]
+    unsafe {
+        ymfm_mix_accumulate_i32(dst.as_mut_ptr(), src.as_ptr(), dst.len() as u32);
+    }
+    #[cfg(not(feature = "integer_mix"))]
+    unsafe {
+        ymfm_mix_accumulate_f32(dst.as_mut_ptr(), src.as_ptr(), dst.len() as u32);
+    }
+}
+
+///
+/// buffer *= gain (i32 is scaled in f32 and converted back, unless the gain is 1)
+///
+pub fn mix_gain(buffer: &mut [MixSample], gain: f32) {
+    #[cfg(feature = "integer_mix")]
+    unsafe {
+        ymfm_gain_i32(buffer.as_mut_ptr(), buffer.len() as u32, gain);
+    }
+    #[cfg(not(feature = "integer_mix"))]
+    unsafe {
+        ymfm_gain_f32(buffer.as_mut_ptr(), buffer.len() as u32, gain);
+    }
+}
+
+///
+/// Saturate the bus to interleaved s16le (f32 as convert_sample_f2i, i32 as convert_sample_i2s)
+///
+pub fn saturate_interleave(left: &[MixSample], right: &[MixSample], s16le: &mut [i16]) {
+    assert!(left.len() == right.len() && s16le.len() >= left.len() * 2);
+    #[cfg(feature = "integer_mix")]
+    unsafe {
+        ymfm_saturate_interleave_i32(
+            left.as_ptr(),
+            right.as_ptr(),
+            s16le.as_mut_ptr(),
+            left.len() as u32,
+        );
+    }
+    #[cfg(not(feature = "integer_mix"))]
+    unsafe {
+        ymfm_saturate_interleave_f32(
+            left.as_ptr(),
+            right.as_ptr(),
+            s16le.as_mut_ptr(),
+            left.len() as u32,
+        );
+    }
+}
@@ -0,0 +1,67 @@
+// license:BSD-3-Clause
+// copyright-holders:Hiromasa Tanaka
+
+///
+/// Render stages measured per chunk
+///
+/// The order is shared with cs_profile_stage_t in main/cs_profile.h.
+///
+#[derive(Clone, Copy)]
+pub enum Stage {
+    Parse = 0,
+    Generate = 1,
+    Mix = 2,
+    Convert = 3,
+}
+
+pub const STAGES: usize = 4;
+
+#[cfg(feature = "profile")]
+extern "C" {
+    fn get_cycles_cs_profile() -> u32;
+}
+
+///
+/// Cycle counter of the running core (0 without the profile feature)
+///
+#[inline(always)]
+pub fn cycles() -> u32 {
+    #[cfg(feature = "profile")]
+    unsafe {
+        get_cycles_cs_profile()
+    }
+    #[cfg(not(feature = "profile"))]
+    0
+}
+
+///
+/// Cycles spent in each stage since the last take
+///
+#[derive(Default)]
+pub struct StageCycles {
+    cycles: [u32; STAGES],
+}
+
+impl StageCycles {
+    ///
+    /// Add cycles from start (returned by cycles()) to now.
+    ///
+    #[inline(always)]
+    pub fn add(&mut self, stage: Stage, start: u32) {
+        #[cfg(feature = "profile")]
+        {
+            let index = stage as usize;
+            self.cycles[index] = self.cycles[index].wrapping_add(cycles().wrapping_sub(start));
+        }
+        #[cfg(not(feature = "profile"))]
+        let _ = (stage, start);
+    }
+
+    ///
+    /// Copy cycles of all stages and clear them.
+    ///
+    pub fn take(&mut self, cycles: &mut [u32]) {
+        cycles[..STAGES].copy_from_slice(&self.cycles);
+        self.cycles = [0; STAGES];
+    }
+}
@@ -9,17 +9,100 @@ use super::chip_okim6295::OKIM6295;
 use super::chip_pwm::PWM;
 use super::chip_segapcm::SEGAPCM;
 use super::chip_sn76496::SN76496;
-use super::chip_ymfm::YmFm;
+use super::chip_ymfm::{generate_blocks_begin, generate_blocks_end, YmFm};
 use super::data_stream::{DataBlock, DataStream};
-use super::device::{DataStreamMode, SoundDevice};
+use super::device::{DataStreamMode, SoundDevice, SoundDeviceState};
+use super::kernel::{mix_accumulate, saturate_interleave, MixBlock};
+use super::profile::{cycles, Stage, StageCycles};
 use super::rom::{RomBusType, RomIndex};
-use super::sound_chip::SoundChip;
+use super::sound_chip::{RenderBlock, Resample, SoundChip};
 use super::stream::{
-    convert_sample_f2i, LinearUpSamplingStream, NativeStream, NearestDownSampleStream,
+    convert_sample_m2f, LinearUpSamplingStream, MixSample, NativeStream, NearestDownSampleStream,
     OverSampleStream, Resolution, SampleHoldUpSamplingStream, SoundStream,
 };
 use super::SoundChipType;
 
+///
+/// Render quality levels (set_quality)
+///
+/// Each level also applies the cheaper ones below it.
+///
+///  QUALITY_FULL: resampling selected per sound chip
+///  QUALITY_NEAREST: nearest resampling instead of interpolation or oversampling
+///  QUALITY_LOW_RATE: lower internal sampling rate of the chips that support it
+///  QUALITY_MUTE: stop rendering the least audible chip
+///
+pub const QUALITY_FULL: u32 = 0;
+pub const QUALITY_NEAREST: u32 = 1;
+pub const QUALITY_LOW_RATE: u32 = 2;
+pub const QUALITY_MUTE: u32 = 3;
+
+///
+/// Select the resampling method of a sound chip that resamples its own output.
+///
+/// Interpolated (linear, or windowed sinc with the sinc_resample feature)
+/// at full quality.
+///
+fn select_resample(quality: u32) -> Resample {
+    if quality >= QUALITY_NEAREST {
+        Resample::Nearest
+    } else if cfg!(feature = "sinc_resample") {
+        Resample::Sinc
+    } else {
+        Resample::Linear
+    }
+}
+
+///
+/// Select the resampling method of a sound chip for the quality level.
+///
+fn select_sound_stream(
+    sound_chip_type: SoundChipType,
+    sound_chip_sampling_rate: u32,
+    output_sampling_rate: u32,
+    quality: u32,
+) -> Box<dyn SoundStream> {
+    let nearest = quality >= QUALITY_NEAREST;
+    match sound_chip_sampling_rate.cmp(&output_sampling_rate) {
+        Ordering::Equal => Box::new(NativeStream::new(sound_chip_sampling_rate)),
+        Ordering::Greater => match sound_chip_type {
+            SoundChipType::SEGAPSG | SoundChipType::SN76489 | SoundChipType::PWM if !nearest => {
+                Box::new(OverSampleStream::new(
+                    sound_chip_sampling_rate,
+                    output_sampling_rate,
+                ))
+            }
+            _ => Box::new(NearestDownSampleStream::new(
+                sound_chip_sampling_rate,
+                output_sampling_rate,
+            )),
+        },
+        _ => match sound_chip_type {
+            SoundChipType::OKIM6258 => Box::new(SampleHoldUpSamplingStream::new(
+                sound_chip_sampling_rate,
+                output_sampling_rate,
+            )),
+            _ if nearest => Box::new(SampleHoldUpSamplingStream::new(
+                sound_chip_sampling_rate,
+                output_sampling_rate,
+            )),
+            _ => Box::new(LinearUpSamplingStream::new(
+                sound_chip_sampling_rate,
+                output_sampling_rate,
+                Resolution::RangeAll,
+            )),
+        },
+    }
+}
+
+///
+/// Saved state of a sound slot (seek keyframe)
+///
+pub struct SoundSlotState {
+    output_sampling_pos: f64,
+    sound_device: Vec<SoundDeviceState>,
+}
+
 ///
 /// Sound Slot
 ///
@@ -28,13 +111,21 @@ pub struct SoundSlot {
     output_sampling_pos: f64,
     output_sampling_step: f64,
     output_sample_chunk_size: usize,
+    output_sample_stream_size: usize,
     output_sampling_l: Vec<f32>,
     output_sampling_r: Vec<f32>,
     output_sampling_s16le: Vec<i16>,
-    output_sampling_buffer_l: VecDeque<f32>,
-    output_sampling_buffer_r: VecDeque<f32>,
-    sound_device: HashMap<SoundChipType, Vec<SoundDevice>>,
+    output_sampling_buffer_l: VecDeque<MixSample>,
+    output_sampling_buffer_r: VecDeque<MixSample>,
+    sound_device: Vec<(SoundChipType, usize, SoundDevice)>,
     data_block: HashMap<usize, DataBlock>,
+    render_blocks: Vec<RenderBlock>,
+    mix_l: MixBlock,
+    mix_r: MixBlock,
+    device_l: MixBlock,
+    device_r: MixBlock,
+    stage_cycles: StageCycles,
+    quality: u32,
 }
 
 impl SoundSlot {
@@ -43,31 +134,44 @@ impl SoundSlot {
         output_sampling_rate: u32,
         output_sample_chunk_size: usize,
     ) -> Self {
-        assert!(output_sampling_rate >= external_tick_rate);
+        // an output rate under the tick rate (e.g. 22050Hz) outputs on some ticks only
+        assert!(output_sampling_rate > 0 && external_tick_rate > 0);
         SoundSlot {
             output_sampling_rate,
             output_sampling_pos: 0_f64,
             output_sampling_step: external_tick_rate as f64 / output_sampling_rate as f64,
             output_sample_chunk_size,
+            output_sample_stream_size: 0,
             output_sampling_l: vec![0_f32; output_sample_chunk_size],
             output_sampling_r: vec![0_f32; output_sample_chunk_size],
             output_sampling_s16le: vec![0; output_sample_chunk_size * 2],
             output_sampling_buffer_l: VecDeque::with_capacity(output_sample_chunk_size * 2),
             output_sampling_buffer_r: VecDeque::with_capacity(output_sample_chunk_size * 2),
-            sound_device: HashMap::new(),
+            sound_device: Vec::new(),
             data_block: HashMap::new(),
+            render_blocks: Vec::new(),
+            mix_l: MixBlock::default(),
+            mix_r: MixBlock::default(),
+            device_l: MixBlock::default(),
+            device_r: MixBlock::default(),
+            stage_cycles: StageCycles::default(),
+            quality: QUALITY_FULL,
         }
     }
 
     ///
     /// Add sound device (sound chip and sound stream, Rom set)
     ///
+    /// Returns false if a sound chip could not be initialized (sampling rate 0),
+    /// which is not added.
+    ///
     pub fn add_sound_device(
         &mut self,
         sound_chip_type: SoundChipType,
         number_of: usize,
         clock: u32,
-    ) {
+    ) -> bool {
+        let mut added = true;
         for _ in 0..number_of {
             // create sound device
             let (mut sound_chip, rom_index): (Box<dyn SoundChip>, Option<Vec<RomIndex>>) =
@@ -126,43 +230,37 @@ impl SoundSlot {
                 };
 
             // initialize sound chip
-            let sound_chip_sampling_rate = sound_chip.init(clock);
+            let mut sound_chip_sampling_rate = sound_chip.init(clock);
+            if sound_chip_sampling_rate == 0 {
+                added = false;
+                continue;
+            }
+            // chips that resample their own output in blocks tick at the output rate
+            if let Some(sampling_rate) =
+                sound_chip.set_output_rate(self.output_sampling_rate, select_resample(self.quality))
+            {
+                sound_chip_sampling_rate = sampling_rate;
+            }
             // select resampling method
-            let sound_stream: Box<dyn SoundStream> =
-                match sound_chip_sampling_rate.cmp(&self.output_sampling_rate) {
-                    Ordering::Equal => Box::new(NativeStream::new()),
-                    Ordering::Greater => match sound_chip_type {
-                        SoundChipType::SEGAPSG | SoundChipType::SN76489 | SoundChipType::PWM => {
-                            Box::new(OverSampleStream::new(
-                                sound_chip_sampling_rate,
-                                self.output_sampling_rate,
-                            ))
-                        }
-                        _ => Box::new(NearestDownSampleStream::new(
-                            sound_chip_sampling_rate,
-                            self.output_sampling_rate,
-                        )),
-                    },
-                    _ => match sound_chip_type {
-                        SoundChipType::OKIM6258 => {
-                            Box::new(SampleHoldUpSamplingStream::new(
-                                sound_chip_sampling_rate,
-                                self.output_sampling_rate,
-                            ))
-                        }
-                        _ => Box::new(LinearUpSamplingStream::new(
-                            sound_chip_sampling_rate,
-                            self.output_sampling_rate,
-                            Resolution::RangeAll,
-                        )),
-                    },
-                };
-            // add sound device
-            self.sound_device
-                .entry(sound_chip_type)
-                .or_insert_with(Vec::new)
-                .push(SoundDevice::new(sound_chip, sound_stream, rom_index));
+            let sound_stream = select_sound_stream(
+                sound_chip_type,
+                sound_chip_sampling_rate,
+                self.output_sampling_rate,
+                self.quality,
+            );
+            // add sound device (the handle is the position in the slot)
+            let sound_chip_index = self
+                .sound_device
+                .iter()
+                .filter(|(device_type, _, _)| *device_type == sound_chip_type)
+                .count();
+            self.sound_device.push((
+                sound_chip_type,
+                sound_chip_index,
+                SoundDevice::new(sound_chip, sound_stream, rom_index),
+            ));
         }
+        added
     }
 
     ///
@@ -181,28 +279,145 @@ impl SoundSlot {
         }
     }
 
+    ///
+    /// Return the handle of a sound device for write_device.
+    ///
+    /// Handles are given in the order the devices are added, so the same
+    /// header gives the same handles.
+    ///
+    pub fn get_device_handle(
+        &self,
+        sound_chip_type: SoundChipType,
+        sound_chip_index: usize,
+    ) -> Option<usize> {
+        self.sound_device
+            .iter()
+            .position(|&(device_type, device_index, _)| {
+                device_type == sound_chip_type && device_index == sound_chip_index
+            })
+    }
+
+    ///
+    /// Return the sound chip type and index of each device handle.
+    ///
+    pub fn get_device_keys(&self) -> Vec<(SoundChipType, usize)> {
+        self.sound_device
+            .iter()
+            .map(|&(sound_chip_type, sound_chip_index, _)| (sound_chip_type, sound_chip_index))
+            .collect()
+    }
+
+    ///
+    /// Write command to the sound device of a handle (get_device_handle).
+    ///
+    #[inline]
+    pub fn write_device(&mut self, handle: usize, port: u32, data: u32) {
+        let (_, sound_chip_index, sound_device) = &mut self.sound_device[handle];
+        sound_device.write(*sound_chip_index, port, data);
+    }
+
     ///
     /// Update sound chip.
     ///
     pub fn update(&mut self, tick_count: usize) {
+        // no writes arrive during the update, so the chips can render the span at once
+        let start = cycles();
+        let output_count = self.get_output_count(tick_count);
+        for (_, index, sound_device) in self.sound_device.iter_mut() {
+            if let Some(render_block) = sound_device.render_ahead(*index, output_count) {
+                self.render_blocks.push(render_block);
+            }
+        }
+        // while the ymfm render worker renders the blocks on the other core,
+        // generate the other devices in advance (mixed in the same order below)
+        if generate_blocks_begin(&self.render_blocks) {
+            for (_, index, sound_device) in self.sound_device.iter_mut() {
+                if !sound_device.is_rendering_ahead() {
+                    sound_device.generate_ahead(*index, &self.data_block, output_count);
+                }
+            }
+        }
+        generate_blocks_end();
+        self.render_blocks.clear();
+        self.stage_cycles.add(Stage::Generate, start);
+        let start = cycles();
+        // mix all devices a block at a time (in the same order as per sample)
+        self.mix_l.reset(output_count);
+        self.mix_r.reset(output_count);
+        self.device_l.reset(output_count);
+        self.device_r.reset(output_count);
+        for (_, index, sound_device) in self.sound_device.iter_mut() {
+            sound_device.generate_block(
+                *index,
+                &self.data_block,
+                self.device_l.as_mut_slice(),
+                self.device_r.as_mut_slice(),
+            );
+            mix_accumulate(self.mix_l.as_mut_slice(), self.device_l.as_slice());
+            mix_accumulate(self.mix_r.as_mut_slice(), self.device_r.as_slice());
+        }
+        self.output_sampling_buffer_l.extend(self.mix_l.as_slice());
+        self.output_sampling_buffer_r.extend(self.mix_r.as_slice());
+        self.advance_output_sampling_pos(tick_count);
+        self.stage_cycles.add(Stage::Mix, start);
+    }
+
+    ///
+    /// Let tick_count ticks pass without rendering (seek fast-forward).
+    ///
+    /// Register writes are applied, no samples are output.
+    ///
+    pub fn skip(&mut self, tick_count: usize) {
+        let output_count = self.get_output_count(tick_count);
+        for (_, _, sound_device) in self.sound_device.iter_mut() {
+            sound_device.skip(output_count, self.output_sampling_rate);
+        }
+        self.advance_output_sampling_pos(tick_count);
+    }
+
+    fn advance_output_sampling_pos(&mut self, tick_count: usize) {
         for _ in 0..tick_count {
             while self.output_sampling_pos < 1_f64 {
-                self.output_sampling_buffer_l.push_back(0_f32);
-                self.output_sampling_buffer_r.push_back(0_f32);
-                let buffer_pos = self.output_sampling_buffer_l.len() - 1;
-                for (_, sound_devices) in self.sound_device.iter_mut() {
-                    for (index, sound_device) in sound_devices.iter_mut().enumerate() {
-                        let (l, r) = sound_device.generate(index, &self.data_block);
-                        self.output_sampling_buffer_l[buffer_pos] += l;
-                        self.output_sampling_buffer_r[buffer_pos] += r;
-                    }
-                }
                 self.output_sampling_pos += self.output_sampling_step;
             }
             self.output_sampling_pos -= 1_f64;
         }
     }
 
+    ///
+    /// Number of ticks (up to max_tick_count) that can be updated until the stream is filled.
+    ///
+    pub fn get_tickable_count(&self, max_tick_count: usize) -> usize {
+        let mut output_count = self.output_sampling_buffer_l.len();
+        let mut output_sampling_pos = self.output_sampling_pos;
+        let mut tick_count = 0;
+        while tick_count < max_tick_count && output_count < self.output_sample_chunk_size {
+            while output_sampling_pos < 1_f64 {
+                output_count += 1;
+                output_sampling_pos += self.output_sampling_step;
+            }
+            output_sampling_pos -= 1_f64;
+            tick_count += 1;
+        }
+        tick_count
+    }
+
+    ///
+    /// Number of output samples produced by updating tick_count ticks.
+    ///
+    fn get_output_count(&self, tick_count: usize) -> usize {
+        let mut output_count = 0;
+        let mut output_sampling_pos = self.output_sampling_pos;
+        for _ in 0..tick_count {
+            while output_sampling_pos < 1_f64 {
+                output_count += 1;
+                output_sampling_pos += self.output_sampling_step;
+            }
+            output_sampling_pos -= 1_f64;
+        }
+        output_count
+    }
+
     ///
     /// Remaining tickable in sampling buffers.
     ///
@@ -214,6 +429,7 @@ impl SoundSlot {
     /// Stream sampling chunk
     ///
     pub fn stream(&mut self) {
+        let start = cycles();
         let mut chunk_size = self.output_sample_chunk_size;
         // Last chunk
         if self.output_sample_chunk_size > self.output_sampling_buffer_l.len() {
@@ -222,22 +438,87 @@ impl SoundSlot {
                 self.output_sampling_l[i] = 0_f32;
                 self.output_sampling_r[i] = 0_f32;
             }
+            #[cfg(feature = "integer_mix")]
+            self.output_sampling_s16le.fill(0);
         }
 
+        // saturated only here on the integer bus
+        #[cfg(feature = "integer_mix")]
+        saturate_interleave(
+            &self.output_sampling_buffer_l.make_contiguous()[..chunk_size],
+            &self.output_sampling_buffer_r.make_contiguous()[..chunk_size],
+            &mut self.output_sampling_s16le,
+        );
         for (i, val) in self
             .output_sampling_buffer_l
             .drain(0..chunk_size)
             .enumerate()
         {
-            self.output_sampling_l[i] = val;
+            self.output_sampling_l[i] = convert_sample_m2f(val);
         }
         for (i, val) in self
             .output_sampling_buffer_r
             .drain(0..chunk_size)
             .enumerate()
         {
-            self.output_sampling_r[i] = val;
+            self.output_sampling_r[i] = convert_sample_m2f(val);
         }
+        self.output_sample_stream_size = chunk_size;
+        self.stage_cycles.add(Stage::Convert, start);
+    }
+
+    ///
+    /// Drop the samples not streamed yet.
+    ///
+    pub fn discard_stream(&mut self) {
+        self.output_sampling_buffer_l.clear();
+        self.output_sampling_buffer_r.clear();
+    }
+
+    ///
+    /// Save the state of all sound devices.
+    ///
+    /// Returns None if a sound chip can not save its state.
+    ///
+    pub fn save_state(&mut self) -> Option<SoundSlotState> {
+        let mut sound_device = Vec::with_capacity(self.sound_device.len());
+        for (_, _, device) in self.sound_device.iter_mut() {
+            sound_device.push(device.save_state()?);
+        }
+        Some(SoundSlotState {
+            output_sampling_pos: self.output_sampling_pos,
+            sound_device,
+        })
+    }
+
+    ///
+    /// Restore a state saved by save_state of this sound slot.
+    ///
+    /// The samples not streamed yet are dropped.
+    ///
+    pub fn restore_state(&mut self, state: &SoundSlotState) -> bool {
+        if state.sound_device.len() != self.sound_device.len() {
+            return false;
+        }
+        for ((_, _, device), device_state) in
+            self.sound_device.iter_mut().zip(state.sound_device.iter())
+        {
+            if !device.restore_state(device_state) {
+                return false;
+            }
+        }
+        self.output_sampling_pos = state.output_sampling_pos;
+        self.discard_stream();
+        true
+    }
+
+    ///
+    /// Return the number of valid samples in the last streamed chunk.
+    ///
+    /// It is less than the chunk size only for the last chunk of the data.
+    ///
+    pub fn get_output_sample_stream_size(&self) -> usize {
+        self.output_sample_stream_size
     }
 
     ///
@@ -258,25 +539,110 @@ impl SoundSlot {
     /// Convert and return s16le sampling buffer
     ///
     pub fn get_output_sampling_s16le_ref(&mut self) -> *const i16 {
-        for i in 0..self.output_sample_chunk_size {
-            self.output_sampling_s16le[i * 2] = convert_sample_f2i(self.output_sampling_l[i]);
-            self.output_sampling_s16le[i * 2 + 1] = convert_sample_f2i(self.output_sampling_r[i]);
-        }
+        // converted by stream on the integer bus
+        #[cfg(not(feature = "integer_mix"))]
+        saturate_interleave(
+            &self.output_sampling_l,
+            &self.output_sampling_r,
+            &mut self.output_sampling_s16le,
+        );
         self.output_sampling_s16le.as_ptr()
     }
 
     ///
-    /// Convert and return s16le sampling buffer (for FFI)
+    /// Convert s16le sampling into caller buffer (for FFI)
+    ///
+    /// s16le must hold output_sample_chunk_size * 2 samples and be 16-bit aligned.
     ///
     pub fn get_output_sampling_s16le(&mut self, s16le: *mut i16) {
-        for i in 0..self.output_sample_chunk_size {
-            unsafe {
-                let left = s16le.offset(i as isize * 2);
-                let right = s16le.offset(i as isize * 2 + 1);
-                *left = convert_sample_f2i(self.output_sampling_l[i]);
-                *right= convert_sample_f2i(self.output_sampling_r[i]);
+        let start = cycles();
+        let s16le =
+            unsafe { std::slice::from_raw_parts_mut(s16le, self.output_sample_chunk_size * 2) };
+        // converted by stream on the integer bus
+        #[cfg(feature = "integer_mix")]
+        s16le.copy_from_slice(&self.output_sampling_s16le);
+        #[cfg(not(feature = "integer_mix"))]
+        saturate_interleave(&self.output_sampling_l, &self.output_sampling_r, s16le);
+        self.stage_cycles.add(Stage::Convert, start);
+    }
+
+    ///
+    /// Add cycles spent in a stage outside of the sound slot (e.g. parse).
+    ///
+    pub fn add_stage_cycles(&mut self, stage: Stage, start: u32) {
+        self.stage_cycles.add(stage, start);
+    }
+
+    ///
+    /// Copy cycles per stage since the last call and clear them.
+    ///
+    /// cycles must hold STAGES values (order of sound::Stage).
+    ///
+    pub fn take_stage_cycles(&mut self, cycles: &mut [u32]) {
+        self.stage_cycles.take(cycles);
+    }
+
+    ///
+    /// Set render quality level (QUALITY_FULL..QUALITY_MUTE).
+    ///
+    /// Lowered by the player when rendering falls behind realtime.
+    /// QUALITY_MUTE mutes the device with the lowest peak level since the
+    /// last change, only when there is another device to be heard.
+    ///
+    pub fn set_quality(&mut self, quality: u32) {
+        let quality = quality.min(QUALITY_MUTE);
+        if quality == self.quality {
+            return;
+        }
+        let nearest_changed = (quality >= QUALITY_NEAREST) != (self.quality >= QUALITY_NEAREST);
+        let low_rate_changed = (quality >= QUALITY_LOW_RATE) != (self.quality >= QUALITY_LOW_RATE);
+        let mut peak_levels: Vec<(MixSample, usize)> = Vec::new();
+        for (handle, (sound_chip_type, _, sound_device)) in self.sound_device.iter_mut().enumerate()
+        {
+            let mut sampling_rate = None;
+            if low_rate_changed {
+                sampling_rate = sound_device.set_low_rate(quality >= QUALITY_LOW_RATE);
+            }
+            if nearest_changed {
+                let resample = select_resample(quality);
+                if let Some(rate) =
+                    sound_device.set_output_rate(self.output_sampling_rate, resample)
+                {
+                    sampling_rate = Some(rate);
+                }
+            }
+            if nearest_changed || sampling_rate.is_some() {
+                let sampling_rate =
+                    sampling_rate.unwrap_or_else(|| sound_device.get_sound_chip_sampling_rate());
+                sound_device.set_sound_stream(select_sound_stream(
+                    *sound_chip_type,
+                    sampling_rate,
+                    self.output_sampling_rate,
+                    quality,
+                ));
+            }
+            if quality < QUALITY_MUTE && sound_device.is_muted() {
+                sound_device.set_mute(false);
+            }
+            peak_levels.push((sound_device.take_peak_level(), handle));
+        }
+        if quality >= QUALITY_MUTE && self.quality < QUALITY_MUTE && peak_levels.len() > 1 {
+            // the quietest device that can be muted
+            peak_levels.sort_by(|a, b| a.0.partial_cmp(&b.0).unwrap_or(Ordering::Equal));
+            for &(_, handle) in peak_levels.iter() {
+                if self.sound_device[handle].2.set_mute(true) {
+                    break;
+                }
             }
         }
+        self.quality = quality;
+    }
+
+    ///
+    /// Return render quality level.
+    ///
+    pub fn get_quality(&self) -> u32 {
+        self.quality
     }
 
     ///
@@ -492,18 +858,11 @@ impl SoundSlot {
         sound_chip_type: SoundChipType,
         sound_chip_index: usize,
     ) -> Option<&mut SoundDevice> {
-        let sound_device = match self.sound_device.get_mut(&sound_chip_type) {
-            None => None,
-            Some(vec) => {
-                if vec.len() < sound_chip_index {
-                    return None;
-                }
-                Some(vec)
-            }
-        };
-        match sound_device {
-            None => None,
-            Some(sound_chip) => Some(&mut sound_chip[sound_chip_index]),
-        }
+        self.sound_device
+            .iter_mut()
+            .find(|(device_type, device_index, _)| {
+                *device_type == sound_chip_type && *device_index == sound_chip_index
+            })
+            .map(|(_, _, sound_device)| sound_device)
     }
 }
@@ -4,6 +4,7 @@ use super::RomBusType;
 use super::rom::RomBank;
 use super::rom::RomIndex;
 use super::stream::SoundStream;
+use std::any::Any;
 
 ///
 /// Sound chip type
@@ -33,6 +34,31 @@ pub enum SoundChipType {
     OKIM6295,
 }
 
+///
+/// Block of ticks rendered ahead of the tick loop
+///
+/// Same layout as ymfm_block in ymfmffi.cpp, so that the blocks of all chips
+/// are rendered by one ymfm_generate_blocks call (split across both cores).
+///
+#[repr(C)]
+pub struct RenderBlock {
+    pub handle: u32,
+    pub frames: u32,
+    pub buffer: *mut i32,
+}
+
+///
+/// Resampling method of a sound chip that resamples its own output
+///
+/// Same values as vgm_resample_quality in ymfm_resampler.h.
+///
+#[derive(PartialEq, Eq, Clone, Copy, Debug)]
+pub enum Resample {
+    Nearest = 0,
+    Linear = 1,
+    Sinc = 2,
+}
+
 ///
 /// Sound Chip Interface
 ///
@@ -47,4 +73,53 @@ pub trait SoundChip {
     fn set_rom_bank(&mut self, rom_index: RomIndex, rom_bank: RomBank);
     fn notify_add_rom(&mut self, rom_index: RomIndex, index_no: usize);
     fn set_rom_bus(&mut self, rom_bus_type: Option<RomBusType>);
+    fn render_ahead(&mut self, _index: usize, _tick_count: usize) -> Option<RenderBlock> {
+        /* render on each tick by default */
+        None
+    }
+    fn set_low_rate(&mut self, _low_rate: bool) -> Option<u32> {
+        /* the internal sampling rate is fixed by default */
+        None
+    }
+    fn set_mute(&mut self, _mute: bool) -> bool {
+        /* chips that are not rendered in blocks keep ticking */
+        false
+    }
+    fn set_output_rate(&mut self, _output_rate: u32, _resample: Resample) -> Option<u32> {
+        /* resampled by the sound stream by default */
+        None
+    }
+    fn skip(&mut self) {
+        /* writes are applied at once by default */
+    }
+    fn save_state(&mut self) -> Option<Box<dyn Any>> {
+        /* no seek keyframes by default */
+        None
+    }
+    fn restore_state(&mut self, _state: &dyn Any, _sound_stream: &mut dyn SoundStream) -> bool {
+        false
+    }
+}
+
+///
+/// Save the state of a sound chip made of plain data (seek keyframe).
+///
+/// ROM banks are shared by the clone, their contents are written by the
+/// vgm data blocks and do not change while playing.
+///
+pub fn save_clone<T: Clone + 'static>(sound_chip: &T) -> Option<Box<dyn Any>> {
+    Some(Box::new(sound_chip.clone()))
+}
+
+///
+/// Restore a state saved by save_clone.
+///
+pub fn restore_clone<T: Clone + 'static>(sound_chip: &mut T, state: &dyn Any) -> bool {
+    match state.downcast_ref::<T>() {
+        Some(state) => {
+            sound_chip.clone_from(state);
+            true
+        }
+        None => false,
+    }
 }
@@ -7,6 +7,17 @@ pub enum OutputChannel {
     Mute,
 }
 
+///
+/// Sample type of the mixing bus
+///
+/// With the integer_mix feature, chips that render integers are mixed
+/// as i32 in s16le scale and saturated only at the s16le output.
+///
+#[cfg(not(feature = "integer_mix"))]
+pub type MixSample = f32;
+#[cfg(feature = "integer_mix")]
+pub type MixSample = i32;
+
 ///
 /// Sound stream interface
 ///
@@ -17,21 +28,52 @@ pub trait SoundStream {
     fn change_sampling_rate(&mut self, sampling_rate: u32);
     fn get_sampling_rate(&self) -> u32;
     fn set_output_channel(&mut self, output_channel: OutputChannel);
+    fn get_tick_count_hint(&self, output_count: usize) -> usize;
+
+    ///
+    /// Push an integer sample (s16le scale) rendered by the sound chip.
+    ///
+    fn push_i32(&mut self, sampling_l: i32, sampling_r: i32) {
+        self.push(convert_sample_i2f(sampling_l), convert_sample_i2f(sampling_r));
+    }
+
+    ///
+    /// Drain a sample for the mixing bus.
+    ///
+    fn drain_mix(&mut self) -> (MixSample, MixSample) {
+        let (sampling_l, sampling_r) = self.drain();
+        (convert_sample_f2m(sampling_l), convert_sample_f2m(sampling_r))
+    }
+}
+
+///
+/// Lower bound of the sound chip ticks needed for output_count samples.
+///
+/// Rounded down with a margin of one tick, so the chip never renders
+/// past a register write that arrives after output_count samples.
+///
+fn tick_count_lower_bound(ticks: f64) -> usize {
+    if ticks < 2_f64 {
+        return 0;
+    }
+    ticks as usize - 1
 }
 
 ///
 /// Through native chip stream
 ///
 pub struct NativeStream {
-    now_input_sampling_l: f32,
-    now_input_sampling_r: f32,
+    sampling_rate: u32,
+    now_input_sampling_l: MixSample,
+    now_input_sampling_r: MixSample,
 }
 
 impl NativeStream {
-    pub fn new() -> Self {
+    pub fn new(sampling_rate: u32) -> Self {
         NativeStream {
-            now_input_sampling_l: 0_f32,
-            now_input_sampling_r: 0_f32,
+            sampling_rate,
+            now_input_sampling_l: MixSample::default(),
+            now_input_sampling_r: MixSample::default(),
         }
     }
 }
@@ -42,12 +84,15 @@ impl SoundStream for NativeStream {
     }
 
     fn push(&mut self, sampling_l: f32, sampling_r: f32) {
-        self.now_input_sampling_l = sampling_l;
-        self.now_input_sampling_r = sampling_r;
+        self.now_input_sampling_l = convert_sample_f2m(sampling_l);
+        self.now_input_sampling_r = convert_sample_f2m(sampling_r);
     }
 
     fn drain(&mut self) -> (f32, f32) {
-        (self.now_input_sampling_l, self.now_input_sampling_r)
+        (
+            convert_sample_m2f(self.now_input_sampling_l),
+            convert_sample_m2f(self.now_input_sampling_r),
+        )
     }
 
     fn change_sampling_rate(&mut self, _sampling_rate: u32) {
@@ -55,12 +100,25 @@ impl SoundStream for NativeStream {
     }
 
     fn get_sampling_rate(&self) -> u32 {
-        todo!()
+        self.sampling_rate
     }
 
     fn set_output_channel(&mut self, _output_channel: OutputChannel) {
         todo!()
     }
+
+    fn get_tick_count_hint(&self, output_count: usize) -> usize {
+        output_count
+    }
+
+    fn push_i32(&mut self, sampling_l: i32, sampling_r: i32) {
+        self.now_input_sampling_l = convert_sample_i2m(sampling_l);
+        self.now_input_sampling_r = convert_sample_i2m(sampling_r);
+    }
+
+    fn drain_mix(&mut self) -> (MixSample, MixSample) {
+        (self.now_input_sampling_l, self.now_input_sampling_r)
+    }
 }
 
 ///
@@ -68,14 +126,14 @@ impl SoundStream for NativeStream {
 ///
 pub struct NearestDownSampleStream {
     input_sampling_rate: u32,
-    now_input_sampling_l: f32,
-    now_input_sampling_r: f32,
-    prev_input_sampling_l: f32,
-    prev_input_sampling_r: f32,
+    now_input_sampling_l: MixSample,
+    now_input_sampling_r: MixSample,
+    prev_input_sampling_l: MixSample,
+    prev_input_sampling_r: MixSample,
     output_sampling_pos: f64,
     output_sampling_step: f64,
-    output_sampling_l: f32,
-    output_sampling_r: f32,
+    output_sampling_l: MixSample,
+    output_sampling_r: MixSample,
 }
 
 impl NearestDownSampleStream {
@@ -83,14 +141,14 @@ impl NearestDownSampleStream {
         assert!(input_sampling_rate >= output_sampling_rate);
         NearestDownSampleStream {
             input_sampling_rate,
-            now_input_sampling_l: 0_f32,
-            now_input_sampling_r: 0_f32,
-            prev_input_sampling_l: 0_f32,
-            prev_input_sampling_r: 0_f32,
+            now_input_sampling_l: MixSample::default(),
+            now_input_sampling_r: MixSample::default(),
+            prev_input_sampling_l: MixSample::default(),
+            prev_input_sampling_r: MixSample::default(),
             output_sampling_pos: 0_f64,
             output_sampling_step: output_sampling_rate as f64 / input_sampling_rate as f64,
-            output_sampling_l: 0_f32,
-            output_sampling_r: 0_f32,
+            output_sampling_l: MixSample::default(),
+            output_sampling_r: MixSample::default(),
         }
     }
 }
@@ -113,15 +171,14 @@ impl SoundStream for NearestDownSampleStream {
     }
 
     fn push(&mut self, sampling_l: f32, sampling_r: f32) {
-        self.output_sampling_pos += self.output_sampling_step;
-        self.prev_input_sampling_l = self.now_input_sampling_l;
-        self.prev_input_sampling_r = self.now_input_sampling_r;
-        self.now_input_sampling_l = sampling_l;
-        self.now_input_sampling_r = sampling_r;
+        self.push_mix(convert_sample_f2m(sampling_l), convert_sample_f2m(sampling_r));
     }
 
     fn drain(&mut self) -> (f32, f32) {
-        (self.output_sampling_l, self.output_sampling_r)
+        (
+            convert_sample_m2f(self.output_sampling_l),
+            convert_sample_m2f(self.output_sampling_r),
+        )
     }
 
     fn change_sampling_rate(&mut self, _sampling_rate: u32) {
@@ -135,6 +192,30 @@ impl SoundStream for NearestDownSampleStream {
     fn set_output_channel(&mut self, _output_channel: OutputChannel) {
         todo!()
     }
+
+    fn get_tick_count_hint(&self, output_count: usize) -> usize {
+        tick_count_lower_bound(
+            (output_count as f64 - self.output_sampling_pos) / self.output_sampling_step,
+        )
+    }
+
+    fn push_i32(&mut self, sampling_l: i32, sampling_r: i32) {
+        self.push_mix(convert_sample_i2m(sampling_l), convert_sample_i2m(sampling_r));
+    }
+
+    fn drain_mix(&mut self) -> (MixSample, MixSample) {
+        (self.output_sampling_l, self.output_sampling_r)
+    }
+}
+
+impl NearestDownSampleStream {
+    fn push_mix(&mut self, sampling_l: MixSample, sampling_r: MixSample) {
+        self.output_sampling_pos += self.output_sampling_step;
+        self.prev_input_sampling_l = self.now_input_sampling_l;
+        self.prev_input_sampling_r = self.now_input_sampling_r;
+        self.now_input_sampling_l = sampling_l;
+        self.now_input_sampling_r = sampling_r;
+    }
 }
 
 ///
@@ -278,6 +359,15 @@ impl SoundStream for LinearUpSamplingStream {
     fn set_output_channel(&mut self, output_channel: OutputChannel) {
         self.output_channel = output_channel;
     }
+
+    fn get_tick_count_hint(&self, output_count: usize) -> usize {
+        if output_count == 0 {
+            return 0;
+        }
+        tick_count_lower_bound(
+            self.output_sampling_pos + (output_count - 1) as f64 * self.output_sampling_step,
+        )
+    }
 }
 
 ///
@@ -355,12 +445,22 @@ impl SoundStream for SampleHoldUpSamplingStream {
     fn set_output_channel(&mut self, output_channel: OutputChannel) {
         self.output_channel = output_channel;
     }
+
+    fn get_tick_count_hint(&self, output_count: usize) -> usize {
+        if output_count == 0 {
+            return 0;
+        }
+        tick_count_lower_bound(
+            self.output_sampling_pos + (output_count - 1) as f64 * self.output_sampling_step,
+        )
+    }
 }
 
 ///
 /// Over sample down sampling stream
 ///
 pub struct OverSampleStream {
+    input_sampling_rate: u32,
     now_input_sampling_l: f32,
     now_input_sampling_r: f32,
     output_sampling_pos: f64,
@@ -373,6 +473,7 @@ impl OverSampleStream {
     pub fn new(input_sampling_rate: u32, output_sampling_rate: u32) -> Self {
         assert!(input_sampling_rate >= output_sampling_rate);
         OverSampleStream {
+            input_sampling_rate,
             now_input_sampling_l: 0_f32,
             now_input_sampling_r: 0_f32,
             output_sampling_pos: 0_f64,
@@ -411,12 +512,18 @@ impl SoundStream for OverSampleStream {
     }
 
     fn get_sampling_rate(&self) -> u32 {
-        todo!()
+        self.input_sampling_rate
     }
 
     fn set_output_channel(&mut self, _output_channel: OutputChannel) {
         todo!()
     }
+
+    fn get_tick_count_hint(&self, output_count: usize) -> usize {
+        tick_count_lower_bound(
+            (output_count as f64 - self.output_sampling_pos) / self.output_sampling_step,
+        )
+    }
 }
 
 #[derive(PartialEq, Eq)]
@@ -443,16 +550,68 @@ pub fn convert_sample_i2f(i32_sample: i32) -> f32 {
 ///
 /// convert_sample_f2i
 ///
+/// The s16le kernels (sound::kernel) convert blocks the same way.
+///
+#[allow(dead_code)]
 pub fn convert_sample_f2i(f32_sample: f32) -> i16 {
     let mut float: f32 = f32_sample * 32768_f32;
     float = float.clamp(-32768_f32, 32767_f32);
     float as i16
 }
 
+///
+/// convert_sample_i2s
+///
+/// Saturate an integer sample (s16le scale) to s16le.
+///
+#[allow(dead_code)]
+pub fn convert_sample_i2s(i32_sample: i32) -> i16 {
+    i32_sample.clamp(-32768, 32767) as i16
+}
+
 pub fn convert_int(sample: i32, max: i32) -> f32 {
     sample as f32 * (1.0_f32 / max as f32)
 }
 
+///
+/// Mixing bus sample conversion (f32 bus)
+///
+#[cfg(not(feature = "integer_mix"))]
+pub fn convert_sample_i2m(i32_sample: i32) -> MixSample {
+    convert_sample_i2f(i32_sample)
+}
+
+#[cfg(not(feature = "integer_mix"))]
+pub fn convert_sample_f2m(f32_sample: f32) -> MixSample {
+    f32_sample
+}
+
+#[cfg(not(feature = "integer_mix"))]
+pub fn convert_sample_m2f(mix_sample: MixSample) -> f32 {
+    mix_sample
+}
+
+///
+/// Mixing bus sample conversion (i32 bus)
+///
+/// Not clamped until saturate_interleave (sound::kernel), the bus has
+/// 16 bits of headroom.
+///
+#[cfg(feature = "integer_mix")]
+pub fn convert_sample_i2m(i32_sample: i32) -> MixSample {
+    i32_sample
+}
+
+#[cfg(feature = "integer_mix")]
+pub fn convert_sample_f2m(f32_sample: f32) -> MixSample {
+    (f32_sample * 32768_f32) as i32
+}
+
+#[cfg(feature = "integer_mix")]
+pub fn convert_sample_m2f(mix_sample: MixSample) -> f32 {
+    convert_int(mix_sample, 32768)
+}
+
 #[cfg(test)]
 mod tests {
     #[allow(unused_imports)]
@@ -559,4 +718,55 @@ mod tests {
         stream.push(1_f32, 1_f32);
         assert_sampling(stream.drain(), (1_f32, 1_f32));
     }
+
+    ///
+    /// Integer mixing bus (integer_mix) against f32 mixing bus.
+    ///
+    /// convert_sample_i2f scales positive samples by 1/32767, so the f32 bus
+    /// is higher by less than one LSB per chip.
+    ///
+    #[test]
+    fn mix_integer_bus() {
+        use super::{convert_sample_f2i, convert_sample_i2f, convert_sample_i2s};
+
+        let mut seed: u32 = 1;
+        for chips in 1..=4 {
+            for _ in 0..100000 {
+                let mut float_bus = 0_f32;
+                let mut integer_bus = 0_i32;
+                for _ in 0..chips {
+                    // full scale ymfm sample
+                    seed = seed.wrapping_mul(1103515245).wrapping_add(12345);
+                    let sample = (seed >> 16) as i32 - 32768;
+                    float_bus += convert_sample_i2f(sample);
+                    integer_bus += sample;
+                }
+                // saturated only at s16le output
+                let diff = convert_sample_f2i(float_bus) as i32
+                    - convert_sample_i2s(integer_bus) as i32;
+                assert!((0..=chips).contains(&diff), "{chips}: {integer_bus} {diff}");
+            }
+        }
+    }
+
+    #[test]
+    fn mix_native_stream() {
+        use super::{convert_sample_i2m, NativeStream, NearestDownSampleStream};
+
+        // integer samples pass through the stream as they are pushed
+        let mut native = NativeStream::new(44100);
+        let mut nearest = NearestDownSampleStream::new(55930, 44100);
+        for sample in [-32768, -1, 0, 1, 16384, 32767] {
+            let expect = (convert_sample_i2m(sample), convert_sample_i2m(-sample));
+            native.push_i32(sample, -sample);
+            assert!(native.drain_mix() == expect);
+            // at least two ticks so that both nearest samples are the same
+            for _ in 0..2 {
+                while nearest.is_tick() != Tick::No {
+                    nearest.push_i32(sample, -sample);
+                }
+            }
+            assert!(nearest.drain_mix() == expect);
+        }
+    }
 }
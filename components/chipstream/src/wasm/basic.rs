@@ -1,24 +1,33 @@
 // license:BSD-3-Clause
 // copyright-holders:Hiromasa Tanaka
 use std::cell::RefCell;
+use std::collections::HashMap;
 use std::rc::Rc;
 
 use crate::{
-    driver::{self, VgmPlay, XgmPlay},
-    sound::{RomBusType, RomIndex, SoundChipType, SoundSlot},
+    driver::{self, VgmMetaInfo, VgmMetaReader, VgmPlay, XgmPlay},
+    sound::{RomBusType, RomIndex, SoundChipType, SoundSlot, STAGES},
 };
 
 ///
 /// for WebAssembly Instance on thread-local
 ///
-type VgmPlayBank = Rc<RefCell<Vec<VgmPlay>>>;
+/// Players are keyed by index id so that any instance can be dropped
+/// without moving the others.
+///
+type VgmPlayBank = Rc<RefCell<HashMap<usize, VgmPlay>>>;
 std::thread_local!(static VGM_PLAY: VgmPlayBank = {
-    Rc::new(RefCell::new(Vec::new()))
+    Rc::new(RefCell::new(HashMap::new()))
 });
 
-type XgmPlayBank = Rc<RefCell<Vec<XgmPlay>>>;
+type XgmPlayBank = Rc<RefCell<HashMap<usize, XgmPlay>>>;
 std::thread_local!(static XGM_PLAY: XgmPlayBank = {
-    Rc::new(RefCell::new(Vec::new()))
+    Rc::new(RefCell::new(HashMap::new()))
+});
+
+type VgmMetaBank = Rc<RefCell<HashMap<usize, VgmMetaReader>>>;
+std::thread_local!(static VGM_META: VgmMetaBank = {
+    Rc::new(RefCell::new(HashMap::new()))
 });
 
 type SoundSlotBank = Rc<RefCell<Vec<SoundSlot>>>;
@@ -42,6 +51,10 @@ fn get_xgm_bank() -> XgmPlayBank {
     XGM_PLAY.with(|rc| rc.clone())
 }
 
+fn get_vgm_meta_bank() -> VgmMetaBank {
+    VGM_META.with(|rc| rc.clone())
+}
+
 fn get_sound_slot_bank() -> SoundSlotBank {
     SOUND_SLOT.with(|rc| rc.clone())
 }
@@ -117,6 +130,179 @@ pub extern "C" fn vgm_create(
     true
 }
 
+///
+/// Create vgm instance to be loaded by chunks
+///
+/// The file is passed by vgm_load_stream and vgm_end_stream,
+/// so that the whole file is not held in memory.
+///
+#[no_mangle]
+pub extern "C" fn vgm_create_stream(
+    vgm_index_id: u32,
+    output_sampling_rate: u32,
+    output_sample_chunk_size: u32,
+) {
+    let vgmplay = VgmPlay::new_stream(SoundSlot::new(
+        driver::VGM_TICK_RATE,
+        output_sampling_rate,
+        output_sample_chunk_size as usize,
+    ));
+    get_vgm_bank()
+        .borrow_mut()
+        .insert(vgm_index_id as usize, vgmplay);
+}
+
+#[no_mangle]
+pub extern "C" fn vgm_load_stream(vgm_index_id: u32, vgm_chunk: *const u8, length: u32) -> bool {
+    let vgm_chunk = unsafe { std::slice::from_raw_parts(vgm_chunk, length as usize) };
+    let result = get_vgm_bank()
+        .borrow_mut()
+        .get_mut(&(vgm_index_id as usize))
+        .unwrap()
+        .load_stream(vgm_chunk);
+    if result.is_err() {
+        get_vgm_bank().borrow_mut().remove(&(vgm_index_id as usize));
+        return false;
+    }
+    true
+}
+
+#[no_mangle]
+pub extern "C" fn vgm_end_stream(vgm_index_id: u32) -> bool {
+    let result = get_vgm_bank()
+        .borrow_mut()
+        .get_mut(&(vgm_index_id as usize))
+        .unwrap()
+        .end_stream();
+    if result.is_err() {
+        get_vgm_bank().borrow_mut().remove(&(vgm_index_id as usize));
+        return false;
+    }
+    true
+}
+
+///
+/// Compile the vgm commands of a loaded instance into events
+///
+/// The events are walked by vgm_play instead of parsing the commands.
+/// Returns false (the commands are parsed) if they cannot be compiled.
+///
+#[no_mangle]
+pub extern "C" fn vgm_compile_events(vgm_index_id: u32) -> bool {
+    get_vgm_bank()
+        .borrow_mut()
+        .get_mut(&(vgm_index_id as usize))
+        .unwrap()
+        .compile_events()
+        .is_ok()
+}
+
+///
+/// Copy the compiled events (saved form) into allocated memory
+///
+/// Returns the memory index id (empty if not compiled).
+///
+#[no_mangle]
+pub extern "C" fn vgm_get_events(vgm_index_id: u32) -> u32 {
+    let events = get_vgm_bank()
+        .borrow_mut()
+        .get_mut(&(vgm_index_id as usize))
+        .unwrap()
+        .get_events();
+    let memory_index_id = memory_get_alloc_len();
+    get_memory_bank()
+        .borrow_mut()
+        .insert(memory_index_id as usize, events);
+    memory_index_id
+}
+
+///
+/// Set the events saved by vgm_get_events for the same vgm
+///
+/// Returns false (the instance is kept) if they are not of the vgm.
+///
+#[no_mangle]
+pub extern "C" fn vgm_set_events(vgm_index_id: u32, events: *const u8, length: u32) -> bool {
+    let events = unsafe { std::slice::from_raw_parts(events, length as usize) };
+    get_vgm_bank()
+        .borrow_mut()
+        .get_mut(&(vgm_index_id as usize))
+        .unwrap()
+        .set_events(events)
+        .is_ok()
+}
+
+///
+/// Read the header and the GD3 of a .vgm/.vgz by chunks (library index)
+///
+/// Each chunk is read from vgm_meta_get_next_offset, which skips to the
+/// GD3 of a .vgm, until it returns 0xffffffff or the file ends.
+///
+#[no_mangle]
+pub extern "C" fn vgm_meta_create(meta_index_id: u32) {
+    get_vgm_meta_bank()
+        .borrow_mut()
+        .insert(meta_index_id as usize, VgmMetaReader::new());
+}
+
+#[no_mangle]
+pub extern "C" fn vgm_meta_load(meta_index_id: u32, vgm_chunk: *const u8, length: u32) -> bool {
+    let vgm_chunk = unsafe { std::slice::from_raw_parts(vgm_chunk, length as usize) };
+    let result = get_vgm_meta_bank()
+        .borrow_mut()
+        .get_mut(&(meta_index_id as usize))
+        .unwrap()
+        .load(vgm_chunk);
+    if result.is_err() {
+        get_vgm_meta_bank()
+            .borrow_mut()
+            .remove(&(meta_index_id as usize));
+        return false;
+    }
+    true
+}
+
+#[no_mangle]
+pub extern "C" fn vgm_meta_get_next_offset(meta_index_id: u32) -> u32 {
+    get_vgm_meta_bank()
+        .borrow_mut()
+        .get_mut(&(meta_index_id as usize))
+        .unwrap()
+        .next_offset()
+        .map_or(u32::MAX, |offset| offset as u32)
+}
+
+///
+/// Finish reading and drop the reader
+///
+/// Sets the header summary and the memory index id of the GD3 strings
+/// (see driver::get_gd3_strings). Returns false if the header is not read.
+///
+#[no_mangle]
+pub extern "C" fn vgm_meta_end(
+    meta_index_id: u32,
+    info: *mut VgmMetaInfo,
+    memory_index_id: *mut u32,
+) -> bool {
+    let reader = get_vgm_meta_bank()
+        .borrow_mut()
+        .remove(&(meta_index_id as usize));
+    let (header, gd3) = match reader.unwrap().finish() {
+        Ok(meta) => meta,
+        Err(_) => return false,
+    };
+    // UTF-8 strings into allocate memory
+    let strings_index_id = memory_get_alloc_len();
+    get_memory_bank()
+        .borrow_mut()
+        .insert(strings_index_id as usize, driver::get_gd3_strings(&gd3));
+    unsafe {
+        *info = VgmMetaInfo::new(&header);
+        *memory_index_id = strings_index_id;
+    }
+    true
+}
+
 #[no_mangle]
 pub extern "C" fn xgm_create(
     xgm_index_id: u32,
@@ -176,7 +362,7 @@ pub extern "C" fn sound_slot_add_sound_device(
             get_sound_chip_type(sound_chip_type),
             number_of as usize,
             clock,
-        )
+        );
 }
 
 #[no_mangle]
@@ -499,7 +685,7 @@ pub extern "C" fn sound_slot_is_stop_data_stream(
 pub extern "C" fn vgm_get_sampling_l_ref(vgm_index_id: u32) -> *const f32 {
     get_vgm_bank()
         .borrow_mut()
-        .get_mut(vgm_index_id as usize)
+        .get_mut(&(vgm_index_id as usize))
         .unwrap()
         .get_sampling_l_ref()
 }
@@ -508,7 +694,7 @@ pub extern "C" fn vgm_get_sampling_l_ref(vgm_index_id: u32) -> *const f32 {
 pub extern "C" fn vgm_get_sampling_r_ref(vgm_index_id: u32) -> *const f32 {
     get_vgm_bank()
         .borrow_mut()
-        .get_mut(vgm_index_id as usize)
+        .get_mut(&(vgm_index_id as usize))
         .unwrap()
         .get_sampling_r_ref()
 }
@@ -517,25 +703,59 @@ pub extern "C" fn vgm_get_sampling_r_ref(vgm_index_id: u32) -> *const f32 {
 pub extern "C" fn vgm_get_sampling_s16le_ref(vgm_index_id: u32) -> *const i16 {
     get_vgm_bank()
         .borrow_mut()
-        .get_mut(vgm_index_id as usize)
+        .get_mut(&(vgm_index_id as usize))
         .unwrap()
         .get_output_sampling_s16le_ref()
 }
 
+#[no_mangle]
+pub extern "C" fn vgm_get_sampling_stream_size(vgm_index_id: u32) -> u32 {
+    get_vgm_bank()
+        .borrow_mut()
+        .get_mut(&(vgm_index_id as usize))
+        .unwrap()
+        .get_output_sample_stream_size() as u32
+}
+
 #[no_mangle]
 pub extern "C" fn vgm_get_sampling_s16le(vgm_index_id: u32, s16le: *mut i16) {
     get_vgm_bank()
         .borrow_mut()
-        .get_mut(vgm_index_id as usize)
+        .get_mut(&(vgm_index_id as usize))
         .unwrap()
         .get_output_sampling_s16le(s16le);
 }
 
+///
+/// cycles must hold STAGES values (parse, generate, mix, convert)
+///
+#[no_mangle]
+pub extern "C" fn vgm_get_stage_cycles(vgm_index_id: u32, cycles: *mut u32) {
+    let cycles = unsafe { std::slice::from_raw_parts_mut(cycles, STAGES) };
+    get_vgm_bank()
+        .borrow_mut()
+        .get_mut(&(vgm_index_id as usize))
+        .unwrap()
+        .take_stage_cycles(cycles);
+}
+
+///
+/// quality is 0 (full) to 3 (see SoundSlot::set_quality)
+///
+#[no_mangle]
+pub extern "C" fn vgm_set_quality(vgm_index_id: u32, quality: u32) {
+    get_vgm_bank()
+        .borrow_mut()
+        .get_mut(&(vgm_index_id as usize))
+        .unwrap()
+        .set_quality(quality);
+}
+
 #[no_mangle]
 pub extern "C" fn vgm_get_header_json(vgm_index_id: u32) -> u32 {
     let json = get_vgm_bank()
         .borrow_mut()
-        .get_mut(vgm_index_id as usize)
+        .get_mut(&(vgm_index_id as usize))
         .unwrap()
         .get_vgm_header_json();
     // UTF-8 json into allocate memory
@@ -551,7 +771,7 @@ pub extern "C" fn vgm_get_header_json(vgm_index_id: u32) -> u32 {
 pub extern "C" fn vgm_get_gd3_json(vgm_index_id: u32) -> u32 {
     let json = get_vgm_bank()
         .borrow_mut()
-        .get_mut(vgm_index_id as usize)
+        .get_mut(&(vgm_index_id as usize))
         .unwrap()
         .get_vgm_gd3_json();
     // UTF-8 json into allocate memory
@@ -567,7 +787,7 @@ pub extern "C" fn vgm_get_gd3_json(vgm_index_id: u32) -> u32 {
 pub extern "C" fn xgm_get_sampling_l_ref(xgm_index_id: u32) -> *const f32 {
     get_xgm_bank()
         .borrow_mut()
-        .get_mut(xgm_index_id as usize)
+        .get_mut(&(xgm_index_id as usize))
         .unwrap()
         .get_sampling_l_ref()
 }
@@ -576,7 +796,7 @@ pub extern "C" fn xgm_get_sampling_l_ref(xgm_index_id: u32) -> *const f32 {
 pub extern "C" fn xgm_get_sampling_r_ref(xgm_index_id: u32) -> *const f32 {
     get_xgm_bank()
         .borrow_mut()
-        .get_mut(xgm_index_id as usize)
+        .get_mut(&(xgm_index_id as usize))
         .unwrap()
         .get_sampling_r_ref()
 }
@@ -585,16 +805,25 @@ pub extern "C" fn xgm_get_sampling_r_ref(xgm_index_id: u32) -> *const f32 {
 pub extern "C" fn xgm_get_sampling_s16le_ref(xgm_index_id: u32) -> *const i16 {
     get_xgm_bank()
         .borrow_mut()
-        .get_mut(xgm_index_id as usize)
+        .get_mut(&(xgm_index_id as usize))
         .unwrap()
         .get_output_sampling_s16le_ref()
 }
 
+#[no_mangle]
+pub extern "C" fn xgm_get_sampling_stream_size(xgm_index_id: u32) -> u32 {
+    get_xgm_bank()
+        .borrow_mut()
+        .get_mut(&(xgm_index_id as usize))
+        .unwrap()
+        .get_output_sample_stream_size() as u32
+}
+
 #[no_mangle]
 pub extern "C" fn xgm_get_header_json(xgm_index_id: u32) -> u32 {
     let json = get_xgm_bank()
         .borrow_mut()
-        .get_mut(xgm_index_id as usize)
+        .get_mut(&(xgm_index_id as usize))
         .unwrap()
         .get_xgm_header_json();
     // UTF-8 json into allocate memory
@@ -610,7 +839,7 @@ pub extern "C" fn xgm_get_header_json(xgm_index_id: u32) -> u32 {
 pub extern "C" fn xgm_get_gd3_json(xgm_index_id: u32) -> u32 {
     let json = get_xgm_bank()
         .borrow_mut()
-        .get_mut(xgm_index_id as usize)
+        .get_mut(&(xgm_index_id as usize))
         .unwrap()
         .get_xgm_gd3_json();
     // UTF-8 json into allocate memory
@@ -626,28 +855,58 @@ pub extern "C" fn xgm_get_gd3_json(xgm_index_id: u32) -> u32 {
 pub extern "C" fn vgm_play(vgm_index_id: u32) -> usize {
     get_vgm_bank()
         .borrow_mut()
-        .get_mut(vgm_index_id as usize)
+        .get_mut(&(vgm_index_id as usize))
         .unwrap()
         .play(true)
 }
 
+///
+/// Seek to position_ms from the start (see VgmPlay::seek)
+///
+/// Returns false (the position is kept) if the instance is not played,
+/// its events are not compiled, or the position is over the end.
+///
+#[no_mangle]
+pub extern "C" fn vgm_seek(vgm_index_id: u32, position_ms: u32) -> bool {
+    let tick_pos = position_ms as u64 * driver::VGM_TICK_RATE as u64 / 1000;
+    get_vgm_bank()
+        .borrow_mut()
+        .get_mut(&(vgm_index_id as usize))
+        .unwrap()
+        .seek(tick_pos as usize)
+        .is_ok()
+}
+
+///
+/// Play position in ms from the start (back to the loop point on each loop)
+///
+#[no_mangle]
+pub extern "C" fn vgm_get_position(vgm_index_id: u32) -> u32 {
+    let tick_pos = get_vgm_bank()
+        .borrow_mut()
+        .get_mut(&(vgm_index_id as usize))
+        .unwrap()
+        .get_position();
+    (tick_pos as u64 * 1000 / driver::VGM_TICK_RATE as u64) as u32
+}
+
 #[no_mangle]
 pub extern "C" fn xgm_play(xgm_index_id: u32) -> usize {
     get_xgm_bank()
         .borrow_mut()
-        .get_mut(xgm_index_id as usize)
+        .get_mut(&(xgm_index_id as usize))
         .unwrap()
         .play(true)
 }
 
 #[no_mangle]
 pub extern "C" fn vgm_drop(vgm_index_id: u32) {
-    get_vgm_bank().borrow_mut().remove(vgm_index_id as usize);
+    get_vgm_bank().borrow_mut().remove(&(vgm_index_id as usize));
 }
 
 #[no_mangle]
 pub extern "C" fn xgm_drop(xgm_index_id: u32) {
-    get_xgm_bank().borrow_mut().remove(xgm_index_id as usize);
+    get_xgm_bank().borrow_mut().remove(&(xgm_index_id as usize));
 }
 
 #[no_mangle]
@@ -0,0 +1,252 @@
+// license:BSD-3-Clause
+// copyright-holders:Hiromasa Tanaka
+#ifndef YMFM_KERNELS_H
+#define YMFM_KERNELS_H
+
+#include <cstdint>
+
+#ifdef ESP_PLATFORM
+#include <sdkconfig.h>
+#endif
+
+//*********************************************************
+//  MIXING BUS KERNELS
+//*********************************************************
+
+// block kernels of the chipstream mixing bus (sound::SoundSlot): accumulate
+// a device into the bus, apply an output level, and saturate the bus to
+// interleaved s16le; the bus is i32 (s16le scale) with the integer_mix
+// feature and f32 (1.0 full scale) without it
+//
+// every kernel has three paths, which must give the same bits:
+//  reference: one sample at a time, as the Rust bus did it
+//  generic: branch free loops the compiler can vectorize
+//  pie: ESP32-S3 PIE (128-bit, 4 x i32) where it has the instruction,
+//       the generic loop elsewhere and for the unaligned head and tail
+// vgm_kernels::active is the path selected at compile time; define
+// YMFM_KERNELS_REFERENCE to force the reference path
+
+namespace vgm_kernels
+{
+
+// ======================> reference
+
+namespace reference
+{
+
+// dst[i] += src[i], saturated to i32
+inline void mix_accumulate(int32_t *dst, int32_t const *src, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        int64_t sum = int64_t(dst[i]) + src[i];
+        if (sum > INT32_MAX)
+            sum = INT32_MAX;
+        else if (sum < INT32_MIN)
+            sum = INT32_MIN;
+        dst[i] = int32_t(sum);
+    }
+}
+
+inline void mix_accumulate(float *dst, float const *src, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+        dst[i] += src[i];
+}
+
+// buffer[i] *= gain; i32 is scaled in f32 and converted back with the
+// saturating (NaN to 0) conversion of Rust, unless the gain is exactly 1
+inline void gain(int32_t *buffer, uint32_t count, float gain)
+{
+    if (gain == 1.0f)
+        return;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        float scaled = float(buffer[i]) * gain;
+        if (scaled != scaled)
+            buffer[i] = 0;
+        else if (scaled >= 2147483648.0f)
+            buffer[i] = INT32_MAX;
+        else if (scaled < -2147483648.0f)
+            buffer[i] = INT32_MIN;
+        else
+            buffer[i] = int32_t(scaled);
+    }
+}
+
+inline void gain(float *buffer, uint32_t count, float gain)
+{
+    for (uint32_t i = 0; i < count; i++)
+        buffer[i] *= gain;
+}
+
+// s16le[i * 2] = left[i], s16le[i * 2 + 1] = right[i], saturated to i16
+// (f32 is scaled by 32768 and truncated, NaN is 0)
+inline int16_t saturate(int32_t sample)
+{
+    if (sample > 32767)
+        return 32767;
+    if (sample < -32768)
+        return -32768;
+    return int16_t(sample);
+}
+
+inline int16_t saturate(float sample)
+{
+    float scaled = sample * 32768.0f;
+    if (scaled != scaled)
+        return 0;
+    if (scaled > 32767.0f)
+        return 32767;
+    if (scaled < -32768.0f)
+        return -32768;
+    return int16_t(scaled);
+}
+
+template<typename SampleType>
+inline void saturate_interleave(SampleType const *left, SampleType const *right, int16_t *s16le, uint32_t frames)
+{
+    for (uint32_t i = 0; i < frames; i++)
+    {
+        s16le[i * 2] = saturate(left[i]);
+        s16le[i * 2 + 1] = saturate(right[i]);
+    }
+}
+
+} // namespace reference
+
+// ======================> generic
+
+namespace generic
+{
+
+// no aliasing between the buffers, fixed work per sample (selects, not
+// branches) so that GCC and Clang vectorize the loops at -O3
+
+inline int32_t add_saturate(int32_t a, int32_t b)
+{
+    // wrapping add, then the sign of a decides the overflow bound
+    int32_t sum = int32_t(uint32_t(a) + uint32_t(b));
+    int32_t bound = (a < 0) ? INT32_MIN : INT32_MAX;
+    bool overflow = ((a ^ sum) & (b ^ sum)) < 0;
+    return overflow ? bound : sum;
+}
+
+inline void mix_accumulate(int32_t *__restrict dst, int32_t const *__restrict src, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+        dst[i] = add_saturate(dst[i], src[i]);
+}
+
+inline void mix_accumulate(float *__restrict dst, float const *__restrict src, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+        dst[i] += src[i];
+}
+
+inline void gain(int32_t *__restrict buffer, uint32_t count, float gain)
+{
+    if (gain == 1.0f)
+        return;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        float scaled = float(buffer[i]) * gain;
+        // clamped in float first, so the conversion is always defined
+        float clamped = (scaled < -2147483648.0f) ? -2147483648.0f : scaled;
+        clamped = (clamped < 2147483520.0f) ? clamped : 2147483520.0f;
+        clamped = (scaled == scaled) ? clamped : 0.0f;
+        int32_t sample = int32_t(clamped);
+        buffer[i] = (scaled >= 2147483648.0f) ? INT32_MAX : sample;
+    }
+}
+
+inline void gain(float *__restrict buffer, uint32_t count, float gain)
+{
+    for (uint32_t i = 0; i < count; i++)
+        buffer[i] *= gain;
+}
+
+inline int16_t saturate(int32_t sample)
+{
+    sample = (sample < -32768) ? -32768 : sample;
+    sample = (sample > 32767) ? 32767 : sample;
+    return int16_t(sample);
+}
+
+inline int16_t saturate(float sample)
+{
+    float scaled = sample * 32768.0f;
+    scaled = (scaled == scaled) ? scaled : 0.0f;
+    scaled = (scaled < -32768.0f) ? -32768.0f : scaled;
+    scaled = (scaled > 32767.0f) ? 32767.0f : scaled;
+    return int16_t(int32_t(scaled));
+}
+
+template<typename SampleType>
+inline void saturate_interleave(SampleType const *__restrict left, SampleType const *__restrict right,
+    int16_t *__restrict s16le, uint32_t frames)
+{
+    for (uint32_t i = 0; i < frames; i++)
+    {
+        s16le[i * 2] = saturate(left[i]);
+        s16le[i * 2 + 1] = saturate(right[i]);
+    }
+}
+
+} // namespace generic
+
+// ======================> pie
+
+#if defined(CONFIG_IDF_TARGET_ESP32S3) && !defined(YMFM_KERNELS_REFERENCE)
+#define YMFM_KERNELS_PIE
+
+namespace pie
+{
+
+// EE.VADDS.S32 is the saturating add of the generic path, 4 lanes at a
+// time; the 128-bit loads and stores need 16-byte aligned buffers
+inline void mix_accumulate(int32_t *dst, int32_t const *src, uint32_t count)
+{
+    uint32_t done = 0;
+    if (((uintptr_t(dst) | uintptr_t(src)) & 15) == 0)
+    {
+        int32_t *load = dst;
+        int32_t const *add = src;
+        int32_t *store = dst;
+        for (uint32_t lanes = count / 4; lanes != 0; lanes--)
+        {
+            asm volatile(
+                "ee.vld.128.ip q0, %0, 16\n"
+                "ee.vld.128.ip q1, %1, 16\n"
+                "ee.vadds.s32 q2, q0, q1\n"
+                "ee.vst.128.ip q2, %2, 16\n"
+                : "+r"(load), "+r"(add), "+r"(store)
+                :
+                : "memory");
+        }
+        done = count & ~3u;
+    }
+    generic::mix_accumulate(dst + done, src + done, count - done);
+}
+
+// PIE has no f32 lanes and no 32-bit multiply
+inline void mix_accumulate(float *dst, float const *src, uint32_t count)
+{
+    generic::mix_accumulate(dst, src, count);
+}
+
+using generic::gain;
+using generic::saturate_interleave;
+
+} // namespace pie
+
+namespace active = pie;
+#elif defined(YMFM_KERNELS_REFERENCE)
+namespace active = reference;
+#else
+namespace active = generic;
+#endif
+
+} // namespace vgm_kernels
+
+#endif // YMFM_KERNELS_H
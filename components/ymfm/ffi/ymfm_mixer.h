@@ -0,0 +1,136 @@
+// license:BSD-3-Clause
+// copyright-holders:Aaron Giles, Hiromasa Tanaka (for libymfm.wasm)
+#ifndef YMFM_MIXER_H
+#define YMFM_MIXER_H
+
+#include <cstdint>
+
+#include "ymfm_misc.h"
+#include "ymfm_opl.h"
+#include "ymfm_opm.h"
+#include "ymfm_opn.h"
+
+//*********************************************************
+//  MIXERS
+//*********************************************************
+
+// ======================> vgm_mixer
+
+// mixes a block of chip outputs into an interleaved stereo buffer; each chip
+// gets its own fixed mix path, selected at compile time
+
+// default: stereo chips (data[0] is left, data[1] is right)
+template<typename ChipType, int Outputs = ChipType::OUTPUTS>
+struct vgm_mixer
+{
+    static void mix(typename ChipType::output_data const *output, int32_t *buffer, uint32_t frames)
+    {
+        for (uint32_t i = 0; i < frames; i++)
+        {
+            *buffer++ += output[i].data[0];
+            *buffer++ += output[i].data[1];
+        }
+    }
+};
+
+// mono chips (YM3526, Y8950, YM3812)
+template<typename ChipType>
+struct vgm_mixer<ChipType, 1>
+{
+    static void mix(typename ChipType::output_data const *output, int32_t *buffer, uint32_t frames)
+    {
+        for (uint32_t i = 0; i < frames; i++)
+        {
+            *buffer++ += output[i].data[0] / 2;
+            *buffer++ += output[i].data[0] / 2;
+        }
+    }
+};
+
+// YM2203: FM plus 3 SSG channels
+template<>
+struct vgm_mixer<ymfm::ym2203>
+{
+    static void mix(ymfm::ym2203::output_data const *output, int32_t *buffer, uint32_t frames)
+    {
+        for (uint32_t i = 0; i < frames; i++)
+        {
+            int32_t out0 = output[i].data[0];
+            int32_t out1 = output[i].data[1];
+            int32_t out2 = output[i].data[2];
+            int32_t out3 = output[i].data[3];
+            *buffer++ += out0 + (out1 + out2 + out3) / 2;
+            *buffer++ += out0 + (out1 + out2 + out3) / 2;
+        }
+    }
+};
+
+// YM2608/YM2610/YM2610B: stereo FM/ADPCM plus mono SSG
+template<typename ChipType>
+struct vgm_mixer_opn_ssg
+{
+    static void mix(typename ChipType::output_data const *output, int32_t *buffer, uint32_t frames)
+    {
+        for (uint32_t i = 0; i < frames; i++)
+        {
+            int32_t out0 = output[i].data[0];
+            int32_t out1 = output[i].data[1];
+            int32_t out2 = output[i].data[2];
+            *buffer++ += out0 + (out2 / 2);
+            *buffer++ += out1 + (out2 / 2);
+        }
+    }
+};
+
+template<> struct vgm_mixer<ymfm::ym2608> : vgm_mixer_opn_ssg<ymfm::ym2608> {};
+template<> struct vgm_mixer<ymfm::ym2610> : vgm_mixer_opn_ssg<ymfm::ym2610> {};
+template<> struct vgm_mixer<ymfm::ym2610b> : vgm_mixer_opn_ssg<ymfm::ym2610b> {};
+
+// YM2149: 3 SSG channels
+template<>
+struct vgm_mixer<ymfm::ym2149>
+{
+    static void mix(ymfm::ym2149::output_data const *output, int32_t *buffer, uint32_t frames)
+    {
+        for (uint32_t i = 0; i < frames; i++)
+        {
+            int32_t out0 = output[i].data[0];
+            int32_t out1 = output[i].data[1];
+            int32_t out2 = output[i].data[2];
+            *buffer++ += (out0 + out1 + out2) / 2;
+            *buffer++ += (out0 + out1 + out2) / 2;
+        }
+    }
+};
+
+// YMF278B: FM/PCM mix on outputs 4 and 5
+template<>
+struct vgm_mixer<ymfm::ymf278b>
+{
+    static void mix(ymfm::ymf278b::output_data const *output, int32_t *buffer, uint32_t frames)
+    {
+        for (uint32_t i = 0; i < frames; i++)
+        {
+            *buffer++ += output[i].data[4];
+            *buffer++ += output[i].data[5];
+        }
+    }
+};
+
+// YM2413: melody and rhythm
+template<>
+struct vgm_mixer<ymfm::ym2413>
+{
+    static void mix(ymfm::ym2413::output_data const *output, int32_t *buffer, uint32_t frames)
+    {
+        for (uint32_t i = 0; i < frames; i++)
+        {
+            int32_t out0 = output[i].data[0];
+            int32_t out1 = output[i].data[1];
+            *buffer++ += out0 + out1;
+            *buffer++ += out0 + out1;
+        }
+    }
+};
+
+#endif
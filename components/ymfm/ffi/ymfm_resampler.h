@@ -0,0 +1,274 @@
+// license:BSD-3-Clause
+// copyright-holders:Hiromasa Tanaka
+#ifndef YMFM_RESAMPLER_H
+#define YMFM_RESAMPLER_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+//*********************************************************
+//  RESAMPLER
+//*********************************************************
+
+// ======================> vgm_resampler
+
+// converts the interleaved stereo frames of a chip to the output rate a block
+// at a time; the position is 32.32 fixed point and the remainder of the step
+// is carried in units of the output rate, so it never drifts and no floating
+// point is used per frame
+
+enum vgm_resample_quality : uint8_t
+{
+    RESAMPLE_NEAREST,
+    RESAMPLE_LINEAR,
+    RESAMPLE_SINC
+};
+
+class vgm_resampler
+{
+public:
+    // windowed-sinc taps per output frame, and phases of the coefficient table
+    static constexpr uint32_t SINC_TAPS = 8;
+    static constexpr uint32_t SINC_PHASE_BITS = 6;
+    static constexpr uint32_t SINC_PHASES = 1 << SINC_PHASE_BITS;
+    static constexpr uint32_t SINC_SHIFT = 14;
+    static constexpr int32_t SINC_ONE = 1 << SINC_SHIFT;
+
+    // frames kept before the position for the taps, and the input window
+    static constexpr uint32_t HISTORY = SINC_TAPS / 2;
+    static constexpr uint32_t WINDOW_FRAMES = 256;
+
+    // start converting from input_rate to output_rate (0 stops)
+    void configure(uint32_t input_rate, uint32_t output_rate, vgm_resample_quality quality)
+    {
+        m_output_rate = output_rate;
+        m_quality = quality;
+        if (output_rate == 0)
+            return;
+        // the window starts with silence as the history
+        memset(m_window, 0, HISTORY * 2 * sizeof(int32_t));
+        m_frames = HISTORY;
+        set_input_rate(input_rate);
+        // nearest matches the stream of chipstream: output n takes the input
+        // frame nearest to (n + 1) * step - 1; the others are centered on n * step - 1
+        m_pos = uint64_t(HISTORY - 1) << 32;
+        m_rem = 0;
+        if (quality == RESAMPLE_NEAREST)
+        {
+            m_pos += m_step;
+            m_rem = m_step_rem;
+        }
+    }
+
+    // change the input rate, keeping the position and the frames held
+    void set_input_rate(uint32_t input_rate)
+    {
+        m_input_rate = input_rate;
+        uint64_t step = (uint64_t(input_rate) << 32);
+        m_step = step / m_output_rate;
+        m_step_rem = uint32_t(step % m_output_rate);
+        if (m_quality == RESAMPLE_SINC)
+            build_sinc();
+    }
+
+    // change the quality, keeping the position and the frames held
+    void set_quality(vgm_resample_quality quality)
+    {
+        m_quality = quality;
+        if (quality != RESAMPLE_SINC)
+            return;
+        // the taps reach HISTORY - 1 frames back; pad with silence
+        uint32_t base = uint32_t(m_pos >> 32);
+        if (base < HISTORY - 1)
+        {
+            uint32_t pad = HISTORY - 1 - base;
+            memmove(&m_window[pad * 2], m_window, m_frames * 2 * sizeof(int32_t));
+            memset(m_window, 0, pad * 2 * sizeof(int32_t));
+            m_frames += pad;
+            m_pos += uint64_t(pad) << 32;
+        }
+        build_sinc();
+    }
+
+    // drop the frames held and restart the position, as configure (seek)
+    void reset()
+    {
+        if (active())
+            configure(m_input_rate, m_output_rate, m_quality);
+    }
+
+    bool active() const { return m_output_rate != 0; }
+    uint32_t output_rate() const { return m_output_rate; }
+
+    // output frames that one window of input can produce
+    uint32_t max_output() const
+    {
+        uint64_t room = uint64_t(WINDOW_FRAMES - lookahead() - (m_pos >> 32) - 1) << 32;
+        return uint32_t(std::max<uint64_t>(room / (m_step + 1), 1));
+    }
+
+    // input frames to add before frames (up to max_output) can be resampled
+    uint32_t input_needed(uint32_t frames) const
+    {
+        if (frames == 0)
+            return 0;
+        uint64_t steps = frames - 1;
+        uint64_t rem = m_rem + steps * m_step_rem;
+        uint64_t last = m_pos + steps * m_step + rem / m_output_rate;
+        uint32_t needed = uint32_t(last >> 32) + lookahead();
+        return (needed > m_frames) ? needed - m_frames : 0;
+    }
+
+    // zero-filled room for frames of input added to the window
+    int32_t *input(uint32_t frames)
+    {
+        int32_t *room = &m_window[m_frames * 2];
+        memset(room, 0, frames * 2 * sizeof(int32_t));
+        m_frames += frames;
+        return room;
+    }
+
+    // resample frames from the window, mixed into the buffer
+    void resample(int32_t *buffer, uint32_t frames)
+    {
+        switch (m_quality)
+        {
+            case RESAMPLE_NEAREST:
+                resample_nearest(buffer, frames);
+                break;
+            case RESAMPLE_LINEAR:
+                resample_linear(buffer, frames);
+                break;
+            case RESAMPLE_SINC:
+                resample_sinc(buffer, frames);
+                break;
+        }
+        // drop the frames behind the taps of the next output
+        uint32_t base = uint32_t(m_pos >> 32);
+        uint32_t drop = std::min(base - std::min(base, (m_quality == RESAMPLE_SINC) ? HISTORY - 1 : 0), m_frames);
+        if (drop != 0)
+        {
+            memmove(m_window, &m_window[drop * 2], (m_frames - drop) * 2 * sizeof(int32_t));
+            m_frames -= drop;
+            m_pos -= uint64_t(drop) << 32;
+        }
+    }
+
+private:
+    // input frames needed after the base frame of an output
+    uint32_t lookahead() const
+    {
+        switch (m_quality)
+        {
+            case RESAMPLE_NEAREST:
+            case RESAMPLE_LINEAR:
+                return 2;
+            default:
+                return HISTORY + 1;
+        }
+    }
+
+    void advance()
+    {
+        m_pos += m_step;
+        m_rem += m_step_rem;
+        if (m_rem >= m_output_rate)
+        {
+            m_rem -= m_output_rate;
+            m_pos++;
+        }
+    }
+
+    void resample_nearest(int32_t *buffer, uint32_t frames)
+    {
+        for (uint32_t i = 0; i < frames; i++)
+        {
+            // half up; the remainder never moves a frame across a half
+            int32_t const *frame = &m_window[uint32_t((m_pos + 0x80000000u) >> 32) * 2];
+            *buffer++ += frame[0];
+            *buffer++ += frame[1];
+            advance();
+        }
+    }
+
+    void resample_linear(int32_t *buffer, uint32_t frames)
+    {
+        for (uint32_t i = 0; i < frames; i++)
+        {
+            int32_t const *frame = &m_window[uint32_t(m_pos >> 32) * 2];
+            int64_t frac = int64_t((m_pos >> 16) & 0xffff);
+            *buffer++ += frame[0] + int32_t((int64_t(frame[2] - frame[0]) * frac) >> 16);
+            *buffer++ += frame[1] + int32_t((int64_t(frame[3] - frame[1]) * frac) >> 16);
+            advance();
+        }
+    }
+
+    void resample_sinc(int32_t *buffer, uint32_t frames)
+    {
+        for (uint32_t i = 0; i < frames; i++)
+        {
+            int32_t const *frame = &m_window[(uint32_t(m_pos >> 32) - (HISTORY - 1)) * 2];
+            int16_t const *taps = m_sinc[uint32_t(m_pos >> (32 - SINC_PHASE_BITS)) & (SINC_PHASES - 1)];
+            int64_t left = 0;
+            int64_t right = 0;
+            for (uint32_t tap = 0; tap < SINC_TAPS; tap++)
+            {
+                left += int64_t(frame[tap * 2]) * taps[tap];
+                right += int64_t(frame[tap * 2 + 1]) * taps[tap];
+            }
+            *buffer++ += int32_t(left >> SINC_SHIFT);
+            *buffer++ += int32_t(right >> SINC_SHIFT);
+            advance();
+        }
+    }
+
+    // Blackman windowed sinc, cut off at the lower Nyquist frequency of the
+    // two rates; each phase is normalized to a gain of 1 at DC
+    void build_sinc()
+    {
+        double const pi = 3.14159265358979323846;
+        double cutoff = std::min(1.0, double(m_output_rate) / double(m_input_rate));
+        for (uint32_t phase = 0; phase < SINC_PHASES; phase++)
+        {
+            double taps[SINC_TAPS];
+            double sum = 0;
+            for (uint32_t tap = 0; tap < SINC_TAPS; tap++)
+            {
+                // distance of the input frame from the output
+                double x = double(tap) - double(HISTORY - 1) - double(phase) / SINC_PHASES;
+                double t = pi * cutoff * x;
+                double sinc = (x == 0) ? 1.0 : std::sin(t) / t;
+                double window = 0.42 + 0.5 * std::cos(pi * x / HISTORY) + 0.08 * std::cos(2 * pi * x / HISTORY);
+                taps[tap] = sinc * window;
+                sum += taps[tap];
+            }
+            // the rounding error goes to the largest tap
+            int32_t total = 0;
+            uint32_t largest = 0;
+            for (uint32_t tap = 0; tap < SINC_TAPS; tap++)
+            {
+                m_sinc[phase][tap] = int16_t(std::lround(taps[tap] / sum * SINC_ONE));
+                total += m_sinc[phase][tap];
+                if (std::abs(taps[tap]) > std::abs(taps[largest]))
+                    largest = tap;
+            }
+            m_sinc[phase][largest] += int16_t(SINC_ONE - total);
+        }
+    }
+
+    // internal state
+    uint32_t m_input_rate = 0;
+    uint32_t m_output_rate = 0;
+    vgm_resample_quality m_quality = RESAMPLE_LINEAR;
+    uint64_t m_pos = 0;
+    uint64_t m_step = 0;
+    uint32_t m_rem = 0;
+    uint32_t m_step_rem = 0;
+    uint32_t m_frames = 0;
+    int32_t m_window[WINDOW_FRAMES * 2];
+    int16_t m_sinc[SINC_PHASES][SINC_TAPS];
+};
+
+#endif // YMFM_RESAMPLER_H
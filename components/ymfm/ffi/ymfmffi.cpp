@@ -4,16 +4,60 @@
 #include <cstdio>
 #include <cstdint>
 #include <cstring>
-#include <list>
+#include <algorithm>
+#include <atomic>
+#include <new>
 #include <string>
+#ifdef YMFM_PROFILE
+#include <chrono>
+#endif
+#ifdef ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_heap_caps.h>
+#include <soc/soc_memory_layout.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
 
 #include "ymfm_misc.h"
 #include "ymfm_opl.h"
 #include "ymfm_opm.h"
 #include "ymfm_opn.h"
+#include "ymfm_mixer.h"
+#include "ymfm_resampler.h"
+#include "ymfm_kernels.h"
 
 #define LOG_WRITES (0)
 
+// number of frames rendered by a single ymfm generate() call when no register
+// writes are pending
+#define GENERATE_BATCH_FRAMES (32)
+
+// frames of exactly zero output after which a chip with silent engines
+// stops generating until its next register write
+#define IDLE_FRAMES (1024)
+
+// capacity of the register write queue per chip (must be a power of 2)
+#define WRITE_QUEUE_SIZE (256)
+
+// maximum number of chips alive at the same time
+#define MAX_CHIPS (32)
+
+// internal DRAM left for stacks, DMA and the rest of the system (ESP32)
+#define INTERNAL_RESERVE_BYTES (32 * 1024)
+
+// ROM overlay pages (copy-on-write over the shared ROM) and address space
+#define ROM_PAGE_SHIFT (12)
+#define ROM_PAGE_SIZE (1u << ROM_PAGE_SHIFT)
+#define ROM_ADDRESS_LIMIT (1u << 24)
+
+// render worker task (ESP32)
+#define RENDER_WORKER_STACK_SIZE (4096)
+#define RENDER_WORKER_PRIORITY (2)
+
 //*********************************************************
 //  GLOBAL TYPES
 //*********************************************************
@@ -21,6 +65,14 @@
 // we use an int64_t as emulated time, as a 32.32 fixed point value
 using emulated_time = int64_t;
 
+// a block of frames to render ahead for one chip (shared with chip_ymfm.rs)
+struct ymfm_block
+{
+    uint32_t handle;
+    uint32_t frames;
+    int32_t *buffer;
+};
+
 // enumeration of the different types of chips we support
 enum chip_type
 {
@@ -39,6 +91,244 @@ enum chip_type
     CHIP_TYPES
 };
 
+//*********************************************************
+//  MEMORY PLACEMENT
+//*********************************************************
+
+// chip state and block buffers are touched on every frame, so they are
+// allocated from internal DRAM while it has room and fall back to PSRAM;
+// ROM data is large and read sparsely, so it always goes to PSRAM
+
+void *alloc_internal(size_t size)
+{
+#ifdef ESP_PLATFORM
+    if (heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT) >= size + INTERNAL_RESERVE_BYTES)
+    {
+        void *ptr = heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (ptr != nullptr)
+            return ptr;
+    }
+    return heap_caps_malloc(size, MALLOC_CAP_8BIT);
+#else
+    return malloc(size);
+#endif
+}
+
+void *alloc_external(size_t size)
+{
+#ifdef ESP_PLATFORM
+    void *ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return (ptr != nullptr) ? ptr : heap_caps_malloc(size, MALLOC_CAP_8BIT);
+#else
+    return malloc(size);
+#endif
+}
+
+void *realloc_external(void *ptr, size_t size)
+{
+#ifdef ESP_PLATFORM
+    return heap_caps_realloc(ptr, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+#else
+    return realloc(ptr, size);
+#endif
+}
+
+char const *placement_name(void const *ptr)
+{
+#ifdef ESP_PLATFORM
+    if (ptr == nullptr)
+        return "none";
+    return esp_ptr_internal(ptr) ? "internal" : esp_ptr_external_ram(ptr) ? "psram" : esp_ptr_in_drom(ptr) ? "flash" : "other";
+#else
+    return (ptr == nullptr) ? "none" : "host";
+#endif
+}
+
+// std::vector allocator for ROM data
+template<typename T>
+struct external_allocator
+{
+    using value_type = T;
+    external_allocator() = default;
+    template<typename U> external_allocator(external_allocator<U> const &) {}
+    T *allocate(size_t count) { return static_cast<T *>(alloc_external(count * sizeof(T))); }
+    void deallocate(T *ptr, size_t) { free(ptr); }
+    template<typename U> bool operator==(external_allocator<U> const &) const { return true; }
+    template<typename U> bool operator!=(external_allocator<U> const &) const { return false; }
+};
+
+//*********************************************************
+//  SHARED ROM
+//*********************************************************
+
+// sample ROMs that are not part of a VGM (e.g. YM2608 rhythm, YMF278B
+// wavetable) are memory-mapped from the rom partition once and shared by
+// every chip of the type; a chip only keeps RAM for the pages a VGM writes
+
+struct shared_rom
+{
+    uint8_t const *data;
+    uint32_t size;
+};
+
+// set by ymfm_set_shared_rom before the chips are added
+shared_rom shared_rom_table[CHIP_TYPES][ymfm::ACCESS_CLASSES];
+
+// ======================> rom_overlay
+
+// ROM data of one access class as seen by a chip: over a shared ROM, written
+// pages are copied from it into PSRAM on first write and the rest reads
+// through; without one (or once a VGM brings the whole ROM), the data is a
+// single PSRAM block
+class rom_overlay
+{
+public:
+    rom_overlay() = default;
+    rom_overlay(rom_overlay const &) = delete;
+    rom_overlay &operator=(rom_overlay const &) = delete;
+    ~rom_overlay()
+    {
+        free_pages();
+        free(m_data);
+    }
+
+    void set_shared(shared_rom const &rom) { m_shared = rom; }
+
+    uint8_t read(uint32_t offset) const
+    {
+        if (m_shared.size == 0)
+            return (offset < m_size) ? m_data[offset] : 0;
+
+        // samples are read in sequence, so the page mostly stays the same
+        uint32_t page = offset >> ROM_PAGE_SHIFT;
+        if (page != m_read_page)
+            set_read_page(page);
+        uint32_t index = offset & (ROM_PAGE_SIZE - 1);
+        return (index < m_read_size) ? m_read_data[index] : 0;
+    }
+
+    // returns false when the range is out of the address space or out of memory
+    bool write(uint32_t base, uint32_t length, uint8_t const *src)
+    {
+        if (base >= ROM_ADDRESS_LIMIT || length > ROM_ADDRESS_LIMIT - base)
+            return false;
+
+        // a VGM that brings the whole ROM no longer reads the shared one
+        if (m_shared.size != 0 && m_page_count == 0 && base == 0 && length >= m_shared.size)
+            m_shared = { nullptr, 0 };
+
+        if (m_shared.size == 0)
+        {
+            if (!reserve(base + length, length))
+                return false;
+            memcpy(m_data + base, src, length);
+            return true;
+        }
+
+        while (length > 0)
+        {
+            uint32_t offset = base & (ROM_PAGE_SIZE - 1);
+            uint32_t chunk = std::min(length, ROM_PAGE_SIZE - offset);
+            uint8_t *page = writable_page(base >> ROM_PAGE_SHIFT);
+            if (page == nullptr)
+                return false;
+            memcpy(page + offset, src, chunk);
+            base += chunk;
+            src += chunk;
+            length -= chunk;
+        }
+        return true;
+    }
+
+    uint32_t shared_bytes() const { return m_shared.size; }
+    uint32_t overlay_bytes() const { return m_page_count * ROM_PAGE_SIZE + m_size; }
+    void const *shared_data() const { return m_shared.data; }
+    void const *overlay_data() const
+    {
+        if (m_data != nullptr)
+            return m_data;
+        for (uint8_t *page : m_pages)
+            if (page != nullptr)
+                return page;
+        return nullptr;
+    }
+
+private:
+    // grow the block to end; a data block is kept exact, byte writes double it
+    bool reserve(uint32_t end, uint32_t length)
+    {
+        if (end <= m_size)
+            return true;
+        uint32_t size = (length >= ROM_PAGE_SIZE) ? end : std::max(end, std::min(m_size * 2, ROM_ADDRESS_LIMIT));
+        uint8_t *data = static_cast<uint8_t *>(realloc_external(m_data, size));
+        if (data == nullptr)
+            return false;
+        memset(data + m_size, 0, size - m_size);
+        m_data = data;
+        m_size = size;
+        return true;
+    }
+
+    void set_read_page(uint32_t page) const
+    {
+        uint32_t start = page << ROM_PAGE_SHIFT;
+        m_read_page = page;
+        if (page < m_pages.size() && m_pages[page] != nullptr)
+        {
+            m_read_data = m_pages[page];
+            m_read_size = ROM_PAGE_SIZE;
+        }
+        else if (start < m_shared.size)
+        {
+            m_read_data = m_shared.data + start;
+            m_read_size = std::min(ROM_PAGE_SIZE, m_shared.size - start);
+        }
+        else
+        {
+            m_read_data = nullptr;
+            m_read_size = 0;
+        }
+    }
+
+    uint8_t *writable_page(uint32_t page)
+    {
+        if (page >= m_pages.size())
+            m_pages.resize(page + 1, nullptr);
+        if (m_pages[page] == nullptr)
+        {
+            uint8_t *data = static_cast<uint8_t *>(alloc_external(ROM_PAGE_SIZE));
+            if (data == nullptr)
+                return nullptr;
+            uint32_t start = page << ROM_PAGE_SHIFT;
+            uint32_t copied = (start < m_shared.size) ? std::min(ROM_PAGE_SIZE, m_shared.size - start) : 0;
+            memcpy(data, m_shared.data + start, copied);
+            memset(data + copied, 0, ROM_PAGE_SIZE - copied);
+            m_pages[page] = data;
+            m_page_count++;
+            // the last read page may have been the shared one
+            m_read_page = UINT32_MAX;
+        }
+        return m_pages[page];
+    }
+
+    void free_pages()
+    {
+        for (uint8_t *page : m_pages)
+            free(page);
+        m_pages.clear();
+        m_page_count = 0;
+    }
+
+    shared_rom m_shared = { nullptr, 0 };
+    std::vector<uint8_t *, external_allocator<uint8_t *>> m_pages;
+    uint32_t m_page_count = 0;
+    uint8_t *m_data = nullptr;
+    uint32_t m_size = 0;
+    mutable uint32_t m_read_page = UINT32_MAX;
+    mutable uint8_t const *m_read_data = nullptr;
+    mutable uint32_t m_read_size = 0;
+};
+
 //*********************************************************
 //  CLASSES
 //*********************************************************
@@ -55,8 +345,14 @@ public:
         m_type(type),
         m_name(name)
     {
+        for (uint32_t index = 0; index < ymfm::ACCESS_CLASSES; index++)
+            m_rom[index].set_shared(shared_rom_table[type][index]);
     }
-    virtual ~vgm_chip_base() {}
+    virtual ~vgm_chip_base() { free(m_block_buffer); }
+
+    // chip state lives in internal DRAM when it fits (see MEMORY PLACEMENT)
+    static void *operator new(size_t size) noexcept { return alloc_internal(size); }
+    static void operator delete(void *ptr) { free(ptr); }
 
     // simple getters
     chip_type type() const { return m_type; }
@@ -64,27 +360,234 @@ public:
 
     // required methods for derived classes to implement
     virtual void write(uint32_t reg, uint8_t data) = 0;
-    virtual void generate(int32_t *buffer) = 0;
+    virtual void write_batch(uint32_t const *packed, uint32_t count) = 0;
+    virtual void generate(int32_t *buffer, uint32_t frames) = 0;
+    virtual size_t object_size() const = 0;
+
+    // lower (or restore) the internal sample rate; returns the new rate,
+    // or 0 if the chip has a single rate
+    virtual uint32_t set_low_rate(bool low) = 0;
+
+    // apply all queued writes without generating (seek fast-forward)
+    virtual void skip() = 0;
+
+    // save or restore the ymfm chip state (registers, envelopes, timers and
+    // PCM engines); ROM data, the fidelity and the resampler are not included
+    virtual void save_state(std::vector<uint8_t> &buffer) = 0;
+    virtual bool restore_state(std::vector<uint8_t> &buffer) = 0;
+
+    // a muted chip applies register writes but skips generate
+    void set_mute(bool mute) { m_muted = mute; }
+
+    // resample the output to output_rate (0 outputs at the chip rate)
+    void set_output_rate(uint32_t output_rate, vgm_resample_quality quality)
+    {
+        if (m_resampler.active() && m_resampler.output_rate() == output_rate)
+            m_resampler.set_quality(quality);
+        else
+            m_resampler.configure(sample_rate(), output_rate, quality);
+    }
+
+    // rate of the frames returned by generate_output
+    uint32_t output_sample_rate() const
+    {
+        return m_resampler.active() ? m_resampler.output_rate() : sample_rate();
+    }
+
+    // generate a block of stereo frames at the output rate, mixed into the buffer
+    void generate_output(int32_t *buffer, uint32_t frames)
+    {
+        if (!m_resampler.active())
+        {
+            generate(buffer, frames);
+            return;
+        }
+        while (frames != 0)
+        {
+            uint32_t count = std::min(frames, m_resampler.max_output());
+            uint32_t needed = m_resampler.input_needed(count);
+            generate(m_resampler.input(needed), needed);
+            m_resampler.resample(buffer, count);
+            buffer += count * 2;
+            frames -= count;
+        }
+    }
 
-    // write data to the ADPCM-A buffer
+    // write data over the ROM of an access class
     void write_data(ymfm::access_class type, uint32_t base, uint32_t length, uint8_t const *src)
     {
-        uint32_t end = base + length;
-        if (end > m_data[type].size())
-            m_data[type].resize(end);
-        memcpy(&m_data[type][base], src, length);
+        if (!m_rom[type].write(base, length, src))
+            fprintf(stderr, "Warning: %s rom write %08x+%x dropped\n", m_name.c_str(), base, length);
+    }
+
+    // zero-filled buffer for a block of frames, owned by the chip
+    int32_t *block_buffer(uint32_t frames)
+    {
+        if (frames > m_block_frames)
+        {
+            free(m_block_buffer);
+            m_block_buffer = static_cast<int32_t *>(alloc_internal(frames * 2 * sizeof(int32_t)));
+            m_block_frames = (m_block_buffer != nullptr) ? frames : 0;
+        }
+        if (m_block_buffer != nullptr)
+            memset(m_block_buffer, 0, frames * 2 * sizeof(int32_t));
+        return m_block_buffer;
+    }
+
+    // log where the chip state, block buffer and ROM data landed
+    void report_placement(uint32_t handle) const
+    {
+        uint32_t overlay = 0;
+        uint32_t shared = 0;
+        void const *overlay_data = nullptr;
+        void const *shared_data = nullptr;
+        for (auto const &rom : m_rom)
+        {
+            overlay += rom.overlay_bytes();
+            shared += rom.shared_bytes();
+            if (overlay_data == nullptr)
+                overlay_data = rom.overlay_data();
+            if (shared_data == nullptr)
+                shared_data = rom.shared_data();
+        }
+        fprintf(stderr, "ymfm chip %u %s: state %u bytes in %s, block %u bytes in %s, rom %u bytes in %s, shared rom %u bytes in %s\n",
+            handle, m_name.c_str(),
+            uint32_t(object_size()), placement_name(this),
+            uint32_t(m_block_frames * 2 * sizeof(int32_t)), placement_name(m_block_buffer),
+            overlay, placement_name(overlay_data),
+            shared, placement_name(shared_data));
+    }
+
+    // frames generated, and of those skipped while idle (at the chip rate)
+    uint64_t frames() const { return m_frames; }
+    uint64_t idle_frames() const { return m_idle_frames; }
+
+    // log the frames the chip has been idle
+    void report_idle(uint32_t handle) const
+    {
+        fprintf(stderr, "ymfm chip %u %s: idle %llu of %llu frames (%.1f%%)\n",
+            handle, m_name.c_str(),
+            (unsigned long long)m_idle_frames, (unsigned long long)m_frames,
+            (m_frames != 0) ? 100.0 * m_idle_frames / m_frames : 0.0);
     }
 
     // seek within the PCM stream
     void seek_pcm(uint32_t pos) { m_pcm_offset = pos; }
-    uint8_t read_pcm() { auto &pcm = m_data[ymfm::ACCESS_PCM]; return (m_pcm_offset < pcm.size()) ? pcm[m_pcm_offset++] : 0; }
+    uint8_t read_pcm() { return m_rom[ymfm::ACCESS_PCM].read(m_pcm_offset++); }
 
 protected:
     // internal state
     chip_type m_type;
     std::string m_name;
-    std::vector<uint8_t> m_data[ymfm::ACCESS_CLASSES];
+    rom_overlay m_rom[ymfm::ACCESS_CLASSES];
     uint32_t m_pcm_offset;
+    int32_t *m_block_buffer = nullptr;
+    uint32_t m_block_frames = 0;
+    bool m_muted = false;
+    vgm_resampler m_resampler;
+    uint64_t m_frames = 0;
+    uint64_t m_idle_frames = 0;
+};
+
+
+// ======================> vgm_fidelity
+
+// lowers the internal sample rate of a chip type; by default the rate is fixed
+
+template<typename ChipType>
+struct vgm_fidelity
+{
+    static bool set(ChipType &, bool) { return false; }
+};
+
+// OPN chips with SSG run the SSG at the FM rate on the lowest fidelity
+template<typename ChipType>
+struct vgm_opn_fidelity
+{
+    static bool set(ChipType &chip, bool low)
+    {
+        chip.set_fidelity(low ? ymfm::OPN_FIDELITY_MIN : ymfm::OPN_FIDELITY_DEFAULT);
+        return true;
+    }
+};
+
+template<> struct vgm_fidelity<ymfm::ym2203> : vgm_opn_fidelity<ymfm::ym2203> {};
+template<> struct vgm_fidelity<ymfm::ym2608> : vgm_opn_fidelity<ymfm::ym2608> {};
+template<> struct vgm_fidelity<ymfm::ym2610> : vgm_opn_fidelity<ymfm::ym2610> {};
+template<> struct vgm_fidelity<ymfm::ym2610b> : vgm_opn_fidelity<ymfm::ym2610b> {};
+
+
+// ======================> vgm_idle
+
+// tells if the engines of a chip stay silent until the next register write:
+// every FM operator released and fully attenuated, every SSG channel at zero
+// amplitude without envelope (timers are not run, so nothing keys on by
+// itself); by default a chip is never idle, as the PCM engines play on
+
+template<typename ChipType>
+struct vgm_idle
+{
+    static bool check(ChipType &) { return false; }
+};
+
+// the engines are protected members of the ymfm chip classes
+template<typename ChipType>
+struct vgm_engines : ChipType
+{
+    static constexpr auto fm() { return &vgm_engines::m_fm; }
+    static constexpr auto ssg() { return &vgm_engines::m_ssg; }
+};
+
+template<typename EngineType>
+bool fm_silent(EngineType &fm)
+{
+    for (uint32_t chnum = 0; chnum < EngineType::CHANNELS; chnum++)
+        for (uint32_t opnum = 0; opnum < 4; opnum++)
+        {
+            // unused operators of 2-op channels are null
+            auto *op = fm.debug_channel(chnum)->debug_operator(opnum);
+            if (op != nullptr && (op->debug_eg_state() != ymfm::EG_RELEASE || op->debug_eg_attenuation() < 0x3ff))
+                return false;
+        }
+    return true;
+}
+
+template<typename EngineType>
+bool ssg_silent(EngineType &ssg)
+{
+    for (uint32_t chnum = 0; chnum < 3; chnum++)
+        if (ssg.regs().ch_amplitude(chnum) != 0 || ssg.regs().ch_envelope_enable(chnum) != 0)
+            return false;
+    return true;
+}
+
+template<typename ChipType>
+struct vgm_fm_idle
+{
+    static bool check(ChipType &chip) { return fm_silent(chip.*vgm_engines<ChipType>::fm()); }
+};
+
+template<> struct vgm_idle<ymfm::ym2151> : vgm_fm_idle<ymfm::ym2151> {};
+template<> struct vgm_idle<ymfm::ym2413> : vgm_fm_idle<ymfm::ym2413> {};
+template<> struct vgm_idle<ymfm::ym2612> : vgm_fm_idle<ymfm::ym2612> {};
+template<> struct vgm_idle<ymfm::ym3526> : vgm_fm_idle<ymfm::ym3526> {};
+template<> struct vgm_idle<ymfm::ym3812> : vgm_fm_idle<ymfm::ym3812> {};
+template<> struct vgm_idle<ymfm::ymf262> : vgm_fm_idle<ymfm::ymf262> {};
+
+template<>
+struct vgm_idle<ymfm::ym2203>
+{
+    static bool check(ymfm::ym2203 &chip)
+    {
+        return fm_silent(chip.*vgm_engines<ymfm::ym2203>::fm())
+            && ssg_silent(chip.*vgm_engines<ymfm::ym2203>::ssg());
+    }
+};
+
+template<>
+struct vgm_idle<ymfm::ym2149>
+{
+    static bool check(ymfm::ym2149 &chip) { return ssg_silent(chip.*vgm_engines<ymfm::ym2149>::ssg()); }
 };
 
 
@@ -101,7 +604,9 @@ public:
         vgm_chip_base(clock, type, name),
         m_chip(*this),
         m_clock(clock),
-        m_clocks(0)
+        m_clocks(0),
+        m_queue_head(0),
+        m_queue_tail(0)
     {
         m_chip.reset();
     }
@@ -111,98 +616,153 @@ public:
         return m_chip.sample_rate(m_clock);
     }
 
-    // handle a register write: just queue for now
+    virtual size_t object_size() const override
+    {
+        return sizeof(*this);
+    }
+
+    // handle a register write: queue it to land before the next frame to be
+    // generated; the caller places writes within a block by generating up to
+    // them first (the chipstream tick loop flushes its batch before each render)
     virtual void write(uint32_t reg, uint8_t data) override
     {
-        m_queue.push_back(std::make_pair(reg, data));
+        // queue full; apply the oldest write now
+        if (m_queue_tail - m_queue_head == WRITE_QUEUE_SIZE)
+            apply(m_queue[m_queue_head++ & (WRITE_QUEUE_SIZE - 1)]);
+        m_queue[m_queue_tail++ & (WRITE_QUEUE_SIZE - 1)] = { reg, data };
     }
 
-    // generate one output sample of output
-    virtual void generate(int32_t *buffer) override
+    // handle a run of register writes packed as (reg << 8) | data
+    virtual void write_batch(uint32_t const *packed, uint32_t count) override
     {
-        uint32_t addr1 = 0xffff, addr2 = 0xffff;
-        uint8_t data1 = 0, data2 = 0;
+        for (uint32_t i = 0; i < count; i++)
+            vgm_chip::write(packed[i] >> 8, packed[i] & 0xff);
+    }
 
-        // see if there is data to be written; if so, extract it and dequeue
-        if (!m_queue.empty())
+    // generate a block of stereo output frames, mixed into the buffer
+    virtual void generate(int32_t *buffer, uint32_t frames) override
+    {
+        skip();
+        while (frames != 0)
         {
-            auto front = m_queue.front();
-            addr1 = 0 + 2 * ((front.first >> 8) & 3);
-            data1 = front.first & 0xff;
-            addr2 = addr1 + ((m_type == CHIP_YM2149) ? 2 : 1);
-            data2 = front.second;
-            m_queue.erase(m_queue.begin());
+            uint32_t count = std::min<uint32_t>(frames, GENERATE_BATCH_FRAMES);
+            render(buffer, count);
+            buffer += count * 2;
+            frames -= count;
         }
+    }
+
+    // queued writes are applied at the current rate before it changes;
+    // returns the new output rate
+    virtual uint32_t set_low_rate(bool low) override
+    {
+        while (m_queue_tail != m_queue_head)
+            apply(m_queue[m_queue_head++ & (WRITE_QUEUE_SIZE - 1)]);
+        if (!vgm_fidelity<ChipType>::set(m_chip, low))
+            return 0;
+        if (m_resampler.active())
+            m_resampler.set_input_rate(sample_rate());
+        return output_sample_rate();
+    }
+
+    virtual void skip() override
+    {
+        while (m_queue_tail != m_queue_head)
+            apply(m_queue[m_queue_head++ & (WRITE_QUEUE_SIZE - 1)]);
+    }
+
+    virtual void save_state(std::vector<uint8_t> &buffer) override
+    {
+        skip();
+        ymfm::ymfm_saved_state state(buffer, true);
+        m_chip.save_restore(state);
+        m_state_size = buffer.size();
+    }
+
+    // ymfm reads past the end of a state of another size, so the size is
+    // checked against the states saved by this chip; the writes queued and
+    // the frames held by the resampler are of the old position
+    virtual bool restore_state(std::vector<uint8_t> &buffer) override
+    {
+        if (m_state_size != 0 && buffer.size() != m_state_size)
+            return false;
+        ymfm::ymfm_saved_state state(buffer, false);
+        m_chip.save_restore(state);
+        m_queue_head = m_queue_tail;
+        m_clocks = 0;
+        m_resampler.reset();
+        m_idle = false;
+        m_silent_frames = 0;
+        return true;
+    }
+
+protected:
+    // queued register write
+    struct queued_write
+    {
+        uint32_t reg;
+        uint8_t data;
+    };
+
+    // write a queued register write to the chip
+    void apply(queued_write const &write)
+    {
+        m_idle = false;
+        m_silent_frames = 0;
+
+        uint32_t addr1 = 0 + 2 * ((write.reg >> 8) & 3);
+        uint8_t data1 = write.reg & 0xff;
+        uint32_t addr2 = addr1 + ((m_type == CHIP_YM2149) ? 2 : 1);
+        uint8_t data2 = write.data;
 
         // write to the chip
-        if (addr1 != 0xffff)
+        // if (LOG_WRITES)
+        //     printf("%10.5f: %s %03X=%02X\n", double(m_clocks) / double(m_chip.sample_rate(m_clock)), m_name.c_str(), data1, data2);
+        m_chip.write(addr1, data1);
+        m_chip.write(addr2, data2);
+    }
+
+    // generate frames at the chip sample rate and add them to the buffer;
+    // an idle chip adds nothing and is not clocked (LFO, noise and envelope
+    // counters resume from where they stopped)
+    void render(int32_t *buffer, uint32_t frames)
+    {
+        if (m_idle)
+            m_idle_frames += frames;
+        else if (!m_muted)
         {
-            // if (LOG_WRITES)
-            //     printf("%10.5f: %s %03X=%02X\n", double(m_clocks) / double(m_chip.sample_rate(m_clock)), m_name.c_str(), data1, data2);
-            m_chip.write(addr1, data1);
-            m_chip.write(addr2, data2);
+            m_chip.generate(m_output, frames);
+            vgm_mixer<ChipType>::mix(m_output, buffer, frames);
+            detect_idle(frames);
         }
+        m_frames += frames;
+        m_clocks += frames;
+    }
 
-        // generate at the appropriate sample rate
-        m_chip.generate(&m_output);
+    // count the trailing frames of zero output; the chip goes idle once they
+    // reach IDLE_FRAMES and its engines are silent
+    void detect_idle(uint32_t frames)
+    {
+        uint32_t index = frames;
+        while (index != 0 && silent(m_output[index - 1]))
+            index--;
+        m_silent_frames = (index == 0) ? m_silent_frames + frames : frames - index;
+        if (m_silent_frames >= IDLE_FRAMES && vgm_idle<ChipType>::check(m_chip))
+            m_idle = true;
+    }
 
-        // add the final result to the buffer
-        if (m_type == CHIP_YM2203)
-        {
-            int32_t out0 = m_output.data[0];
-            int32_t out1 = m_output.data[1 % ChipType::OUTPUTS];
-            int32_t out2 = m_output.data[2 % ChipType::OUTPUTS];
-            int32_t out3 = m_output.data[3 % ChipType::OUTPUTS];
-            *buffer++ += out0 + (out1 + out2 + out3) / 2;
-            *buffer++ += out0 + (out1 + out2 + out3) / 2;
-        }
-        else if (m_type == CHIP_YM2608 || m_type == CHIP_YM2610)
-        {
-            int32_t out0 = m_output.data[0];
-            int32_t out1 = m_output.data[1 % ChipType::OUTPUTS];
-            int32_t out2 = m_output.data[2 % ChipType::OUTPUTS];
-            *buffer++ += out0 + (out2 / 2);
-            *buffer++ += out1 + (out2 / 2);
-        }
-        else if (m_type == CHIP_YM2149)
-        {
-            int32_t out0 = m_output.data[0];
-            int32_t out1 = m_output.data[1 % ChipType::OUTPUTS];
-            int32_t out2 = m_output.data[2 % ChipType::OUTPUTS];
-            *buffer++ += (out0 + out1 + out2) / 2;
-            *buffer++ += (out0 + out1 + out2) / 2;
-        }
-        else if (m_type == CHIP_YMF278B)
-        {
-            *buffer++ += m_output.data[4];
-            *buffer++ += m_output.data[5];
-        }
-        else if (m_type == CHIP_YM2413)
-        {
-            int32_t out0 = m_output.data[0];
-            int32_t out1 = m_output.data[1 % ChipType::OUTPUTS];
-            *buffer++ += out0 + out1;
-            *buffer++ += out0 + out1;
-        }
-        else if (ChipType::OUTPUTS == 1)
-        {
-            *buffer++ += m_output.data[0] / 2;
-            *buffer++ += m_output.data[0] / 2;
-        }
-        else
-        {
-            *buffer++ += m_output.data[0];
-            *buffer++ += m_output.data[1 % ChipType::OUTPUTS];
-        }
-        m_clocks++;
+    static bool silent(typename ChipType::output_data const &output)
+    {
+        for (uint32_t index = 0; index < ChipType::OUTPUTS; index++)
+            if (output.data[index] != 0)
+                return false;
+        return true;
     }
 
-protected:
     // handle a read from the buffer
     virtual uint8_t ymfm_external_read(ymfm::access_class type, uint32_t offset) override
     {
-        auto &data = m_data[type];
-        return (offset < data.size()) ? data[offset] : 0;
+        return m_rom[type].read(offset);
     }
 
     virtual void ymfm_external_write(ymfm::access_class type, uint32_t address, uint8_t data) override
@@ -214,163 +774,606 @@ protected:
     ChipType m_chip;
     uint32_t m_clock;
     uint64_t m_clocks;
-    typename ChipType::output_data m_output;
-    std::vector<std::pair<uint32_t, uint8_t>> m_queue;
+    typename ChipType::output_data m_output[GENERATE_BATCH_FRAMES];
+    queued_write m_queue[WRITE_QUEUE_SIZE];
+    uint32_t m_queue_head;
+    uint32_t m_queue_tail;
+    uint32_t m_silent_frames = 0;
+    bool m_idle = false;
+    size_t m_state_size = 0;
+};
+
+// ======================> vgm_chip_state
+
+// chip state saved for a seek keyframe; keyframes are kept for the whole
+// track, so they go to PSRAM (allocated with new (std::nothrow), which is
+// nullptr when out of memory)
+struct vgm_chip_state
+{
+    static void *operator new(size_t size, std::nothrow_t const &) noexcept { return alloc_external(size); }
+    static void operator delete(void *ptr) { free(ptr); }
+    static void operator delete(void *ptr, std::nothrow_t const &) { free(ptr); }
+
+    chip_type type;
+    std::vector<uint8_t, external_allocator<uint8_t>> data;
 };
 
+// ymfm saves to and restores from a std::vector only, so keyframes pass
+// through this buffer (sized for the largest state once) on the way to and
+// from PSRAM
+std::vector<uint8_t> state_buffer;
+
 //*********************************************************
 //  GLOBAL HELPERS
 //*********************************************************
 
-// global list of active chips
-std::list<vgm_chip_base *> active_chips;
+// table of active chips, addressed by handle - 1 (0 is an invalid handle)
+vgm_chip_base *chip_table[MAX_CHIPS];
+
+#ifdef YMFM_PROFILE
+// per chip type render counters (host builds only); chips are rendered by
+// the render worker thread while the main thread reads the counters, so they
+// are relaxed atomics and the played and idle times are kept in nanoseconds
+struct chip_profile
+{
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> nanos;
+    std::atomic<uint64_t> played_nanos;
+    std::atomic<uint64_t> idle_nanos;
+};
+chip_profile profile_table[CHIP_TYPES];
+
+inline void generate_profiled(vgm_chip_base *chip, int32_t *buffer, uint32_t frames)
+{
+    uint64_t idle_frames = chip->idle_frames();
+    auto start = std::chrono::steady_clock::now();
+    chip->generate_output(buffer, frames);
+    auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    chip_profile &profile = profile_table[chip->type()];
+    profile.frames.fetch_add(frames, std::memory_order_relaxed);
+    profile.nanos.fetch_add(nanos, std::memory_order_relaxed);
+    profile.played_nanos.fetch_add(uint64_t(frames) * 1000000000 / chip->output_sample_rate(), std::memory_order_relaxed);
+    profile.idle_nanos.fetch_add((chip->idle_frames() - idle_frames) * 1000000000 / chip->sample_rate(), std::memory_order_relaxed);
+}
+#define CHIP_GENERATE(chip, buffer, frames) generate_profiled(chip, buffer, frames)
+#else
+#define CHIP_GENERATE(chip, buffer, frames) (chip)->generate_output(buffer, frames)
+#endif
 
 template<typename ChipType>
 uint32_t add_chips(uint32_t clock, chip_type type, char const *chipname)
 {
+    uint32_t slot = 0;
+    while (slot < MAX_CHIPS && chip_table[slot] != nullptr)
+        slot++;
+    if (slot == MAX_CHIPS)
+    {
+        fprintf(stderr, "Warning: too many chips, %s not added\n", chipname);
+        return 0;
+    }
+
     uint32_t clockval = clock & 0x3fffffff;
     vgm_chip<ChipType> *chip = new vgm_chip<ChipType>(clockval, type, chipname);
-    active_chips.push_back(new vgm_chip<ChipType>(clockval, type, chipname));
+    if (chip == nullptr)
+    {
+        fprintf(stderr, "Warning: out of memory, %s not added\n", chipname);
+        return 0;
+    }
+    chip_table[slot] = chip;
+
+    return slot + 1;
+}
+
+// access class of a VGM data block type
+ymfm::access_class access_class_of(uint16_t access_type)
+{
+    ymfm::access_class type = ymfm::ACCESS_ADPCM_B;
+    switch(access_type) {
+        case 0x81: // YM2608_DELTA_T
+            type = ymfm::ACCESS_ADPCM_B;
+            break;
+        case 0x82: // YM2610_ADPCM (Also used as YM2608)
+            type = ymfm::ACCESS_ADPCM_A;
+            break;
+        case 0x83: // YM2610_DELTA_T
+            type = ymfm::ACCESS_ADPCM_B;
+            break;
+        case 0x84: // YMF278B_ROM
+        case 0x87: // YMF278B_RAM
+            type = ymfm::ACCESS_PCM;
+            break;
+        case 0x88: // Y8950_ROM
+            type = ymfm::ACCESS_ADPCM_B;
+            break;
+    }
+
+    return type;
+}
+
+// nullptr for 0, out of range or removed handles; the entry points ignore them
+inline vgm_chip_base *find_chip(uint32_t handle)
+{
+    if (handle - 1 >= MAX_CHIPS)
+        return nullptr;
+    return chip_table[handle - 1];
+}
 
-    if (type == CHIP_YM2608)
+void remove_chip(uint32_t handle)
+{
+    if (find_chip(handle) == nullptr)
+        return;
+    delete chip_table[handle - 1];
+    chip_table[handle - 1] = nullptr;
+}
+
+//*********************************************************
+//  RENDER WORKER
+//*********************************************************
+
+// chips are independent and each renders into its own buffer, so the blocks
+// of a generate_blocks call are taken one by one by the worker on the other
+// core and by the caller, once the caller has rendered its own (non ymfm)
+// work; the output does not change
+
+// blocks of the current call, largest first; next is the next one to take
+struct render_job
+{
+    ymfm_block const *blocks;
+    uint8_t order[MAX_CHIPS];
+    uint32_t count;
+    std::atomic<uint32_t> next;
+};
+render_job worker_job;
+bool worker_running;
+bool worker_busy;
+
+void take_blocks(render_job &job)
+{
+    uint32_t index;
+    while ((index = job.next.fetch_add(1, std::memory_order_relaxed)) < job.count)
     {
-        fprintf(/* for output pcm stdout */ stderr, "load ym2608_adpcm_rom.bin using WASI\n");
-        FILE *rom = fopen("ym2608_adpcm_rom.bin", "rb");
-        if (rom == nullptr)
-            fprintf(stderr, "Warning: YM2608 enabled but ym2608_adpcm_rom.bin not found\n");
-        else
-        {
-            fseek(rom, 0, SEEK_END);
-            uint32_t size = ftell(rom);
-            fseek(rom, 0, SEEK_SET);
-            std::vector<uint8_t> temp(size);
-            fread(&temp[0], 1, size, rom);
-            fclose(rom);
-            for (auto chip : active_chips)
-                if (chip->type() == type)
-                    chip->write_data(ymfm::ACCESS_ADPCM_A, 0, size, &temp[0]);
-        }
+        ymfm_block const &block = job.blocks[job.order[index]];
+        vgm_chip_base *chip = find_chip(block.handle);
+        if (chip != nullptr)
+            CHIP_GENERATE(chip, block.buffer, block.frames);
     }
+}
 
-    return chip->sample_rate();
+#ifdef ESP_PLATFORM
+TaskHandle_t worker_task;
+TaskHandle_t worker_caller;
+
+void worker_main(void *)
+{
+    while (true)
+    {
+        // task notifications act as the barrier (and memory fence) both ways
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (!worker_running)
+            break;
+        take_blocks(worker_job);
+        xTaskNotifyGive(worker_caller);
+    }
+    vTaskDelete(nullptr);
 }
 
-vgm_chip_base *find_chip(chip_type type, uint8_t index)
+bool start_worker(int core)
 {
-    for (auto chip : active_chips)
-        if (chip->type() == type && index-- == 0)
-            return chip;
-    return nullptr;
+    worker_running = true;
+    if (xTaskCreatePinnedToCore(worker_main, "ymfm_worker", RENDER_WORKER_STACK_SIZE, nullptr,
+            RENDER_WORKER_PRIORITY, &worker_task, core) != pdPASS)
+    {
+        worker_running = false;
+        return false;
+    }
+    return true;
 }
 
-void remove_chip(chip_type type, uint8_t index)
+void stop_worker()
 {
-    vgm_chip_base *chip = find_chip(type, index);
-    if(chip != nullptr)
+    worker_running = false;
+    xTaskNotifyGive(worker_task);
+}
+
+void wake_worker()
+{
+    worker_caller = xTaskGetCurrentTaskHandle();
+    xTaskNotifyGive(worker_task);
+}
+
+void wait_worker()
+{
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+}
+#else
+// host: a std::thread stands in for the second core
+std::thread worker_thread;
+std::mutex worker_mutex;
+std::condition_variable worker_cond;
+uint32_t worker_request;
+uint32_t worker_done;
+
+void worker_main()
+{
+    std::unique_lock<std::mutex> lock(worker_mutex);
+    while (true)
     {
-        active_chips.remove(chip);
-        delete chip;
+        worker_cond.wait(lock, [] { return worker_request != worker_done || !worker_running; });
+        if (!worker_running)
+            break;
+        lock.unlock();
+        take_blocks(worker_job);
+        lock.lock();
+        worker_done = worker_request;
+        worker_cond.notify_all();
     }
 }
 
+bool start_worker(int)
+{
+    worker_running = true;
+    worker_request = worker_done = 0;
+    worker_thread = std::thread(worker_main);
+    return true;
+}
+
+void stop_worker()
+{
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        worker_running = false;
+    }
+    worker_cond.notify_all();
+    worker_thread.join();
+}
+
+void wake_worker()
+{
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        worker_request++;
+    }
+    worker_cond.notify_all();
+}
+
+void wait_worker()
+{
+    std::unique_lock<std::mutex> lock(worker_mutex);
+    worker_cond.wait(lock, [] { return worker_done == worker_request; });
+}
+#endif
+
 //*********************************************************
 //  FFI interface
 //*********************************************************
 extern "C" {
+// returns a chip handle, or 0 when the chip could not be added
 uint32_t ymfm_add_chip(uint16_t chip_num, uint32_t clock)
 {
-    uint32_t sampling_rate = 0;
+    uint32_t handle = 0;
     switch(chip_num)
     {
         case CHIP_YM2149:
-            sampling_rate = add_chips<ymfm::ym2149>(clock, static_cast<chip_type>(chip_num), "YM2149");
+            handle = add_chips<ymfm::ym2149>(clock, static_cast<chip_type>(chip_num), "YM2149");
             break;
         case CHIP_YM2151:
-            sampling_rate = add_chips<ymfm::ym2151>(clock, static_cast<chip_type>(chip_num), "YM2151");
+            handle = add_chips<ymfm::ym2151>(clock, static_cast<chip_type>(chip_num), "YM2151");
             break;
         case CHIP_YM2203:
-            sampling_rate = add_chips<ymfm::ym2203>(clock, static_cast<chip_type>(chip_num), "YM2203");
+            handle = add_chips<ymfm::ym2203>(clock, static_cast<chip_type>(chip_num), "YM2203");
             break;
         case CHIP_YM2413:
-            sampling_rate = add_chips<ymfm::ym2413>(clock, static_cast<chip_type>(chip_num), "YM2413");
+            handle = add_chips<ymfm::ym2413>(clock, static_cast<chip_type>(chip_num), "YM2413");
             break;
         case CHIP_YM2608:
-            sampling_rate = add_chips<ymfm::ym2608>(clock, static_cast<chip_type>(chip_num), "YM2608");
+            handle = add_chips<ymfm::ym2608>(clock, static_cast<chip_type>(chip_num), "YM2608");
             break;
         case CHIP_YM2610:
             if (clock & 0x80000000)
-                sampling_rate = add_chips<ymfm::ym2610b>(clock, static_cast<chip_type>(chip_num), "YM2610B");
+                handle = add_chips<ymfm::ym2610b>(clock, static_cast<chip_type>(chip_num), "YM2610B");
             else
-                sampling_rate = add_chips<ymfm::ym2610>(clock, static_cast<chip_type>(chip_num), "YM2610");
+                handle = add_chips<ymfm::ym2610>(clock, static_cast<chip_type>(chip_num), "YM2610");
             break;
         case CHIP_YM2612:
-            sampling_rate = add_chips<ymfm::ym2612>(clock, static_cast<chip_type>(chip_num), "YM2612");
+            handle = add_chips<ymfm::ym2612>(clock, static_cast<chip_type>(chip_num), "YM2612");
             break;
         case CHIP_YM3526:
-            sampling_rate = add_chips<ymfm::ym3526>(clock, static_cast<chip_type>(chip_num), "YM3526");
+            handle = add_chips<ymfm::ym3526>(clock, static_cast<chip_type>(chip_num), "YM3526");
             break;
         case CHIP_Y8950:
-            sampling_rate = add_chips<ymfm::y8950>(clock, static_cast<chip_type>(chip_num), "Y8950");
+            handle = add_chips<ymfm::y8950>(clock, static_cast<chip_type>(chip_num), "Y8950");
             break;
         case CHIP_YM3812:
-            sampling_rate = add_chips<ymfm::ym3812>(clock, static_cast<chip_type>(chip_num), "YM3812");
+            handle = add_chips<ymfm::ym3812>(clock, static_cast<chip_type>(chip_num), "YM3812");
             break;
         case CHIP_YMF262:
-            sampling_rate = add_chips<ymfm::ymf262>(clock, static_cast<chip_type>(chip_num), "YMF262");
+            handle = add_chips<ymfm::ymf262>(clock, static_cast<chip_type>(chip_num), "YMF262");
             break;
         case CHIP_YMF278B:
-            sampling_rate = add_chips<ymfm::ymf278b>(clock, static_cast<chip_type>(chip_num), "YMF278B");
+            handle = add_chips<ymfm::ymf278b>(clock, static_cast<chip_type>(chip_num), "YMF278B");
             break;
     }
-    return sampling_rate;
+    return handle;
 }
 
-void ymfm_write(uint16_t chip_num, uint16_t index, uint32_t reg, uint8_t data)
+uint32_t ymfm_get_sample_rate(uint32_t handle)
 {
-    vgm_chip_base* chip = find_chip(static_cast<chip_type>(chip_num), index);
-    chip->write(reg, data);
+    vgm_chip_base *chip = find_chip(handle);
+    if (chip == nullptr)
+        return 0;
+    return chip->output_sample_rate();
 }
 
-void ymfm_generate(uint16_t chip_num, uint16_t index, int32_t *buffer)
+// returns the new sample rate, or 0 if the chip has a single rate
+uint32_t ymfm_set_low_rate(uint32_t handle, bool low)
 {
-    vgm_chip_base* chip = find_chip(static_cast<chip_type>(chip_num), index);
-    chip->generate(buffer);
+    vgm_chip_base *chip = find_chip(handle);
+    if (chip == nullptr)
+        return 0;
+    return chip->set_low_rate(low);
 }
 
-void ymfm_remove_chip(uint16_t chip_num)
+void ymfm_set_mute(uint32_t handle, bool mute)
 {
-    // pop chip
-    remove_chip(static_cast<chip_type>(chip_num), 0);
+    vgm_chip_base *chip = find_chip(handle);
+    if (chip != nullptr)
+        chip->set_mute(mute);
 }
 
-// void ymfm_add_rom_data(uint16_t chip_num, uint16_t access_type, uint8_t *buffer, uint32_t length, uint32_t start_address)
-void ymfm_add_rom_data(uint16_t chip_num, uint16_t access_type, uint8_t *buffer, uint32_t length, uint32_t start_address)
+// resample the chip to output_rate (vgm_resample_quality); returns the new
+// sample rate, or 0 if the chip is not resampled (YM2149 ticks at 4x its rate)
+uint32_t ymfm_set_output_rate(uint32_t handle, uint32_t output_rate, uint8_t quality)
 {
-    ymfm::access_class type = ymfm::ACCESS_ADPCM_B;
-    switch(access_type) {
-        case 0x81: // YM2608_DELTA_T
-            type = ymfm::ACCESS_ADPCM_B;
-            break;
-        case 0x82: // YM2610_ADPCM (Also used as YM2608)
-            type = ymfm::ACCESS_ADPCM_A;
-            break;
-        case 0x83: // YM2610_DELTA_T
-            type = ymfm::ACCESS_ADPCM_B;
-            break;
-        case 0x84: // YMF278B_ROM
-        case 0x87: // YMF278B_RAM
-            type = ymfm::ACCESS_PCM;
-            break;
-        case 0x88: // Y8950_ROM
-            type = ymfm::ACCESS_ADPCM_B;
-            break;
+    vgm_chip_base *chip = find_chip(handle);
+    if (chip == nullptr || chip->type() == CHIP_YM2149 || quality > RESAMPLE_SINC)
+        return 0;
+    chip->set_output_rate(output_rate, static_cast<vgm_resample_quality>(quality));
+    return chip->output_sample_rate();
+}
+
+void ymfm_write(uint32_t handle, uint32_t reg, uint8_t data)
+{
+    vgm_chip_base *chip = find_chip(handle);
+    if (chip != nullptr)
+        chip->write(reg, data);
+}
+
+// packed writes are (reg << 8) | data, all landing before the next frame
+// generated; the caller places them by flushing before each render
+void ymfm_write_batch(uint32_t handle, const uint32_t *packed, uint32_t count)
+{
+    vgm_chip_base *chip = find_chip(handle);
+    if (chip != nullptr)
+        chip->write_batch(packed, count);
+}
+
+void ymfm_generate(uint32_t handle, int32_t *buffer)
+{
+    vgm_chip_base *chip = find_chip(handle);
+    if (chip != nullptr)
+        CHIP_GENERATE(chip, buffer, 1);
+}
+
+void ymfm_generate_block(uint32_t handle, int32_t *buffer, uint32_t frames)
+{
+    vgm_chip_base *chip = find_chip(handle);
+    if (chip != nullptr)
+        CHIP_GENERATE(chip, buffer, frames);
+}
+
+// start rendering a block for each chip; returns true when the render worker
+// has started on them, so that the caller can do other work until
+// ymfm_generate_blocks_end; the chips must not be used until then
+bool ymfm_generate_blocks_begin(ymfm_block const *blocks, uint32_t count)
+{
+    render_job &job = worker_job;
+    job.blocks = blocks;
+    job.count = std::min<uint32_t>(count, MAX_CHIPS);
+    for (uint32_t i = 0; i < job.count; i++)
+        job.order[i] = i;
+    std::sort(job.order, job.order + job.count, [blocks](uint8_t a, uint8_t b) { return blocks[a].frames > blocks[b].frames; });
+    job.next.store(0, std::memory_order_relaxed);
+    worker_busy = worker_running && job.count != 0;
+    if (worker_busy)
+        wake_worker();
+    return worker_busy;
+}
+
+// render the blocks not taken by the worker and wait for the worker
+void ymfm_generate_blocks_end()
+{
+    take_blocks(worker_job);
+    if (worker_busy)
+        wait_worker();
+    worker_busy = false;
+}
+
+void ymfm_generate_blocks(ymfm_block const *blocks, uint32_t count)
+{
+    ymfm_generate_blocks_begin(blocks, count);
+    ymfm_generate_blocks_end();
+}
+
+// start the render worker used by ymfm_generate_blocks on core (ESP32)
+bool ymfm_start_render_worker(int32_t core)
+{
+    if (worker_running)
+        return true;
+    return start_worker(core);
+}
+
+void ymfm_stop_render_worker()
+{
+    if (worker_running)
+        stop_worker();
+}
+
+// apply the queued writes without generating (seek fast-forward)
+void ymfm_skip(uint32_t handle)
+{
+    vgm_chip_base *chip = find_chip(handle);
+    if (chip != nullptr)
+        chip->skip();
+}
+
+// save the chip state for a seek keyframe, freed by ymfm_free_state; queued
+// writes are applied first
+vgm_chip_state *ymfm_save_state(uint32_t handle)
+{
+    vgm_chip_base *chip = find_chip(handle);
+    if (chip == nullptr)
+        return nullptr;
+    vgm_chip_state *state = new (std::nothrow) vgm_chip_state;
+    if (state == nullptr)
+        return nullptr;
+    chip->save_state(state_buffer);
+    state->type = chip->type();
+    state->data.assign(state_buffer.begin(), state_buffer.end());
+    return state;
+}
+
+// restore a state saved by ymfm_save_state; returns false if the state is of
+// another chip type
+bool ymfm_restore_state(uint32_t handle, vgm_chip_state const *state)
+{
+    vgm_chip_base *chip = find_chip(handle);
+    if (chip == nullptr || state->type != chip->type())
+        return false;
+    state_buffer.assign(state->data.begin(), state->data.end());
+    return chip->restore_state(state_buffer);
+}
+
+void ymfm_free_state(vgm_chip_state *state)
+{
+    delete state;
+}
+
+void ymfm_remove_chip(uint32_t handle)
+{
+    remove_chip(handle);
+}
+
+// zero-filled block buffer of frames (stereo) owned by the chip, in internal
+// DRAM when it fits; valid until the next call or the chip is removed
+int32_t *ymfm_get_block_buffer(uint32_t handle, uint32_t frames)
+{
+    vgm_chip_base *chip = find_chip(handle);
+    if (chip == nullptr)
+        return nullptr;
+    return chip->block_buffer(frames);
+}
+
+// log the placement of every chip and the free heap
+void ymfm_report_placement()
+{
+    for (uint32_t slot = 0; slot < MAX_CHIPS; slot++)
+        if (chip_table[slot] != nullptr)
+            chip_table[slot]->report_placement(slot + 1);
+#ifdef ESP_PLATFORM
+    fprintf(stderr, "ymfm heap: internal %u free (largest %u), psram %u free\n",
+        heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT),
+        heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT),
+        heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+#endif
+}
+
+// frames generated by the chip and of those skipped while idle, at the chip rate
+void ymfm_get_idle_frames(uint32_t handle, uint64_t *idle_frames, uint64_t *frames)
+{
+    vgm_chip_base *chip = find_chip(handle);
+    if (chip == nullptr)
+    {
+        *idle_frames = *frames = 0;
+        return;
     }
+    *idle_frames = chip->idle_frames();
+    *frames = chip->frames();
+}
+
+// log the frames every chip has been idle
+void ymfm_report_idle()
+{
+    for (uint32_t slot = 0; slot < MAX_CHIPS; slot++)
+        if (chip_table[slot] != nullptr)
+            chip_table[slot]->report_idle(slot + 1);
+}
+
+// void ymfm_add_rom_data(uint32_t handle, uint16_t access_type, uint8_t *buffer, uint32_t length, uint32_t start_address)
+void ymfm_add_rom_data(uint32_t handle, uint16_t access_type, uint8_t *buffer, uint32_t length, uint32_t start_address)
+{
+    vgm_chip_base *chip = find_chip(handle);
+    if (chip != nullptr)
+        chip->write_data(access_class_of(access_type), start_address, length, buffer);
+}
 
-    for (int index = 0; index < 2; index++)
+// shares a read-only sample ROM (e.g. memory-mapped flash) with every chip of
+// chip_num added afterwards; access_type is a VGM data block type, data must
+// stay valid while the chips are alive
+bool ymfm_set_shared_rom(uint16_t chip_num, uint16_t access_type, uint8_t const *data, uint32_t length)
+{
+    if (chip_num >= CHIP_TYPES || length > ROM_ADDRESS_LIMIT)
+        return false;
+    shared_rom_table[chip_num][access_class_of(access_type)] = { data, (data != nullptr) ? length : 0 };
+    return true;
+}
+
+// mixing bus kernels (ymfm_kernels.h) for the chipstream sound slot; the
+// i32 variants are the integer_mix bus, the f32 variants the float bus
+void ymfm_mix_accumulate_i32(int32_t *dst, int32_t const *src, uint32_t count)
+{
+    vgm_kernels::active::mix_accumulate(dst, src, count);
+}
+
+void ymfm_mix_accumulate_f32(float *dst, float const *src, uint32_t count)
+{
+    vgm_kernels::active::mix_accumulate(dst, src, count);
+}
+
+void ymfm_gain_i32(int32_t *buffer, uint32_t count, float gain)
+{
+    vgm_kernels::active::gain(buffer, count, gain);
+}
+
+void ymfm_gain_f32(float *buffer, uint32_t count, float gain)
+{
+    vgm_kernels::active::gain(buffer, count, gain);
+}
+
+void ymfm_saturate_interleave_i32(int32_t const *left, int32_t const *right, int16_t *s16le, uint32_t frames)
+{
+    vgm_kernels::active::saturate_interleave(left, right, s16le, frames);
+}
+
+void ymfm_saturate_interleave_f32(float const *left, float const *right, int16_t *s16le, uint32_t frames)
+{
+    vgm_kernels::active::saturate_interleave(left, right, s16le, frames);
+}
+
+#ifdef YMFM_PROFILE
+// returns false when chip_num has not generated any frames since the last reset
+bool ymfm_profile_get(uint16_t chip_num, uint64_t *frames, uint64_t *nanos, double *seconds, double *idle_seconds)
+{
+    if (chip_num >= CHIP_TYPES)
+        return false;
+    chip_profile const &profile = profile_table[chip_num];
+    *frames = profile.frames.load(std::memory_order_relaxed);
+    if (*frames == 0)
+        return false;
+    *nanos = profile.nanos.load(std::memory_order_relaxed);
+    *seconds = profile.played_nanos.load(std::memory_order_relaxed) / 1e9;
+    *idle_seconds = profile.idle_nanos.load(std::memory_order_relaxed) / 1e9;
+    return true;
+}
+
+void ymfm_profile_reset()
+{
+    for (chip_profile &profile : profile_table)
     {
-        vgm_chip_base *chip = find_chip(static_cast<chip_type>(chip_num), index);
-        if(chip != nullptr)
-            chip->write_data(type, start_address, length, buffer);
+        profile.frames.store(0, std::memory_order_relaxed);
+        profile.nanos.store(0, std::memory_order_relaxed);
+        profile.played_nanos.store(0, std::memory_order_relaxed);
+        profile.idle_nanos.store(0, std::memory_order_relaxed);
     }
 }
+#endif
 } // extern "C"
@@ -0,0 +1,78 @@
+/**
+ * cs_audio test (host)
+ *
+ * Plans every supported sample rate over a range of target latencies and
+ * checks the limits of the chunk, ring buffer and DMA buffers, that the
+ * reported latency is the play time of the buffers, and that the default
+ * (44.1kHz, 210ms) is 32 chunks of 256 frames with 4 DMA buffers.
+ */
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include "cs_audio.h"
+
+#define LATENCY_MIN_MS 10
+#define LATENCY_MAX_MS 2000
+
+int main(void)
+{
+    cs_audio_config_t config;
+    if(plan_cs_audio(11025, 200, &config) || plan_cs_audio(0, 200, &config)) {
+        printf("NG: rate\n");
+        return 1;
+    }
+
+    const uint32_t sample_rates[] = { 22050, 32000, 44100, 48000 };
+    uint32_t plans = 0;
+    for(uint32_t sample_rate : sample_rates) {
+        for(uint32_t latency_ms = LATENCY_MIN_MS; latency_ms <= LATENCY_MAX_MS; latency_ms += 5) {
+            if(!plan_cs_audio(sample_rate, latency_ms, &config)) {
+                printf("NG: plan %u %u\n", sample_rate, latency_ms);
+                return 1;
+            }
+            uint32_t buffers = config.chunk_hold + config.dma_buf_count;
+            uint64_t latency_us = (uint64_t)buffers * config.chunk_frames * 1000000 / sample_rate;
+            // a chunk of I2S DMA (dma_buf_len * 4 bytes) is at most 4092 bytes
+            if(config.chunk_frames % CS_AUDIO_CHUNK_ALIGN != 0
+                || config.chunk_frames < CS_AUDIO_MIN_CHUNK_FRAMES
+                || config.chunk_frames > CS_AUDIO_MAX_CHUNK_FRAMES
+                || config.chunk_frames * CS_AUDIO_CHANNELS * sizeof(int16_t) > 4092
+                || config.chunk_hold < CS_AUDIO_MIN_CHUNK_HOLD
+                || config.chunk_hold > CS_AUDIO_MAX_CHUNK_HOLD
+                || config.dma_buf_count < CS_AUDIO_MIN_DMA_BUF_COUNT
+                || config.ring_buf_bytes % 4 != 0
+                || config.latency_us != latency_us) {
+                printf("NG: limits %u %u\n", sample_rate, latency_ms);
+                return 1;
+            }
+            // within a chunk of the target unless the limits are reached
+            uint64_t target_us = (uint64_t)latency_ms * 1000;
+            bool limited = config.chunk_frames == CS_AUDIO_MIN_CHUNK_FRAMES
+                || config.chunk_frames == CS_AUDIO_MAX_CHUNK_FRAMES;
+            if(!limited && (latency_us > target_us || latency_us + 2 * config.chunk_us < target_us)) {
+                printf("NG: latency %u %u -> %u us\n", sample_rate, latency_ms, config.latency_us);
+                return 1;
+            }
+            plans++;
+        }
+    }
+
+    cs_audio_config_t other;
+    plan_cs_audio(44100, 210, &config);
+    plan_cs_audio(44100, 210, &other);
+    if(config.chunk_frames != 256 || config.chunk_hold != 32 || config.dma_buf_count != 4
+        || !equal_cs_audio(&config, &other)) {
+        printf("NG: default %u %u %u\n", config.chunk_frames, config.chunk_hold, config.dma_buf_count);
+        return 1;
+    }
+    plan_cs_audio(48000, 210, &other);
+    if(equal_cs_audio(&config, &other)) {
+        printf("NG: equal\n");
+        return 1;
+    }
+    dump_cs_audio(&config);
+    printf("OK: %u plans\n", plans);
+
+    return 0;
+}
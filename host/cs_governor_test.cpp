@@ -0,0 +1,84 @@
+/**
+ * cs_governor test (host)
+ *
+ * Drains the ring buffer as a render slower than realtime would and checks
+ * that the quality steps down one level per hold, stops at the lowest level,
+ * and steps back up only after the buffer has stayed full.
+ */
+#include <cstdint>
+#include <cstdio>
+
+#include "cs_governor.h"
+
+#define LEVELS 4
+#define HOLD_CHUNKS 32
+#define LOW_WATERMARK 8
+#define HIGH_WATERMARK 24
+#define HOLD 16
+
+int main(void)
+{
+    init_cs_governor(LEVELS, LOW_WATERMARK, HIGH_WATERMARK, HOLD);
+
+    // full buffer stays at full quality
+    for(uint32_t i = 0; i < HOLD * CS_GOVERNOR_UP_HOLD_FACTOR * 2; i++) {
+        if(update_cs_governor(HOLD_CHUNKS) != 0) {
+            printf("NG: full\n");
+            return 1;
+        }
+    }
+
+    // starving: first step at once, then one step per HOLD chunks
+    if(update_cs_governor(LOW_WATERMARK - 1) != 1) {
+        printf("NG: first step\n");
+        return 1;
+    }
+    for(uint32_t level = 2; level < LEVELS; level++) {
+        for(uint32_t i = 0; i < HOLD - 1; i++) {
+            if(update_cs_governor(LOW_WATERMARK - 1) != level - 1) {
+                printf("NG: hold %u\n", level);
+                return 1;
+            }
+        }
+        if(update_cs_governor(LOW_WATERMARK - 1) != level) {
+            printf("NG: step %u\n", level);
+            return 1;
+        }
+    }
+    for(uint32_t i = 0; i < HOLD * 4; i++) {
+        if(update_cs_governor(0) != LEVELS - 1) {
+            printf("NG: lowest\n");
+            return 1;
+        }
+    }
+
+    // between the watermarks nothing changes
+    for(uint32_t i = 0; i < HOLD * CS_GOVERNOR_UP_HOLD_FACTOR * 2; i++) {
+        if(update_cs_governor(LOW_WATERMARK + 1) != LEVELS - 1) {
+            printf("NG: hysteresis\n");
+            return 1;
+        }
+    }
+
+    // refilled: a step up after a full hold over the high watermark,
+    // a dip below it restarts the hold
+    uint32_t up_hold = HOLD * CS_GOVERNOR_UP_HOLD_FACTOR;
+    for(uint32_t i = 0; i < up_hold - 1; i++) update_cs_governor(HIGH_WATERMARK);
+    update_cs_governor(HIGH_WATERMARK - 1);
+    for(uint32_t i = 0; i < up_hold - 1; i++) update_cs_governor(HIGH_WATERMARK);
+    if(update_cs_governor(HIGH_WATERMARK) != LEVELS - 2) {
+        printf("NG: step up\n");
+        return 1;
+    }
+
+    cs_governor_stats_t stats;
+    get_stats_cs_governor(&stats);
+    if(stats.level != LEVELS - 2 || stats.step_down_count != LEVELS - 1
+        || stats.step_up_count != 1 || stats.lowest_fill != 0) {
+        printf("NG: stats %u %u %u %u\n", stats.level, stats.step_down_count, stats.step_up_count, stats.lowest_fill);
+        return 1;
+    }
+    printf("OK: down %u, up %u\n", stats.step_down_count, stats.step_up_count);
+
+    return 0;
+}
@@ -0,0 +1,401 @@
+/**
+ * chipstream offline renderer and benchmark (host)
+ *
+ * Renders VGM/VGZ files (or directories of them) through main/chipstream.c
+ * to s16le stereo WAV, and reports per file and per chip throughput.
+ *
+ *  cs_render [--json] [--loops N] [--rate HZ] [--chunk FRAMES] [--rom IMAGE] [-o DIR] FILE|DIR...
+ *
+ * x-realtime is seconds of audio rendered per second of render time.
+ * Per chip figures come from the YMFM_PROFILE counters in ymfmffi.cpp
+ * and are measured at the native sample rate of each chip; idle is the
+ * share of the audio a chip skipped generating as silent.
+ * Peak heap is the largest malloc in-use size seen while loading and rendering.
+ * --rom shares the sample ROMs of a rom partition image (tools/mkrompart.py)
+ * with the chips, as the rom partition does on the device.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <malloc.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_CYCLE_COUNTER 1
+#endif
+
+#include "chipstream.h"
+#include "rom_partition.h"
+
+extern "C" {
+bool ymfm_profile_get(uint16_t chip_num, uint64_t *frames, uint64_t *nanos, double *seconds, double *idle_seconds);
+void ymfm_profile_reset();
+}
+
+/**
+ * chip_type in ymfmffi.cpp
+ */
+static const char *chip_names[] = {
+    "YM2149", "YM2151", "YM2203", "YM2413", "YM2608", "YM2610",
+    "YM2612", "YM3526", "Y8950", "YM3812", "YMF262", "YMF278B",
+};
+
+#define CS_INSTANCE_ID 0
+#define CS_LOOP_END 0xffffffff
+#define VGM_LOAD_CHUNK_BYTES 4096
+// safety net for files whose loop never ends
+#define RENDER_MAX_SECONDS 1200
+
+typedef struct render_option {
+    bool json;
+    uint32_t loop_max_count;
+    uint32_t sample_rate;
+    uint32_t sample_chunk_size;
+    const char *output_dir;
+} render_option_t;
+
+typedef struct render_result {
+    uint64_t frames;
+    double load_sec;
+    double render_sec;
+    uint64_t cycles;
+    size_t peak_heap;
+} render_result_t;
+
+static size_t heap_in_use()
+{
+    return mallinfo2().uordblks;
+}
+
+static uint64_t cycle_counter()
+{
+    #if HAS_CYCLE_COUNTER
+    return __rdtsc();
+    #else
+    return 0;
+    #endif
+}
+
+static double elapsed_sec(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool has_vgm_ext(const std::string &path)
+{
+    size_t dot = path.rfind('.');
+    if(dot == std::string::npos) return false;
+    std::string ext = path.substr(dot);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == ".vgm" || ext == ".vgz";
+}
+
+/**
+ * Collect .vgm/.vgz files (directories are not recursed)
+ */
+static void collect_files(const char *path, std::vector<std::string> &files)
+{
+    struct stat st;
+    if(stat(path, &st) != 0) {
+        fprintf(stderr, "cs_render: %s not found\n", path);
+        return;
+    }
+    if(!S_ISDIR(st.st_mode)) {
+        files.push_back(path);
+        return;
+    }
+    DIR *dir = opendir(path);
+    if(dir == nullptr) return;
+    std::vector<std::string> entries;
+    struct dirent *entry;
+    while((entry = readdir(dir)) != nullptr) {
+        std::string name = entry->d_name;
+        if(has_vgm_ext(name)) {
+            entries.push_back(std::string(path) + "/" + name);
+        }
+    }
+    closedir(dir);
+    std::sort(entries.begin(), entries.end());
+    files.insert(files.end(), entries.begin(), entries.end());
+}
+
+static std::string json_escape(const std::string &text)
+{
+    std::string escaped;
+    for(char c : text) {
+        if(c == '"' || c == '\\') escaped += '\\';
+        if((unsigned char)c >= 0x20) escaped += c;
+    }
+    return escaped;
+}
+
+static void put_le(FILE *fp, uint32_t value, int bytes)
+{
+    for(int i = 0; i < bytes; i++) {
+        fputc((value >> (i * 8)) & 0xff, fp);
+    }
+}
+
+/**
+ * Write (or rewrite) 44 bytes RIFF WAVE header for s16le stereo
+ */
+static void write_wav_header(FILE *fp, uint32_t sample_rate, uint64_t frames)
+{
+    uint32_t data_bytes = (uint32_t)std::min<uint64_t>(frames * 4, 0xffffffffULL - 36);
+    fseek(fp, 0, SEEK_SET);
+    fwrite("RIFF", 1, 4, fp);
+    put_le(fp, 36 + data_bytes, 4);
+    fwrite("WAVEfmt ", 1, 8, fp);
+    put_le(fp, 16, 4);
+    put_le(fp, 1, 2);               // PCM
+    put_le(fp, 2, 2);               // channels
+    put_le(fp, sample_rate, 4);
+    put_le(fp, sample_rate * 4, 4); // byte rate
+    put_le(fp, 4, 2);               // block align
+    put_le(fp, 16, 2);              // bits per sample
+    fwrite("data", 1, 4, fp);
+    put_le(fp, data_bytes, 4);
+}
+
+static std::string wav_path(const char *output_dir, const std::string &file)
+{
+    size_t slash = file.rfind('/');
+    std::string base = slash == std::string::npos ? file : file.substr(slash + 1);
+    size_t dot = base.rfind('.');
+    if(dot != std::string::npos) base = base.substr(0, dot);
+    return std::string(output_dir) + "/" + base + ".wav";
+}
+
+/**
+ * Share the sample ROMs of a rom partition image, as init_rom_partition does
+ *
+ * The image is kept loaded while the chips use it.
+ */
+static bool load_rom_image(const char *file)
+{
+    static std::vector<uint8_t> image;
+    FILE *fp = fopen(file, "rb");
+    if(fp == nullptr) {
+        fprintf(stderr, "cs_render: can not open %s\n", file);
+        return false;
+    }
+    uint8_t buffer[VGM_LOAD_CHUNK_BYTES];
+    size_t length;
+    while((length = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        image.insert(image.end(), buffer, buffer + length);
+    }
+    fclose(fp);
+
+    rom_partition_header_t header = {};
+    if(image.size() >= sizeof(header)) {
+        memcpy(&header, image.data(), sizeof(header));
+    }
+    if(memcmp(header.magic, ROM_PARTITION_MAGIC, sizeof(header.magic)) != 0
+        || header.version != ROM_PARTITION_VERSION
+        || header.count > ROM_PARTITION_MAX_IMAGES
+        || image.size() < sizeof(header) + header.count * sizeof(rom_partition_entry_t)) {
+        fprintf(stderr, "cs_render: %s is not a rom image (tools/mkrompart.py)\n", file);
+        return false;
+    }
+    for(uint32_t i = 0; i < header.count; i++) {
+        rom_partition_entry_t entry;
+        memcpy(&entry, image.data() + sizeof(header) + i * sizeof(entry), sizeof(entry));
+        if(entry.offset > image.size() || entry.size > image.size() - entry.offset) {
+            fprintf(stderr, "cs_render: %s: image %u is out of the file\n", file, i);
+            return false;
+        }
+        cs_set_shared_rom(entry.chip_num, entry.access_type, image.data() + entry.offset, entry.size);
+    }
+
+    return true;
+}
+
+/**
+ * Load a vgm/vgz file by chunks, as main.cpp does from SD
+ */
+static bool load_vgm(const std::string &file, const render_option_t &option, render_result_t &result)
+{
+    FILE *fp = fopen(file.c_str(), "rb");
+    if(fp == nullptr) {
+        fprintf(stderr, "cs_render: can not open %s\n", file.c_str());
+        return false;
+    }
+    static uint8_t chunk[VGM_LOAD_CHUNK_BYTES];
+    auto start = std::chrono::steady_clock::now();
+    cs_create_vgm_stream(CS_INSTANCE_ID, option.sample_rate, option.sample_chunk_size);
+    bool loaded = true;
+    size_t length;
+    while(loaded && (length = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        loaded = cs_load_vgm_stream(CS_INSTANCE_ID, chunk, length);
+        result.peak_heap = std::max(result.peak_heap, heap_in_use());
+    }
+    fclose(fp);
+    if(loaded) {
+        loaded = cs_end_vgm_stream(CS_INSTANCE_ID);
+    }
+    result.load_sec = elapsed_sec(start);
+    result.peak_heap = std::max(result.peak_heap, heap_in_use());
+    if(!loaded) {
+        fprintf(stderr, "cs_render: %s is not a vgm/vgz file\n", file.c_str());
+    }
+
+    return loaded;
+}
+
+/**
+ * Render until loop_max_count loops (or the end of data)
+ *
+ * Only cs_stream_vgm is timed; WAV writing and heap sampling are not.
+ */
+static void render_vgm(FILE *wav, const render_option_t &option, render_result_t &result)
+{
+    std::vector<int16_t> s16le(option.sample_chunk_size * 2);
+    uint64_t max_frames = (uint64_t)option.sample_rate * RENDER_MAX_SECONDS;
+    std::chrono::steady_clock::duration render_time(0);
+    while(result.frames < max_frames) {
+        uint32_t loop_count;
+        auto start = std::chrono::steady_clock::now();
+        uint64_t cycles = cycle_counter();
+        uint32_t frames = cs_stream_vgm(CS_INSTANCE_ID, s16le.data(), &loop_count);
+        result.cycles += cycle_counter() - cycles;
+        render_time += std::chrono::steady_clock::now() - start;
+
+        result.frames += frames;
+        result.peak_heap = std::max(result.peak_heap, heap_in_use());
+        if(wav != nullptr) {
+            fwrite(s16le.data(), sizeof(int16_t) * 2, frames, wav);
+        }
+        if(loop_count == CS_LOOP_END || loop_count > option.loop_max_count) break;
+    }
+    result.render_sec = std::chrono::duration<double>(render_time).count();
+}
+
+static void report_file(const std::string &file, const render_option_t &option, const render_result_t &result)
+{
+    double audio_sec = (double)result.frames / option.sample_rate;
+    double x_realtime = result.render_sec > 0 ? audio_sec / result.render_sec : 0;
+    double cycles_per_sample = result.frames > 0 ? (double)result.cycles / result.frames : 0;
+    if(option.json) {
+        printf("{\"type\":\"file\",\"file\":\"%s\",\"sample_rate\":%u,\"frames\":%llu,"
+            "\"audio_sec\":%.3f,\"load_sec\":%.6f,\"render_sec\":%.6f,\"x_realtime\":%.3f,"
+            "\"cycles_per_sample\":%.1f,\"peak_heap\":%zu}\n",
+            json_escape(file).c_str(), option.sample_rate, (unsigned long long)result.frames,
+            audio_sec, result.load_sec, result.render_sec, x_realtime,
+            cycles_per_sample, result.peak_heap);
+    } else {
+        printf("%s: %.1fs audio in %.3fs (load %.3fs): x%.2f realtime, %.0f cycles/sample, peak heap %zu bytes\n",
+            file.c_str(), audio_sec, result.render_sec, result.load_sec, x_realtime,
+            cycles_per_sample, result.peak_heap);
+    }
+    for(uint16_t chip_num = 0; chip_num < sizeof(chip_names) / sizeof(chip_names[0]); chip_num++) {
+        uint64_t frames, nanos;
+        double seconds, idle_seconds;
+        if(!ymfm_profile_get(chip_num, &frames, &nanos, &seconds, &idle_seconds)) continue;
+        double chip_sec = nanos / 1e9;
+        double chip_x_realtime = chip_sec > 0 ? seconds / chip_sec : 0;
+        double idle_percent = seconds > 0 ? idle_seconds * 100 / seconds : 0;
+        if(option.json) {
+            printf("{\"type\":\"chip\",\"file\":\"%s\",\"chip\":\"%s\",\"frames\":%llu,"
+                "\"audio_sec\":%.3f,\"render_sec\":%.6f,\"x_realtime\":%.3f,\"idle_percent\":%.1f}\n",
+                json_escape(file).c_str(), chip_names[chip_num], (unsigned long long)frames,
+                seconds, chip_sec, chip_x_realtime, idle_percent);
+        } else {
+            printf("  %-8s %llu frames in %.3fs: x%.2f realtime, idle %.1f%%\n",
+                chip_names[chip_num], (unsigned long long)frames, chip_sec, chip_x_realtime, idle_percent);
+        }
+    }
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: cs_render [--json] [--loops N] [--rate HZ] [--chunk FRAMES] [--rom IMAGE] [-o DIR] FILE|DIR...\n");
+}
+
+int main(int argc, char *argv[])
+{
+    render_option_t option = { false, 1, 44100, 256, nullptr };
+    std::vector<std::string> files;
+    for(int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if(strcmp(arg, "--json") == 0) {
+            option.json = true;
+        } else if(strcmp(arg, "--loops") == 0 && has_value) {
+            option.loop_max_count = strtoul(argv[++i], nullptr, 10);
+        } else if(strcmp(arg, "--rate") == 0 && has_value) {
+            option.sample_rate = strtoul(argv[++i], nullptr, 10);
+        } else if(strcmp(arg, "--chunk") == 0 && has_value) {
+            option.sample_chunk_size = strtoul(argv[++i], nullptr, 10);
+        } else if(strcmp(arg, "--rom") == 0 && has_value) {
+            if(!load_rom_image(argv[++i])) {
+                return 2;
+            }
+        } else if(strcmp(arg, "-o") == 0 && has_value) {
+            option.output_dir = argv[++i];
+        } else if(arg[0] == '-') {
+            usage();
+            return 2;
+        } else {
+            collect_files(arg, files);
+        }
+    }
+    if(files.empty() || option.sample_rate == 0 || option.sample_chunk_size == 0) {
+        usage();
+        return 2;
+    }
+
+    int failed = 0;
+    render_result_t total = {};
+    for(const std::string &file : files) {
+        render_result_t result = {};
+        ymfm_profile_reset();
+        if(!load_vgm(file, option, result)) {
+            failed++;
+            continue;
+        }
+        FILE *wav = nullptr;
+        if(option.output_dir != nullptr) {
+            wav = fopen(wav_path(option.output_dir, file).c_str(), "wb");
+            if(wav == nullptr) {
+                fprintf(stderr, "cs_render: can not write %s\n", wav_path(option.output_dir, file).c_str());
+            } else {
+                write_wav_header(wav, option.sample_rate, 0);
+            }
+        }
+        render_vgm(wav, option, result);
+        if(wav != nullptr) {
+            write_wav_header(wav, option.sample_rate, result.frames);
+            fclose(wav);
+        }
+        cs_drop_vgm(CS_INSTANCE_ID);
+        report_file(file, option, result);
+
+        total.frames += result.frames;
+        total.load_sec += result.load_sec;
+        total.render_sec += result.render_sec;
+        total.cycles += result.cycles;
+        total.peak_heap = std::max(total.peak_heap, result.peak_heap);
+    }
+
+    double audio_sec = (double)total.frames / option.sample_rate;
+    double x_realtime = total.render_sec > 0 ? audio_sec / total.render_sec : 0;
+    double cycles_per_sample = total.frames > 0 ? (double)total.cycles / total.frames : 0;
+    if(option.json) {
+        printf("{\"type\":\"total\",\"files\":%zu,\"failed\":%d,\"audio_sec\":%.3f,"
+            "\"render_sec\":%.6f,\"x_realtime\":%.3f,\"cycles_per_sample\":%.1f,\"peak_heap\":%zu}\n",
+            files.size(), failed, audio_sec, total.render_sec, x_realtime,
+            cycles_per_sample, total.peak_heap);
+    } else {
+        printf("total: %zu files (%d failed), %.1fs audio in %.3fs: x%.2f realtime, %.0f cycles/sample, peak heap %zu bytes\n",
+            files.size(), failed, audio_sec, total.render_sec, x_realtime,
+            cycles_per_sample, total.peak_heap);
+    }
+
+    return failed == 0 ? 0 : 1;
+}
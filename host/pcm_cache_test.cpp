@@ -0,0 +1,190 @@
+/**
+ * pcm_cache test (host)
+ *
+ * Renders a fake track into the cache with a pause and a resume in the
+ * middle, and checks that reading it back returns the same frames and
+ * loop counts as the render. Then checks validation and eviction
+ * (of .part files too).
+ */
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "pcm_cache.h"
+
+#define CHUNK_FRAMES 256
+#define TRACK_CHUNKS 300
+// loop count changes after these chunks, the track ends with loops > LOOP_MAX
+#define LOOP_CHUNK 100
+#define LOOP_CHUNKS 90
+#define LOOP_MAX 2
+#define LAST_FRAMES 100
+#define PAUSE_CHUNK 150
+
+/**
+ * Fake render of chunk (as cs_stream_vgm), returns frames
+ */
+static uint32_t render_chunk(uint32_t chunk, int16_t *s16le, uint32_t *loop_count)
+{
+    uint32_t loops = chunk < LOOP_CHUNK ? 0 : 1 + (chunk - LOOP_CHUNK) / LOOP_CHUNKS;
+    bool last = loops > LOOP_MAX;
+    for(uint32_t i = 0; i < CHUNK_FRAMES * 2; i++) {
+        s16le[i] = (int16_t)(chunk * 31 + i * 7);
+    }
+    *loop_count = loops;
+    return last ? LAST_FRAMES : CHUNK_FRAMES;
+}
+
+/**
+ * Render the track from the start, stop after stop_chunk chunks (or the end)
+ */
+static bool render_track(const pcm_cache_key_t *key, uint32_t stop_chunk, std::vector<uint32_t> &loop_counts)
+{
+    pcm_cache_writer_t writer;
+    if(!begin_pcm_cache(key, &writer)) return false;
+    int16_t s16le[CHUNK_FRAMES * 2];
+    for(uint32_t chunk = 0; chunk < TRACK_CHUNKS; chunk++) {
+        uint32_t loop_count;
+        uint32_t frames = render_chunk(chunk, s16le, &loop_count);
+        if(!write_pcm_cache(&writer, s16le, frames, loop_count)) return false;
+        loop_counts.push_back(loop_count);
+        if(loop_count > LOOP_MAX) return end_pcm_cache(&writer);
+        if(chunk + 1 == stop_chunk) {
+            pause_pcm_cache(&writer);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Play the cache of key (open and close), returns its play sequence
+ */
+static uint32_t play(const pcm_cache_key_t *key)
+{
+    pcm_cache_reader_t reader;
+    if(!open_pcm_cache(key, &reader)) return 0;
+    close_pcm_cache(&reader);
+    return reader.header.play_sequence;
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/pcm_cache_testXXXXXX";
+    if(mkdtemp(dir) == nullptr) return 1;
+    std::string cache_dir = std::string(dir) + "/cache";
+    if(!init_pcm_cache(cache_dir.c_str(), 64ull << 20)) return 1;
+
+    uint8_t vgm[] = { 'V', 'g', 'm', ' ' };
+    pcm_cache_key_t key = { hash_pcm_cache(PCM_CACHE_HASH_INIT, vgm, sizeof(vgm)), sizeof(vgm), 44100, LOOP_MAX };
+
+    // paused render, then resumed from the start
+    std::vector<uint32_t> loop_counts;
+    if(!render_track(&key, PAUSE_CHUNK, loop_counts) || exists_pcm_cache(&key)) {
+        printf("NG: pause\n");
+        return 1;
+    }
+    loop_counts.clear();
+    if(!render_track(&key, 0, loop_counts) || !exists_pcm_cache(&key)) {
+        printf("NG: resume\n");
+        return 1;
+    }
+
+    // read back as task_cs plays
+    pcm_cache_reader_t reader;
+    if(!open_pcm_cache(&key, &reader)) {
+        printf("NG: open\n");
+        return 1;
+    }
+    int16_t expect[CHUNK_FRAMES * 2];
+    int16_t actual[CHUNK_FRAMES * 2];
+    for(uint32_t chunk = 0; chunk < loop_counts.size(); chunk++) {
+        uint32_t expect_loop;
+        uint32_t expect_frames = render_chunk(chunk, expect, &expect_loop);
+        uint32_t loop_count;
+        uint32_t frames = read_pcm_cache(&reader, actual, CHUNK_FRAMES, &loop_count);
+        if(frames != expect_frames || loop_count != loop_counts[chunk]
+            || memcmp(actual, expect, frames * 2 * sizeof(int16_t)) != 0) {
+            printf("NG: chunk %u frames %u/%u loop %u/%u\n", chunk, frames, expect_frames, loop_count, loop_counts[chunk]);
+            return 1;
+        }
+    }
+    close_pcm_cache(&reader);
+
+    // another loop count is another cache
+    pcm_cache_key_t other = key;
+    other.loop_max_count = 0;
+    if(exists_pcm_cache(&other)) {
+        printf("NG: key\n");
+        return 1;
+    }
+
+    // truncated file is removed
+    char path[PCM_CACHE_FILE_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%08x_%u_%u.pcm", cache_dir.c_str(), key.vgm_hash, key.sample_rate, key.loop_max_count);
+    size_t size = sizeof(pcm_cache_header_t) + (TRACK_CHUNKS * CHUNK_FRAMES * 4) / 2;
+    if(truncate(path, size) != 0 || exists_pcm_cache(&key) || access(path, F_OK) == 0) {
+        printf("NG: validation\n");
+        return 1;
+    }
+
+    // eviction keeps the most recently played files in the budget
+    std::vector<pcm_cache_key_t> keys;
+    for(uint32_t i = 0; i < 3; i++) {
+        pcm_cache_key_t each = key;
+        each.vgm_hash = i;
+        loop_counts.clear();
+        render_track(&each, 0, loop_counts);
+        keys.push_back(each);
+    }
+    play(&keys[1]);
+    play(&keys[0]);
+    uint32_t last = play(&keys[2]);
+    // the play sequence continues after a reboot (no clock is set)
+    init_pcm_cache(cache_dir.c_str(), 3 * (sizeof(pcm_cache_header_t) + TRACK_CHUNKS * CHUNK_FRAMES * 4));
+    if(play(&keys[0]) <= last) {
+        printf("NG: play sequence\n");
+        return 1;
+    }
+    init_pcm_cache(cache_dir.c_str(), 2 * (sizeof(pcm_cache_header_t) + TRACK_CHUNKS * CHUNK_FRAMES * 4));
+    evict_pcm_cache(0);
+    if(exists_pcm_cache(&keys[1]) || !exists_pcm_cache(&keys[0]) || !exists_pcm_cache(&keys[2])) {
+        printf("NG: eviction\n");
+        return 1;
+    }
+
+    // a paused .part file is evicted by age, the one being written is kept
+    std::vector<uint32_t> part_counts;
+    pcm_cache_key_t paused = key;
+    paused.vgm_hash = 3;
+    render_track(&paused, PAUSE_CHUNK, part_counts);
+    play(&keys[0]);
+    play(&keys[2]);
+    pcm_cache_key_t writing = key;
+    writing.vgm_hash = 4;
+    pcm_cache_writer_t writer;
+    char part_path[PCM_CACHE_FILE_PATH_LEN + 8];
+    snprintf(path, sizeof(path), "%s/%08x_%u_%u.pcm.part", cache_dir.c_str(), paused.vgm_hash, paused.sample_rate, paused.loop_max_count);
+    snprintf(part_path, sizeof(part_path), "%s/%08x_%u_%u.pcm.part", cache_dir.c_str(), writing.vgm_hash, writing.sample_rate, writing.loop_max_count);
+    if(!begin_pcm_cache(&writing, &writer) || access(path, F_OK) == 0
+        || !exists_pcm_cache(&keys[0]) || !exists_pcm_cache(&keys[2])) {
+        printf("NG: part eviction\n");
+        return 1;
+    }
+    evict_pcm_cache(UINT64_MAX / 2);
+    if(access(part_path, F_OK) != 0 || exists_pcm_cache(&keys[0]) || exists_pcm_cache(&keys[2])) {
+        printf("NG: writing eviction\n");
+        return 1;
+    }
+    pause_pcm_cache(&writer);
+
+    std::string rm = std::string("rm -rf ") + dir;
+    if(system(rm.c_str()) != 0) return 1;
+    printf("OK: %zu chunks\n", loop_counts.size());
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+/**
+ * vgm_index test (host)
+ *
+ * Scans a fake library with a fake header reader (as step_index_job of
+ * main.cpp), and checks the records, the files skipped, a rescan that
+ * reads only the files added or changed, and the validation of the file.
+ */
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "vgm_index.h"
+
+static std::string mount;
+
+static void write_file(const std::string &path, size_t size, time_t mtime)
+{
+    std::string data(size, 'v');
+    FILE *fp = fopen((mount + path).c_str(), "wb");
+    fwrite(data.data(), 1, data.size(), fp);
+    fclose(fp);
+    struct utimbuf times = { mtime, mtime };
+    utime((mount + path).c_str(), &times);
+}
+
+/**
+ * Scan the library, returns the paths read (files without "bad" are read)
+ */
+static std::set<std::string> scan(void)
+{
+    std::set<std::string> reads;
+    if(!begin_vgm_index()) return reads;
+    const char *path;
+    while(step_vgm_index(&path)) {
+        if(path == NULL) continue;
+        reads.insert(path);
+        if(strstr(path, "bad") != NULL) continue;
+        // dual YM2151 and SN76489
+        vgm_index_info_t info = { 171, 441000, 44100, VGM_INDEX_CHIP_YM2151 | VGM_INDEX_CHIP_SN76489, VGM_INDEX_CHIP_YM2151 };
+        std::string strings = std::string(strrchr(path, '/') + 1) + '\0' + "Game" + '\0' + '\0' + "Author" + '\0' + "2023" + '\0';
+        add_vgm_index(&info, strings.data());
+    }
+    end_vgm_index();
+    return reads;
+}
+
+static bool check_record(const char *path, const char *title, uint32_t render_cost)
+{
+    const vgm_index_record_t *record = find_vgm_index(path);
+    return record != NULL
+        && strcmp(string_vgm_index(record->title), title) == 0
+        && strcmp(string_vgm_index(record->game), render_cost ? "Game" : "") == 0
+        && strcmp(string_vgm_index(record->system), "") == 0
+        && record->render_cost == render_cost;
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/vgm_index_testXXXXXX";
+    if(mkdtemp(dir) == nullptr) return 1;
+    mount = dir;
+    mkdir((mount + "/VGM").c_str(), 0755);
+    mkdir((mount + "/VGM/sub").c_str(), 0755);
+    mkdir((mount + "/VGM/sub/deep").c_str(), 0755);
+    write_file("/VGM/a.vgm", 100, 1000);
+    write_file("/VGM/b.VGZ", 200, 1000);
+    write_file("/VGM/bad.vgm", 300, 1000);
+    write_file("/VGM/sub/c.vgm", 400, 1000);
+    // not indexed
+    write_file("/VGM/a.vgm.cse", 10, 1000);
+    write_file("/VGM/._a.vgm", 10, 1000);
+    write_file("/VGM/readme.txt", 10, 1000);
+    write_file("/VGM/sub/deep/d.vgm", 10, 1000);
+
+    if(init_vgm_index(dir, "/VGM", "/index.bin")) {
+        printf("NG: no index\n");
+        return 1;
+    }
+    std::set<std::string> reads = scan();
+    if(reads != std::set<std::string>{ "/VGM/a.vgm", "/VGM/b.VGZ", "/VGM/bad.vgm", "/VGM/sub/c.vgm" }
+        || count_vgm_index() != 4) {
+        printf("NG: scan %zu reads %u records\n", reads.size(), count_vgm_index());
+        return 1;
+    }
+    if(!check_record("/VGM/a.vgm", "a.vgm", 349) || !check_record("/VGM/sub/c.vgm", "c.vgm", 349)
+        || !check_record("/VGM/bad.vgm", "", 0) || find_vgm_index("/VGM/a.vgm.cse") != NULL) {
+        printf("NG: records\n");
+        return 1;
+    }
+
+    // loaded again, nothing to read
+    if(!init_vgm_index(dir, "/VGM", "/index.bin") || count_vgm_index() != 4 || !scan().empty()
+        || !check_record("/VGM/b.VGZ", "b.VGZ", 349)) {
+        printf("NG: rescan\n");
+        return 1;
+    }
+
+    // changed, added and removed files
+    write_file("/VGM/b.VGZ", 200, 2000);
+    write_file("/VGM/sub/e.vgz", 500, 1000);
+    unlink((mount + "/VGM/a.vgm").c_str());
+    reads = scan();
+    if(reads != std::set<std::string>{ "/VGM/b.VGZ", "/VGM/sub/e.vgz" } || count_vgm_index() != 4
+        || find_vgm_index("/VGM/a.vgm") != NULL || !check_record("/VGM/sub/e.vgz", "e.vgz", 349)
+        || !init_vgm_index(dir, "/VGM", "/index.bin") || count_vgm_index() != 4) {
+        printf("NG: update %zu reads %u records\n", reads.size(), count_vgm_index());
+        return 1;
+    }
+
+    // truncated file is not used
+    if(truncate((mount + "/index.bin").c_str(), sizeof(vgm_index_header_t) + 10) != 0
+        || init_vgm_index(dir, "/VGM", "/index.bin")) {
+        printf("NG: validation\n");
+        return 1;
+    }
+
+    std::string rm = std::string("rm -rf ") + dir;
+    if(system(rm.c_str()) != 0) return 1;
+    printf("OK: %u records\n", count_vgm_index());
+
+    return 0;
+}
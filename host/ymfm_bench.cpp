@@ -0,0 +1,239 @@
+/**
+ * ymfm FFI render benchmark (host)
+ *
+ * Renders every chip in chip_type through the per-sample ymfm_generate()
+ * entry point and the block ymfm_generate_block() entry point,
+ * and prints samples/sec for both.
+ *
+ * Every FM channel (and SSG tone, OPL4 PCM voice) is keyed on with a
+ * sustained tone before timing, as a silent chip skips most of its work.
+ */
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+extern "C" {
+uint32_t ymfm_add_chip(uint16_t chip_num, uint32_t clock);
+uint32_t ymfm_get_sample_rate(uint32_t handle);
+void ymfm_write(uint32_t handle, uint32_t reg, uint8_t data);
+void ymfm_generate(uint32_t handle, int32_t *buffer);
+void ymfm_generate_block(uint32_t handle, int32_t *buffer, uint32_t frames);
+void ymfm_remove_chip(uint32_t handle);
+}
+
+/**
+ * chip_type in ymfmffi.cpp and typical clocks
+ */
+typedef struct bench_chip {
+    uint16_t chip_num;
+    const char *name;
+    uint32_t clock;
+} bench_chip_t;
+
+static const bench_chip_t bench_chips[] = {
+    { 0, "YM2149", 1789773 },
+    { 1, "YM2151", 3579545 },
+    { 2, "YM2203", 3993600 },
+    { 3, "YM2413", 3579545 },
+    { 4, "YM2608", 7987200 },
+    { 5, "YM2610", 8000000 },
+    { 6, "YM2612", 7670454 },
+    { 7, "YM3526", 3579545 },
+    { 8, "Y8950", 3579545 },
+    { 9, "YM3812", 3579545 },
+    { 10, "YMF262", 14318180 },
+    { 11, "YMF278B", 33868800 },
+};
+
+#define BENCH_SECONDS 2
+#define BENCH_BLOCK_FRAMES 256
+
+/**
+ * Key-on writes (reg is port << 8 | address, as ymfm_write)
+ */
+static void write_chip(uint32_t handle, uint32_t port, uint32_t reg, uint8_t data)
+{
+    ymfm_write(handle, (port << 8) | reg, data);
+}
+
+/**
+ * SSG: three tones at full volume
+ */
+static void key_on_ssg(uint32_t handle)
+{
+    for (uint32_t ch = 0; ch < 3; ch++) {
+        write_chip(handle, 0, 0x00 + ch * 2, 0x80 + ch * 0x20);
+        write_chip(handle, 0, 0x01 + ch * 2, 0x00);
+        write_chip(handle, 0, 0x08 + ch, 0x0f);
+    }
+    write_chip(handle, 0, 0x07, 0x38);
+}
+
+/**
+ * OPM: 8 channels of 4 operators (algorithm 7, held at full level)
+ */
+static void key_on_opm(uint32_t handle)
+{
+    for (uint32_t ch = 0; ch < 8; ch++) {
+        write_chip(handle, 0, 0x20 + ch, 0xc7);
+        write_chip(handle, 0, 0x28 + ch, 0x4a + ch);
+        for (uint32_t op = 0; op < 4; op++) {
+            write_chip(handle, 0, 0x60 + op * 8 + ch, 0x00);
+            write_chip(handle, 0, 0x80 + op * 8 + ch, 0x1f);
+            write_chip(handle, 0, 0xe0 + op * 8 + ch, 0x0f);
+        }
+        write_chip(handle, 0, 0x08, 0x78 + ch);
+    }
+}
+
+/**
+ * OPN: channels of 4 operators on ports (3 per port, first_ch skips the
+ * channel 0 of each port that the YM2610 does not have)
+ */
+static void key_on_opn(uint32_t handle, uint32_t ports, uint32_t first_ch)
+{
+    for (uint32_t port = 0; port < ports; port++) {
+        for (uint32_t ch = first_ch; ch < 3; ch++) {
+            write_chip(handle, port, 0xb0 + ch, 0x07);
+            write_chip(handle, port, 0xb4 + ch, 0xc0);
+            for (uint32_t op = 0; op < 4; op++) {
+                write_chip(handle, port, 0x40 + op * 4 + ch, 0x00);
+                write_chip(handle, port, 0x50 + op * 4 + ch, 0x1f);
+                write_chip(handle, port, 0x80 + op * 4 + ch, 0x0f);
+            }
+            write_chip(handle, port, 0xa4 + ch, 0x22);
+            write_chip(handle, port, 0xa0 + ch, 0x69 + ch * 0x10);
+            write_chip(handle, 0, 0x28, 0xf0 | (port << 2) | ch);
+        }
+    }
+}
+
+/**
+ * OPLL: 9 channels of a sustained instrument
+ */
+static void key_on_opll(uint32_t handle)
+{
+    for (uint32_t ch = 0; ch < 9; ch++) {
+        write_chip(handle, 0, 0x30 + ch, 0x10);
+        write_chip(handle, 0, 0x10 + ch, 0x80 + ch * 0x08);
+        write_chip(handle, 0, 0x20 + ch, 0x18);
+    }
+}
+
+/**
+ * OPL: 9 channels of 2 operators (additive, held at full level) on ports
+ */
+static void key_on_opl(uint32_t handle, uint32_t ports)
+{
+    static const uint8_t slots[9] = { 0x00, 0x01, 0x02, 0x08, 0x09, 0x0a, 0x10, 0x11, 0x12 };
+    for (uint32_t port = 0; port < ports; port++) {
+        for (uint32_t ch = 0; ch < 9; ch++) {
+            for (uint32_t op = 0; op < 2; op++) {
+                uint32_t slot = slots[ch] + op * 3;
+                write_chip(handle, port, 0x20 + slot, 0x01);
+                write_chip(handle, port, 0x40 + slot, 0x00);
+                write_chip(handle, port, 0x60 + slot, 0xf0);
+                write_chip(handle, port, 0x80 + slot, 0x0f);
+            }
+            write_chip(handle, port, 0xc0 + ch, 0x31);
+            write_chip(handle, port, 0xa0 + ch, 0x41 + ch * 0x10);
+            write_chip(handle, port, 0xb0 + ch, 0x31);
+        }
+    }
+}
+
+/**
+ * OPL4 PCM: 24 voices (the wave headers read from an empty ROM)
+ */
+static void key_on_opl4_pcm(uint32_t handle)
+{
+    for (uint32_t ch = 0; ch < 24; ch++) {
+        write_chip(handle, 2, 0x08 + ch, 0x00);
+        write_chip(handle, 2, 0x20 + ch, 0x00);
+        write_chip(handle, 2, 0x38 + ch, 0x00);
+        write_chip(handle, 2, 0x50 + ch, 0x00);
+        write_chip(handle, 2, 0x68 + ch, 0x80);
+    }
+}
+
+/**
+ * Key on every tone of the chip
+ */
+static void key_on_chip(uint32_t handle, uint16_t chip_num)
+{
+    switch (chip_num) {
+        case 0: key_on_ssg(handle); break;
+        case 1: key_on_opm(handle); break;
+        case 2: key_on_ssg(handle); key_on_opn(handle, 1, 0); break;
+        case 3: key_on_opll(handle); break;
+        case 4: key_on_ssg(handle); write_chip(handle, 0, 0x29, 0x80); key_on_opn(handle, 2, 0); break;
+        case 5: key_on_ssg(handle); key_on_opn(handle, 2, 1); break;
+        case 6: key_on_opn(handle, 2, 0); break;
+        case 7: case 8: case 9: key_on_opl(handle, 1); break;
+        case 10: write_chip(handle, 1, 0x05, 0x01); key_on_opl(handle, 2); break;
+        case 11: write_chip(handle, 1, 0x05, 0x03); key_on_opl(handle, 2); key_on_opl4_pcm(handle); break;
+    }
+}
+
+static double elapsed_sec(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Render per sample (one FFI call per frame)
+ */
+static double bench_per_sample(uint32_t handle, uint32_t frames)
+{
+    int32_t buffer[2];
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < frames; i++) {
+        buffer[0] = buffer[1] = 0;
+        ymfm_generate(handle, buffer);
+    }
+    return frames / elapsed_sec(start);
+}
+
+/**
+ * Render by block (one FFI call per BENCH_BLOCK_FRAMES frames)
+ */
+static double bench_block(uint32_t handle, uint32_t frames)
+{
+    std::vector<int32_t> buffer(BENCH_BLOCK_FRAMES * 2);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < frames; i += BENCH_BLOCK_FRAMES) {
+        std::fill(buffer.begin(), buffer.end(), 0);
+        ymfm_generate_block(handle, buffer.data(), BENCH_BLOCK_FRAMES);
+    }
+    return frames / elapsed_sec(start);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t seconds = argc > 1 ? (uint32_t)atoi(argv[1]) : BENCH_SECONDS;
+
+    printf("%-8s %10s %14s %14s %8s\n", "chip", "rate", "sample/sec", "block/sec", "ratio");
+    for (const bench_chip_t &chip : bench_chips) {
+        uint32_t handle = ymfm_add_chip(chip.chip_num, chip.clock);
+        uint32_t sampling_rate = ymfm_get_sample_rate(handle);
+        uint32_t frames = sampling_rate * seconds;
+        // round up to block size
+        frames = (frames + BENCH_BLOCK_FRAMES - 1) / BENCH_BLOCK_FRAMES * BENCH_BLOCK_FRAMES;
+
+        // key on and apply the queued writes before timing
+        key_on_chip(handle, chip.chip_num);
+        std::vector<int32_t> warm_up(BENCH_BLOCK_FRAMES * 2);
+        ymfm_generate_block(handle, warm_up.data(), BENCH_BLOCK_FRAMES);
+
+        double per_sample = bench_per_sample(handle, frames);
+        double block = bench_block(handle, frames);
+        printf("%-8s %10u %14.0f %14.0f %7.2fx\n",
+            chip.name, sampling_rate, per_sample, block, block / per_sample);
+
+        ymfm_remove_chip(handle);
+    }
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+/**
+ * ymfm idle chip test (host)
+ *
+ * Keys a tone on and off, and checks that a chip goes idle once it has
+ * been silent for a while (its output stays zero), that a register write
+ * wakes it up, and that a chip with PCM engines never goes idle.
+ */
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+extern "C" {
+uint32_t ymfm_add_chip(uint16_t chip_num, uint32_t clock);
+void ymfm_write(uint32_t handle, uint32_t reg, uint8_t data);
+void ymfm_generate_block(uint32_t handle, int32_t *buffer, uint32_t frames);
+void ymfm_get_idle_frames(uint32_t handle, uint64_t *idle_frames, uint64_t *frames);
+void ymfm_remove_chip(uint32_t handle);
+}
+
+#define TEST_BLOCK_FRAMES 1024
+#define TEST_RELEASE_BLOCKS 16
+
+/**
+ * chip_type in ymfmffi.cpp, a tone to key on and the writes to key it off
+ */
+typedef struct test_chip {
+    uint16_t chip_num;
+    const char *name;
+    uint32_t clock;
+    bool idles;
+    uint8_t key_on[16][2];
+    uint8_t key_off[2][2];
+} test_chip_t;
+
+static const test_chip_t test_chips[] = {
+    { 0, "YM2149", 1789773, true, {
+        { 0x00, 0x80 }, { 0x01, 0x00 }, { 0x07, 0x3e }, { 0x08, 0x0f } },
+        { { 0x08, 0x00 } } },
+    { 1, "YM2151", 3579545, true, {
+        { 0x20, 0xc7 }, { 0x28, 0x4a }, { 0x60, 0x00 }, { 0x80, 0x1f }, { 0xe0, 0x0f }, { 0x08, 0x08 } },
+        { { 0x08, 0x00 } } },
+    { 4, "YM2608", 7987200, false, {
+        { 0x00, 0x80 }, { 0x01, 0x00 }, { 0x07, 0x3e }, { 0x08, 0x0f } },
+        { { 0x08, 0x00 } } },
+};
+
+#define TEST_CHIPS (sizeof(test_chips) / sizeof(test_chips[0]))
+
+static void write_all(uint32_t handle, const uint8_t (*writes)[2], uint32_t count)
+{
+    // {0, 0} ends the list
+    for(uint32_t i = 0; i < count && (writes[i][0] != 0 || writes[i][1] != 0); i++) {
+        ymfm_write(handle, writes[i][0], writes[i][1]);
+    }
+}
+
+/**
+ * Render blocks, returns true if any frame is not zero
+ */
+static bool render(uint32_t handle, uint32_t blocks)
+{
+    static int32_t buffer[TEST_BLOCK_FRAMES * 2];
+    bool sound = false;
+    for(uint32_t block = 0; block < blocks; block++) {
+        memset(buffer, 0, sizeof(buffer));
+        ymfm_generate_block(handle, buffer, TEST_BLOCK_FRAMES);
+        for(uint32_t i = 0; i < TEST_BLOCK_FRAMES * 2; i++) {
+            sound = sound || buffer[i] != 0;
+        }
+    }
+    return sound;
+}
+
+static bool test_chip(const test_chip_t &chip)
+{
+    uint64_t idle_frames, frames, last_idle_frames;
+    uint32_t handle = ymfm_add_chip(chip.chip_num, chip.clock);
+    if(handle == 0) {
+        printf("%s NG add\n", chip.name);
+        return false;
+    }
+    bool ok = true;
+
+    // a sounding chip is not idle
+    write_all(handle, chip.key_on, 16);
+    ok = ok && render(handle, 4);
+    ymfm_get_idle_frames(handle, &idle_frames, &frames);
+    ok = ok && idle_frames == 0 && frames == 4 * TEST_BLOCK_FRAMES;
+    if(!ok) printf("%s NG key on (idle %llu)\n", chip.name, (unsigned long long)idle_frames);
+
+    // released and silent, then idle (and still silent)
+    write_all(handle, chip.key_off, 2);
+    render(handle, TEST_RELEASE_BLOCKS);
+    ymfm_get_idle_frames(handle, &last_idle_frames, &frames);
+    bool sound = render(handle, 1);
+    ymfm_get_idle_frames(handle, &idle_frames, &frames);
+    if(ok && chip.idles
+        && (sound || last_idle_frames == 0 || idle_frames != last_idle_frames + TEST_BLOCK_FRAMES)) {
+        printf("%s NG key off (idle %llu, sound %d)\n", chip.name, (unsigned long long)idle_frames, sound);
+        ok = false;
+    }
+    if(ok && !chip.idles && idle_frames != 0) {
+        printf("%s NG idle with PCM engines (idle %llu)\n", chip.name, (unsigned long long)idle_frames);
+        ok = false;
+    }
+
+    // a write wakes the chip up
+    write_all(handle, chip.key_on, 16);
+    if(ok && !render(handle, 4)) {
+        printf("%s NG key on again\n", chip.name);
+        ok = false;
+    }
+
+    ymfm_remove_chip(handle);
+    if(ok) printf("%s OK\n", chip.name);
+    return ok;
+}
+
+int main()
+{
+    bool ok = true;
+
+    for(uint32_t i = 0; i < TEST_CHIPS; i++) {
+        ok &= test_chip(test_chips[i]);
+    }
+
+    return ok ? 0 : 1;
+}
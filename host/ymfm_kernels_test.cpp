@@ -0,0 +1,202 @@
+/**
+ * ymfm_kernels test (host)
+ *
+ * Checks that the generic (vectorized) and the active (compile time
+ * selected) paths of every mixing bus kernel give the same bits as the
+ * reference path, on random samples mixed with the edge values (i32 and
+ * i16 limits, NaN, infinities, negative zero), for every length up to a
+ * few vectors and at unaligned offsets. The PIE path is only built for
+ * the ESP32-S3, where it is the active path.
+ */
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#include "ymfm_kernels.h"
+
+#define TEST_SAMPLES 256
+#define TEST_OFFSETS 4
+#define TEST_ROUNDS 16
+
+static uint32_t lcg = 1;
+
+static uint32_t next_random()
+{
+    lcg = lcg * 1664525 + 1013904223;
+    return lcg;
+}
+
+static int32_t random_i32()
+{
+    static const int32_t edges[] = {
+        INT32_MIN, INT32_MIN + 1, INT32_MAX, INT32_MAX - 1,
+        -32769, -32768, 32767, 32768, 0, -1, 1
+    };
+    uint32_t r = next_random();
+    switch (r >> 29)
+    {
+        case 0:
+            return edges[(r >> 8) % (sizeof(edges) / sizeof(edges[0]))];
+        case 1:
+            // full range
+            return int32_t(next_random());
+        default:
+            // a few chips over s16le
+            return int32_t(next_random() >> 14) - (1 << 17);
+    }
+}
+
+static float random_f32()
+{
+    static const float edges[] = {
+        std::numeric_limits<float>::quiet_NaN(),
+        std::numeric_limits<float>::infinity(),
+        -std::numeric_limits<float>::infinity(),
+        -0.0f, 0.0f, 1.0f, -1.0f, 32767.0f / 32768.0f, 32767.5f / 32768.0f,
+        -32768.5f / 32768.0f, 1e30f, -1e30f
+    };
+    uint32_t r = next_random();
+    if ((r >> 29) == 0)
+        return edges[(r >> 8) % (sizeof(edges) / sizeof(edges[0]))];
+    return (float(next_random() >> 8) / float(1 << 24) - 0.5f) * 6.0f;
+}
+
+template<typename SampleType>
+static SampleType random_sample();
+template<> int32_t random_sample<int32_t>() { return random_i32(); }
+template<> float random_sample<float>() { return random_f32(); }
+
+/**
+ * Compare as bits (NaN payloads included)
+ */
+template<typename SampleType>
+static bool same(SampleType const *expect, SampleType const *actual, uint32_t count)
+{
+    return memcmp(expect, actual, count * sizeof(SampleType)) == 0;
+}
+
+template<typename SampleType>
+static bool test_kernels(char const *name)
+{
+    // 16-byte aligned, so offset 0 takes the aligned PIE loop
+    alignas(16) static SampleType src[TEST_SAMPLES + TEST_OFFSETS];
+    alignas(16) static SampleType dst[TEST_SAMPLES + TEST_OFFSETS];
+    alignas(16) static SampleType expect[TEST_SAMPLES + TEST_OFFSETS];
+    alignas(16) static SampleType generic[TEST_SAMPLES + TEST_OFFSETS];
+    alignas(16) static SampleType active[TEST_SAMPLES + TEST_OFFSETS];
+    static int16_t s16le_expect[TEST_SAMPLES * 2];
+    static int16_t s16le_generic[TEST_SAMPLES * 2];
+    static int16_t s16le_active[TEST_SAMPLES * 2];
+    const float gains[] = { 1.0f, 0.5f, 0.7071f, 1.5f, 4.0f, -1.0f, 0.0f };
+
+    for (uint32_t round = 0; round < TEST_ROUNDS; round++)
+    {
+        for (uint32_t i = 0; i < TEST_SAMPLES + TEST_OFFSETS; i++)
+        {
+            src[i] = random_sample<SampleType>();
+            dst[i] = random_sample<SampleType>();
+        }
+        for (uint32_t offset = 0; offset < TEST_OFFSETS; offset++)
+        {
+            for (uint32_t count = 0; count <= TEST_SAMPLES; count += (count < 40) ? 1 : 37)
+            {
+                // mix accumulate
+                memcpy(expect, dst, sizeof(dst));
+                memcpy(generic, dst, sizeof(dst));
+                memcpy(active, dst, sizeof(dst));
+                vgm_kernels::reference::mix_accumulate(expect + offset, src + offset, count);
+                vgm_kernels::generic::mix_accumulate(generic + offset, src + offset, count);
+                vgm_kernels::active::mix_accumulate(active + offset, src + offset, count);
+                if (!same(expect, generic, TEST_SAMPLES + TEST_OFFSETS)
+                    || !same(expect, active, TEST_SAMPLES + TEST_OFFSETS))
+                {
+                    printf("%s NG mix_accumulate (count %u, offset %u)\n", name, count, offset);
+                    return false;
+                }
+                // gain
+                for (float gain : gains)
+                {
+                    memcpy(expect, dst, sizeof(dst));
+                    memcpy(generic, dst, sizeof(dst));
+                    memcpy(active, dst, sizeof(dst));
+                    vgm_kernels::reference::gain(expect + offset, count, gain);
+                    vgm_kernels::generic::gain(generic + offset, count, gain);
+                    vgm_kernels::active::gain(active + offset, count, gain);
+                    if (!same(expect, generic, TEST_SAMPLES + TEST_OFFSETS)
+                        || !same(expect, active, TEST_SAMPLES + TEST_OFFSETS))
+                    {
+                        printf("%s NG gain %f (count %u, offset %u)\n", name, gain, count, offset);
+                        return false;
+                    }
+                }
+                // saturate and interleave
+                memset(s16le_expect, 0x55, sizeof(s16le_expect));
+                memset(s16le_generic, 0x55, sizeof(s16le_generic));
+                memset(s16le_active, 0x55, sizeof(s16le_active));
+                vgm_kernels::reference::saturate_interleave(dst + offset, src + offset, s16le_expect, count);
+                vgm_kernels::generic::saturate_interleave(dst + offset, src + offset, s16le_generic, count);
+                vgm_kernels::active::saturate_interleave(dst + offset, src + offset, s16le_active, count);
+                if (!same(s16le_expect, s16le_generic, TEST_SAMPLES * 2)
+                    || !same(s16le_expect, s16le_active, TEST_SAMPLES * 2))
+                {
+                    printf("%s NG saturate_interleave (count %u, offset %u)\n", name, count, offset);
+                    return false;
+                }
+            }
+        }
+    }
+    printf("%s OK\n", name);
+    return true;
+}
+
+/**
+ * The reference path against the former per-sample conversions of the
+ * Rust bus (convert_sample_i2s, convert_sample_f2i and scale_sample_m)
+ */
+static bool test_reference()
+{
+    const int32_t ints[] = { INT32_MIN, -40000, -32768, -1, 0, 1, 32767, 40000, INT32_MAX };
+    const int16_t ints_s16[] = { -32768, -32768, -32768, -1, 0, 1, 32767, 32767, 32767 };
+    const float floats[] = { -2.0f, -1.0f, -0.5f, -1.0f / 65536, 0.0f, 0.99999f, 1.0f, 2.0f, NAN };
+    const int16_t floats_s16[] = { -32768, -32768, -16384, 0, 0, 32767, 32767, 32767, 0 };
+    int16_t s16le[2];
+    for (uint32_t i = 0; i < sizeof(ints) / sizeof(ints[0]); i++)
+    {
+        vgm_kernels::reference::saturate_interleave(&ints[i], &ints[i], s16le, 1);
+        if (s16le[0] != ints_s16[i] || s16le[1] != ints_s16[i])
+        {
+            printf("reference NG i32 %d -> %d\n", ints[i], s16le[0]);
+            return false;
+        }
+        vgm_kernels::reference::saturate_interleave(&floats[i], &floats[i], s16le, 1);
+        if (s16le[0] != floats_s16[i] || s16le[1] != floats_s16[i])
+        {
+            printf("reference NG f32 %f -> %d\n", floats[i], s16le[0]);
+            return false;
+        }
+    }
+    // (sample as f32 * rate) as i32
+    int32_t scaled[] = { 3, -3, 1 << 30, -(1 << 30) };
+    vgm_kernels::reference::gain(scaled, 4, 2.5f);
+    if (scaled[0] != 7 || scaled[1] != -7 || scaled[2] != INT32_MAX || scaled[3] != INT32_MIN)
+    {
+        printf("reference NG gain %d %d %d %d\n", scaled[0], scaled[1], scaled[2], scaled[3]);
+        return false;
+    }
+    printf("reference OK\n");
+    return true;
+}
+
+int main()
+{
+    bool ok = true;
+
+    ok &= test_reference();
+    ok &= test_kernels<int32_t>("i32");
+    ok &= test_kernels<float>("f32");
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+/**
+ * vgm_mixer test (host)
+ *
+ * Checks that every vgm_mixer specialization is bit-exact against the
+ * former per-sample mixer of vgm_chip::generate(), which branched on the
+ * runtime chip type.
+ */
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include "ymfm_mixer.h"
+
+#define TEST_FRAMES 1024
+
+// chip type the former mixer branched on
+enum legacy_type
+{
+    LEGACY_YM2203,
+    LEGACY_YM2608_YM2610,
+    LEGACY_YM2149,
+    LEGACY_YMF278B,
+    LEGACY_YM2413,
+    LEGACY_OTHER
+};
+
+/**
+ * Former mixer (one frame)
+ */
+template<typename ChipType>
+static void legacy_mix(legacy_type type, typename ChipType::output_data const &m_output, int32_t *buffer)
+{
+    if (type == LEGACY_YM2203)
+    {
+        int32_t out0 = m_output.data[0];
+        int32_t out1 = m_output.data[1 % ChipType::OUTPUTS];
+        int32_t out2 = m_output.data[2 % ChipType::OUTPUTS];
+        int32_t out3 = m_output.data[3 % ChipType::OUTPUTS];
+        *buffer++ += out0 + (out1 + out2 + out3) / 2;
+        *buffer++ += out0 + (out1 + out2 + out3) / 2;
+    }
+    else if (type == LEGACY_YM2608_YM2610)
+    {
+        int32_t out0 = m_output.data[0];
+        int32_t out1 = m_output.data[1 % ChipType::OUTPUTS];
+        int32_t out2 = m_output.data[2 % ChipType::OUTPUTS];
+        *buffer++ += out0 + (out2 / 2);
+        *buffer++ += out1 + (out2 / 2);
+    }
+    else if (type == LEGACY_YM2149)
+    {
+        int32_t out0 = m_output.data[0];
+        int32_t out1 = m_output.data[1 % ChipType::OUTPUTS];
+        int32_t out2 = m_output.data[2 % ChipType::OUTPUTS];
+        *buffer++ += (out0 + out1 + out2) / 2;
+        *buffer++ += (out0 + out1 + out2) / 2;
+    }
+    else if (type == LEGACY_YMF278B)
+    {
+        *buffer++ += m_output.data[4 % ChipType::OUTPUTS];
+        *buffer++ += m_output.data[5 % ChipType::OUTPUTS];
+    }
+    else if (type == LEGACY_YM2413)
+    {
+        int32_t out0 = m_output.data[0];
+        int32_t out1 = m_output.data[1 % ChipType::OUTPUTS];
+        *buffer++ += out0 + out1;
+        *buffer++ += out0 + out1;
+    }
+    else if (ChipType::OUTPUTS == 1)
+    {
+        *buffer++ += m_output.data[0] / 2;
+        *buffer++ += m_output.data[0] / 2;
+    }
+    else
+    {
+        *buffer++ += m_output.data[0];
+        *buffer++ += m_output.data[1 % ChipType::OUTPUTS];
+    }
+}
+
+/**
+ * Mix random outputs (odd and negative values included) with both mixers
+ */
+template<typename ChipType>
+static bool test_mixer(char const *name, legacy_type type)
+{
+    static typename ChipType::output_data output[TEST_FRAMES];
+    static int32_t expect[TEST_FRAMES * 2];
+    static int32_t actual[TEST_FRAMES * 2];
+
+    srand(1);
+    for (uint32_t i = 0; i < TEST_FRAMES; i++)
+    {
+        for (uint32_t j = 0; j < ChipType::OUTPUTS; j++)
+            output[i].data[j] = (rand() % 65536) - 32768;
+        // mixed on top of existing samples
+        expect[i * 2] = actual[i * 2] = (rand() % 65536) - 32768;
+        expect[i * 2 + 1] = actual[i * 2 + 1] = (rand() % 65536) - 32768;
+    }
+
+    for (uint32_t i = 0; i < TEST_FRAMES; i++)
+        legacy_mix<ChipType>(type, output[i], &expect[i * 2]);
+    vgm_mixer<ChipType>::mix(output, actual, TEST_FRAMES);
+
+    for (uint32_t i = 0; i < TEST_FRAMES * 2; i++)
+    {
+        if (expect[i] != actual[i])
+        {
+            printf("%-8s NG sample %u: expect %d actual %d\n", name, i, expect[i], actual[i]);
+            return false;
+        }
+    }
+    printf("%-8s OK\n", name);
+    return true;
+}
+
+int main()
+{
+    bool ok = true;
+
+    ok &= test_mixer<ymfm::ym2149>("YM2149", LEGACY_YM2149);
+    ok &= test_mixer<ymfm::ym2151>("YM2151", LEGACY_OTHER);
+    ok &= test_mixer<ymfm::ym2203>("YM2203", LEGACY_YM2203);
+    ok &= test_mixer<ymfm::ym2413>("YM2413", LEGACY_YM2413);
+    ok &= test_mixer<ymfm::ym2608>("YM2608", LEGACY_YM2608_YM2610);
+    ok &= test_mixer<ymfm::ym2610>("YM2610", LEGACY_YM2608_YM2610);
+    ok &= test_mixer<ymfm::ym2610b>("YM2610B", LEGACY_YM2608_YM2610);
+    ok &= test_mixer<ymfm::ym2612>("YM2612", LEGACY_OTHER);
+    ok &= test_mixer<ymfm::ym3526>("YM3526", LEGACY_OTHER);
+    ok &= test_mixer<ymfm::y8950>("Y8950", LEGACY_OTHER);
+    ok &= test_mixer<ymfm::ym3812>("YM3812", LEGACY_OTHER);
+    ok &= test_mixer<ymfm::ymf262>("YMF262", LEGACY_OTHER);
+    ok &= test_mixer<ymfm::ymf278b>("YMF278B", LEGACY_YMF278B);
+
+    return ok ? 0 : 1;
+}
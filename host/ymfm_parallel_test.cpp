@@ -0,0 +1,123 @@
+/**
+ * ymfm_generate_blocks test (host)
+ *
+ * Renders the same chip set with identical register writes sequentially
+ * and through the render worker, and checks that the output is bit-exact.
+ */
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+struct ymfm_block {
+    uint32_t handle;
+    uint32_t frames;
+    int32_t *buffer;
+};
+
+extern "C" {
+uint32_t ymfm_add_chip(uint16_t chip_num, uint32_t clock);
+uint32_t ymfm_get_sample_rate(uint32_t handle);
+void ymfm_write(uint32_t handle, uint32_t reg, uint8_t data);
+void ymfm_generate_blocks(ymfm_block const *blocks, uint32_t count);
+bool ymfm_start_render_worker(int32_t core);
+void ymfm_stop_render_worker();
+void ymfm_remove_chip(uint32_t handle);
+}
+
+#define TEST_BLOCKS 64
+#define TEST_OUTPUT_FRAMES 256
+
+/**
+ * chip_type in ymfmffi.cpp and a tone to key on
+ */
+typedef struct test_chip {
+    uint16_t chip_num;
+    const char *name;
+    uint32_t clock;
+    uint8_t writes[16][2];
+} test_chip_t;
+
+static const test_chip_t test_chips[] = {
+    { 0, "YM2149", 1789773, {
+        { 0x00, 0x80 }, { 0x01, 0x00 }, { 0x07, 0x3e }, { 0x08, 0x0f } } },
+    { 1, "YM2151", 3579545, {
+        { 0x20, 0xc7 }, { 0x28, 0x4a }, { 0x60, 0x00 }, { 0x68, 0x7f }, { 0x70, 0x7f }, { 0x78, 0x7f },
+        { 0x80, 0x1f }, { 0xe0, 0x0f }, { 0x08, 0x78 } } },
+    { 9, "YM3812", 3579545, {
+        { 0x20, 0x01 }, { 0x40, 0x10 }, { 0x60, 0xf0 }, { 0x80, 0x77 }, { 0x23, 0x01 }, { 0x43, 0x00 },
+        { 0x63, 0xf0 }, { 0x83, 0x77 }, { 0xa0, 0x98 }, { 0xb0, 0x31 } } },
+    { 2, "YM2203", 3993600, {
+        { 0x00, 0x40 }, { 0x01, 0x00 }, { 0x07, 0x3e }, { 0x08, 0x0f } } },
+};
+
+#define TEST_CHIPS (sizeof(test_chips) / sizeof(test_chips[0]))
+
+/**
+ * Add the chip set and key on, returns rendered output of all blocks
+ */
+static std::vector<int32_t> render(bool parallel)
+{
+    if (parallel && !ymfm_start_render_worker(1)) {
+        printf("ymfm_start_render_worker failed\n");
+        exit(1);
+    }
+
+    uint32_t handles[TEST_CHIPS];
+    uint32_t frames[TEST_CHIPS];
+    std::vector<int32_t> buffers[TEST_CHIPS];
+    for (uint32_t i = 0; i < TEST_CHIPS; i++) {
+        handles[i] = ymfm_add_chip(test_chips[i].chip_num, test_chips[i].clock);
+        for (const uint8_t *write : test_chips[i].writes) {
+            if (write[0] == 0 && write[1] == 0) break;
+            ymfm_write(handles[i], write[0], write[1]);
+        }
+        // frames at the chip rate for TEST_OUTPUT_FRAMES at 44100Hz
+        frames[i] = (uint32_t)((uint64_t)ymfm_get_sample_rate(handles[i]) * TEST_OUTPUT_FRAMES / 44100) + 1;
+        buffers[i].resize(frames[i] * 2);
+    }
+
+    std::vector<int32_t> output;
+    ymfm_block blocks[TEST_CHIPS];
+    for (uint32_t block = 0; block < TEST_BLOCKS; block++) {
+        for (uint32_t i = 0; i < TEST_CHIPS; i++) {
+            std::fill(buffers[i].begin(), buffers[i].end(), 0);
+            blocks[i] = { handles[i], frames[i], buffers[i].data() };
+        }
+        ymfm_generate_blocks(blocks, TEST_CHIPS);
+        for (uint32_t i = 0; i < TEST_CHIPS; i++) {
+            output.insert(output.end(), buffers[i].begin(), buffers[i].end());
+        }
+    }
+
+    for (uint32_t i = 0; i < TEST_CHIPS; i++) {
+        ymfm_remove_chip(handles[i]);
+    }
+    if (parallel) ymfm_stop_render_worker();
+
+    return output;
+}
+
+int main(void)
+{
+    std::vector<int32_t> sequential = render(false);
+    std::vector<int32_t> parallel = render(true);
+
+    bool silent = true;
+    for (int32_t sample : sequential) {
+        if (sample != 0) silent = false;
+    }
+    if (silent) {
+        printf("NG: no sound was rendered\n");
+        return 1;
+    }
+    if (sequential.size() != parallel.size()
+        || memcmp(sequential.data(), parallel.data(), sequential.size() * sizeof(int32_t)) != 0) {
+        printf("NG: parallel render differs from sequential render\n");
+        return 1;
+    }
+    printf("OK: %zu samples\n", sequential.size());
+
+    return 0;
+}
@@ -0,0 +1,250 @@
+/**
+ * ymfm_resampler test (host)
+ *
+ * Runs vgm_resampler against ports of the chipstream sound streams it
+ * replaces for the ymfm chips (NearestDownSampleStream and
+ * LinearUpSamplingStream, driven as SoundDevice::generate drives them),
+ * checks the windowed sinc against a floating point reference, and checks
+ * that the output does not depend on the block sizes it is rendered in.
+ */
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "ymfm_resampler.h"
+
+#define OUTPUT_RATE 44100
+#define OUTPUT_FRAMES 20000
+// the linear stream outputs silence until it has two inputs
+#define LINEAR_SKIP 4
+// 16 bit interpolation fraction on full scale noise
+#define LINEAR_ERROR 2.0
+
+/**
+ * Test signal (one channel, the other is negated)
+ */
+static std::vector<int32_t> make_input(uint32_t frames, uint32_t seed, bool smooth)
+{
+    std::vector<int32_t> input;
+    uint32_t lcg = seed;
+    for(uint32_t i = 0; i < frames; i++) {
+        lcg = lcg * 1664525 + 1013904223;
+        int32_t noise = int32_t(lcg >> 16) - 32768;
+        input.push_back(smooth ? int32_t(12000 * std::sin(i * 0.05) + noise / 256) : noise / 2);
+    }
+    return input;
+}
+
+/**
+ * Resample with vgm_resampler as vgm_chip_base::generate_output does,
+ * in blocks of block_frames (0: random block sizes); seek_frames of other
+ * input are resampled first and dropped by reset (a seek)
+ */
+static std::vector<int32_t> resample(const std::vector<int32_t> &input, uint32_t input_rate,
+    vgm_resample_quality quality, uint32_t block_frames, uint32_t seek_frames = 0)
+{
+    static vgm_resampler resampler;
+    resampler.configure(input_rate, OUTPUT_RATE, quality);
+    if(seek_frames != 0) {
+        std::vector<int32_t> skipped(seek_frames * 2);
+        int32_t *room = resampler.input(resampler.input_needed(seek_frames));
+        room[0] = 0x7fff;
+        resampler.resample(skipped.data(), seek_frames);
+        resampler.reset();
+    }
+    std::vector<int32_t> output(OUTPUT_FRAMES * 2, 0);
+    uint32_t consumed = 0;
+    uint32_t lcg = 1;
+    for(uint32_t done = 0; done < OUTPUT_FRAMES; ) {
+        lcg = lcg * 1664525 + 1013904223;
+        uint32_t frames = block_frames != 0 ? block_frames : 1 + (lcg >> 24);
+        frames = std::min<uint32_t>(frames, OUTPUT_FRAMES - done);
+        while(frames != 0) {
+            uint32_t count = std::min(frames, resampler.max_output());
+            uint32_t needed = resampler.input_needed(count);
+            int32_t *room = resampler.input(needed);
+            for(uint32_t i = 0; i < needed; i++, consumed++) {
+                room[i * 2] = input[consumed];
+                room[i * 2 + 1] = -input[consumed];
+            }
+            resampler.resample(&output[done * 2], count);
+            done += count;
+            frames -= count;
+        }
+    }
+    return output;
+}
+
+/**
+ * NearestDownSampleStream (stream.rs)
+ */
+static std::vector<int32_t> nearest_stream(const std::vector<int32_t> &input, uint32_t input_rate)
+{
+    double pos = 0;
+    double step = double(OUTPUT_RATE) / input_rate;
+    int32_t now = 0, prev = 0;
+    uint32_t consumed = 0;
+    std::vector<int32_t> output;
+    for(uint32_t n = 0; n < OUTPUT_FRAMES; n++) {
+        // Tick::More until the position passes the output
+        while(pos < 1) {
+            pos += step;
+            prev = now;
+            now = input[consumed++];
+        }
+        double prev_pos = pos - step;
+        output.push_back(1 - prev_pos < pos - 1 ? prev : now);
+        pos -= 1;
+    }
+    return output;
+}
+
+/**
+ * LinearUpSamplingStream (stream.rs, Resolution::RangeAll)
+ *
+ * The output that ticks the chip holds the last input without its fraction,
+ * it is returned as NaN and not compared.
+ */
+static std::vector<double> linear_stream(const std::vector<int32_t> &input, uint32_t input_rate)
+{
+    double pos = 1;
+    double step = double(input_rate) / OUTPUT_RATE;
+    double now = 0, prev = 0, sample = 0;
+    uint32_t pushed = 0;
+    uint32_t consumed = 0;
+    std::vector<double> output;
+    for(uint32_t n = 0; n < OUTPUT_FRAMES; n++) {
+        if(pos >= 1) {
+            sample = NAN;
+            pos -= 1;
+            // Tick::One
+            prev = now;
+            now = input[consumed++];
+            pushed++;
+        } else {
+            sample = pushed < 2 ? 0 : prev + pos * (now - prev);
+        }
+        output.push_back(sample);
+        pos += step;
+    }
+    return output;
+}
+
+/**
+ * Windowed sinc at the exact position of each output (double precision)
+ */
+static std::vector<double> sinc_reference(const std::vector<int32_t> &input, uint32_t input_rate)
+{
+    const double pi = 3.14159265358979323846;
+    const int32_t history = vgm_resampler::HISTORY;
+    double cutoff = std::min(1.0, double(OUTPUT_RATE) / input_rate);
+    std::vector<double> output;
+    for(uint32_t n = 0; n < OUTPUT_FRAMES; n++) {
+        // output n is centered on input n * step - 1
+        double center = double(n) * input_rate / OUTPUT_RATE - 1;
+        int32_t base = int32_t(std::floor(center));
+        double sum = 0, weight = 0;
+        for(int32_t tap = 0; tap < int32_t(vgm_resampler::SINC_TAPS); tap++) {
+            int32_t frame = base - (history - 1) + tap;
+            double x = frame - center;
+            double t = pi * cutoff * x;
+            double sinc = x == 0 ? 1.0 : std::sin(t) / t;
+            double window = 0.42 + 0.5 * std::cos(pi * x / history) + 0.08 * std::cos(2 * pi * x / history);
+            weight += sinc * window;
+            sum += sinc * window * (frame < 0 ? 0 : input[frame]);
+        }
+        output.push_back(sum / weight);
+    }
+    return output;
+}
+
+static bool check_blocks(const std::vector<int32_t> &input, uint32_t input_rate, vgm_resample_quality quality)
+{
+    std::vector<int32_t> whole = resample(input, input_rate, quality, OUTPUT_FRAMES);
+    const uint32_t blocks[] = { 1, 7, 256, 0 };
+    for(uint32_t block : blocks) {
+        if(resample(input, input_rate, quality, block) != whole) {
+            printf("NG: blocks %u (%u Hz, quality %u)\n", block, input_rate, quality);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(void)
+{
+    // ymfm chips above the output rate (YM2151, YM2612, OPL)
+    const uint32_t down_rates[] = { 55930, 53267, 49715 };
+    // and below it
+    const uint32_t up_rates[] = { 15625, 22050, 41666 };
+
+    for(uint32_t input_rate : down_rates) {
+        std::vector<int32_t> input = make_input(OUTPUT_FRAMES * 2, input_rate, false);
+        std::vector<int32_t> expect = nearest_stream(input, input_rate);
+        std::vector<int32_t> actual = resample(input, input_rate, RESAMPLE_NEAREST, 256);
+        // the stream rounds a tie in floating point; allow a few
+        uint32_t mismatch = 0;
+        for(uint32_t n = 0; n < OUTPUT_FRAMES; n++) {
+            if(actual[n * 2] != expect[n]) mismatch++;
+        }
+        if(mismatch > OUTPUT_FRAMES / 1000) {
+            printf("NG: nearest %u Hz, %u mismatches\n", input_rate, mismatch);
+            return 1;
+        }
+        if(!check_blocks(input, input_rate, RESAMPLE_NEAREST)) return 1;
+    }
+
+    for(uint32_t input_rate : up_rates) {
+        std::vector<int32_t> input = make_input(OUTPUT_FRAMES, input_rate, false);
+        std::vector<double> expect = linear_stream(input, input_rate);
+        std::vector<int32_t> actual = resample(input, input_rate, RESAMPLE_LINEAR, 256);
+        for(uint32_t n = LINEAR_SKIP; n < OUTPUT_FRAMES; n++) {
+            if(!std::isnan(expect[n]) && std::fabs(actual[n * 2] - expect[n]) > LINEAR_ERROR) {
+                printf("NG: linear %u Hz at %u, %d/%f\n", input_rate, n, actual[n * 2], expect[n]);
+                return 1;
+            }
+        }
+        if(!check_blocks(input, input_rate, RESAMPLE_LINEAR)) return 1;
+    }
+
+    for(uint32_t input_rate : { 55930u, 49715u, 22050u }) {
+        std::vector<int32_t> input = make_input(OUTPUT_FRAMES * 2, input_rate, true);
+        std::vector<double> expect = sinc_reference(input, input_rate);
+        std::vector<int32_t> actual = resample(input, input_rate, RESAMPLE_SINC, 256);
+        // within the error of the phase table on the smooth signal
+        double worst = 0;
+        for(uint32_t n = 0; n < OUTPUT_FRAMES; n++) {
+            worst = std::max(worst, std::fabs(actual[n * 2] - expect[n]));
+        }
+        if(worst > 16) {
+            printf("NG: sinc %u Hz, error %f\n", input_rate, worst);
+            return 1;
+        }
+        if(!check_blocks(input, input_rate, RESAMPLE_SINC)) return 1;
+    }
+
+    // DC passes through every phase unchanged
+    std::vector<int32_t> dc(OUTPUT_FRAMES * 2, -12345);
+    std::vector<int32_t> actual = resample(dc, 53267, RESAMPLE_SINC, 256);
+    for(uint32_t n = vgm_resampler::SINC_TAPS; n < OUTPUT_FRAMES; n++) {
+        if(actual[n * 2] != -12345) {
+            printf("NG: sinc dc %u, %d\n", n, actual[n * 2]);
+            return 1;
+        }
+    }
+
+    // reset restarts as configure did
+    std::vector<int32_t> input = make_input(OUTPUT_FRAMES * 2, 5, false);
+    for(vgm_resample_quality quality : { RESAMPLE_NEAREST, RESAMPLE_LINEAR, RESAMPLE_SINC }) {
+        if(resample(input, 53267, quality, 256, 100) != resample(input, 53267, quality, 256)) {
+            printf("NG: reset (quality %u)\n", quality);
+            return 1;
+        }
+    }
+
+    printf("OK: %u frames\n", OUTPUT_FRAMES);
+
+    return 0;
+}
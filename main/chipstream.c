@@ -1,9 +1,12 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <esp_log.h>
 
+#include "vgm_index.h"
+
 /**
  * Rust chipstream(vgmplay) interface
  *
@@ -17,18 +20,59 @@ extern uint32_t vgm_create(
     uint32_t output_sampling_rate,
     uint32_t output_sample_chunk_size,
     uint32_t memory_index_id);
+extern void vgm_create_stream(
+    uint32_t vgm_index_id,
+    uint32_t output_sampling_rate,
+    uint32_t output_sample_chunk_size);
+extern bool vgm_load_stream(uint32_t vgm_index_id, const uint8_t *vgm_chunk, uint32_t length);
+extern bool vgm_end_stream(uint32_t vgm_index_id);
+extern bool vgm_compile_events(uint32_t vgm_index_id);
+extern uint32_t vgm_get_events(uint32_t vgm_index_id);
+extern bool vgm_set_events(uint32_t vgm_index_id, const uint8_t *events, uint32_t length);
 extern uint32_t vgm_get_gd3_json(uint32_t vgm_index_id);
+extern void vgm_meta_create(uint32_t meta_index_id);
+extern bool vgm_meta_load(uint32_t meta_index_id, const uint8_t *vgm_chunk, uint32_t length);
+extern uint32_t vgm_meta_get_next_offset(uint32_t meta_index_id);
+extern bool vgm_meta_end(uint32_t meta_index_id, vgm_index_info_t *info, uint32_t *memory_index_id);
 extern int16_t* vgm_get_sampling_s16le_ref(uint32_t vgm_index_id);
 extern void vgm_get_sampling_s16le(uint32_t vgm_index_id, int16_t *s16le);
+extern uint32_t vgm_get_sampling_stream_size(uint32_t vgm_index_id);
 extern uint32_t vgm_play(uint32_t vgm_index_id);
+extern void vgm_get_stage_cycles(uint32_t vgm_index_id, uint32_t *cycles);
+extern void vgm_set_quality(uint32_t vgm_index_id, uint32_t quality);
+extern bool vgm_seek(uint32_t vgm_index_id, uint32_t position_ms);
+extern uint32_t vgm_get_position(uint32_t vgm_index_id);
 extern void vgm_drop(uint32_t vgm_index_id);
 extern void memory_alloc(uint32_t memory_index_id, uint32_t length);
 extern uint8_t* memory_get_ref(uint32_t memory_index_id);
 extern uint32_t memory_get_len(uint32_t memory_index_id);
 extern void memory_drop(uint32_t memory_index_id);
 
+/**
+ * ymfm render worker (ymfmffi.cpp)
+ */
+extern bool ymfm_start_render_worker(int32_t core);
+extern void ymfm_report_placement(void);
+extern void ymfm_report_idle(void);
+extern bool ymfm_set_shared_rom(uint16_t chip_num, uint16_t access_type, const uint8_t *data, uint32_t length);
+
 static const char *TAG = "chipstream.c";
 
+/**
+ * Log GD3 json of vgmplay instance
+ */
+static void cs_log_gd3_vgm(uint32_t vgm_instance_id)
+{
+    uint32_t memory_index_id = vgm_get_gd3_json(vgm_instance_id);
+    uint8_t *vgm_header_json  = memory_get_ref(memory_index_id);
+    uint32_t vgm_heade_json_len = memory_get_len(memory_index_id);
+    uint8_t *vgm_header = (uint8_t *)calloc(vgm_heade_json_len + 1, sizeof(uint8_t));
+    strncpy((char *)vgm_header, (const char *)vgm_header_json, vgm_heade_json_len);
+    ESP_LOGI(TAG, "vgm_create(%s)", vgm_header);
+    free(vgm_header);
+    memory_drop(memory_index_id);
+}
+
 /**
  * Create chipstream vgmplay instance
  */
@@ -48,19 +92,143 @@ bool cs_create_vgm(
 
     // get json (test)
     if(vgm_result) {
-        uint32_t memory_index_id = vgm_get_gd3_json(vgm_instance_id);
-        uint8_t *vgm_header_json  = memory_get_ref(memory_index_id);
-        uint32_t vgm_heade_json_len = memory_get_len(memory_index_id);
-        uint8_t *vgm_header = (uint8_t *)calloc(vgm_heade_json_len + 1, sizeof(uint8_t));
-        strncpy((char *)vgm_header, (const char *)vgm_header_json, vgm_heade_json_len);
-        ESP_LOGI(TAG, "vgm_create(%s)", vgm_header);
-        free(vgm_header);
-        memory_drop(memory_index_id);
+        cs_log_gd3_vgm(vgm_instance_id);
     }
 
     return (bool)vgm_result;
 }
 
+/**
+ * Create chipstream vgmplay instance to be loaded by chunks
+ */
+void cs_create_vgm_stream(
+    uint32_t vgm_instance_id,
+    uint32_t sample_rate,
+    uint32_t sample_chunk_size)
+{
+    vgm_create_stream(
+        vgm_instance_id,
+        sample_rate,
+        sample_chunk_size);
+}
+
+/**
+ * Load a chunk of vgm/vgz file
+ *
+ * The chunk is inflated and parsed on the fly,
+ * and data blocks are added to sound chips.
+ * The instance is dropped on error.
+ */
+bool cs_load_vgm_stream(uint32_t vgm_instance_id, const uint8_t *vgm_chunk, uint32_t length)
+{
+    return vgm_load_stream(vgm_instance_id, vgm_chunk, length);
+}
+
+/**
+ * Finish loading vgm/vgz file
+ *
+ * The instance is dropped on error.
+ */
+bool cs_end_vgm_stream(uint32_t vgm_instance_id)
+{
+    bool vgm_result = vgm_end_stream(vgm_instance_id);
+    ESP_LOGI(TAG, "vgm_end_stream(%d)", vgm_result);
+
+    // get json (test)
+    if(vgm_result) {
+        cs_log_gd3_vgm(vgm_instance_id);
+    }
+
+    return vgm_result;
+}
+
+/**
+ * Compile the commands of a loaded vgmplay instance into events
+ *
+ * The render loop then walks a flat event array instead of parsing
+ * the vgm commands. Returns false if the commands are kept (e.g. the vgm
+ * has a command the events cannot hold); the instance plays either way.
+ */
+bool cs_compile_events_vgm(uint32_t vgm_instance_id)
+{
+    return vgm_compile_events(vgm_instance_id);
+}
+
+/**
+ * Get the compiled events of vgmplay instance to be saved
+ *
+ * The events are copied into chipstream memory mem_id,
+ * which must be dropped by cs_drop_mem.
+ * Returns NULL (length 0) if the instance has no events.
+ */
+const uint8_t* cs_get_events_vgm(uint32_t vgm_instance_id, uint32_t *mem_id, uint32_t *length)
+{
+    *mem_id = vgm_get_events(vgm_instance_id);
+    *length = memory_get_len(*mem_id);
+    if(*length == 0) {
+        return NULL;
+    }
+    return memory_get_ref(*mem_id);
+}
+
+/**
+ * Set the events saved by cs_get_events_vgm, instead of compiling them
+ *
+ * Returns false if they are not of the loaded vgm (the instance is kept).
+ */
+bool cs_set_events_vgm(uint32_t vgm_instance_id, const uint8_t *events, uint32_t length)
+{
+    return vgm_set_events(vgm_instance_id, events, length);
+}
+
+/**
+ * Create a reader of the header and GD3 of a vgm/vgz (library index)
+ *
+ * No player instance is created; the chunks are read from
+ * cs_get_next_offset_meta_vgm until it returns CS_META_COMPLETE
+ * or the end of the file, then cs_end_meta_vgm.
+ */
+void cs_create_meta_vgm(uint32_t meta_instance_id)
+{
+    vgm_meta_create(meta_instance_id);
+}
+
+/**
+ * Load a chunk of vgm/vgz file read from cs_get_next_offset_meta_vgm
+ *
+ * A .vgm is read up to the VGM data and from the GD3, a .vgz is inflated
+ * through and only the header and the GD3 are kept.
+ * The reader is dropped on error.
+ */
+bool cs_load_meta_vgm(uint32_t meta_instance_id, const uint8_t *vgm_chunk, uint32_t length)
+{
+    return vgm_meta_load(meta_instance_id, vgm_chunk, length);
+}
+
+/**
+ * Get the file offset of the next chunk, CS_META_COMPLETE when all has been read
+ */
+uint32_t cs_get_next_offset_meta_vgm(uint32_t meta_instance_id)
+{
+    return vgm_meta_get_next_offset(meta_instance_id);
+}
+
+/**
+ * Finish reading and drop the reader
+ *
+ * Sets the header summary and returns the title, game, system, author
+ * and date of the GD3 as NUL terminated UTF-8 ("" if blank), copied into
+ * chipstream memory mem_id, which must be dropped by cs_drop_mem.
+ * Returns NULL (no mem_id) if the header could not be read.
+ */
+const char* cs_end_meta_vgm(uint32_t meta_instance_id, vgm_index_info_t *info, uint32_t *mem_id)
+{
+    if(!vgm_meta_end(meta_instance_id, info, mem_id)) {
+        return NULL;
+    }
+    return (const char *)memory_get_ref(*mem_id);
+}
+
 /**
  * Generate waveform for test
  *
@@ -112,28 +280,76 @@ uint32_t vgm_get_sampling_stub(
 
 /**
  * Tick and stream vgmplay instance by sample_chunk_size
+ *
+ * s16le needs sample_chunk_size * 2 samples and 16-bit alignment;
+ * the chunk is written directly by chipstream.
+ * Returns the number of valid frames, which is less than sample_chunk_size
+ * only for the last chunk (the rest is filled with silence).
  */
-void cs_stream_vgm(uint32_t vgm_instance_id, int16_t *s16le, uint32_t *loop_count)
+uint32_t cs_stream_vgm(uint32_t vgm_instance_id, int16_t *s16le, uint32_t *loop_count)
 {
     *loop_count = vgm_play(vgm_instance_id);
     vgm_get_sampling_s16le(vgm_instance_id, s16le);
 
     // To perform a sound test, disable the top two lines and enable the bottom line.
     // *loop_count = vgm_get_sampling_stub(44100, 256, 440, s16le);
+
+    return vgm_get_sampling_stream_size(vgm_instance_id);
 }
 
 /**
  * Tick and stream vgmplay instance by sample_chunk_size
+ *
+ * Returns the s16le buffer owned by chipstream,
+ * valid until the next call for the instance.
  */
 int16_t* cs_stream_vgm_ref(uint32_t vgm_instance_id, uint32_t *loop_count)
 {
-    // TODO: There is a memory layout discrepancy between Rust and C.
-    // Pattern 1 (normal)
-    // I (2313) main.cpp: written 512 (8000:8000:8000): render time: 128 / 5ms
-    // Pattern 2 (out of alignment)
-    // I (2313) main.cpp: written 512 (7fff:8000:8000): render time: 128 / 5ms
     *loop_count = vgm_play(vgm_instance_id);
-    return (int16_t *)vgm_get_sampling_s16le;
+    return vgm_get_sampling_s16le_ref(vgm_instance_id);
+}
+
+/**
+ * Get cycles per render stage since the last call
+ *
+ * cycles needs 4 values (parse, generate, mix, convert),
+ * all 0 unless chipstream is built with the profile feature.
+ */
+void cs_get_stage_cycles_vgm(uint32_t vgm_instance_id, uint32_t *cycles)
+{
+    vgm_get_stage_cycles(vgm_instance_id, cycles);
+}
+
+/**
+ * Set render quality level of vgmplay instance
+ *
+ * 0 is full quality, each level up to CS_QUALITY_LEVELS - 1 is cheaper
+ * (nearest resampling, lower chip rate, mute the least audible chip).
+ */
+void cs_set_quality_vgm(uint32_t vgm_instance_id, uint32_t quality)
+{
+    vgm_set_quality(vgm_instance_id, quality);
+}
+
+/**
+ * Seek vgmplay instance to position_ms from the start
+ *
+ * Restores the nearest chip state keyframe and renders at most one
+ * keyframe interval; keyframes past the last one are built first by a
+ * fast-forward without rendering. Needs compiled events and a played chunk.
+ * Returns false (the position is kept) otherwise or over the end.
+ */
+bool cs_seek_vgm(uint32_t vgm_instance_id, uint32_t position_ms)
+{
+    return vgm_seek(vgm_instance_id, position_ms);
+}
+
+/**
+ * Get play position of vgmplay instance in ms (back to the loop point on each loop)
+ */
+uint32_t cs_get_position_vgm(uint32_t vgm_instance_id)
+{
+    return vgm_get_position(vgm_instance_id);
 }
 
 /**
@@ -145,6 +361,52 @@ void cs_drop_vgm(uint32_t vgm_instance_id)
     vgm_drop(vgm_instance_id);
 }
 
+/**
+ * Start rendering ymfm chips on another core
+ *
+ * Each chipstream update then renders the ymfm chips on core
+ * while the calling core renders the other chips, without changing output.
+ */
+bool cs_start_parallel_render(int32_t core)
+{
+    bool result = ymfm_start_render_worker(core);
+    ESP_LOGI(TAG, "ymfm_start_render_worker(%d)", result);
+
+    return result;
+}
+
+/**
+ * Log where the state, block buffer and ROM data of each ymfm chip landed
+ * (internal DRAM or PSRAM) and the free heap
+ */
+void cs_report_placement(void)
+{
+    ymfm_report_placement();
+}
+
+/**
+ * Log the frames each ymfm chip has skipped generating while idle
+ * (silent engines and zero output until the next register write)
+ */
+void cs_report_idle(void)
+{
+    ymfm_report_idle();
+}
+
+/**
+ * Share a read-only sample ROM with the ymfm chips of chip_num
+ *
+ * data is not copied (e.g. memory-mapped from the rom partition) and must
+ * stay valid. Applies to chips created afterwards.
+ */
+bool cs_set_shared_rom(uint16_t chip_num, uint16_t access_type, const uint8_t *data, uint32_t length)
+{
+    bool result = ymfm_set_shared_rom(chip_num, access_type, data, length);
+    ESP_LOGI(TAG, "ymfm_set_shared_rom(%d, 0x%02x, %d)", chip_num, access_type, result);
+
+    return result;
+}
+
 /**
  * Alloc memory on chipstream
  */
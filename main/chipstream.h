@@ -1,10 +1,38 @@
 #include <stdint.h>
 
+/**
+ * Render quality levels of cs_set_quality_vgm
+ */
+#define CS_QUALITY_LEVELS 4
+
+/**
+ * Returned by cs_get_next_offset_meta_vgm when the header and GD3 have been read
+ */
+#define CS_META_COMPLETE 0xffffffff
+
 extern "C" {
 bool cs_create_vgm(uint32_t vgm_mem_id, uint32_t vgm_instance_id, uint32_t sample_rate, uint32_t sample_chunk_size);
-void cs_stream_vgm(uint32_t vgm_instance_id, int16_t *s16le, uint32_t *loop_count);
+void cs_create_vgm_stream(uint32_t vgm_instance_id, uint32_t sample_rate, uint32_t sample_chunk_size);
+bool cs_load_vgm_stream(uint32_t vgm_instance_id, const uint8_t *vgm_chunk, uint32_t length);
+bool cs_end_vgm_stream(uint32_t vgm_instance_id);
+bool cs_compile_events_vgm(uint32_t vgm_instance_id);
+const uint8_t* cs_get_events_vgm(uint32_t vgm_instance_id, uint32_t *mem_id, uint32_t *length);
+bool cs_set_events_vgm(uint32_t vgm_instance_id, const uint8_t *events, uint32_t length);
+void cs_create_meta_vgm(uint32_t meta_instance_id);
+bool cs_load_meta_vgm(uint32_t meta_instance_id, const uint8_t *vgm_chunk, uint32_t length);
+uint32_t cs_get_next_offset_meta_vgm(uint32_t meta_instance_id);
+const char* cs_end_meta_vgm(uint32_t meta_instance_id, struct vgm_index_info *info, uint32_t *mem_id);
+uint32_t cs_stream_vgm(uint32_t vgm_instance_id, int16_t *s16le, uint32_t *loop_count);
 int16_t* cs_stream_vgm_ref(uint32_t vgm_instance_id, uint32_t *loop_count);
+void cs_get_stage_cycles_vgm(uint32_t vgm_instance_id, uint32_t *cycles);
+void cs_set_quality_vgm(uint32_t vgm_instance_id, uint32_t quality);
+bool cs_seek_vgm(uint32_t vgm_instance_id, uint32_t position_ms);
+uint32_t cs_get_position_vgm(uint32_t vgm_instance_id);
 void cs_drop_vgm(uint32_t vgm_instance_id);
+bool cs_start_parallel_render(int32_t core);
+void cs_report_placement(void);
+void cs_report_idle(void);
+bool cs_set_shared_rom(uint16_t chip_num, uint16_t access_type, const uint8_t *data, uint32_t length);
 uint8_t* cs_alloc_mem(uint32_t mem_id, uint32_t vgm_size);
 void cs_drop_mem(uint32_t vgm_mem_id);
 }
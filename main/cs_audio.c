@@ -0,0 +1,108 @@
+#include <stdbool.h>
+#include <string.h>
+#include <esp_log.h>
+
+#include "cs_audio.h"
+
+static const char *TAG = "cs_audio.c";
+
+/**
+ * Supported output sample rates
+ */
+static const uint32_t sample_rates[] = { 22050, 32000, 44100, 48000 };
+
+/**
+ * Chunk of the default configuration, 256 frames at 44.1kHz (about 5.8ms)
+ */
+#define CS_AUDIO_CHUNK_FRAMES_44K 256
+
+static uint32_t align_down(uint32_t frames)
+{
+    return frames / CS_AUDIO_CHUNK_ALIGN * CS_AUDIO_CHUNK_ALIGN;
+}
+
+static uint32_t clamp(uint32_t value, uint32_t min, uint32_t max)
+{
+    return value < min ? min : value > max ? max : value;
+}
+
+/**
+ * is_rate_cs_audio
+ */
+bool is_rate_cs_audio(uint32_t sample_rate)
+{
+    for(uint32_t i = 0; i < sizeof(sample_rates) / sizeof(sample_rates[0]); i++) {
+        if(sample_rates[i] == sample_rate) return true;
+    }
+    return false;
+}
+
+/**
+ * plan_cs_audio
+ *
+ * The chunk keeps the play time of 256 frames at 44.1kHz, shrinks so that
+ * a short latency still holds CS_AUDIO_MIN_CHUNK_HOLD chunks, and grows
+ * so that a long one fits in CS_AUDIO_MAX_CHUNK_HOLD chunks.
+ * Returns false if the sample rate is not supported.
+ */
+bool plan_cs_audio(uint32_t sample_rate, uint32_t latency_ms, cs_audio_config_t *config)
+{
+    if(!is_rate_cs_audio(sample_rate)) return false;
+
+    uint32_t target_frames = (uint64_t)sample_rate * latency_ms / 1000;
+    // nearest multiple of CS_AUDIO_CHUNK_ALIGN
+    uint32_t chunk_frames = align_down(
+        CS_AUDIO_CHUNK_FRAMES_44K * sample_rate / 44100 + CS_AUDIO_CHUNK_ALIGN / 2);
+    uint32_t min_chunks = CS_AUDIO_MIN_CHUNK_HOLD + CS_AUDIO_MIN_DMA_BUF_COUNT;
+    uint32_t max_chunks = CS_AUDIO_MAX_CHUNK_HOLD + CS_AUDIO_DMA_BUF_COUNT;
+    if(target_frames / chunk_frames < min_chunks) {
+        chunk_frames = align_down(target_frames / min_chunks);
+    } else if(target_frames / chunk_frames > max_chunks) {
+        chunk_frames = align_down(target_frames / max_chunks + CS_AUDIO_CHUNK_ALIGN - 1);
+    }
+    chunk_frames = clamp(chunk_frames, CS_AUDIO_MIN_CHUNK_FRAMES, CS_AUDIO_MAX_CHUNK_FRAMES);
+
+    // DMA buffers are given up first for a short latency
+    uint32_t chunks = target_frames / chunk_frames;
+    uint32_t dma_buf_count = chunks >= CS_AUDIO_MIN_CHUNK_HOLD + CS_AUDIO_DMA_BUF_COUNT
+        ? CS_AUDIO_DMA_BUF_COUNT : CS_AUDIO_MIN_DMA_BUF_COUNT;
+    uint32_t chunk_hold = clamp(
+        chunks > dma_buf_count ? chunks - dma_buf_count : 0,
+        CS_AUDIO_MIN_CHUNK_HOLD,
+        CS_AUDIO_MAX_CHUNK_HOLD);
+
+    memset(config, 0, sizeof(*config));
+    config->sample_rate = sample_rate;
+    config->chunk_frames = chunk_frames;
+    config->chunk_hold = chunk_hold;
+    config->dma_buf_count = dma_buf_count;
+    config->item_bytes = sizeof(uint32_t) + chunk_frames * CS_AUDIO_CHANNELS * sizeof(int16_t);
+    config->ring_buf_bytes = (config->item_bytes + CS_AUDIO_RINGBUF_ITEM_HEADER_BYTES) * chunk_hold;
+    config->chunk_us = (uint64_t)chunk_frames * 1000000 / sample_rate;
+    config->latency_us = (uint64_t)(chunk_hold + dma_buf_count) * chunk_frames * 1000000 / sample_rate;
+
+    return true;
+}
+
+/**
+ * equal_cs_audio
+ */
+bool equal_cs_audio(const cs_audio_config_t *a, const cs_audio_config_t *b)
+{
+    return memcmp(a, b, sizeof(*a)) == 0;
+}
+
+/**
+ * dump_cs_audio
+ */
+void dump_cs_audio(const cs_audio_config_t *config)
+{
+    ESP_LOGI(TAG, "audio %d Hz: chunk %d frames, ring buffer %d chunks (%d bytes), dma %d, latency %d.%d ms",
+        config->sample_rate,
+        config->chunk_frames,
+        config->chunk_hold,
+        config->ring_buf_bytes,
+        config->dma_buf_count,
+        config->latency_us / 1000,
+        config->latency_us % 1000 / 100);
+}
@@ -0,0 +1,51 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/**
+ * Audio configuration
+ *
+ * Sizes the render chunk (also the I2S DMA buffer length), the ring buffer
+ * and the DMA buffers for a sample rate and a target latency.
+ * The latency is the play time of a filled ring buffer and DMA buffers,
+ * it may differ from the target by the chunk size and the limits below.
+ */
+#define CS_AUDIO_CHUNK_ALIGN 32
+#define CS_AUDIO_MIN_CHUNK_FRAMES 64
+#define CS_AUDIO_MAX_CHUNK_FRAMES 512
+#define CS_AUDIO_MIN_CHUNK_HOLD 4
+#define CS_AUDIO_MAX_CHUNK_HOLD 128
+#define CS_AUDIO_DMA_BUF_COUNT 4
+#define CS_AUDIO_MIN_DMA_BUF_COUNT 2
+#define CS_AUDIO_CHANNELS 2
+// header of each no-split ring buffer item
+#define CS_AUDIO_RINGBUF_ITEM_HEADER_BYTES 8
+
+/**
+ *  chunk_frames: frames rendered per chunk and per DMA buffer
+ *  chunk_hold: chunks held by the ring buffer
+ *  item_bytes: ring buffer item, valid frame count (uint32_t) and chunk
+ *  ring_buf_bytes: ring buffer storage (32-bit aligned)
+ *  chunk_us: play time of a chunk
+ *  latency_us: play time of the ring buffer and DMA buffers when filled
+ */
+typedef struct cs_audio_config {
+    uint32_t sample_rate;
+    uint32_t chunk_frames;
+    uint32_t chunk_hold;
+    uint32_t dma_buf_count;
+    uint32_t item_bytes;
+    uint32_t ring_buf_bytes;
+    uint32_t chunk_us;
+    uint32_t latency_us;
+} cs_audio_config_t;
+
+bool is_rate_cs_audio(uint32_t sample_rate);
+bool plan_cs_audio(uint32_t sample_rate, uint32_t latency_ms, cs_audio_config_t *config);
+bool equal_cs_audio(const cs_audio_config_t *a, const cs_audio_config_t *b);
+void dump_cs_audio(const cs_audio_config_t *config);
+#ifdef __cplusplus
+}
+#endif
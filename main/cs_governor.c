@@ -0,0 +1,90 @@
+#include <stdbool.h>
+#include <string.h>
+#include <esp_log.h>
+
+#include "cs_governor.h"
+
+static const char *TAG = "cs_governor.c";
+
+/**
+ * Governor state (updated by task_cs only)
+ *
+ *  since_step: chunks since the last step
+ *  over_high: chunks in a row at or over the high watermark
+ */
+static uint32_t governor_levels;
+static uint32_t low_watermark;
+static uint32_t high_watermark;
+static uint32_t hold_chunks;
+static uint32_t since_step;
+static uint32_t over_high;
+static cs_governor_stats_t stats;
+
+/**
+ * init_cs_governor
+ *
+ * Watermarks are chunks waiting in the ring buffer,
+ * levels is the number of quality levels (CS_QUALITY_LEVELS).
+ */
+void init_cs_governor(uint32_t levels, uint32_t low, uint32_t high, uint32_t hold)
+{
+    governor_levels = levels;
+    low_watermark = low;
+    high_watermark = high;
+    hold_chunks = hold;
+    since_step = hold;
+    over_high = 0;
+    memset(&stats, 0, sizeof(stats));
+    stats.lowest_fill = UINT32_MAX;
+}
+
+/**
+ * update_cs_governor
+ *
+ * Call after each rendered chunk with the chunks in the ring buffer,
+ * returns the quality level to render the next chunk.
+ */
+uint32_t update_cs_governor(uint32_t fill)
+{
+    if(fill < stats.lowest_fill) stats.lowest_fill = fill;
+    if(since_step < UINT32_MAX) since_step++;
+    over_high = fill >= high_watermark ? over_high + 1 : 0;
+
+    if(fill < low_watermark && stats.level + 1 < governor_levels && since_step >= hold_chunks) {
+        stats.level++;
+        stats.step_down_count++;
+        since_step = 0;
+        over_high = 0;
+        ESP_LOGI(TAG, "quality down %d -> %d (fill %d, down %d, up %d)",
+            stats.level - 1, stats.level, fill, stats.step_down_count, stats.step_up_count);
+    } else if(stats.level > 0 && over_high >= hold_chunks * CS_GOVERNOR_UP_HOLD_FACTOR) {
+        stats.level--;
+        stats.step_up_count++;
+        since_step = 0;
+        over_high = 0;
+        ESP_LOGI(TAG, "quality up %d -> %d (fill %d, down %d, up %d)",
+            stats.level + 1, stats.level, fill, stats.step_down_count, stats.step_up_count);
+    }
+
+    return stats.level;
+}
+
+/**
+ * get_stats_cs_governor
+ */
+void get_stats_cs_governor(cs_governor_stats_t *governor_stats)
+{
+    *governor_stats = stats;
+}
+
+/**
+ * dump_cs_governor
+ */
+void dump_cs_governor(void)
+{
+    ESP_LOGI(TAG, "quality level: %d, down %d, up %d, lowest fill %d",
+        stats.level,
+        stats.step_down_count,
+        stats.step_up_count,
+        stats.lowest_fill == UINT32_MAX ? 0 : stats.lowest_fill);
+}
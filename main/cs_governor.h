@@ -0,0 +1,30 @@
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/**
+ * Render quality governor
+ *
+ * Steps the render quality down one level (0 is full quality) while the
+ * ring buffer is drained below the low watermark, and back up while it
+ * stays at or over the high watermark. After a step down the next one waits
+ * hold_chunks, a step up waits hold_chunks * CS_GOVERNOR_UP_HOLD_FACTOR
+ * chunks over the high watermark.
+ */
+#define CS_GOVERNOR_UP_HOLD_FACTOR 8
+
+typedef struct cs_governor_stats {
+    uint32_t level;
+    uint32_t step_down_count;
+    uint32_t step_up_count;
+    uint32_t lowest_fill;
+} cs_governor_stats_t;
+
+void init_cs_governor(uint32_t levels, uint32_t low_watermark, uint32_t high_watermark, uint32_t hold_chunks);
+uint32_t update_cs_governor(uint32_t fill);
+void get_stats_cs_governor(cs_governor_stats_t *stats);
+void dump_cs_governor(void);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,171 @@
+#include <stdbool.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_cpu.h>
+
+#include "cs_profile.h"
+
+static const char *TAG = "cs_profile.c";
+
+/**
+ * Histogram of cycles per chunk
+ *
+ * Buckets have 4 steps per power of 2 (values under 4 are exact),
+ * so a percentile is within 25% of the measured value.
+ * Each stage has a single writer task, counters are updated with
+ * relaxed atomics and read by dump without a lock.
+ */
+#define CS_PROFILE_SUB_BITS 2
+#define CS_PROFILE_SUBS (1 << CS_PROFILE_SUB_BITS)
+#define CS_PROFILE_BUCKETS ((32 - CS_PROFILE_SUB_BITS + 1) * CS_PROFILE_SUBS)
+
+typedef struct cs_profile_histogram {
+    uint32_t count;
+    uint32_t over_deadline;
+    uint32_t max;
+    uint32_t bucket[CS_PROFILE_BUCKETS];
+} cs_profile_histogram_t;
+
+static const char *stage_names[CS_PROFILE_STAGES] = {
+    "parse",
+    "generate",
+    "mix",
+    "convert",
+    "chunk",
+    "ring_wait",
+    "i2s_wait",
+};
+
+static cs_profile_histogram_t histograms[CS_PROFILE_STAGES];
+static uint32_t profile_cpu_mhz = 240;
+static uint32_t deadline_cycles;
+
+/**
+ * Ring buffer fill watermark (chunks buffered when the writer takes one)
+ */
+static uint32_t fill_low;
+static uint32_t fill_high;
+static uint32_t fill_count;
+
+static inline uint32_t bucket_of(uint32_t cycles)
+{
+    if(cycles < CS_PROFILE_SUBS) return cycles;
+    uint32_t msb = 31 - __builtin_clz(cycles);
+    uint32_t sub = (cycles >> (msb - CS_PROFILE_SUB_BITS)) & (CS_PROFILE_SUBS - 1);
+    return (msb - CS_PROFILE_SUB_BITS + 1) * CS_PROFILE_SUBS + sub;
+}
+
+static inline uint32_t bucket_upper(uint32_t bucket)
+{
+    if(bucket < CS_PROFILE_SUBS) return bucket;
+    uint32_t msb = bucket / CS_PROFILE_SUBS + CS_PROFILE_SUB_BITS - 1;
+    uint32_t sub = bucket % CS_PROFILE_SUBS;
+    uint64_t lower = (uint64_t)(CS_PROFILE_SUBS + sub) << (msb - CS_PROFILE_SUB_BITS);
+    uint64_t upper = lower + ((uint64_t)1 << (msb - CS_PROFILE_SUB_BITS)) - 1;
+    return upper > UINT32_MAX ? UINT32_MAX : (uint32_t)upper;
+}
+
+/**
+ * init_cs_profile
+ *
+ * deadline_us is the play time of a chunk.
+ */
+void init_cs_profile(uint32_t cpu_mhz, uint32_t deadline_us)
+{
+    profile_cpu_mhz = cpu_mhz;
+    deadline_cycles = cpu_mhz * deadline_us;
+    reset_cs_profile();
+}
+
+/**
+ * reset_cs_profile
+ *
+ * Call while no stage is being recorded.
+ */
+void reset_cs_profile(void)
+{
+    memset(histograms, 0, sizeof(histograms));
+    fill_low = UINT32_MAX;
+    fill_high = 0;
+    fill_count = 0;
+}
+
+/**
+ * get_cycles_cs_profile
+ *
+ * CPU cycle counter of the running core, also used by chipstream.
+ */
+uint32_t get_cycles_cs_profile(void)
+{
+    return esp_cpu_get_ccount();
+}
+
+/**
+ * record_cs_profile
+ */
+void record_cs_profile(cs_profile_stage_t stage, uint32_t cycles)
+{
+    cs_profile_histogram_t *histogram = &histograms[stage];
+    __atomic_fetch_add(&histogram->bucket[bucket_of(cycles)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+    if(cycles > deadline_cycles) {
+        __atomic_fetch_add(&histogram->over_deadline, 1, __ATOMIC_RELAXED);
+    }
+    if(cycles > __atomic_load_n(&histogram->max, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&histogram->max, cycles, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * record_fill_cs_profile
+ */
+void record_fill_cs_profile(uint32_t chunks)
+{
+    if(chunks < __atomic_load_n(&fill_low, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&fill_low, chunks, __ATOMIC_RELAXED);
+    }
+    if(chunks > __atomic_load_n(&fill_high, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&fill_high, chunks, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&fill_count, 1, __ATOMIC_RELAXED);
+}
+
+static uint32_t percentile(const cs_profile_histogram_t *histogram, uint32_t count, uint32_t permille)
+{
+    uint32_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+    uint64_t rank = ((uint64_t)count * permille + 999) / 1000;
+    uint64_t seen = 0;
+    for(uint32_t i = 0; i < CS_PROFILE_BUCKETS; i++) {
+        seen += __atomic_load_n(&histogram->bucket[i], __ATOMIC_RELAXED);
+        if(seen >= rank) return bucket_upper(i) < max ? bucket_upper(i) : max;
+    }
+    return max;
+}
+
+/**
+ * dump_cs_profile
+ *
+ * Log p50/p99/max per stage in microseconds
+ * and the number of chunks over the deadline.
+ */
+void dump_cs_profile(void)
+{
+    ESP_LOGI(TAG, "stage: chunks p50/p99/max us, over %dus", deadline_cycles / profile_cpu_mhz);
+    for(uint32_t stage = 0; stage < CS_PROFILE_STAGES; stage++) {
+        const cs_profile_histogram_t *histogram = &histograms[stage];
+        uint32_t count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+        if(count == 0) continue;
+        ESP_LOGI(TAG, "%s: %d %d/%d/%d, over %d",
+            stage_names[stage],
+            count,
+            percentile(histogram, count, 500) / profile_cpu_mhz,
+            percentile(histogram, count, 990) / profile_cpu_mhz,
+            __atomic_load_n(&histogram->max, __ATOMIC_RELAXED) / profile_cpu_mhz,
+            __atomic_load_n(&histogram->over_deadline, __ATOMIC_RELAXED));
+    }
+    if(__atomic_load_n(&fill_count, __ATOMIC_RELAXED) > 0) {
+        ESP_LOGI(TAG, "ring buffer fill: low %d, high %d chunks",
+            __atomic_load_n(&fill_low, __ATOMIC_RELAXED),
+            __atomic_load_n(&fill_high, __ATOMIC_RELAXED));
+    }
+}
@@ -0,0 +1,35 @@
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/**
+ * Render and output stages measured per chunk
+ *
+ *  CS_PROFILE_PARSE .. CS_PROFILE_CONVERT: inside chipstream (order of sound::Stage)
+ *  CS_PROFILE_CHUNK: the whole cs_stream_vgm call
+ *  CS_PROFILE_RING_WAIT: xRingbufferSendAcquire in stream_vgm
+ *  CS_PROFILE_I2S_WAIT: DMA wait and i2s_write in task_i2s_write
+ */
+typedef enum {
+    CS_PROFILE_PARSE,
+    CS_PROFILE_GENERATE,
+    CS_PROFILE_MIX,
+    CS_PROFILE_CONVERT,
+    CS_PROFILE_CHUNK,
+    CS_PROFILE_RING_WAIT,
+    CS_PROFILE_I2S_WAIT,
+    CS_PROFILE_STAGES
+} cs_profile_stage_t;
+
+#define CS_PROFILE_CS_STAGES (CS_PROFILE_CONVERT + 1)
+
+void init_cs_profile(uint32_t cpu_mhz, uint32_t deadline_us);
+void reset_cs_profile(void);
+uint32_t get_cycles_cs_profile(void);
+void record_cs_profile(cs_profile_stage_t stage, uint32_t cycles);
+void record_fill_cs_profile(uint32_t chunks);
+void dump_cs_profile(void);
+#ifdef __cplusplus
+}
+#endif
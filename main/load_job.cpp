@@ -0,0 +1,361 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <Arduino.h>
+#include <SD.h>
+#include <esp_heap_caps.h>
+
+#include "chipstream.h"
+#include "cs_audio.h"
+#include "pcm_cache.h"
+#include "load_job.h"
+
+static const char *TAG = "load_job.cpp";
+
+/**
+ * Compiled event settings
+ *
+ * VGM_EVENTS_EXT = suffix of the compiled events saved next to a vgm/vgz
+ * VGM_EVENTS_MAGIC = magic of vgm_events_header_t
+ */
+#define VGM_EVENTS_EXT ".cse"
+#define VGM_EVENTS_MAGIC "CSEV"
+
+#if CONFIG_CHIPSTREAM_EVENT_CACHE
+/**
+ * Saved compiled events (followed by length bytes of cs_get_events_vgm)
+ *
+ *  vgm_hash: FNV-1a of the vgm/vgz file (hash_pcm_cache)
+ */
+typedef struct vgm_events_header {
+    char magic[4];
+    uint32_t vgm_hash;
+    uint32_t vgm_size;
+    uint32_t length;
+} vgm_events_header_t;
+#endif
+
+load_job_t load_job;
+uint8_t vgm_load_chunk[VGM_LOAD_CHUNK_BYTES];
+
+/**
+ * end_load_job
+ *
+ * The instance has been dropped (by the caller or by chipstream) on LOAD_ERROR.
+ */
+static load_result_t end_load_job(load_result_t result)
+{
+    load_job.loading = false;
+
+    return result;
+}
+
+#if CONFIG_CHIPSTREAM_EVENT_CACHE
+/**
+ * open_sd_vgm_events
+ *
+ * Open the events saved next to the vgm/vgz file, if they are of the file.
+ */
+static bool open_sd_vgm_events(void)
+{
+    snprintf(load_job.events_path, sizeof(load_job.events_path), "%s" VGM_EVENTS_EXT, load_job.filename);
+    if(!SD.exists(load_job.events_path)) {
+        return false;
+    }
+    load_job.fp = SD.open(load_job.events_path);
+    if(!load_job.fp) {
+        return false;
+    }
+    vgm_events_header_t header;
+    bool result = load_job.fp.read((uint8_t *)&header, sizeof(header)) == sizeof(header)
+        && memcmp(header.magic, VGM_EVENTS_MAGIC, sizeof(header.magic)) == 0
+        && header.vgm_hash == load_job.vgm_hash
+        && header.vgm_size == load_job.vgm_size
+        && header.length == load_job.fp.size() - sizeof(header);
+    if(result) {
+        load_job.events = (uint8_t *)heap_caps_malloc(header.length, MALLOC_CAP_DEFAULT);
+        result = load_job.events != NULL;
+    }
+    if(!result) {
+        load_job.fp.close();
+        return false;
+    }
+    load_job.events_length = header.length;
+    load_job.events_done = 0;
+
+    return true;
+}
+
+/**
+ * begin_save_sd_vgm_events
+ *
+ * Create the file to save the compiled events of the instance next to
+ * the vgm/vgz file, the events are written by step_load_job.
+ */
+static bool begin_save_sd_vgm_events(void)
+{
+    vgm_events_header_t header;
+    load_job.events = (uint8_t *)cs_get_events_vgm(load_job.vgm_instance_id, &load_job.mem_id, &header.length);
+    if(load_job.events == NULL) {
+        cs_drop_mem(load_job.mem_id);
+        return false;
+    }
+    memcpy(header.magic, VGM_EVENTS_MAGIC, sizeof(header.magic));
+    header.vgm_hash = load_job.vgm_hash;
+    header.vgm_size = load_job.vgm_size;
+    load_job.events_length = header.length;
+    load_job.events_done = 0;
+
+    snprintf(load_job.events_path, sizeof(load_job.events_path), "%s" VGM_EVENTS_EXT, load_job.filename);
+    load_job.fp = SD.open(load_job.events_path, FILE_WRITE);
+    if(!load_job.fp) {
+        cs_drop_mem(load_job.mem_id);
+        return false;
+    }
+    if(load_job.fp.write((const uint8_t *)&header, sizeof(header)) != sizeof(header)) {
+        load_job.fp.close();
+        SD.remove(load_job.events_path);
+        cs_drop_mem(load_job.mem_id);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * end_save_sd_vgm_events
+ *
+ * A partly written file is removed.
+ */
+static void end_save_sd_vgm_events(bool result)
+{
+    load_job.fp.close();
+    if(!result) {
+        SD.remove(load_job.events_path);
+    }
+    cs_drop_mem(load_job.mem_id);
+    ESP_LOGI(TAG, "save events(%d): %s (%d bytes)", result, load_job.events_path, load_job.events_length);
+}
+#endif
+
+/**
+ * compile_load_job
+ *
+ * Compile the commands into events, then save them with
+ * CONFIG_CHIPSTREAM_EVENT_CACHE.
+ */
+static load_result_t compile_load_job(void)
+{
+    unsigned long compile_start = micros();
+    bool compiled = cs_compile_events_vgm(load_job.vgm_instance_id);
+    ESP_LOGI(TAG, "compile events(%d): %luus", compiled, micros() - compile_start);
+    #if CONFIG_CHIPSTREAM_EVENT_CACHE
+    if(compiled && begin_save_sd_vgm_events()) {
+        load_job.step = SAVE_EVENTS;
+        return LOAD_BUSY;
+    }
+    #endif
+
+    return end_load_job(LOAD_DONE);
+}
+
+#if CONFIG_CHIPSTREAM_PCM_CACHE
+/**
+ * key_load_job
+ *
+ * PCM cache key of the file read by the load job.
+ */
+void key_load_job(pcm_cache_key_t *key)
+{
+    key->vgm_hash = load_job.vgm_hash;
+    key->vgm_size = load_job.vgm_size;
+    key->sample_rate = load_job.sample_rate;
+    key->loop_max_count = load_job.loop_max_count;
+}
+
+/**
+ * cache_load_job
+ *
+ * Open the cache file of the track into cache (only look for it if cache
+ * is NULL). Returns true if the track has been cached.
+ */
+static bool cache_load_job(void)
+{
+    pcm_cache_key_t key;
+    key_load_job(&key);
+    if(load_job.cache != NULL) {
+        return open_pcm_cache(&key, load_job.cache);
+    }
+
+    return exists_pcm_cache(&key);
+}
+#endif
+
+/**
+ * begin_load_job
+ *
+ * Open the vgm/vgz file and create the instance (rendering at config) to be
+ * loaded by step_load_job.
+ * loop_max_count and cache are of CONFIG_CHIPSTREAM_PCM_CACHE (see load job).
+ */
+bool begin_load_job(
+    uint32_t vgm_instance_id,
+    const char *filename,
+    const cs_audio_config_t *config,
+    uint32_t loop_max_count,
+    pcm_cache_reader_t *cache)
+{
+    // SD open
+    load_job.fp = SD.open(filename);
+    if(!load_job.fp) {
+        ESP_LOGE(TAG, "open vgm error(%s)", filename);
+        return false;
+    }
+    load_job.vgm_size = load_job.fp.size();
+    ESP_LOGI(TAG, "vgm file(%d)", load_job.vgm_size);
+
+    // create vgm instance
+    cs_create_vgm_stream(
+        vgm_instance_id,
+        config->sample_rate,
+        config->chunk_frames);
+
+    load_job.loading = true;
+    load_job.step = LOAD_VGM;
+    load_job.vgm_instance_id = vgm_instance_id;
+    load_job.filename = filename;
+    load_job.read_size = 0;
+    load_job.vgm_hash = PCM_CACHE_HASH_INIT;
+    #if CONFIG_CHIPSTREAM_PCM_CACHE
+    load_job.sample_rate = config->sample_rate;
+    load_job.loop_max_count = loop_max_count;
+    load_job.cache = cache;
+    load_job.cached = false;
+    #endif
+
+    return true;
+}
+
+/**
+ * step_load_job
+ *
+ * Read (or write) a chunk of the load job. Returns LOAD_BUSY until
+ * the instance is loaded (LOAD_DONE) or dropped (LOAD_ERROR).
+ */
+load_result_t step_load_job(void)
+{
+    switch(load_job.step) {
+        case LOAD_VGM: {
+            if(load_job.read_size < load_job.vgm_size) {
+                size_t read_size = load_job.fp.read(vgm_load_chunk, VGM_LOAD_CHUNK_BYTES);
+                if(read_size == 0) {
+                    ESP_LOGE(TAG, "read vgm error(%d)", load_job.read_size);
+                    load_job.fp.close();
+                    cs_drop_vgm(load_job.vgm_instance_id);
+                    return end_load_job(LOAD_ERROR);
+                }
+                if(!cs_load_vgm_stream(load_job.vgm_instance_id, vgm_load_chunk, read_size)) {
+                    // instance has been dropped by chipstream
+                    ESP_LOGE(TAG, "load vgm error(%d)", load_job.read_size);
+                    load_job.fp.close();
+                    return end_load_job(LOAD_ERROR);
+                }
+                #if CONFIG_CHIPSTREAM_EVENT_CACHE || CONFIG_CHIPSTREAM_PCM_CACHE
+                load_job.vgm_hash = hash_pcm_cache(load_job.vgm_hash, vgm_load_chunk, read_size);
+                #endif
+                load_job.read_size += read_size;
+                return LOAD_BUSY;
+            }
+            ESP_LOGI(TAG, "read vgm file(%d)", load_job.read_size);
+            load_job.fp.close();
+            #if CONFIG_CHIPSTREAM_PCM_CACHE
+            // play the pre-rendered PCM if it has been cached
+            if(cache_load_job()) {
+                ESP_LOGI(TAG, "pcm cache(%s)", load_job.filename);
+                cs_drop_vgm(load_job.vgm_instance_id);
+                load_job.cached = true;
+                return end_load_job(LOAD_DONE);
+            }
+            #endif
+            if(!cs_end_vgm_stream(load_job.vgm_instance_id)) {
+                return end_load_job(LOAD_ERROR);
+            }
+            #if CONFIG_CHIPSTREAM_EVENT_CACHE
+            if(open_sd_vgm_events()) {
+                load_job.step = LOAD_EVENTS;
+                return LOAD_BUSY;
+            }
+            #endif
+            return compile_load_job();
+        }
+        #if CONFIG_CHIPSTREAM_EVENT_CACHE
+        case LOAD_EVENTS: {
+            uint32_t size = load_job.events_length - load_job.events_done;
+            if(size > VGM_LOAD_CHUNK_BYTES) size = VGM_LOAD_CHUNK_BYTES;
+            bool result = size > 0
+                && load_job.fp.read(load_job.events + load_job.events_done, size) == size;
+            load_job.events_done += size;
+            if(result && load_job.events_done < load_job.events_length) {
+                return LOAD_BUSY;
+            }
+            load_job.fp.close();
+            result = result && cs_set_events_vgm(load_job.vgm_instance_id, load_job.events, load_job.events_length);
+            free(load_job.events);
+            load_job.events = NULL;
+            ESP_LOGI(TAG, "load events(%d): %s", result, load_job.events_path);
+            if(!result) {
+                return compile_load_job();
+            }
+            return end_load_job(LOAD_DONE);
+        }
+        case SAVE_EVENTS: {
+            uint32_t size = load_job.events_length - load_job.events_done;
+            if(size > VGM_LOAD_CHUNK_BYTES) size = VGM_LOAD_CHUNK_BYTES;
+            bool result = load_job.fp.write(load_job.events + load_job.events_done, size) == size;
+            load_job.events_done += size;
+            if(result && load_job.events_done < load_job.events_length) {
+                return LOAD_BUSY;
+            }
+            end_save_sd_vgm_events(result);
+            // the instance is loaded even if the events could not be saved
+            return end_load_job(LOAD_DONE);
+        }
+        #endif
+        default:
+            return end_load_job(LOAD_ERROR);
+    }
+}
+
+/**
+ * finish_load_job
+ *
+ * Load the rest at once (nothing is being rendered meanwhile).
+ */
+load_result_t finish_load_job(void)
+{
+    load_result_t result;
+    while((result = step_load_job()) == LOAD_BUSY);
+
+    return result;
+}
+
+/**
+ * cancel_load_job
+ *
+ * Stop the load job and drop its instance.
+ */
+void cancel_load_job(void)
+{
+    if(!load_job.loading) return;
+    load_job.fp.close();
+    #if CONFIG_CHIPSTREAM_EVENT_CACHE
+    if(load_job.step == LOAD_EVENTS) {
+        free(load_job.events);
+        load_job.events = NULL;
+    } else if(load_job.step == SAVE_EVENTS) {
+        end_save_sd_vgm_events(false);
+    }
+    #endif
+    cs_drop_vgm(load_job.vgm_instance_id);
+    end_load_job(LOAD_ERROR);
+}
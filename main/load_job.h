@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <sdkconfig.h>
+#include <FS.h>
+
+/**
+ * VGM load job
+ *
+ * A vgm/vgz is read from SD by VGM_LOAD_CHUNK_BYTES and passed to
+ * chipstream, which inflates it and adds data blocks to sound chips on
+ * the fly. The commands are then compiled into events (see chipstream.c),
+ * or with CONFIG_CHIPSTREAM_EVENT_CACHE, the events saved next to the
+ * file are used. Each step_load_job reads or writes one chunk, so the next
+ * track is loaded between the chunks rendered for the current one.
+ *
+ * With CONFIG_CHIPSTREAM_PCM_CACHE, the PCM cache key is hashed while
+ * reading, and if the track has been cached, the instance is dropped
+ * before compiling (cached) and the cache file is opened into cache.
+ *
+ * One job runs at a time on task_cs, which dispatches the results.
+ *
+ *  LOAD_VGM = reading the vgm/vgz
+ *  LOAD_EVENTS = reading the saved events into events
+ *  SAVE_EVENTS = writing the compiled events (of chipstream memory mem_id)
+ */
+#define VGM_LOAD_CHUNK_BYTES 4096
+#define VGM_EVENTS_PATH_LEN 128
+
+typedef enum {
+    LOAD_VGM,
+    LOAD_EVENTS,
+    SAVE_EVENTS
+} load_step_t;
+
+typedef enum {
+    LOAD_BUSY,
+    LOAD_DONE,
+    LOAD_ERROR
+} load_result_t;
+
+typedef struct load_job {
+    bool loading;
+    load_step_t step;
+    uint32_t vgm_instance_id;
+    const char *filename;
+    File fp;
+    size_t vgm_size;
+    size_t read_size;
+    uint32_t vgm_hash;
+    #if CONFIG_CHIPSTREAM_PCM_CACHE
+    uint32_t sample_rate;
+    uint32_t loop_max_count;
+    pcm_cache_reader_t *cache;
+    bool cached;
+    #endif
+    #if CONFIG_CHIPSTREAM_EVENT_CACHE
+    uint8_t *events;
+    uint32_t events_length;
+    uint32_t events_done;
+    uint32_t mem_id;
+    char events_path[VGM_EVENTS_PATH_LEN];
+    #endif
+} load_job_t;
+
+extern load_job_t load_job;
+
+/**
+ * SD read buffer for loading vgm (shared with the other jobs of task_cs)
+ */
+extern uint8_t vgm_load_chunk[VGM_LOAD_CHUNK_BYTES];
+
+bool begin_load_job(
+    uint32_t vgm_instance_id,
+    const char *filename,
+    const cs_audio_config_t *config,
+    uint32_t loop_max_count,
+    pcm_cache_reader_t *cache);
+load_result_t step_load_job(void);
+load_result_t finish_load_job(void);
+void cancel_load_job(void);
+#if CONFIG_CHIPSTREAM_PCM_CACHE
+void key_load_job(pcm_cache_key_t *key);
+#endif
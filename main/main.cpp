@@ -12,20 +12,35 @@
 
 #include "module_rca_i2s.h"
 #include "chipstream.h"
+#include "cs_profile.h"
+#include "rom_partition.h"
+#include "pcm_cache.h"
+#include "cs_governor.h"
+#include "cs_audio.h"
+#include "vgm_index.h"
+#include "load_job.h"
 
 static const char *TAG = "main.cpp";
 
 /**
  * for testing
+ *
+ * The sample rate and target latency of an entry are applied before it
+ * is played (0 is AUDIO_SAMPLE_RATE / AUDIO_LATENCY_MS).
  */
-#define CS_MEM_INDEX_ID 0
-#define CS_VGM_INSTANCE_ID 0
+#define CS_VGM_INSTANCES 2
+
+typedef struct play_list_entry {
+    const char *filename;
+    uint32_t sample_rate;
+    uint32_t latency_ms;
+} play_list_entry_t;
 
 uint32_t play_list_index = 0;
-const char *play_list[3] = {
-    "/M5Stack/VGM/30.vgm",
-    "/M5Stack/VGM/31.vgm",
-    "/M5Stack/VGM/32.vgm",
+const play_list_entry_t play_list[3] = {
+    { "/M5Stack/VGM/30.vgm", 0, 0 },
+    { "/M5Stack/VGM/31.vgm", 0, 0 },
+    { "/M5Stack/VGM/32.vgm", 0, 0 },
 };
 
 /**
@@ -61,20 +76,90 @@ File debug_pcm_log;
 #define CS_TASK_STACK_SIZE 65535
 #define IS2_TASK_STACK_SIZE 8192
 #define MESSAGE_QUEUE_SIZE 10
+#define UI_EVENT_WAIT_MS 10
 
 /**
  * Audio settings
  *
- * SAMPLE_BUF_BYTES = 32-bit aligned size
+ * AUDIO_SAMPLE_RATE = default output rate (22050, 32000, 44100 or 48000)
+ * AUDIO_LATENCY_MS = default target latency of the ring buffer and DMA buffers
+ *  (at 44.1kHz, 32 chunks of 256 frames and 4 DMA buffers)
+ *
+ * The chunk, ring buffer and DMA buffers are sized by cs_audio.
  */
 #define STREO 2
-#define SAPMLING_RATE 44100
-#define SAMPLE_CHUNK_SIZE 256
-#define SAMPLE_CHUNK_HOLD 32
-#define SAMPLE_CHUNK_BYTES (SAMPLE_CHUNK_SIZE * STREO * sizeof(int16_t))
-#define SAMPLE_CHUNK_MS (SAMPLE_CHUNK_SIZE / SAPMLING_RATE * 1000)
-#define SAMPLE_BUF_BYTES (SAMPLE_CHUNK_BYTES * SAMPLE_CHUNK_HOLD)
-#define SAMPLE_BUF_MS (SAMPLE_CHUNK_MS * SAMPLE_CHUNK_HOLD * 1000)
+#define AUDIO_SAMPLE_RATE 44100
+#define AUDIO_LATENCY_MS 210
+
+/**
+ * I2S DMA settings
+ *
+ * I2S_LATE_FILL_TIMEOUT_MS = recheck player state while waiting a late chunk
+ */
+#define I2S_LATE_FILL_TIMEOUT_MS 100
+
+/**
+ * chipstream settings
+ *
+ * CS_LOOP_END = loop count returned by vgm_play at the end of data
+ * RING_BUF_ACQUIRE_TIMEOUT_MS = recheck commands while ring buffer is full
+ */
+#define CS_LOOP_END 0xffffffff
+#define RING_BUF_ACQUIRE_TIMEOUT_MS 10
+
+/**
+ * PCM cache settings
+ *
+ * PCM_CACHE_DIR = cache directory (VFS path of SD)
+ * PCM_CACHE_HEAVY_PERCENT = render time per play time of a track to be cached
+ * PCM_CACHE_JOBS = tracks waiting to be cached
+ * CS_CACHE_INSTANCE_ID = chipstream instance of the cache render
+ */
+#if M5STACK_CORE2
+#define PCM_CACHE_DIR "/sd/M5Stack/PCM"
+#else
+#define PCM_CACHE_DIR "/sdcard/M5Stack/PCM"
+#endif
+#define PCM_CACHE_HEAVY_PERCENT 80
+#define PCM_CACHE_JOBS 8
+#define CS_CACHE_INSTANCE_ID CS_VGM_INSTANCES
+
+/**
+ * Library index settings
+ *
+ * VGM_INDEX_MOUNT = VFS path of SD (the index holds SD paths as played)
+ * VGM_INDEX_DIR = directory indexed in the background (SD path)
+ * VGM_INDEX_FILE = index file (SD path)
+ * CS_INDEX_INSTANCE_ID = chipstream header reader of the index job
+ */
+#if M5STACK_CORE2
+#define VGM_INDEX_MOUNT "/sd"
+#else
+#define VGM_INDEX_MOUNT "/sdcard"
+#endif
+#define VGM_INDEX_DIR "/M5Stack/VGM"
+#define VGM_INDEX_FILE "/M5Stack/vgm_index.bin"
+#define CS_INDEX_INSTANCE_ID 0
+
+/**
+ * Seek settings
+ *
+ * SEEK_HOLD_MS = button C held at least this long seeks instead of skipping
+ * SEEK_STEP_MS = forward seek of a hold (from the render position)
+ */
+#define SEEK_HOLD_MS 500
+#define SEEK_STEP_MS 10000
+
+/**
+ * Quality governor settings
+ *
+ * GOVERNOR_LOW_WATERMARK = buffered chunks (of chunk_hold) under which the render quality steps down
+ * GOVERNOR_HIGH_WATERMARK = buffered chunks (of chunk_hold) over which it steps back up
+ * GOVERNOR_HOLD_CHUNKS = chunks rendered at a level before the next step down
+ */
+#define GOVERNOR_LOW_WATERMARK(chunk_hold) ((chunk_hold) / 4)
+#define GOVERNOR_HIGH_WATERMARK(chunk_hold) ((chunk_hold) * 3 / 4)
+#define GOVERNOR_HOLD_CHUNKS 16
 
 /**
  * Handler
@@ -83,7 +168,7 @@ TaskHandle_t task_i2s_write_handle;
 TaskHandle_t task_cs_handle;
 RingbufHandle_t ring_buf_handle;
 QueueHandle_t queue_cs_command_handle;
-QueueHandle_t queue_cs_state_handle;
+QueueHandle_t queue_cs_event_handle;
 
 /**
  * Ring buffer
@@ -91,84 +176,92 @@ QueueHandle_t queue_cs_state_handle;
 uint8_t *ring_buf;
 StaticRingbuffer_t *ring_buf_struct;
 
+/**
+ * Audio configuration
+ *
+ * Changed by apply_audio_config only while nothing streams.
+ * i2s_idle is set while task_i2s_write waits for the start of streaming.
+ */
+cs_audio_config_t audio_config;
+volatile bool i2s_idle = true;
+
 /**
  * chipstream messega queue
+ *
+ * Commands return immediately, results arrive on the event queue.
  */
 typedef enum {
     CS_CMD_LOAD,
-    CS_CMD_FILL_BUFFER,
-    CS_CMD_STREAM,
-    CS_CMD_DROP
+    CS_CMD_PLAY,
+    CS_CMD_STOP,
+    CS_CMD_DROP,
+    CS_CMD_CACHE,
+    CS_CMD_SEEK
 } cs_command_t;
 
 typedef struct cs_command_message {
     cs_command_t cs_command;
     uint32_t vgm_instance_id;
-    uint32_t vgm_mem_id;
     const char* filename;
     uint32_t loop_max_count;
+    int32_t seek_offset_ms;
 } cs_command_message_t;
 
-typedef struct cs_state_message {
-    cs_command_t cs_state;
-    uint32_t remain_chunk_count;
-} cs_state_message_t;
+typedef enum {
+    CS_EVT_LOADED,
+    CS_EVT_BUFFERED,
+    CS_EVT_LOOP,
+    CS_EVT_END,
+    CS_EVT_NEXT,
+    CS_EVT_STOPPED,
+    CS_EVT_DROPPED,
+    CS_EVT_CACHED,
+    CS_EVT_ERROR
+} cs_event_t;
+
+typedef struct cs_event_message {
+    cs_event_t cs_event;
+    uint32_t vgm_instance_id;
+    uint32_t loop_count;
+} cs_event_message_t;
 
 /**
  * Player state
  */
 typedef enum {
   START,
+  LOADING,
+  BUFFERING,
   PLAYING,
   BUFFERD,
+  STOPPING,
   END,
+  DROPPING,
+  CACHING,
   DESTRUCT,
   SLEEP
 } player_state_t;
 
-player_state_t player_state;
+volatile player_state_t player_state;
 
 /**
- * load_sd_vgm_file
+ * Playing instance and preloaded next instance
  */
-void load_sd_vgm_file(
-    uint32_t vgm_instance_id,
-    uint32_t vgm_mem_id,
-    const char *filename)
-{
-    // SD open
-    File fp = SD.open(filename);
-    size_t vgm_size = fp.size();
-    ESP_LOGI(TAG, "vgm file(%d)", vgm_size);
-
-    // alloc vgmfile mem
-    uint8_t* mem = cs_alloc_mem(CS_MEM_INDEX_ID, vgm_size);
-
-    // load vgm from SD
-    size_t read_vgm_size = fp.read(mem, vgm_size);
-    ESP_LOGI(TAG, "read vgm file(%d)", read_vgm_size);
-    fp.close();
-    if(vgm_size != read_vgm_size) {
-        // TODO: excaption handling
-        ESP_LOGE(TAG, "read vgm error(%d)", read_vgm_size);
-    }
-
-    // create vgm instance
-    cs_create_vgm(
-        vgm_mem_id,
-        vgm_instance_id,
-        SAPMLING_RATE,
-        SAMPLE_CHUNK_SIZE);
-
-    // drop vgmfile mem
-    // vgm data is cloned and decoded by vgm instance from vgmfile
-    cs_drop_mem(CS_MEM_INDEX_ID);
-}
+uint32_t cs_vgm_instance_id;
+bool cs_next_preloaded;
+bool play_list_stop;
 
 /**
  * stream_vgm
+ *
+ * Render one chunk into ring buffer, or read it from the PCM cache
+ * when cache is not NULL.
+ * The ring buffer item starts with the number of valid frames,
+ * so the last chunk of a track is followed by the next track without gap.
+ * Render time (without the ring buffer wait) is added to render_us.
+ * Returns false if ring buffer stays full for RING_BUF_ACQUIRE_TIMEOUT_MS.
  */
-uint32_t stream_vgm(uint32_t vgm_instance_id) {
+bool stream_vgm(uint32_t vgm_instance_id, pcm_cache_reader_t *cache, uint32_t *loop_count, uint64_t *render_us) {
     /**
      * M5Stack Core2 (ESP32 with 40MHz PSRAM) Test Result
      *
@@ -183,48 +276,368 @@ uint32_t stream_vgm(uint32_t vgm_instance_id) {
      *  I (3443) main.cpp: render time: 44100 / 501ms
      *
      * The time is about 400ms shorter for the ESP32-S3 with PSRAM set to 80 MHz Octa.
+     *
+     * Per stage timing is recorded by cs_profile (CONFIG_CHIPSTREAM_PROFILE).
      */
-    #if DEBUG
-    uint32_t time = millis();
+    #if CONFIG_CHIPSTREAM_PROFILE
+    uint32_t wait_start = get_cycles_cs_profile();
     #endif
 
-    uint32_t loop_count;
+    // acquire a 32-bit aligned item in ring buffer (block if buffer is filled)
+    uint32_t *item;
+    UBaseType_t res = xRingbufferSendAcquire(
+        ring_buf_handle,
+        (void **)&item,
+        audio_config.item_bytes,
+        pdMS_TO_TICKS(RING_BUF_ACQUIRE_TIMEOUT_MS));
+    if(res != pdTRUE) {
+        return false;
+    }
+    #if CONFIG_CHIPSTREAM_PROFILE
+    record_cs_profile(CS_PROFILE_RING_WAIT, get_cycles_cs_profile() - wait_start);
+    uint32_t chunk_start = get_cycles_cs_profile();
+    #endif
 
-    // int16_t *s16le = cs_stream_vgm_ref(vgm_instance_id, &loop_count);
-    int16_t s16le[SAMPLE_CHUNK_BYTES / 2];
-    cs_stream_vgm(vgm_instance_id, s16le, &loop_count);
+    // render directly into ring buffer
+    int16_t *s16le = (int16_t *)(item + 1);
+    if(cache != NULL) {
+        // pre-rendered
+        item[0] = read_pcm_cache(cache, s16le, audio_config.chunk_frames, loop_count);
+    } else {
+        unsigned long render_start = micros();
+        item[0] = cs_stream_vgm(vgm_instance_id, s16le, loop_count);
+        *render_us += micros() - render_start;
+        #if CONFIG_CHIPSTREAM_PROFILE
+        record_cs_profile(CS_PROFILE_CHUNK, get_cycles_cs_profile() - chunk_start);
+        uint32_t stage_cycles[CS_PROFILE_CS_STAGES];
+        cs_get_stage_cycles_vgm(vgm_instance_id, stage_cycles);
+        for(uint32_t stage = 0; stage < CS_PROFILE_CS_STAGES; stage++) {
+            record_cs_profile((cs_profile_stage_t)stage, stage_cycles[stage]);
+        }
+        #endif
+    }
 
     #if DEBUG
-    ESP_LOGI(TAG, "written %d (%04x:%04x:%04x:%04x): render time: %d / %dms",
-        SAMPLE_CHUNK_BYTES,
+    ESP_LOGI(TAG, "written %d (%04x:%04x:%04x:%04x)",
+        audio_config.chunk_frames * STREO * sizeof(int16_t),
         (uint16_t)s16le[0],
         (uint16_t)s16le[1],
-        (uint16_t)s16le[SAMPLE_CHUNK_SIZE - 2],
-        (uint16_t)s16le[SAMPLE_CHUNK_SIZE - 1],
-        SAMPLE_CHUNK_SIZE,
-        (uint32_t)(millis() - time));
+        (uint16_t)s16le[audio_config.chunk_frames - 2],
+        (uint16_t)s16le[audio_config.chunk_frames - 1]);
     #endif
 
     // PCM log for debug
     #if DEBUG_PCM_LOG
-    debug_pcm_log.write((uint8_t *)s16le, SAMPLE_CHUNK_BYTES);
+    debug_pcm_log.write((uint8_t *)s16le, audio_config.chunk_frames * STREO * sizeof(int16_t));
     #endif
 
-    // stream copy to ring buffer (block if buffer is filled)
-    UBaseType_t res = xRingbufferSend(
-        ring_buf_handle,
-        s16le,
-        SAMPLE_CHUNK_BYTES,
-        portMAX_DELAY);
+    // commit chunk to ring buffer
+    res = xRingbufferSendComplete(ring_buf_handle, item);
     if(res != pdTRUE) {
-        ESP_LOGE(TAG, "stream_vgm: failed to xRingbufferSend");
+        ESP_LOGE(TAG, "stream_vgm: failed to xRingbufferSendComplete");
     }
 
-    return loop_count;
+    return true;
+}
+
+/**
+ * send_cs_event
+ */
+void send_cs_event(cs_event_t cs_event, uint32_t vgm_instance_id, uint32_t loop_count)
+{
+    cs_event_message_t event;
+    event.cs_event = cs_event;
+    event.vgm_instance_id = vgm_instance_id;
+    event.loop_count = loop_count;
+    xQueueSend(
+        queue_cs_event_handle,
+        &event,
+        portMAX_DELAY);
+}
+
+#if CONFIG_CHIPSTREAM_PCM_CACHE
+/**
+ * PCM cache render jobs
+ *
+ * Tracks are rendered one at a time on CS_CACHE_INSTANCE_ID by
+ * step_cache_job, one chunk each time task_cs has time.
+ */
+typedef struct cache_job {
+    const char *filenames[PCM_CACHE_JOBS];
+    uint32_t loop_max_counts[PCM_CACHE_JOBS];
+    uint32_t count;
+    bool rendering;
+    pcm_cache_writer_t writer;
+} cache_job_t;
+
+cache_job_t cache_job;
+int16_t cache_chunk[CS_AUDIO_MAX_CHUNK_FRAMES * STREO];
+
+/**
+ * queue_cache_job
+ */
+void queue_cache_job(const char *filename, uint32_t loop_max_count)
+{
+    for(uint32_t i = 0; i < cache_job.count; i++) {
+        if(cache_job.filenames[i] == filename
+            && cache_job.loop_max_counts[i] == loop_max_count) return;
+    }
+    if(cache_job.count == PCM_CACHE_JOBS) {
+        ESP_LOGW(TAG, "cache job queue is full(%s)", filename);
+        return;
+    }
+    cache_job.filenames[cache_job.count] = filename;
+    cache_job.loop_max_counts[cache_job.count] = loop_max_count;
+    cache_job.count++;
+}
+
+/**
+ * finish_cache_job
+ *
+ * Remove the first job and send CS_EVT_CACHED with the number of jobs left.
+ */
+void finish_cache_job(void)
+{
+    if(cache_job.rendering) {
+        cs_drop_vgm(CS_CACHE_INSTANCE_ID);
+        cache_job.rendering = false;
+    }
+    cache_job.count--;
+    memmove(&cache_job.filenames[0], &cache_job.filenames[1], cache_job.count * sizeof(cache_job.filenames[0]));
+    memmove(&cache_job.loop_max_counts[0], &cache_job.loop_max_counts[1], cache_job.count * sizeof(cache_job.loop_max_counts[0]));
+    send_cs_event(cs_event_t::CS_EVT_CACHED, CS_CACHE_INSTANCE_ID, cache_job.count);
+}
+
+/**
+ * cancel_cache_job
+ *
+ * Keep the rendered part to be resumed by the next job of the track.
+ */
+void cancel_cache_job(void)
+{
+    if(cache_job.rendering) {
+        pause_pcm_cache(&cache_job.writer);
+    }
+    while(cache_job.count > 0) {
+        finish_cache_job();
+    }
+}
+
+/**
+ * step_cache_job
+ *
+ * Render a chunk of the first job into its cache file. A job is started
+ * (the vgm is loaded) only when can_start, as loading takes a while.
+ * Returns false when there is nothing to do.
+ */
+bool step_cache_job(bool can_start)
+{
+    if(cache_job.count == 0) return false;
+    const char *filename = cache_job.filenames[0];
+    uint32_t loop_max_count = cache_job.loop_max_counts[0];
+
+    if(!cache_job.rendering) {
+        if(!can_start) return false;
+        // load at once (the player has no track loaded)
+        if(!begin_load_job(CS_CACHE_INSTANCE_ID, filename, &audio_config, loop_max_count, NULL)
+            || finish_load_job() != LOAD_DONE) {
+            ESP_LOGE(TAG, "cache load error(%s)", filename);
+            finish_cache_job();
+            return true;
+        }
+        if(load_job.cached) {
+            finish_cache_job();
+            return true;
+        }
+        pcm_cache_key_t key;
+        key_load_job(&key);
+        cache_job.rendering = true;
+        if(!begin_pcm_cache(&key, &cache_job.writer)) {
+            finish_cache_job();
+        }
+        return true;
+    }
+
+    uint32_t loop_count;
+    uint32_t frames = cs_stream_vgm(CS_CACHE_INSTANCE_ID, cache_chunk, &loop_count);
+    bool end = loop_count == CS_LOOP_END || loop_count > loop_max_count;
+    if(!write_pcm_cache(&cache_job.writer, cache_chunk, frames, loop_count)) {
+        // SD is full or removed; keep the part written
+        pause_pcm_cache(&cache_job.writer);
+        finish_cache_job();
+    } else if(end) {
+        end_pcm_cache(&cache_job.writer);
+        finish_cache_job();
+    }
+
+    return true;
+}
+#endif
+
+#if CONFIG_CHIPSTREAM_VGM_INDEX
+/**
+ * Library index job
+ *
+ * The library is scanned by step_index_job, one step each time task_cs
+ * has time. A file to be indexed is read by VGM_LOAD_CHUNK_BYTES from
+ * the offsets chipstream asks for (only the header and the GD3 of a .vgm),
+ * without creating a player instance.
+ */
+typedef struct index_job {
+    bool scanning;
+    bool reading;
+    File fp;
+} index_job_t;
+
+index_job_t index_job;
+
+/**
+ * end_index_file
+ *
+ * Add the file being read to the index (without the header if it could not be read).
+ */
+void end_index_file(bool read)
+{
+    index_job.fp.close();
+    index_job.reading = false;
+    if(!read) {
+        add_vgm_index(NULL, NULL);
+        return;
+    }
+    vgm_index_info_t info;
+    uint32_t mem_id;
+    const char *strings = cs_end_meta_vgm(CS_INDEX_INSTANCE_ID, &info, &mem_id);
+    if(strings == NULL) {
+        add_vgm_index(NULL, NULL);
+        return;
+    }
+    add_vgm_index(&info, strings);
+    cs_drop_mem(mem_id);
+}
+
+/**
+ * step_index_job
+ *
+ * Read a chunk of the file being indexed, or look at the next entries of
+ * the library. Returns false when there is nothing to do.
+ */
+bool step_index_job(void)
+{
+    if(!index_job.scanning) return false;
+
+    if(index_job.reading) {
+        uint32_t offset = cs_get_next_offset_meta_vgm(CS_INDEX_INSTANCE_ID);
+        size_t read_size = 0;
+        if(offset != CS_META_COMPLETE && offset < index_job.fp.size() && index_job.fp.seek(offset)) {
+            read_size = index_job.fp.read(vgm_load_chunk, VGM_LOAD_CHUNK_BYTES);
+        }
+        if(read_size == 0) {
+            // all has been read (or the end of the file)
+            end_index_file(true);
+        } else if(!cs_load_meta_vgm(CS_INDEX_INSTANCE_ID, vgm_load_chunk, read_size)) {
+            // reader has been dropped by chipstream
+            end_index_file(false);
+        }
+        return true;
+    }
+
+    const char *path;
+    if(!step_vgm_index(&path)) {
+        end_vgm_index();
+        index_job.scanning = false;
+        return true;
+    }
+    if(path != NULL) {
+        index_job.fp = SD.open(path);
+        if(!index_job.fp) {
+            add_vgm_index(NULL, NULL);
+            return true;
+        }
+        cs_create_meta_vgm(CS_INDEX_INSTANCE_ID);
+        index_job.reading = true;
+    }
+
+    return true;
+}
+
+/**
+ * log_index_track
+ *
+ * Log the indexed title, length, chips and estimated render cost of a track.
+ */
+void log_index_track(const char *filename)
+{
+    const vgm_index_record_t *record = find_vgm_index(filename);
+    if(record == NULL) {
+        ESP_LOGI(TAG, "not indexed(%s)", filename);
+        return;
+    }
+    ESP_LOGI(TAG, "%s / %s (%lu s, loop %lu s, chips 0x%08lx, cost %lu%%)",
+        string_vgm_index(record->title),
+        string_vgm_index(record->game),
+        (unsigned long)(record->info.total_samples / VGM_INDEX_SAMPLE_RATE),
+        (unsigned long)(record->info.loop_samples / VGM_INDEX_SAMPLE_RATE),
+        (unsigned long)record->info.chips,
+        (unsigned long)record->render_cost);
+}
+#endif
+
+/**
+ * report_load_job
+ *
+ * Mark the instance of a finished load job loaded and send CS_EVT_LOADED,
+ * or send CS_EVT_ERROR. Nothing while the job is busy.
+ */
+void report_load_job(load_result_t result, bool *loaded)
+{
+    if(result == LOAD_BUSY) return;
+    if(result == LOAD_ERROR) {
+        send_cs_event(cs_event_t::CS_EVT_ERROR, load_job.vgm_instance_id, 0);
+        return;
+    }
+    loaded[load_job.vgm_instance_id] = true;
+    #if CONFIG_CHIPSTREAM_PCM_CACHE
+    if(!load_job.cached) cs_report_placement();
+    #else
+    cs_report_placement();
+    #endif
+    // PCM log for debug
+    // ffplay -f s16le -ar 44100 -ac 2 30.PCM
+    #if DEBUG_PCM_LOG
+    char debug_pcm_log_name[255];
+    strncpy(debug_pcm_log_name, load_job.filename, sizeof(debug_pcm_log_name) - 1);
+    debug_pcm_log_name[strlen(load_job.filename) - 4] = NULL; // 4: remove extention
+    strncat(debug_pcm_log_name, ".pcm", sizeof(debug_pcm_log_name) - 1);
+    ESP_LOGI(TAG, "debug_pcm_log_name: %s", debug_pcm_log_name);
+    debug_pcm_log = SD.open(debug_pcm_log_name, "wb", true);
+    #endif
+    send_cs_event(cs_event_t::CS_EVT_LOADED, load_job.vgm_instance_id, 0);
 }
 
 /**
  * chipstream task (core 0)
+ *
+ * Renders one chunk at a time while streaming and handles commands
+ * between chunks, so a command waits at most one chunk.
+ * A PLAY command received while streaming queues the next instance,
+ * which continues rendering right after the last chunk of the current one.
+ * A LOAD command received while streaming is a load job stepped while
+ * the ring buffer is full, so the current instance is never held up by
+ * a whole file load; it is finished at once when its PLAY is due.
+ *
+ * With CONFIG_CHIPSTREAM_PCM_CACHE, LOAD opens the cache file of the track
+ * (keyed by the loop_max_count of LOAD, PLAY must use the same) once the
+ * file has been read for its hash, instead of compiling it. A track
+ * rendered slower than PCM_CACHE_HEAVY_PERCENT of realtime, and the tracks of CACHE commands, are rendered into the cache
+ * while not streaming or while the ring buffer is full.
+ *
+ * With CONFIG_CHIPSTREAM_GOVERNOR, the render quality of the streaming
+ * instance follows the ring buffer fill (cs_governor).
+ *
+ * With CONFIG_CHIPSTREAM_VGM_INDEX, the library is indexed from the start
+ * while not streaming or while the ring buffer is full, before cache jobs.
+ * The estimated render cost of a track is logged when loaded; only the
+ * measured render time queues it for the cache.
  */
 void task_cs(void *pvParameters)
 {
@@ -235,210 +648,531 @@ void task_cs(void *pvParameters)
 
     cs_command_message_t cmd;
 
+    // loaded instances
+    bool loaded[CS_VGM_INSTANCES] = { false };
+
+    // instances played from the PCM cache (fp is NULL when rendered)
+    pcm_cache_reader_t cache_readers[CS_VGM_INSTANCES] = {};
+    #if CONFIG_CHIPSTREAM_PCM_CACHE
+    const char *filenames[CS_VGM_INSTANCES] = { NULL };
+    #endif
+
+    // render quality level of instances
+    #if CONFIG_CHIPSTREAM_GOVERNOR
+    uint32_t qualities[CS_VGM_INSTANCES] = { 0 };
+    #endif
+
+    // streaming state
+    bool streaming = false;
+    uint32_t stream_instance_id = 0;
+    uint32_t stream_chunk_count = 0;
+    uint32_t stream_loop_count = 0;
+    uint32_t stream_loop_max_count = 0;
+    uint64_t stream_frames = 0;
+    uint64_t stream_render_us = 0;
+
+    // queued next instance
+    bool next_pending = false;
+    uint32_t next_instance_id = 0;
+    uint32_t next_loop_max_count = 0;
+
+    // index the library in the background
+    #if CONFIG_CHIPSTREAM_VGM_INDEX
+    index_job.scanning = begin_vgm_index();
+    #endif
+
     while(1) {
-        // wait command queue (block)
+        // wait command queue (block only while not streaming, indexing or caching)
+        bool busy = streaming;
+        #if CONFIG_CHIPSTREAM_VGM_INDEX
+        busy = busy || index_job.scanning;
+        #endif
+        #if CONFIG_CHIPSTREAM_PCM_CACHE
+        busy = busy || cache_job.count > 0;
+        #endif
         if(xQueueReceive(
-            queue_cs_command_handle, &cmd, portMAX_DELAY) != pdPASS) {
-            ESP_LOGE(TAG, "xQueueReceive");
-            continue;
-        }
-        cs_state_message_t state;
-        switch (cmd.cs_command) {
-            case cs_command_t::CS_CMD_LOAD:
-                // init cs and load vgm
-                load_sd_vgm_file(
-                    cmd.vgm_instance_id,
-                    cmd.vgm_mem_id,
-                    cmd.filename
-                );
-                // PCM log for debug
-                // ffplay -f s16le -ar 44100 -ac 2 30.PCM
-                #if DEBUG_PCM_LOG
-                char debug_pcm_log_name[255];
-                strncpy(debug_pcm_log_name, cmd.filename, sizeof(debug_pcm_log_name) - 1);
-                debug_pcm_log_name[strlen(cmd.filename) - 4] = NULL; // 4: remove extention
-                strncat(debug_pcm_log_name, ".pcm", sizeof(debug_pcm_log_name) - 1);
-                ESP_LOGI(TAG, "debug_pcm_log_name: %s", debug_pcm_log_name);
-                debug_pcm_log = SD.open(debug_pcm_log_name, "wb", true);
-                #endif
-                // return state
-                state.cs_state = cmd.cs_command;
-                xQueueSend(
-                    queue_cs_state_handle,
-                    &state,
-                    portMAX_DELAY);
-                // wait for next command
-                continue;
-            case cs_command_t::CS_CMD_FILL_BUFFER:
-                // fill buffer
-                for(uint32_t i = 0; i < SAMPLE_CHUNK_HOLD; i++) {
-                    stream_vgm(cmd.vgm_instance_id);
+            queue_cs_command_handle,
+            &cmd,
+            busy ? 0 : portMAX_DELAY) == pdPASS) {
+            switch (cmd.cs_command) {
+                case cs_command_t::CS_CMD_LOAD:
+                    #if CONFIG_CHIPSTREAM_GOVERNOR
+                    qualities[cmd.vgm_instance_id] = 0;
+                    #endif
+                    #if CONFIG_CHIPSTREAM_PCM_CACHE
+                    filenames[cmd.vgm_instance_id] = cmd.filename;
+                    #endif
+                    #if CONFIG_CHIPSTREAM_VGM_INDEX
+                    log_index_track(cmd.filename);
+                    #endif
+                    // one load job at a time
+                    if(load_job.loading) {
+                        report_load_job(finish_load_job(), loaded);
+                    }
+                    // init cs and load vgm (between rendered chunks while streaming)
+                    // (the pre-rendered PCM is played if it has been cached)
+                    if(!begin_load_job(
+                        cmd.vgm_instance_id,
+                        cmd.filename,
+                        &audio_config,
+                        cmd.loop_max_count,
+                        &cache_readers[cmd.vgm_instance_id])) {
+                        send_cs_event(cs_event_t::CS_EVT_ERROR, cmd.vgm_instance_id, 0);
+                        break;
+                    }
+                    if(!streaming) {
+                        report_load_job(finish_load_job(), loaded);
+                    }
+                    break;
+                case cs_command_t::CS_CMD_PLAY:
+                    if(load_job.loading && load_job.vgm_instance_id == cmd.vgm_instance_id) {
+                        // queued until the end of the current one, loaded meanwhile
+                        if(streaming) {
+                            next_pending = true;
+                            next_instance_id = cmd.vgm_instance_id;
+                            next_loop_max_count = cmd.loop_max_count;
+                            break;
+                        }
+                        report_load_job(finish_load_job(), loaded);
+                    }
+                    if(!loaded[cmd.vgm_instance_id]) {
+                        send_cs_event(cs_event_t::CS_EVT_ERROR, cmd.vgm_instance_id, 0);
+                        break;
+                    }
+                    if(streaming) {
+                        // continue with this instance after the current one
+                        next_pending = true;
+                        next_instance_id = cmd.vgm_instance_id;
+                        next_loop_max_count = cmd.loop_max_count;
+                        break;
+                    }
+                    // start streaming (first chunk_hold chunks fill buffer)
+                    streaming = true;
+                    stream_instance_id = cmd.vgm_instance_id;
+                    stream_chunk_count = 0;
+                    stream_loop_count = 0;
+                    stream_loop_max_count = cmd.loop_max_count;
+                    stream_frames = 0;
+                    stream_render_us = 0;
+                    break;
+                case cs_command_t::CS_CMD_STOP:
+                    streaming = false;
+                    next_pending = false;
+                    send_cs_event(cs_event_t::CS_EVT_STOPPED, cmd.vgm_instance_id, stream_loop_count);
+                    break;
+                case cs_command_t::CS_CMD_DROP:
+                    if(streaming && stream_instance_id == cmd.vgm_instance_id) {
+                        streaming = false;
+                    }
+                    if(next_pending && next_instance_id == cmd.vgm_instance_id) {
+                        next_pending = false;
+                    }
+                    // PCM log for debug
+                    #if DEBUG_PCM_LOG
+                    debug_pcm_log.close();
+                    #endif
+                    // drop instance
+                    if(load_job.loading && load_job.vgm_instance_id == cmd.vgm_instance_id) {
+                        cancel_load_job();
+                    }
+                    if(loaded[cmd.vgm_instance_id] && cache_readers[cmd.vgm_instance_id].fp != NULL) {
+                        close_pcm_cache(&cache_readers[cmd.vgm_instance_id]);
+                        loaded[cmd.vgm_instance_id] = false;
+                    } else if(loaded[cmd.vgm_instance_id]) {
+                        cs_report_idle();
+                        cs_drop_vgm(cmd.vgm_instance_id);
+                        loaded[cmd.vgm_instance_id] = false;
+                    }
+                    send_cs_event(cs_event_t::CS_EVT_DROPPED, cmd.vgm_instance_id, 0);
+                    break;
+                case cs_command_t::CS_CMD_SEEK: {
+                    // only the rendered instance has a position (the ring buffer is kept)
+                    if(!streaming || stream_instance_id != cmd.vgm_instance_id
+                        || cache_readers[cmd.vgm_instance_id].fp != NULL) {
+                        ESP_LOGW(TAG, "seek ignored(%d)", cmd.vgm_instance_id);
+                        break;
+                    }
+                    int64_t position = (int64_t)cs_get_position_vgm(cmd.vgm_instance_id) + cmd.seek_offset_ms;
+                    if(position < 0) position = 0;
+                    if(!cs_seek_vgm(cmd.vgm_instance_id, (uint32_t)position)) {
+                        ESP_LOGW(TAG, "seek failed(%d, %lld ms)", cmd.vgm_instance_id, position);
+                        break;
+                    }
+                    // the driver restarts the loop count at a seek
+                    stream_loop_count = 0;
+                    ESP_LOGI(TAG, "seek(%d, %lld ms)", cmd.vgm_instance_id, position);
+                    break;
                 }
-                // return state
-                state.cs_state = cmd.cs_command;
-                xQueueSend(
-                    queue_cs_state_handle,
-                    &state,
-                    portMAX_DELAY);
-                // wait for next command
-                continue;
-            case cs_command_t::CS_CMD_STREAM:
-                // stream (TODO: loop count)
-                while(stream_vgm(cmd.vgm_instance_id) == 0);
-                // return state
-                state.cs_state = cmd.cs_command;
-                xQueueSend(
-                    queue_cs_state_handle,
-                    &state,
-                    portMAX_DELAY);
-                // wait for next command
-                continue;
-            case cs_command_t::CS_CMD_DROP:
-                // PCM log for debug
-                #if DEBUG_PCM_LOG
-                debug_pcm_log.close();
+                #if CONFIG_CHIPSTREAM_PCM_CACHE
+                case cs_command_t::CS_CMD_CACHE:
+                    // NULL cancels all jobs
+                    if(cmd.filename == NULL) {
+                        cancel_cache_job();
+                        send_cs_event(cs_event_t::CS_EVT_CACHED, CS_CACHE_INSTANCE_ID, 0);
+                        break;
+                    }
+                    queue_cache_job(cmd.filename, cmd.loop_max_count);
+                    break;
                 #endif
-                // drop instance
-                cs_drop_vgm(cmd.vgm_instance_id);
-                // return state
-                state.cs_state = cmd.cs_command;
-                xQueueSend(
-                    queue_cs_state_handle,
-                    &state,
-                    portMAX_DELAY);
-                // wait for next command
+                default:
+                    ESP_LOGE(TAG, "not yet impliments");
+                    break;
+            }
+            // handle all pending commands before rendering
+            continue;
+        }
+        if(!streaming) {
+            // nothing is rendered, so a load job left by STOP is finished at once
+            if(load_job.loading) {
+                report_load_job(finish_load_job(), loaded);
                 continue;
-            default:
-                ESP_LOGE(TAG, "not yet impliments");
+            }
+            // let the lower priority tasks of core 0 run between steps
+            bool stepped = false;
+            #if CONFIG_CHIPSTREAM_VGM_INDEX
+            stepped = step_index_job();
+            #endif
+            #if CONFIG_CHIPSTREAM_PCM_CACHE
+            // start a job only while the player has no track loaded
+            bool idle = true;
+            for(uint32_t i = 0; i < CS_VGM_INSTANCES; i++) {
+                idle = idle && !loaded[i];
+            }
+            stepped = stepped || step_cache_job(idle);
+            #endif
+            if(stepped) vTaskDelay(1);
+            continue;
+        }
+
+        // render one chunk (retry after checking commands if ring buffer is full)
+        uint32_t loop_count;
+        pcm_cache_reader_t *cache = cache_readers[stream_instance_id].fp != NULL
+            ? &cache_readers[stream_instance_id] : NULL;
+        if(!stream_vgm(stream_instance_id, cache, &loop_count, &stream_render_us)) {
+            // the ring buffer is full, load a chunk of the next track,
+            // read a chunk of the index or render a chunk of the cache meanwhile
+            if(load_job.loading) {
+                report_load_job(step_load_job(), loaded);
                 continue;
+            }
+            #if CONFIG_CHIPSTREAM_VGM_INDEX
+            if(step_index_job()) continue;
+            #endif
+            #if CONFIG_CHIPSTREAM_PCM_CACHE
+            step_cache_job(false);
+            #endif
+            continue;
+        }
+        stream_frames += audio_config.chunk_frames;
+        bool end = loop_count == CS_LOOP_END || loop_count > stream_loop_max_count;
+
+        // buffer filled (or the whole data is shorter than buffer)
+        if(stream_chunk_count < audio_config.chunk_hold) {
+            stream_chunk_count++;
+            if(stream_chunk_count == audio_config.chunk_hold || end) {
+                stream_chunk_count = audio_config.chunk_hold;
+                send_cs_event(cs_event_t::CS_EVT_BUFFERED, stream_instance_id, 0);
+            }
+        }
+        #if CONFIG_CHIPSTREAM_GOVERNOR
+        // follow the ring buffer fill once it has been filled
+        if(cache == NULL && !end && stream_chunk_count == audio_config.chunk_hold) {
+            UBaseType_t items_waiting;
+            vRingbufferGetInfo(ring_buf_handle, NULL, NULL, NULL, NULL, &items_waiting);
+            uint32_t quality = update_cs_governor(items_waiting);
+            if(quality != qualities[stream_instance_id]) {
+                cs_set_quality_vgm(stream_instance_id, quality);
+                qualities[stream_instance_id] = quality;
+            }
+        }
+        #endif
+        if(end) {
+            streaming = false;
+            // the next instance is due (its ERROR comes before END)
+            if(next_pending && load_job.loading && load_job.vgm_instance_id == next_instance_id) {
+                report_load_job(finish_load_job(), loaded);
+            }
+            next_pending = next_pending && loaded[next_instance_id];
+            #if CONFIG_CHIPSTREAM_PCM_CACHE
+            // too heavy to render in realtime
+            uint64_t play_us = stream_frames * 1000000 / audio_config.sample_rate;
+            if(cache == NULL && stream_render_us * 100 > play_us * PCM_CACHE_HEAVY_PERCENT) {
+                ESP_LOGI(TAG, "render %llu us / play %llu us, cache %s",
+                    stream_render_us, play_us, filenames[stream_instance_id]);
+                queue_cache_job(filenames[stream_instance_id], stream_loop_max_count);
+            }
+            #endif
+            send_cs_event(cs_event_t::CS_EVT_END, stream_instance_id, stream_loop_count);
+            if(next_pending) {
+                // gapless; ring buffer is already filled by the current instance
+                next_pending = false;
+                streaming = true;
+                stream_instance_id = next_instance_id;
+                stream_chunk_count = audio_config.chunk_hold;
+                stream_loop_count = 0;
+                stream_loop_max_count = next_loop_max_count;
+                stream_frames = 0;
+                stream_render_us = 0;
+                send_cs_event(cs_event_t::CS_EVT_NEXT, stream_instance_id, 0);
+            }
+        } else if(loop_count != stream_loop_count) {
+            stream_loop_count = loop_count;
+            send_cs_event(cs_event_t::CS_EVT_LOOP, stream_instance_id, loop_count);
         }
     }
 }
 
 /**
  * I2S write task (core 1)
+ *
+ * Started by a task notification when the ring buffer has been filled,
+ * then writes one full chunk each time a DMA buffer has been sent.
+ *
+ * The last chunk of a track holds fewer frames and the next track
+ * continues right after them, so a chunk may be assembled from two items;
+ * the frames left over are carried to the next chunk. The rest of the
+ * last chunk of the stream is filled with silence.
  */
+int16_t i2s_chunk[CS_AUDIO_MAX_CHUNK_FRAMES * STREO];
+int16_t i2s_carry[CS_AUDIO_MAX_CHUNK_FRAMES * STREO];
+
 void task_i2s_write(void *pvParameters)
 {
+    const size_t frame_bytes = STREO * sizeof(int16_t);
+    uint32_t carry_frames = 0;
+
     while(1) {
-        if(player_state == player_state_t::PLAYING
-            || player_state == player_state_t::BUFFERD) {
-            size_t item_size;
-            // wait sample SAMPLE_CHUNK_BYTES (block)
-            int16_t *s16le = (int16_t *)xRingbufferReceiveUpTo(
-                ring_buf_handle,
-                &item_size,
-                portMAX_DELAY,
-                SAMPLE_CHUNK_BYTES);
-            if(item_size == SAMPLE_CHUNK_BYTES && s16le != NULL) {
-                #if DEBUG
-                ESP_LOGI(TAG, "read %d (%04x:%04x:%04x:%04x)",
-                    item_size,
-                    (uint16_t)s16le[0],
-                    (uint16_t)s16le[1],
-                    (uint16_t)s16le[SAMPLE_CHUNK_SIZE - 2],
-                    (uint16_t)s16le[SAMPLE_CHUNK_SIZE - 1]);
-                #endif
-                // write i2s (DMA)
-                write_module_rca_i2s(s16le, SAMPLE_CHUNK_BYTES);
+        // wait for start of streaming (block)
+        i2s_idle = true;
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        i2s_idle = false;
+        carry_frames = 0;
+        while(1) {
+            // wait for a free DMA buffer (block)
+            #if CONFIG_CHIPSTREAM_PROFILE
+            uint32_t wait_start = get_cycles_cs_profile();
+            #endif
+            wait_dma_module_rca_i2s();
+            #if CONFIG_CHIPSTREAM_PROFILE
+            uint32_t i2s_wait = get_cycles_cs_profile() - wait_start;
+            if(player_state == player_state_t::PLAYING) {
+                UBaseType_t items_waiting;
+                vRingbufferGetInfo(ring_buf_handle, NULL, NULL, NULL, NULL, &items_waiting);
+                record_fill_cs_profile(items_waiting);
+            }
+            #endif
+            uint32_t chunk_frames = audio_config.chunk_frames;
+            // frames carried over from the last item
+            memcpy(i2s_chunk, i2s_carry, carry_frames * frame_bytes);
+            uint32_t filled = carry_frames;
+            carry_frames = 0;
+            bool drained = false;
+            while(filled < chunk_frames) {
+                size_t item_size;
+                uint32_t *item = (uint32_t *)xRingbufferReceive(
+                    ring_buf_handle,
+                    &item_size,
+                    0);
+                if(item == NULL) {
+                    // ring buffer drained after the end of stream
+                    if(player_state != player_state_t::PLAYING) {
+                        drained = true;
+                        break;
+                    }
+                    // render is late
+                    count_late_fill_module_rca_i2s();
+                    item = (uint32_t *)xRingbufferReceive(
+                        ring_buf_handle,
+                        &item_size,
+                        pdMS_TO_TICKS(I2S_LATE_FILL_TIMEOUT_MS));
+                    if(item == NULL) break;
+                }
+                uint32_t frames = item[0];
+                int16_t *s16le = (int16_t *)(item + 1);
+                if(player_state != player_state_t::PLAYING
+                    && player_state != player_state_t::BUFFERD) {
+                    // stopped; discard buffered chunks
+                    filled = 0;
+                    carry_frames = 0;
+                } else if(item_size == audio_config.item_bytes && frames <= chunk_frames) {
+                    #if DEBUG
+                    ESP_LOGI(TAG, "read %d (%04x:%04x:%04x:%04x)",
+                        item_size,
+                        (uint16_t)s16le[0],
+                        (uint16_t)s16le[1],
+                        (uint16_t)s16le[chunk_frames - 2],
+                        (uint16_t)s16le[chunk_frames - 1]);
+                    #endif
+                    // only valid frames, the next track continues on the last chunk
+                    uint32_t taken = frames < chunk_frames - filled ? frames : chunk_frames - filled;
+                    memcpy(i2s_chunk + filled * STREO, s16le, taken * frame_bytes);
+                    memcpy(i2s_carry, s16le + taken * STREO, (frames - taken) * frame_bytes);
+                    filled += taken;
+                    carry_frames = frames - taken;
+                } else {
+                    ESP_LOGE(TAG, "xRingbufferReceive: %d", item_size);
+                }
                 // return item to ring buffer (mark finished reading)
-                vRingbufferReturnItem(ring_buf_handle, (void *)s16le);
-                // wait little stream time (TODO: probably not needed and will be removed later)
-                delay(SAMPLE_CHUNK_MS / 2);
+                vRingbufferReturnItem(ring_buf_handle, (void *)item);
+            }
+            if(filled == 0) {
+                if(drained) break;
                 continue;
-            } else {
-                ESP_LOGE(TAG, "xRingbufferReceiveUpTo: %d", item_size);
             }
+            // the end of stream (or a late render) is padded with silence
+            memset(i2s_chunk + filled * STREO, 0, (chunk_frames - filled) * frame_bytes);
+            // write i2s (DMA buffer is free, so does not block)
+            #if CONFIG_CHIPSTREAM_PROFILE
+            uint32_t write_start = get_cycles_cs_profile();
+            #endif
+            write_module_rca_i2s(i2s_chunk, chunk_frames * frame_bytes);
+            #if CONFIG_CHIPSTREAM_PROFILE
+            record_cs_profile(CS_PROFILE_I2S_WAIT, i2s_wait + get_cycles_cs_profile() - write_start);
+            #endif
         }
-        delay(1);
     }
 }
 
 /**
- * transmit_receive_cs_command
+ * send_cs_command
  */
-bool transmit_receive_cs_command(
-    cs_command_message_t cmd,
-    cs_state_message_t msg)
+void send_cs_command(
+    cs_command_t cs_command,
+    uint32_t vgm_instance_id,
+    const char * filename,
+    uint32_t loop_max_count)
 {
+    cs_command_message_t cmd;
+    cmd.cs_command = cs_command;
+    cmd.vgm_instance_id = vgm_instance_id;
+    cmd.filename = filename;
+    cmd.loop_max_count = loop_max_count;
+    cmd.seek_offset_ms = 0;
     xQueueSend(queue_cs_command_handle, &cmd, portMAX_DELAY);
-    if(xQueueReceive(queue_cs_state_handle, &msg, portMAX_DELAY) != pdPASS) {
-        ESP_LOGE(TAG, "transmit_receive_cs_command xQueueReceive");
-        return false;
-    }
-    if(cmd.cs_command != msg.cs_state) {
-        ESP_LOGE(TAG, "transmit_receive_cs_command cs_command");
-        return false;
-    }
-
-    return true;
 }
 
 /**
- * send_cs_command_drop
+ * send_cs_seek
  */
-void send_cs_command_drop(uint32_t vgm_instance_id)
+void send_cs_seek(
+    uint32_t vgm_instance_id,
+    int32_t seek_offset_ms)
 {
-    // create init command
     cs_command_message_t cmd;
-    cmd.cs_command = cs_command_t::CS_CMD_DROP;
+    cmd.cs_command = cs_command_t::CS_CMD_SEEK;
     cmd.vgm_instance_id = vgm_instance_id;
-    // receive state
-    cs_state_message_t state;
-    transmit_receive_cs_command(cmd, state);
-    // TODO: if state
+    cmd.filename = NULL;
+    cmd.loop_max_count = 0;
+    cmd.seek_offset_ms = seek_offset_ms;
+    xQueueSend(queue_cs_command_handle, &cmd, portMAX_DELAY);
 }
 
 /**
- * send_cs_command_stream
+ * discard_ring_buf
  */
-void send_cs_command_stream(uint32_t vgm_instance_id)
+void discard_ring_buf(void)
 {
-    // create init command
-    cs_command_message_t cmd;
-    cmd.cs_command = cs_command_t::CS_CMD_STREAM;
-    cmd.vgm_instance_id = vgm_instance_id;
-    // TODO: do not wait receive state
-    cs_state_message_t state;
-    transmit_receive_cs_command(cmd, state);
-    // TODO: if state
+    size_t item_size;
+    void *item;
+    while((item = xRingbufferReceive(ring_buf_handle, &item_size, 0)) != NULL) {
+        vRingbufferReturnItem(ring_buf_handle, item);
+    }
 }
 
 /**
- * send_cs_command_buffer
+ * dump_stats
+ *
+ * Log I2S output statistics and per stage timing.
  */
-void send_cs_command_buffer(uint32_t vgm_instance_id)
+void dump_stats(void)
 {
-    // create init command
-    cs_command_message_t cmd;
-    cmd.cs_command = cs_command_t::CS_CMD_FILL_BUFFER;
-    cmd.vgm_instance_id = vgm_instance_id;
-    // receive state
-    cs_state_message_t state;
-    transmit_receive_cs_command(cmd, state);
-    // TODO: if state
+    module_rca_i2s_stats_t i2s_stats;
+    get_stats_module_rca_i2s(&i2s_stats);
+    ESP_LOGI(TAG, "i2s underrun: %d, late fill: %d",
+        i2s_stats.underrun_count,
+        i2s_stats.late_fill_count);
+    #if CONFIG_CHIPSTREAM_PROFILE
+    dump_cs_profile();
+    #endif
+    #if CONFIG_CHIPSTREAM_GOVERNOR
+    dump_cs_governor();
+    #endif
+    dump_cs_audio(&audio_config);
 }
 
 /**
- * send_cs_command_init
+ * plan_audio_config
+ *
+ * 0 is AUDIO_SAMPLE_RATE / AUDIO_LATENCY_MS, an unsupported rate falls back to the defaults.
  */
-void send_cs_command_init(
-    uint32_t vgm_instance_id,
-    uint32_t vgm_mem_id,
-    const char * filename,
-    uint32_t loop_max_count)
+void plan_audio_config(uint32_t sample_rate, uint32_t latency_ms, cs_audio_config_t *config)
 {
-    // create init command
-    cs_command_message_t cmd;
-    cmd.cs_command = cs_command_t::CS_CMD_LOAD;
-    cmd.vgm_instance_id = vgm_instance_id;
-    cmd.vgm_mem_id = vgm_mem_id;
-    cmd.filename = filename;
-    cmd.loop_max_count = loop_max_count;
-    // receive state
-    cs_state_message_t state;
-    transmit_receive_cs_command(cmd, state);
-    // TODO: if state
+    if(sample_rate == 0) sample_rate = AUDIO_SAMPLE_RATE;
+    if(latency_ms == 0) latency_ms = AUDIO_LATENCY_MS;
+    if(!plan_cs_audio(sample_rate, latency_ms, config)) {
+        ESP_LOGE(TAG, "unsupported sample rate(%d)", sample_rate);
+        plan_cs_audio(AUDIO_SAMPLE_RATE, AUDIO_LATENCY_MS, config);
+    }
+}
+
+/**
+ * apply_audio_config
+ *
+ * Size the I2S DMA buffers, the ring buffer, the governor watermarks and
+ * the profile deadline (the play time of a chunk) for config.
+ * Only while nothing streams: task_cs does not render into the ring buffer
+ * and task_i2s_write waits for the start of streaming (i2s_idle).
+ */
+void apply_audio_config(const cs_audio_config_t *config)
+{
+    if(ring_buf_handle != nullptr) {
+        deinit_module_rca_i2s();
+        vRingbufferDelete(ring_buf_handle);
+        free(ring_buf_struct);
+        free(ring_buf);
+        ring_buf_handle = nullptr;
+    }
+    audio_config = *config;
+
+    // initialize Module RCA I2S (a DMA buffer is a chunk)
+    init_module_rca_i2s(
+        audio_config.sample_rate,
+        audio_config.chunk_frames,
+        audio_config.dma_buf_count);
+
+    // alloc ring buffer storage (for DMA and only 32-bit aligned size)
+    //  TODO: MALLOC_CAP_RETENTION (not necessary for i2s_write?)
+    ring_buf = (uint8_t *)heap_caps_malloc(
+        audio_config.ring_buf_bytes,
+        MALLOC_CAP_DEFAULT);
+    // alloc ring buffer struct (SRAM)
+    ring_buf_struct = (StaticRingbuffer_t *)heap_caps_malloc(
+        sizeof(StaticRingbuffer_t),
+        MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+
+    // create ring buffer (no-split items for xRingbufferSendAcquire)
+    ring_buf_handle = xRingbufferCreateStatic(
+        audio_config.ring_buf_bytes,
+        RINGBUF_TYPE_NOSPLIT,
+        ring_buf,
+        ring_buf_struct);
+    if(ring_buf_handle == nullptr) {
+        ESP_LOGE(TAG, "Falied to create ring_buf_handle");
+    }
+
+    // render quality follows the ring buffer fill
+    #if CONFIG_CHIPSTREAM_GOVERNOR
+    init_cs_governor(
+        CS_QUALITY_LEVELS,
+        GOVERNOR_LOW_WATERMARK(audio_config.chunk_hold),
+        GOVERNOR_HIGH_WATERMARK(audio_config.chunk_hold),
+        GOVERNOR_HOLD_CHUNKS);
+    #endif
+
+    // per stage timing (deadline is the play time of a chunk)
+    init_cs_profile(getCpuFrequencyMhz(), audio_config.chunk_us);
+
+    dump_cs_audio(&audio_config);
 }
 
 /**
@@ -451,7 +1185,7 @@ void destruct(void)
     vTaskDelete(task_cs_handle);
 
     // delete message queue
-    vQueueDelete(queue_cs_state_handle);
+    vQueueDelete(queue_cs_event_handle);
     vQueueDelete(queue_cs_command_handle);
 
     // delete ring buffer
@@ -461,7 +1195,7 @@ void destruct(void)
     free(ring_buf);
 
     // uninstall Module RCA I2S
-    i2s_driver_uninstall(i2s_port_t::I2S_NUM_1);
+    deinit_module_rca_i2s();
 
     // heap watch
     heap_caps_print_heap_info(
@@ -492,40 +1226,35 @@ void setup(void)
     i2s_driver_uninstall(i2s_port_t::I2S_NUM_0);
     #endif
 
-    // initialize Module RCA I2S
-    init_module_rca_i2s(
-        SAPMLING_RATE,
-        SAMPLE_CHUNK_BYTES,
-        SAMPLE_CHUNK_HOLD);
+    // initialize Module RCA I2S and ring buffer
+    cs_audio_config_t config;
+    plan_audio_config(AUDIO_SAMPLE_RATE, AUDIO_LATENCY_MS, &config);
+    apply_audio_config(&config);
 
-    // alloc ring buffer storage (for DMA and only 32-bit aligned size)
-    //  TODO: MALLOC_CAP_RETENTION (not necessary for i2s_write?)
-    ring_buf = (uint8_t *)heap_caps_malloc(
-        SAMPLE_BUF_BYTES,
-        MALLOC_CAP_DEFAULT);
-    // alloc ring buffer struct (SRAM)
-    //  TODO: MALLOC_CAP_INTERNAL
-    ring_buf_struct = (StaticRingbuffer_t *)heap_caps_malloc(
-        sizeof(StaticRingbuffer_t),
-        MALLOC_CAP_DEFAULT);
+    // pre-rendered PCM cache on SD
+    #if CONFIG_CHIPSTREAM_PCM_CACHE
+    init_pcm_cache(PCM_CACHE_DIR, (uint64_t)CONFIG_CHIPSTREAM_PCM_CACHE_BUDGET_MB << 20);
+    #endif
 
-    // create ring buffer
-    ring_buf_handle = xRingbufferCreateStatic(
-        SAMPLE_BUF_BYTES,
-        RINGBUF_TYPE_BYTEBUF,
-        ring_buf,
-        ring_buf_struct);
-    if(ring_buf_handle == nullptr) {
-        ESP_LOGE(TAG, "Falied to create ring_buf_handle");
-    }
+    // library index on SD (updated by task_cs)
+    #if CONFIG_CHIPSTREAM_VGM_INDEX
+    init_vgm_index(VGM_INDEX_MOUNT, VGM_INDEX_DIR, VGM_INDEX_FILE);
+    #endif
 
     // create message queue
     queue_cs_command_handle = xQueueCreate(
         MESSAGE_QUEUE_SIZE,
         sizeof(struct cs_command_message));
-    queue_cs_state_handle = xQueueCreate(
+    queue_cs_event_handle = xQueueCreate(
         MESSAGE_QUEUE_SIZE,
-        sizeof(struct cs_state_message));
+        sizeof(struct cs_event_message));
+
+    // share the sample ROMs in the rom partition with ymfm chips (zero-copy)
+    init_rom_partition();
+    rom_partition_image_t rom_image;
+    for(uint32_t i = 0; get_rom_partition(i, &rom_image); i++) {
+        cs_set_shared_rom(rom_image.chip_num, rom_image.access_type, rom_image.data, rom_image.size);
+    }
 
     // create chipstream task on ESP32 core 0
     xTaskCreateUniversal(
@@ -537,6 +1266,11 @@ void setup(void)
         &task_cs_handle,
         PRO_CPU_NUM);
 
+    // render ymfm chips on ESP32 core 1 while task_cs renders the others
+    #if CONFIG_CHIPSTREAM_PARALLEL_RENDER
+    cs_start_parallel_render(CONFIG_ARDUINO_RUNNING_CORE);
+    #endif
+
     // create I2S write task on ESP32 core 1
     xTaskCreateUniversal(
         task_i2s_write,
@@ -555,9 +1289,45 @@ void setup(void)
 
     // set state
     play_list_index = 0;
+    play_list_stop = false;
     player_state = player_state_t::START;
 }
 
+/**
+ * stop_player
+ */
+void stop_player(void)
+{
+    send_cs_command(cs_command_t::CS_CMD_STOP, cs_vgm_instance_id, NULL, 0);
+    player_state = player_state_t::STOPPING;
+}
+
+/**
+ * preload_next
+ *
+ * Load the next play list entry into the other instance and queue it
+ * to be rendered right after the current one.
+ */
+void preload_next(void)
+{
+    cs_next_preloaded = false;
+    if(play_list_stop) return;
+    uint32_t next_index = play_list_index + 1;
+    if(next_index >= sizeof(play_list) / sizeof(play_list[0])) return;
+    // gapless only with the same audio configuration
+    cs_audio_config_t config;
+    plan_audio_config(play_list[next_index].sample_rate, play_list[next_index].latency_ms, &config);
+    if(!equal_cs_audio(&config, &audio_config)) return;
+    uint32_t next_instance_id = next_index % CS_VGM_INSTANCES;
+    send_cs_command(
+        cs_command_t::CS_CMD_LOAD,
+        next_instance_id,
+        play_list[next_index].filename,
+        0);
+    send_cs_command(cs_command_t::CS_CMD_PLAY, next_instance_id, NULL, 0);
+    cs_next_preloaded = true;
+}
+
 /**
  * Arduino loop
  */
@@ -568,38 +1338,173 @@ void loop(void)
     M5.update();
     #endif
 
+    // chipstream event (wait a little for UI)
+    cs_event_message_t event;
+    bool has_event = false;
+    if(player_state != player_state_t::DESTRUCT
+        && player_state != player_state_t::SLEEP) {
+        has_event = xQueueReceive(
+            queue_cs_event_handle,
+            &event,
+            pdMS_TO_TICKS(UI_EVENT_WAIT_MS)) == pdPASS;
+    }
+    if(has_event && event.cs_event == cs_event_t::CS_EVT_ERROR) {
+        ESP_LOGE(TAG, "chipstream error: instance %d", event.vgm_instance_id);
+        // the next entry could not be preloaded
+        if(event.vgm_instance_id != cs_vgm_instance_id) {
+            cs_next_preloaded = false;
+        }
+    }
+    if(has_event && event.cs_event == cs_event_t::CS_EVT_LOOP) {
+        ESP_LOGI(TAG, "loop: %d", event.loop_count);
+    }
+    if(has_event && event.cs_event == cs_event_t::CS_EVT_NEXT) {
+        ESP_LOGI(TAG, "next: %d", event.vgm_instance_id);
+    }
+    if(has_event && event.cs_event == cs_event_t::CS_EVT_CACHED) {
+        ESP_LOGI(TAG, "cached: %d left", event.loop_count);
+    }
+    // events of the current instance
+    bool has_current_event = has_event && event.vgm_instance_id == cs_vgm_instance_id;
+
+    // button A: stop, button B: statistics, button C: skip (hold: seek forward)
+    #if M5STACK_CORE2
+    bool streaming = player_state == player_state_t::LOADING
+        || player_state == player_state_t::BUFFERING
+        || player_state == player_state_t::PLAYING
+        || player_state == player_state_t::BUFFERD;
+    if(streaming && M5.BtnA.wasPressed()) {
+        play_list_stop = true;
+        stop_player();
+    } else if(streaming && M5.BtnC.wasReleasefor(SEEK_HOLD_MS)) {
+        send_cs_seek(cs_vgm_instance_id, SEEK_STEP_MS);
+    } else if(streaming && M5.BtnC.wasReleased()) {
+        stop_player();
+    }
+    if(player_state == player_state_t::CACHING && M5.BtnA.wasPressed()) {
+        // cancel caching (rendered parts are resumed next time)
+        send_cs_command(cs_command_t::CS_CMD_CACHE, CS_CACHE_INSTANCE_ID, NULL, 0);
+    }
+    if(M5.BtnB.wasPressed()) {
+        dump_stats();
+    }
+    #endif
+
     switch (player_state) {
-        case player_state_t::START:
-            // clear I2S DMA buffer
+        case player_state_t::START: {
+            // audio configuration of the entry (after the I2S writer has stopped)
+            cs_audio_config_t config;
+            plan_audio_config(play_list[play_list_index].sample_rate, play_list[play_list_index].latency_ms, &config);
+            if(!equal_cs_audio(&config, &audio_config)) {
+                if(!i2s_idle) break;
+                apply_audio_config(&config);
+            }
+            // clear I2S DMA buffer (and statistics)
             clear_dma_module_rca_i2s();
+            #if CONFIG_CHIPSTREAM_PROFILE
+            reset_cs_profile();
+            #endif
             // load and init vgm instance
-            send_cs_command_init(
-                CS_VGM_INSTANCE_ID,
-                CS_MEM_INDEX_ID,
-                play_list[play_list_index],
+            cs_vgm_instance_id = play_list_index % CS_VGM_INSTANCES;
+            cs_next_preloaded = false;
+            send_cs_command(
+                cs_command_t::CS_CMD_LOAD,
+                cs_vgm_instance_id,
+                play_list[play_list_index].filename,
                 0);
-            // fill buffre
-            send_cs_command_buffer(CS_VGM_INSTANCE_ID);
-            player_state = player_state_t::PLAYING;
+            player_state = player_state_t::LOADING;
+            break;
+        }
+        case player_state_t::LOADING:
+            if(!has_current_event) break;
+            if(event.cs_event == cs_event_t::CS_EVT_LOADED) {
+                // stream and fill buffer
+                send_cs_command(cs_command_t::CS_CMD_PLAY, cs_vgm_instance_id, NULL, 0);
+                player_state = player_state_t::BUFFERING;
+            } else if(event.cs_event == cs_event_t::CS_EVT_ERROR) {
+                player_state = player_state_t::END;
+            }
+            break;
+        case player_state_t::BUFFERING:
+            if(has_current_event && event.cs_event == cs_event_t::CS_EVT_BUFFERED) {
+                player_state = player_state_t::PLAYING;
+                // start I2S write
+                xTaskNotifyGive(task_i2s_write_handle);
+                // continue with the next entry without gap
+                preload_next();
+            }
             break;
         case player_state_t::PLAYING:
-            // stream (TODO: do not blocked)
-            send_cs_command_stream(CS_VGM_INSTANCE_ID);
-            player_state = player_state_t::BUFFERD;
+            if(!has_current_event || event.cs_event != cs_event_t::CS_EVT_END) break;
+            if(cs_next_preloaded) {
+                // the next instance is already rendering into ring buffer
+                send_cs_command(cs_command_t::CS_CMD_DROP, cs_vgm_instance_id, NULL, 0);
+                play_list_index++;
+                cs_vgm_instance_id = play_list_index % CS_VGM_INSTANCES;
+                preload_next();
+            } else {
+                player_state = player_state_t::BUFFERD;
+            }
             break;
-        case player_state_t::BUFFERD:
-            // TODO: wait flash ring buffer
-            delay(SAMPLE_BUF_MS * 2);
-            player_state = player_state_t::END;
+        case player_state_t::BUFFERD: {
+            // wait for ring buffer to be played
+            UBaseType_t items_waiting;
+            vRingbufferGetInfo(ring_buf_handle, NULL, NULL, NULL, NULL, &items_waiting);
+            if(items_waiting == 0) {
+                player_state = player_state_t::END;
+            }
+            break;
+        }
+        case player_state_t::STOPPING:
+            if(has_current_event && event.cs_event == cs_event_t::CS_EVT_STOPPED) {
+                player_state = player_state_t::END;
+            }
             break;
         case player_state_t::END:
-            // drop chipstream instance
-            send_cs_command_drop(CS_VGM_INSTANCE_ID);
+            // I2S output statistics and per stage timing
+            dump_stats();
+            // discard chunks left by stop
+            discard_ring_buf();
+            // drop preloaded next instance
+            if(cs_next_preloaded) {
+                send_cs_command(
+                    cs_command_t::CS_CMD_DROP,
+                    (play_list_index + 1) % CS_VGM_INSTANCES,
+                    NULL, 0);
+                cs_next_preloaded = false;
+            }
+            // drop chipstream instance (last, DROPPED is the end of all commands)
+            send_cs_command(cs_command_t::CS_CMD_DROP, cs_vgm_instance_id, NULL, 0);
+            player_state = player_state_t::DROPPING;
+            break;
+        case player_state_t::DROPPING:
+            if(!has_current_event || event.cs_event != cs_event_t::CS_EVT_DROPPED) break;
             // next play
             play_list_index++;
-            if(play_list_index < sizeof(play_list) / sizeof(play_list[0])) {
+            if(!play_list_stop
+                && play_list_index < sizeof(play_list) / sizeof(play_list[0])) {
                 player_state = player_state_t::START;
+                break;
+            }
+            #if CONFIG_CHIPSTREAM_PCM_CACHE
+            // background pass over the play list (cached tracks are skipped)
+            if(!play_list_stop) {
+                for(uint32_t i = 0; i < sizeof(play_list) / sizeof(play_list[0]); i++) {
+                    send_cs_command(cs_command_t::CS_CMD_CACHE, CS_CACHE_INSTANCE_ID, play_list[i].filename, 0);
+                }
             } else {
+                send_cs_command(cs_command_t::CS_CMD_CACHE, CS_CACHE_INSTANCE_ID, NULL, 0);
+            }
+            player_state = player_state_t::CACHING;
+            #else
+            player_state = player_state_t::DESTRUCT;
+            #endif
+            break;
+        case player_state_t::CACHING:
+            // wait until the last job is done (and no CACHE command is left)
+            if(has_event && event.cs_event == cs_event_t::CS_EVT_CACHED
+                && event.loop_count == 0
+                && uxQueueMessagesWaiting(queue_cs_command_handle) == 0) {
                 player_state = player_state_t::DESTRUCT;
             }
             break;
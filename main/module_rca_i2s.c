@@ -1,15 +1,35 @@
+#include <stdbool.h>
 #include <esp_err.h>
 #include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
 #include <driver/i2s.h>
 
+#include "module_rca_i2s.h"
+
 static const char *TAG = "module_rca_i2s.c";
 
+/**
+ * I2S event queue (DMA buffer done / underflow)
+ */
+#define I2S_EVENT_QUEUE_SIZE 8
+
+static QueueHandle_t i2s_event_queue;
+
+/**
+ * Output statistics
+ */
+static module_rca_i2s_stats_t i2s_stats;
+static bool i2s_streaming;
+
 /**
  * Module RCA I2S(PCM5102APWR) initilize
  *
  *  Note that it should be set to I2S_COMM_FORMAT_STAND_I2S.
  *  In I2S_COMM_FORMAT_STAND_MSB, the first bit of PCM is shifted by 1 bit,
  *  resulting in the first 1 bit of PCM being ignored.
+ *
+ *  dma_buf_len is the number of frames (not bytes) of a DMA buffer.
  */
 void init_module_rca_i2s(uint32_t sample_rate, uint32_t dma_buf_len, uint32_t dma_buf_count)
 {
@@ -27,7 +47,11 @@ void init_module_rca_i2s(uint32_t sample_rate, uint32_t dma_buf_len, uint32_t dm
         .tx_desc_auto_clear = true,
         .fixed_mclk = I2S_PIN_NO_CHANGE
     };
-    ESP_ERROR_CHECK(i2s_driver_install(I2S_NUM_1, &i2s_config, 0, NULL));
+    ESP_ERROR_CHECK(i2s_driver_install(
+        I2S_NUM_1,
+        &i2s_config,
+        I2S_EVENT_QUEUE_SIZE,
+        &i2s_event_queue));
 
     // i2s_set_pin
     i2s_pin_config_t i2s_pin_config = {
@@ -40,12 +64,64 @@ void init_module_rca_i2s(uint32_t sample_rate, uint32_t dma_buf_len, uint32_t dm
     ESP_ERROR_CHECK(i2s_set_pin(I2S_NUM_1, &i2s_pin_config));
 }
 
+/**
+ * deinit_module_rca_i2s
+ *
+ * The writer must not be waiting for a DMA buffer.
+ */
+void deinit_module_rca_i2s(void)
+{
+    i2s_driver_uninstall(I2S_NUM_1);
+    i2s_event_queue = NULL;
+}
+
 /**
  * clear_dma_module_rca_i2s
  */
 void clear_dma_module_rca_i2s(void)
 {
     i2s_zero_dma_buffer(I2S_NUM_1);
+    // drop events of silence played before streaming
+    xQueueReset(i2s_event_queue);
+    i2s_streaming = false;
+    i2s_stats.underrun_count = 0;
+    i2s_stats.late_fill_count = 0;
+}
+
+/**
+ * wait_dma_module_rca_i2s
+ *
+ * Block until a DMA buffer has been sent and is free to write.
+ */
+void wait_dma_module_rca_i2s(void)
+{
+    i2s_event_t event;
+    while(xQueueReceive(i2s_event_queue, &event, portMAX_DELAY) == pdPASS) {
+        if(event.type == I2S_EVENT_TX_Q_OVF) {
+            // all DMA buffers were sent and a cleared one was sent again
+            if(i2s_streaming) i2s_stats.underrun_count++;
+            continue;
+        }
+        if(event.type == I2S_EVENT_TX_DONE) {
+            break;
+        }
+    }
+}
+
+/**
+ * count_late_fill_module_rca_i2s
+ */
+void count_late_fill_module_rca_i2s(void)
+{
+    i2s_stats.late_fill_count++;
+}
+
+/**
+ * get_stats_module_rca_i2s
+ */
+void get_stats_module_rca_i2s(module_rca_i2s_stats_t *stats)
+{
+    *stats = i2s_stats;
 }
 
 /**
@@ -54,6 +130,7 @@ void clear_dma_module_rca_i2s(void)
 void write_module_rca_i2s(int16_t *s16le, uint32_t bytes)
 {
     size_t written = 0;
+    i2s_streaming = true;
     ESP_ERROR_CHECK(i2s_write(I2S_NUM_1, s16le, bytes, &written, portMAX_DELAY));
     if(bytes != written) {
         ESP_LOGE(TAG, "i2s_write error: %d / %d", written, bytes);
@@ -1,7 +1,26 @@
 #include <stdint.h>
 
+#ifdef __cplusplus
 extern "C" {
+#endif
+/**
+ * Module RCA I2S output statistics
+ *
+ *  underrun_count: DMA ran out of written buffers and played silence
+ *  late_fill_count: DMA buffer was free but no chunk was ready
+ */
+typedef struct module_rca_i2s_stats {
+    uint32_t underrun_count;
+    uint32_t late_fill_count;
+} module_rca_i2s_stats_t;
+
 void init_module_rca_i2s(uint32_t sample_rate, uint32_t dma_buf_len, uint32_t dma_buf_count);
+void deinit_module_rca_i2s(void);
+void wait_dma_module_rca_i2s(void);
 void write_module_rca_i2s(int16_t *s16le, uint32_t len);
 void clear_dma_module_rca_i2s(void);
+void count_late_fill_module_rca_i2s(void);
+void get_stats_module_rca_i2s(module_rca_i2s_stats_t *stats);
+#ifdef __cplusplus
 }
+#endif
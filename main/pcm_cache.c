@@ -0,0 +1,468 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <esp_log.h>
+
+#include "pcm_cache.h"
+
+static const char *TAG = "pcm_cache.c";
+
+/**
+ * Cache settings
+ *
+ * PCM_CACHE_SYNC_CHUNKS = chunks between progress updates of a .part header
+ */
+#define PCM_CACHE_CHANNELS 2
+#define PCM_CACHE_FRAME_BYTES (PCM_CACHE_CHANNELS * sizeof(int16_t))
+#define PCM_CACHE_SYNC_CHUNKS 64
+#define PCM_CACHE_PART_EXT ".part"
+
+/**
+ * Cache file found by evict_pcm_cache
+ */
+typedef struct pcm_cache_entry {
+    char name[PCM_CACHE_PATH_LEN];
+    uint64_t size;
+    uint32_t play_sequence;
+} pcm_cache_entry_t;
+
+static char cache_dir[PCM_CACHE_PATH_LEN];
+static uint64_t cache_budget_bytes;
+static uint32_t last_play_sequence;
+// .part file of the render in progress, never evicted
+static char writing_part[PCM_CACHE_NAME_LEN + sizeof(PCM_CACHE_PART_EXT)];
+
+static void path_pcm_cache(const pcm_cache_key_t *key, char *path, size_t length)
+{
+    snprintf(path, length, "%s/%08x_%u_%u.pcm",
+        cache_dir,
+        (unsigned)key->vgm_hash,
+        (unsigned)key->sample_rate,
+        (unsigned)key->loop_max_count);
+}
+
+static void part_path_pcm_cache(const char *path, char *part_path, size_t length)
+{
+    snprintf(part_path, length, "%s" PCM_CACHE_PART_EXT, path);
+}
+
+static void writing_pcm_cache(const pcm_cache_writer_t *writer)
+{
+    const char *name = strrchr(writer->path, '/');
+    part_path_pcm_cache(name != NULL ? name + 1 : writer->path, writing_part, sizeof(writing_part));
+}
+
+/**
+ * Loop count after frame frames, as returned by cs_stream_vgm
+ *
+ * Later loops are assumed to be as long as the first one.
+ */
+static uint32_t loop_count_pcm_cache(const pcm_cache_header_t *header, uint32_t frame)
+{
+    if(header->complete && frame >= header->frames) {
+        return header->end_loop_count;
+    }
+    if(header->loop_frame == PCM_CACHE_NO_LOOP || frame < header->loop_frame) {
+        return 0;
+    }
+    if(header->loop_length == 0) {
+        return 1;
+    }
+    // loops differ by a chunk, do not end before the last frames
+    uint32_t loop_count = 1 + (frame - header->loop_frame) / header->loop_length;
+    return loop_count < header->key.loop_max_count ? loop_count : header->key.loop_max_count;
+}
+
+/**
+ * Read and validate the header of a cache file
+ *
+ * The file must be for key and hold header.frames frames.
+ */
+static bool read_header_pcm_cache(FILE *fp, const char *path, const pcm_cache_key_t *key, pcm_cache_header_t *header)
+{
+    struct stat st;
+    if(fread(header, sizeof(pcm_cache_header_t), 1, fp) != 1
+        || stat(path, &st) != 0) {
+        return false;
+    }
+    return memcmp(header->magic, PCM_CACHE_MAGIC, sizeof(header->magic)) == 0
+        && header->version == PCM_CACHE_VERSION
+        && header->channels == PCM_CACHE_CHANNELS
+        && memcmp(&header->key, key, sizeof(pcm_cache_key_t)) == 0
+        && (uint64_t)st.st_size >= sizeof(pcm_cache_header_t) + (uint64_t)header->frames * PCM_CACHE_FRAME_BYTES;
+}
+
+static bool sync_header_pcm_cache(pcm_cache_writer_t *writer)
+{
+    long end = ftell(writer->fp);
+    bool result = fflush(writer->fp) == 0
+        && fseek(writer->fp, 0, SEEK_SET) == 0
+        && fwrite(&writer->header, sizeof(pcm_cache_header_t), 1, writer->fp) == 1
+        && fflush(writer->fp) == 0
+        && fseek(writer->fp, end, SEEK_SET) == 0;
+    writer->chunks_since_sync = 0;
+
+    return result;
+}
+
+/**
+ * List the cache files and .part files with their play sequence
+ *
+ * total is the size of all cache files, including the .part file being
+ * written, which is not listed.
+ * Returns the entries to be freed (NULL if none).
+ */
+static pcm_cache_entry_t *list_pcm_cache(uint32_t *count, uint64_t *total)
+{
+    *count = 0;
+    *total = 0;
+    DIR *dir = opendir(cache_dir);
+    if(dir == NULL) return NULL;
+
+    pcm_cache_entry_t *entries = NULL;
+    uint32_t capacity = 0;
+    char path[PCM_CACHE_PATH_LEN + sizeof(((struct dirent *)0)->d_name) + 1];
+    struct dirent *dirent;
+    while((dirent = readdir(dir)) != NULL) {
+        size_t length = strlen(dirent->d_name);
+        bool part = length > strlen(PCM_CACHE_PART_EXT)
+            && strcmp(dirent->d_name + length - strlen(PCM_CACHE_PART_EXT), PCM_CACHE_PART_EXT) == 0;
+        bool pcm = length > 4 && strcmp(dirent->d_name + length - 4, ".pcm") == 0;
+        if(!part && !pcm) continue;
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", cache_dir, dirent->d_name);
+        if(stat(path, &st) != 0) continue;
+        *total += st.st_size;
+        if(length >= PCM_CACHE_PATH_LEN || (part && strcmp(dirent->d_name, writing_part) == 0)) continue;
+        if(*count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            pcm_cache_entry_t *grown = (pcm_cache_entry_t *)realloc(entries, capacity * sizeof(pcm_cache_entry_t));
+            if(grown == NULL) break;
+            entries = grown;
+        }
+        // a file of an older version (or unreadable) is evicted first
+        pcm_cache_header_t header;
+        FILE *fp = fopen(path, "rb");
+        bool read = fp != NULL && fread(&header, sizeof(pcm_cache_header_t), 1, fp) == 1
+            && header.version == PCM_CACHE_VERSION;
+        if(fp != NULL) fclose(fp);
+        strcpy(entries[*count].name, dirent->d_name);
+        entries[*count].size = st.st_size;
+        entries[*count].play_sequence = read ? header.play_sequence : 0;
+        (*count)++;
+    }
+    closedir(dir);
+
+    return entries;
+}
+
+/**
+ * Initialize cache directory
+ *
+ *  budget_bytes: total size of cache files kept by evict_pcm_cache
+ */
+bool init_pcm_cache(const char *dir, uint64_t budget_bytes)
+{
+    strncpy(cache_dir, dir, sizeof(cache_dir) - 1);
+    cache_dir[sizeof(cache_dir) - 1] = '\0';
+    cache_budget_bytes = budget_bytes;
+
+    if(mkdir(cache_dir, 0755) != 0 && errno != EEXIST) {
+        ESP_LOGE(TAG, "can not create cache directory(%s)", cache_dir);
+        return false;
+    }
+    // continue the play sequence of the files
+    uint32_t count;
+    uint64_t total;
+    pcm_cache_entry_t *entries = list_pcm_cache(&count, &total);
+    last_play_sequence = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        if(entries[i].play_sequence > last_play_sequence) last_play_sequence = entries[i].play_sequence;
+    }
+    free(entries);
+    ESP_LOGI(TAG, "pcm cache: %s (budget %u MB, %u files)", cache_dir, (unsigned)(budget_bytes >> 20), (unsigned)count);
+
+    return true;
+}
+
+/**
+ * FNV-1a hash of a vgm file, pass PCM_CACHE_HASH_INIT for the first chunk
+ */
+uint32_t hash_pcm_cache(uint32_t hash, const uint8_t *data, uint32_t length)
+{
+    for(uint32_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 0x01000193;
+    }
+    return hash;
+}
+
+/**
+ * Open a complete cache file (mode of fopen), an invalid file is removed
+ */
+static bool open_file_pcm_cache(const pcm_cache_key_t *key, pcm_cache_reader_t *reader, const char *mode)
+{
+    char path[PCM_CACHE_FILE_PATH_LEN];
+    path_pcm_cache(key, path, sizeof(path));
+
+    reader->fp = fopen(path, mode);
+    if(reader->fp == NULL) {
+        return false;
+    }
+    if(!read_header_pcm_cache(reader->fp, path, key, &reader->header)
+        || !reader->header.complete) {
+        ESP_LOGW(TAG, "remove invalid cache(%s)", path);
+        fclose(reader->fp);
+        reader->fp = NULL;
+        remove(path);
+        return false;
+    }
+    reader->frame = 0;
+
+    return true;
+}
+
+/**
+ * A complete cache file exists for key (the play sequence is kept)
+ */
+bool exists_pcm_cache(const pcm_cache_key_t *key)
+{
+    pcm_cache_reader_t reader;
+    if(!open_file_pcm_cache(key, &reader, "rb")) {
+        return false;
+    }
+    close_pcm_cache(&reader);
+
+    return true;
+}
+
+/**
+ * Open a complete cache file for playing
+ *
+ * An invalid file is removed. The next play sequence is written to the
+ * header for eviction.
+ */
+bool open_pcm_cache(const pcm_cache_key_t *key, pcm_cache_reader_t *reader)
+{
+    if(!open_file_pcm_cache(key, reader, "r+b")) {
+        return false;
+    }
+    reader->header.play_sequence = ++last_play_sequence;
+    if(fseek(reader->fp, offsetof(pcm_cache_header_t, play_sequence), SEEK_SET) != 0
+        || fwrite(&reader->header.play_sequence, sizeof(uint32_t), 1, reader->fp) != 1
+        || fseek(reader->fp, sizeof(pcm_cache_header_t), SEEK_SET) != 0) {
+        // still playable, only the order of eviction is lost
+        ESP_LOGW(TAG, "can not update play sequence");
+        fseek(reader->fp, sizeof(pcm_cache_header_t), SEEK_SET);
+    }
+
+    return true;
+}
+
+/**
+ * Read up to frames frames
+ *
+ * Returns the number of frames read and the loop count after them,
+ * which is the end loop count of the render with the last frames.
+ */
+uint32_t read_pcm_cache(pcm_cache_reader_t *reader, int16_t *s16le, uint32_t frames, uint32_t *loop_count)
+{
+    uint32_t left = reader->header.frames - reader->frame;
+    if(frames > left) {
+        frames = left;
+    }
+    uint32_t read_frames = fread(s16le, PCM_CACHE_FRAME_BYTES, frames, reader->fp);
+    if(read_frames < frames) {
+        // SD read error; end the track here
+        ESP_LOGE(TAG, "read cache error(%u)", (unsigned)reader->frame);
+        reader->frame = reader->header.frames;
+    } else {
+        reader->frame += read_frames;
+    }
+    *loop_count = loop_count_pcm_cache(&reader->header, reader->frame);
+
+    return read_frames;
+}
+
+void close_pcm_cache(pcm_cache_reader_t *reader)
+{
+    if(reader->fp != NULL) {
+        fclose(reader->fp);
+        reader->fp = NULL;
+    }
+}
+
+/**
+ * Begin or resume rendering into a cache file
+ *
+ * When a .part file of key is left by pause_pcm_cache (or by a reset),
+ * its frames are kept and write_pcm_cache skips them. chipstream can not
+ * seek, so the track is still rendered from the start up to them.
+ */
+bool begin_pcm_cache(const pcm_cache_key_t *key, pcm_cache_writer_t *writer)
+{
+    char part_path[PCM_CACHE_FILE_PATH_LEN + sizeof(PCM_CACHE_PART_EXT)];
+    path_pcm_cache(key, writer->path, sizeof(writer->path));
+    part_path_pcm_cache(writer->path, part_path, sizeof(part_path));
+
+    writer->skip_frames = 0;
+    writer->rendered_frames = 0;
+    writer->last_loop_count = 0;
+    writer->chunks_since_sync = 0;
+
+    // resume
+    writer->fp = fopen(part_path, "r+b");
+    if(writer->fp != NULL) {
+        if(read_header_pcm_cache(writer->fp, part_path, key, &writer->header)
+            && !writer->header.complete
+            && fseek(writer->fp, sizeof(pcm_cache_header_t) + writer->header.frames * PCM_CACHE_FRAME_BYTES, SEEK_SET) == 0) {
+            writer->skip_frames = writer->header.frames;
+            writer->last_loop_count = loop_count_pcm_cache(&writer->header, writer->header.frames);
+            writer->header.play_sequence = ++last_play_sequence;
+            writing_pcm_cache(writer);
+            ESP_LOGI(TAG, "resume cache(%s) from %u frames", writer->path, (unsigned)writer->skip_frames);
+            return true;
+        }
+        fclose(writer->fp);
+    }
+
+    // make room for a new render
+    evict_pcm_cache(0);
+    writer->fp = fopen(part_path, "wb");
+    if(writer->fp == NULL) {
+        ESP_LOGE(TAG, "can not create cache(%s)", part_path);
+        return false;
+    }
+    memset(&writer->header, 0, sizeof(pcm_cache_header_t));
+    memcpy(writer->header.magic, PCM_CACHE_MAGIC, sizeof(writer->header.magic));
+    writer->header.version = PCM_CACHE_VERSION;
+    writer->header.channels = PCM_CACHE_CHANNELS;
+    writer->header.key = *key;
+    writer->header.loop_frame = PCM_CACHE_NO_LOOP;
+    writer->header.play_sequence = ++last_play_sequence;
+    if(fwrite(&writer->header, sizeof(pcm_cache_header_t), 1, writer->fp) != 1) {
+        fclose(writer->fp);
+        writer->fp = NULL;
+        return false;
+    }
+    writing_pcm_cache(writer);
+    ESP_LOGI(TAG, "begin cache(%s)", writer->path);
+
+    return true;
+}
+
+/**
+ * Write a rendered chunk and the loop count returned with it
+ *
+ * Frames kept from a resumed .part file are skipped.
+ */
+bool write_pcm_cache(pcm_cache_writer_t *writer, const int16_t *s16le, uint32_t frames, uint32_t loop_count)
+{
+    uint32_t skip = frames < writer->skip_frames ? frames : writer->skip_frames;
+    writer->skip_frames -= skip;
+    writer->rendered_frames += frames;
+    if(skip == frames) {
+        return true;
+    }
+    if(fwrite(s16le + skip * PCM_CACHE_CHANNELS, PCM_CACHE_FRAME_BYTES, frames - skip, writer->fp) != frames - skip) {
+        ESP_LOGE(TAG, "write cache error(%s)", writer->path);
+        return false;
+    }
+    writer->header.frames += frames - skip;
+    writer->header.end_loop_count = loop_count;
+
+    // loop point (the last chunk returns the end loop count)
+    bool end = loop_count == PCM_CACHE_NO_LOOP || loop_count > writer->header.key.loop_max_count;
+    if(!end && loop_count != writer->last_loop_count) {
+        if(writer->header.loop_frame == PCM_CACHE_NO_LOOP) {
+            writer->header.loop_frame = writer->rendered_frames;
+        } else if(writer->header.loop_length == 0) {
+            writer->header.loop_length = writer->rendered_frames - writer->header.loop_frame;
+        }
+        writer->last_loop_count = loop_count;
+    }
+
+    if(++writer->chunks_since_sync >= PCM_CACHE_SYNC_CHUNKS) {
+        return sync_header_pcm_cache(writer);
+    }
+    return true;
+}
+
+/**
+ * Complete the cache file after the last chunk
+ */
+bool end_pcm_cache(pcm_cache_writer_t *writer)
+{
+    char part_path[PCM_CACHE_FILE_PATH_LEN + sizeof(PCM_CACHE_PART_EXT)];
+    part_path_pcm_cache(writer->path, part_path, sizeof(part_path));
+
+    writer->header.complete = 1;
+    writer->header.play_sequence = ++last_play_sequence;
+    bool result = sync_header_pcm_cache(writer);
+    fclose(writer->fp);
+    writer->fp = NULL;
+    writing_part[0] = '\0';
+    if(!result) {
+        ESP_LOGE(TAG, "write cache error(%s)", writer->path);
+        remove(part_path);
+        return false;
+    }
+    remove(writer->path);
+    if(rename(part_path, writer->path) != 0) {
+        ESP_LOGE(TAG, "rename cache error(%s)", writer->path);
+        remove(part_path);
+        return false;
+    }
+    ESP_LOGI(TAG, "cached %s (%u frames)", writer->path, (unsigned)writer->header.frames);
+    evict_pcm_cache(0);
+
+    return true;
+}
+
+/**
+ * Stop rendering and keep the .part file to resume with begin_pcm_cache
+ */
+void pause_pcm_cache(pcm_cache_writer_t *writer)
+{
+    if(writer->fp == NULL) return;
+    // frames still skipped were not rendered again, the header is unchanged
+    if(writer->skip_frames == 0) {
+        sync_header_pcm_cache(writer);
+    }
+    fclose(writer->fp);
+    writer->fp = NULL;
+    writing_part[0] = '\0';
+    ESP_LOGI(TAG, "pause cache(%s) at %u frames", writer->path, (unsigned)writer->header.frames);
+}
+
+/**
+ * Remove the least recently played (or rendered) cache files until the
+ * total size and reserve_bytes fit in the budget
+ *
+ * A .part file is ordered by when its render began or resumed; the one
+ * being written counts toward the total but is not removed.
+ */
+void evict_pcm_cache(uint64_t reserve_bytes)
+{
+    uint32_t count;
+    uint64_t total;
+    pcm_cache_entry_t *entries = list_pcm_cache(&count, &total);
+    char path[PCM_CACHE_PATH_LEN * 2];
+
+    while(total + reserve_bytes > cache_budget_bytes && count > 0) {
+        uint32_t oldest = 0;
+        for(uint32_t i = 1; i < count; i++) {
+            if(entries[i].play_sequence < entries[oldest].play_sequence) oldest = i;
+        }
+        snprintf(path, sizeof(path), "%s/%s", cache_dir, entries[oldest].name);
+        if(remove(path) == 0) {
+            ESP_LOGI(TAG, "evict cache(%s)", path);
+            total -= entries[oldest].size;
+        }
+        entries[oldest] = entries[--count];
+    }
+    free(entries);
+}
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/**
+ * Pre-rendered PCM cache
+ *
+ * A track is rendered once to <dir>/<hash>_<rate>_<loops>.pcm
+ * (s16le stereo after a pcm_cache_header_t) and later plays are read
+ * from the file instead of rendered.
+ * A render in progress is written to .part and can be resumed.
+ */
+#define PCM_CACHE_MAGIC "CSPC"
+#define PCM_CACHE_VERSION 2
+#define PCM_CACHE_HASH_INIT 0x811c9dc5
+#define PCM_CACHE_NO_LOOP 0xffffffff
+#define PCM_CACHE_PATH_LEN 96
+// "/<hash>_<rate>_<loops>.pcm" of 32 bit values and the terminator
+#define PCM_CACHE_NAME_LEN 36
+#define PCM_CACHE_FILE_PATH_LEN (PCM_CACHE_PATH_LEN + PCM_CACHE_NAME_LEN)
+
+/**
+ * Cache key
+ *
+ *  vgm_hash: FNV-1a of the vgm/vgz file (hash_pcm_cache)
+ *  loop_max_count: loops rendered before the end, as task_cs plays
+ */
+typedef struct pcm_cache_key {
+    uint32_t vgm_hash;
+    uint32_t vgm_size;
+    uint32_t sample_rate;
+    uint32_t loop_max_count;
+} pcm_cache_key_t;
+
+/**
+ * Cache file header
+ *
+ *  frames: frames in the file (progress of a .part file)
+ *  loop_frame: frames rendered when the loop count first changed
+ *  loop_length: frames between the first two loop count changes
+ *  end_loop_count: loop count returned with the last frames
+ *  play_sequence: order of the last play (or render, or .part resume) for eviction,
+ *                 no clock is set on the device so file times are not used
+ */
+typedef struct pcm_cache_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t channels;
+    pcm_cache_key_t key;
+    uint32_t frames;
+    uint32_t complete;
+    uint32_t loop_frame;
+    uint32_t loop_length;
+    uint32_t end_loop_count;
+    uint32_t play_sequence;
+    uint32_t reserved[2];
+} pcm_cache_header_t;
+
+typedef struct pcm_cache_reader {
+    FILE *fp;
+    pcm_cache_header_t header;
+    uint32_t frame;
+} pcm_cache_reader_t;
+
+typedef struct pcm_cache_writer {
+    FILE *fp;
+    pcm_cache_header_t header;
+    uint32_t skip_frames;
+    uint32_t rendered_frames;
+    uint32_t last_loop_count;
+    uint32_t chunks_since_sync;
+    char path[PCM_CACHE_FILE_PATH_LEN];
+} pcm_cache_writer_t;
+
+bool init_pcm_cache(const char *dir, uint64_t budget_bytes);
+uint32_t hash_pcm_cache(uint32_t hash, const uint8_t *data, uint32_t length);
+bool exists_pcm_cache(const pcm_cache_key_t *key);
+bool open_pcm_cache(const pcm_cache_key_t *key, pcm_cache_reader_t *reader);
+uint32_t read_pcm_cache(pcm_cache_reader_t *reader, int16_t *s16le, uint32_t frames, uint32_t *loop_count);
+void close_pcm_cache(pcm_cache_reader_t *reader);
+bool begin_pcm_cache(const pcm_cache_key_t *key, pcm_cache_writer_t *writer);
+bool write_pcm_cache(pcm_cache_writer_t *writer, const int16_t *s16le, uint32_t frames, uint32_t loop_count);
+bool end_pcm_cache(pcm_cache_writer_t *writer);
+void pause_pcm_cache(pcm_cache_writer_t *writer);
+void evict_pcm_cache(uint64_t reserve_bytes);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,100 @@
+#include <stdbool.h>
+#include <string.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_partition.h>
+
+#include "rom_partition.h"
+
+static const char *TAG = "rom_partition.c";
+
+/**
+ * Directory and memory-mapped images of the rom partition
+ *
+ * Mappings are kept while the application runs.
+ */
+static rom_partition_entry_t rom_entries[ROM_PARTITION_MAX_IMAGES];
+static rom_partition_image_t rom_images[ROM_PARTITION_MAX_IMAGES];
+static uint32_t rom_image_count;
+
+/**
+ * Map the sample ROMs of the rom partition
+ *
+ *  Each image is mapped into the flash data window (SPI_FLASH_MMAP_DATA),
+ *  which is shared with the application rodata. An image that does not fit
+ *  is skipped and its chips read zeros (or the data a VGM writes).
+ *
+ *  Returns the number of mapped images.
+ */
+uint32_t init_rom_partition(void)
+{
+    rom_image_count = 0;
+
+    const esp_partition_t *partition = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA,
+        (esp_partition_subtype_t)ROM_PARTITION_SUBTYPE,
+        "rom");
+    if(partition == NULL) {
+        ESP_LOGW(TAG, "rom partition not found");
+        return 0;
+    }
+
+    rom_partition_header_t header;
+    if(esp_partition_read(partition, 0, &header, sizeof(header)) != ESP_OK
+        || memcmp(header.magic, ROM_PARTITION_MAGIC, sizeof(header.magic)) != 0
+        || header.version != ROM_PARTITION_VERSION
+        || header.count > ROM_PARTITION_MAX_IMAGES) {
+        ESP_LOGW(TAG, "rom partition is empty or not a rom image (tools/mkrompart.py)");
+        return 0;
+    }
+    if(esp_partition_read(partition, sizeof(header), rom_entries, header.count * sizeof(rom_partition_entry_t)) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read rom partition directory");
+        return 0;
+    }
+
+    for(uint32_t i = 0; i < header.count; i++) {
+        rom_partition_entry_t *entry = &rom_entries[i];
+        entry->name[ROM_PARTITION_NAME_LEN - 1] = '\0';
+        if(entry->size == 0 || entry->offset > partition->size || entry->size > partition->size - entry->offset) {
+            ESP_LOGW(TAG, "%s: out of the rom partition", entry->name);
+            continue;
+        }
+        const void *data;
+        spi_flash_mmap_handle_t handle;
+        esp_err_t err = esp_partition_mmap(
+            partition,
+            entry->offset,
+            entry->size,
+            SPI_FLASH_MMAP_DATA,
+            &data,
+            &handle);
+        if(err != ESP_OK) {
+            ESP_LOGW(TAG, "%s: esp_partition_mmap(%u bytes) failed (%s)",
+                entry->name, entry->size, esp_err_to_name(err));
+            continue;
+        }
+        rom_partition_image_t *image = &rom_images[rom_image_count++];
+        image->name = entry->name;
+        image->chip_num = entry->chip_num;
+        image->access_type = entry->access_type;
+        image->data = (const uint8_t *)data;
+        image->size = entry->size;
+        ESP_LOGI(TAG, "%s: %u bytes at %p (chip %u, type 0x%02x)",
+            image->name, image->size, image->data, image->chip_num, image->access_type);
+    }
+
+    return rom_image_count;
+}
+
+/**
+ * Get a mapped sample ROM
+ */
+bool get_rom_partition(uint32_t index, rom_partition_image_t *image)
+{
+    if(index >= rom_image_count) {
+        return false;
+    }
+    *image = rom_images[index];
+
+    return true;
+}
@@ -0,0 +1,53 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/**
+ * rom partition image (tools/mkrompart.py)
+ *
+ * Little endian. The header and the directory are at the start of the
+ * partition and each sample ROM follows at a 64KB (flash MMU page)
+ * aligned offset, so it can be memory-mapped on its own.
+ *
+ *  chip_num: chip_type in ymfmffi.cpp (e.g. 4: YM2608, 11: YMF278B)
+ *  access_type: VGM data block type (e.g. 0x82: ADPCM-A, 0x84: YMF278B ROM)
+ */
+#define ROM_PARTITION_SUBTYPE 0x40
+#define ROM_PARTITION_MAGIC "CSRM"
+#define ROM_PARTITION_VERSION 1
+#define ROM_PARTITION_MAX_IMAGES 16
+#define ROM_PARTITION_NAME_LEN 20
+
+typedef struct rom_partition_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t count;
+    uint32_t reserved[2];
+} rom_partition_header_t;
+
+typedef struct rom_partition_entry {
+    char name[ROM_PARTITION_NAME_LEN];
+    uint16_t chip_num;
+    uint16_t access_type;
+    uint32_t offset;
+    uint32_t size;
+} rom_partition_entry_t;
+
+/**
+ * A sample ROM memory-mapped from the rom partition
+ */
+typedef struct rom_partition_image {
+    const char *name;
+    uint16_t chip_num;
+    uint16_t access_type;
+    const uint8_t *data;
+    uint32_t size;
+} rom_partition_image_t;
+
+uint32_t init_rom_partition(void);
+bool get_rom_partition(uint32_t index, rom_partition_image_t *image);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,555 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <esp_log.h>
+
+#include "vgm_index.h"
+
+static const char *TAG = "vgm_index.c";
+
+/**
+ * Index settings
+ *
+ * VGM_INDEX_DEPTH = directory levels scanned (each keeps a directory open)
+ * VGM_INDEX_STEP_ENTRIES = directory entries looked at by a step
+ * VGM_INDEX_GD3_STRINGS = NUL terminated strings passed to add_vgm_index
+ */
+#define VGM_INDEX_DEPTH 2
+#define VGM_INDEX_STEP_ENTRIES 8
+#define VGM_INDEX_GD3_STRINGS 5
+#define VGM_INDEX_TMP_EXT ".tmp"
+
+/**
+ * Estimated render time per play time in percent
+ *
+ * VGM_INDEX_PIPELINE_COST is paid once per track (parse, resample, mix and
+ * convert), chip_costs by each chip played, by bit of VGM_INDEX_CHIP_*
+ * (the index of the bit). Chips that are not played cost nothing.
+ *
+ * From the stream_vgm measurements of main.cpp (M5Stack Core2, 44100Hz)
+ * taken before the block render pipeline: X68K OKIM6258 alone 52%, which is
+ * mostly the pipeline, and with YM2151 200%. The other chips are scaled from
+ * the YM2151 by their operators and PCM channels. The figures are only
+ * logged until they are calibrated with cs_render on the current pipeline.
+ */
+#define VGM_INDEX_PIPELINE_COST 50
+
+static const uint16_t chip_costs[] = {
+    115, // YM2612 (24 operators and DAC)
+    148, // YM2151 (measured)
+    60,  // YM2203 (12 operators and SSG)
+    80,  // YM2413 (18 operators)
+    10,  // AY8910
+    135, // YM2608 (24 operators, SSG and ADPCM)
+    95,  // YM2610 (16 operators, SSG and ADPCM)
+    80,  // YM3812 (18 operators)
+    80,  // YM3526 (18 operators)
+    90,  // Y8950 (18 operators and ADPCM)
+    165, // YMF262 (36 operators)
+    200, // YMF278B (36 operators and 24 PCM channels)
+    3,   // SN76489
+    3,   // PWM
+    10,  // SEGAPCM (16 channels)
+    2,   // OKIM6258 (measured with the pipeline)
+    15,  // C140 (24 channels)
+    10,  // C219 (16 channels)
+    5,   // OKIM6295 (4 channels)
+};
+
+#define VGM_INDEX_CHIP_COSTS (sizeof(chip_costs) / sizeof(chip_costs[0]))
+
+/**
+ * Records and string table
+ */
+typedef struct vgm_index_table {
+    vgm_index_record_t *records;
+    uint32_t count;
+    uint32_t capacity;
+    char *strings;
+    uint32_t strings_size;
+    uint32_t strings_capacity;
+} vgm_index_table_t;
+
+/**
+ * Directory scan of begin_vgm_index
+ *
+ *  path: SD path of the entry (the directories up to path_lengths[depth - 1])
+ *  reading: step_vgm_index returned path, add_vgm_index is waited for
+ */
+typedef struct vgm_index_scan {
+    bool scanning;
+    bool reading;
+    bool failed;
+    DIR *dirs[VGM_INDEX_DEPTH];
+    size_t path_lengths[VGM_INDEX_DEPTH];
+    uint32_t depth;
+    char path[VGM_INDEX_PATH_LEN];
+    uint32_t mtime;
+    uint32_t size;
+    uint32_t files;
+    uint32_t reads;
+} vgm_index_scan_t;
+
+static char index_mount[VGM_INDEX_PATH_LEN];
+static char index_dir[VGM_INDEX_PATH_LEN];
+static char index_file[VGM_INDEX_PATH_LEN];
+
+// loaded index (find_vgm_index) and the one being scanned
+static vgm_index_table_t index_table;
+static vgm_index_table_t scan_table;
+static vgm_index_scan_t scan;
+
+static void vfs_path_vgm_index(const char *path, char *vfs_path, size_t length)
+{
+    snprintf(vfs_path, length, "%s%s", index_mount, path);
+}
+
+static void free_table_vgm_index(vgm_index_table_t *table)
+{
+    free(table->records);
+    free(table->strings);
+    memset(table, 0, sizeof(vgm_index_table_t));
+}
+
+/**
+ * Add a string to the string table
+ *
+ * Returns hint (the offset of the same field of the previous record)
+ * if it is the same string, as the tracks of a game share most names.
+ * Returns 0 ("") on allocation failure and marks the scan failed.
+ */
+static uint32_t intern_vgm_index(vgm_index_table_t *table, const char *string, uint32_t hint)
+{
+    if(string[0] == '\0') return 0;
+    if(hint != 0 && strcmp(table->strings + hint, string) == 0) return hint;
+
+    uint32_t length = strlen(string) + 1;
+    // offset 0 is ""
+    uint32_t offset = table->strings_size ? table->strings_size : 1;
+    if(offset + length > table->strings_capacity) {
+        uint32_t capacity = table->strings_capacity ? table->strings_capacity * 2 : 4096;
+        while(capacity < offset + length) capacity *= 2;
+        char *grown = (char *)realloc(table->strings, capacity);
+        if(grown == NULL) {
+            scan.failed = true;
+            return 0;
+        }
+        table->strings = grown;
+        table->strings_capacity = capacity;
+    }
+    table->strings[0] = '\0';
+    memcpy(table->strings + offset, string, length);
+    table->strings_size = offset + length;
+
+    return offset;
+}
+
+/**
+ * Append a record, the strings are taken from names (path, title .. date)
+ */
+static bool append_vgm_index(
+    vgm_index_table_t *table,
+    const char *const *names,
+    uint32_t mtime,
+    uint32_t size,
+    const vgm_index_info_t *info)
+{
+    if(table->count == table->capacity) {
+        uint32_t capacity = table->capacity ? table->capacity * 2 : 64;
+        vgm_index_record_t *grown = (vgm_index_record_t *)realloc(table->records, capacity * sizeof(vgm_index_record_t));
+        if(grown == NULL) {
+            scan.failed = true;
+            return false;
+        }
+        table->records = grown;
+        table->capacity = capacity;
+    }
+    const vgm_index_record_t *last = table->count > 0 ? &table->records[table->count - 1] : NULL;
+    vgm_index_record_t record;
+    record.path = intern_vgm_index(table, names[0], 0);
+    record.title = intern_vgm_index(table, names[1], last ? last->title : 0);
+    record.game = intern_vgm_index(table, names[2], last ? last->game : 0);
+    record.system = intern_vgm_index(table, names[3], last ? last->system : 0);
+    record.author = intern_vgm_index(table, names[4], last ? last->author : 0);
+    record.date = intern_vgm_index(table, names[5], last ? last->date : 0);
+    record.mtime = mtime;
+    record.size = size;
+    record.info = *info;
+    record.render_cost = cost_vgm_index(info);
+    table->records[table->count++] = record;
+
+    return !scan.failed;
+}
+
+static int compare_record_vgm_index(const void *a, const void *b)
+{
+    const vgm_index_record_t *record_a = (const vgm_index_record_t *)a;
+    const vgm_index_record_t *record_b = (const vgm_index_record_t *)b;
+    return strcmp(scan_table.strings + record_a->path, scan_table.strings + record_b->path);
+}
+
+static int compare_path_vgm_index(const void *key, const void *element)
+{
+    const vgm_index_record_t *record = (const vgm_index_record_t *)element;
+    return strcmp((const char *)key, index_table.strings + record->path);
+}
+
+static bool is_vgm_file_vgm_index(const char *name)
+{
+    size_t length = strlen(name);
+    return length > 4
+        && (strcasecmp(name + length - 4, ".vgm") == 0 || strcasecmp(name + length - 4, ".vgz") == 0);
+}
+
+/**
+ * Read and validate the index file into index_table
+ */
+static bool load_vgm_index(void)
+{
+    char path[VGM_INDEX_PATH_LEN * 2];
+    vfs_path_vgm_index(index_file, path, sizeof(path));
+    FILE *fp = fopen(path, "rb");
+    if(fp == NULL) {
+        return false;
+    }
+    vgm_index_header_t header;
+    struct stat st;
+    bool result = fread(&header, sizeof(header), 1, fp) == 1
+        && stat(path, &st) == 0
+        && memcmp(header.magic, VGM_INDEX_MAGIC, sizeof(header.magic)) == 0
+        && header.version == VGM_INDEX_VERSION
+        && header.record_size == sizeof(vgm_index_record_t)
+        && header.strings_size > 0
+        && (uint64_t)st.st_size == sizeof(header)
+            + (uint64_t)header.count * sizeof(vgm_index_record_t) + header.strings_size;
+    vgm_index_table_t table;
+    memset(&table, 0, sizeof(table));
+    if(result) {
+        table.records = (vgm_index_record_t *)malloc((header.count ? header.count : 1) * sizeof(vgm_index_record_t));
+        table.strings = (char *)malloc(header.strings_size);
+        table.count = table.capacity = header.count;
+        table.strings_size = table.strings_capacity = header.strings_size;
+        result = table.records != NULL && table.strings != NULL
+            && fread(table.records, sizeof(vgm_index_record_t), header.count, fp) == header.count
+            && fread(table.strings, 1, header.strings_size, fp) == header.strings_size
+            && table.strings[0] == '\0'
+            && table.strings[header.strings_size - 1] == '\0';
+    }
+    for(uint32_t i = 0; result && i < table.count; i++) {
+        const vgm_index_record_t *record = &table.records[i];
+        result = record->path < table.strings_size && record->title < table.strings_size
+            && record->game < table.strings_size && record->system < table.strings_size
+            && record->author < table.strings_size && record->date < table.strings_size;
+    }
+    fclose(fp);
+    if(!result) {
+        ESP_LOGW(TAG, "invalid index(%s)", path);
+        free_table_vgm_index(&table);
+        return false;
+    }
+    free_table_vgm_index(&index_table);
+    index_table = table;
+
+    return true;
+}
+
+/**
+ * Write scan_table into the index file (written to .tmp and renamed)
+ */
+static bool write_vgm_index(void)
+{
+    char path[VGM_INDEX_PATH_LEN * 2];
+    char tmp_path[VGM_INDEX_PATH_LEN * 2 + sizeof(VGM_INDEX_TMP_EXT)];
+    vfs_path_vgm_index(index_file, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s" VGM_INDEX_TMP_EXT, path);
+
+    vgm_index_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, VGM_INDEX_MAGIC, sizeof(header.magic));
+    header.version = VGM_INDEX_VERSION;
+    header.record_size = sizeof(vgm_index_record_t);
+    header.count = scan_table.count;
+    header.strings_size = scan_table.strings_size;
+
+    FILE *fp = fopen(tmp_path, "wb");
+    if(fp == NULL) {
+        ESP_LOGE(TAG, "can not create index(%s)", tmp_path);
+        return false;
+    }
+    bool result = fwrite(&header, sizeof(header), 1, fp) == 1
+        && fwrite(scan_table.records, sizeof(vgm_index_record_t), scan_table.count, fp) == scan_table.count
+        && fwrite(scan_table.strings, 1, scan_table.strings_size, fp) == scan_table.strings_size;
+    result = fclose(fp) == 0 && result;
+    if(!result) {
+        ESP_LOGE(TAG, "write index error(%s)", tmp_path);
+        remove(tmp_path);
+        return false;
+    }
+    remove(path);
+    if(rename(tmp_path, path) != 0) {
+        ESP_LOGE(TAG, "rename index error(%s)", path);
+        remove(tmp_path);
+        return false;
+    }
+
+    return true;
+}
+
+static void close_scan_vgm_index(void)
+{
+    while(scan.depth > 0) {
+        closedir(scan.dirs[--scan.depth]);
+    }
+    scan.scanning = false;
+    scan.reading = false;
+}
+
+/**
+ * Initialize the index and load the index file
+ *
+ *  mount: VFS path of SD
+ *  dir: SD path of the directory to be indexed
+ *  index_path: SD path of the index file
+ *
+ * Returns false if there is no valid index file (yet).
+ */
+bool init_vgm_index(const char *mount, const char *dir, const char *index_path)
+{
+    strncpy(index_mount, mount, sizeof(index_mount) - 1);
+    index_mount[sizeof(index_mount) - 1] = '\0';
+    strncpy(index_dir, dir, sizeof(index_dir) - 1);
+    index_dir[sizeof(index_dir) - 1] = '\0';
+    strncpy(index_file, index_path, sizeof(index_file) - 1);
+    index_file[sizeof(index_file) - 1] = '\0';
+
+    if(!load_vgm_index()) {
+        return false;
+    }
+    ESP_LOGI(TAG, "vgm index: %s (%u files)", index_file, (unsigned)index_table.count);
+
+    return true;
+}
+
+/**
+ * Begin a scan of the directory
+ *
+ * Call step_vgm_index until it returns false, then end_vgm_index.
+ */
+bool begin_vgm_index(void)
+{
+    cancel_vgm_index();
+
+    char path[VGM_INDEX_PATH_LEN * 2];
+    vfs_path_vgm_index(index_dir, path, sizeof(path));
+    DIR *dir = opendir(path);
+    if(dir == NULL) {
+        ESP_LOGW(TAG, "can not open directory(%s)", path);
+        return false;
+    }
+    memset(&scan, 0, sizeof(scan));
+    scan.scanning = true;
+    scan.dirs[0] = dir;
+    scan.path_lengths[0] = strlen(index_dir);
+    scan.depth = 1;
+    strcpy(scan.path, index_dir);
+
+    return true;
+}
+
+/**
+ * Look at up to VGM_INDEX_STEP_ENTRIES directory entries
+ *
+ * A file that is unchanged since the index was written is taken from it.
+ * When a file must be read, path is set to its SD path (valid until the
+ * next step) and the step returns; pass its header and GD3 to
+ * add_vgm_index before the next step. Otherwise path is NULL.
+ * Returns false when the scan is over.
+ */
+bool step_vgm_index(const char **path)
+{
+    *path = NULL;
+    if(!scan.scanning) return false;
+    if(scan.reading) {
+        // not read, indexed without the header
+        add_vgm_index(NULL, NULL);
+    }
+
+    for(uint32_t entries = 0; entries < VGM_INDEX_STEP_ENTRIES; entries++) {
+        if(scan.depth == 0) return false;
+        size_t dir_length = scan.path_lengths[scan.depth - 1];
+        struct dirent *dirent = readdir(scan.dirs[scan.depth - 1]);
+        if(dirent == NULL) {
+            closedir(scan.dirs[--scan.depth]);
+            continue;
+        }
+        // hidden files, "." and ".."
+        if(dirent->d_name[0] == '.') continue;
+        size_t length = strlen(dirent->d_name);
+        if(dir_length + 1 + length >= sizeof(scan.path)) continue;
+        scan.path[dir_length] = '/';
+        strcpy(scan.path + dir_length + 1, dirent->d_name);
+
+        char vfs_path[VGM_INDEX_PATH_LEN * 2];
+        vfs_path_vgm_index(scan.path, vfs_path, sizeof(vfs_path));
+        struct stat st;
+        if(stat(vfs_path, &st) != 0) continue;
+        if(S_ISDIR(st.st_mode)) {
+            if(scan.depth == VGM_INDEX_DEPTH) continue;
+            DIR *dir = opendir(vfs_path);
+            if(dir == NULL) continue;
+            scan.dirs[scan.depth] = dir;
+            scan.path_lengths[scan.depth] = dir_length + 1 + length;
+            scan.depth++;
+            continue;
+        }
+        // .vgm/.vgz only (not .cse or .pcm saved next to them)
+        if(!is_vgm_file_vgm_index(dirent->d_name)) continue;
+        scan.files++;
+        scan.mtime = (uint32_t)st.st_mtime;
+        scan.size = (uint32_t)st.st_size;
+
+        const vgm_index_record_t *record = find_vgm_index(scan.path);
+        if(record != NULL && record->mtime == scan.mtime && record->size == scan.size) {
+            const char *names[] = {
+                scan.path,
+                index_table.strings + record->title,
+                index_table.strings + record->game,
+                index_table.strings + record->system,
+                index_table.strings + record->author,
+                index_table.strings + record->date,
+            };
+            append_vgm_index(&scan_table, names, record->mtime, record->size, &record->info);
+            continue;
+        }
+        scan.reading = true;
+        *path = scan.path;
+        return true;
+    }
+
+    return true;
+}
+
+/**
+ * Add the file returned by step_vgm_index
+ *
+ *  info: header summary, NULL if the file could not be read
+ *  strings: title, game, system, author and date, NUL terminated
+ *           (NULL if there is no GD3)
+ */
+bool add_vgm_index(const vgm_index_info_t *info, const char *strings)
+{
+    if(!scan.reading) return false;
+    scan.reading = false;
+    scan.reads++;
+
+    vgm_index_info_t blank;
+    memset(&blank, 0, sizeof(blank));
+    const char *names[1 + VGM_INDEX_GD3_STRINGS] = { scan.path, "", "", "", "", "" };
+    for(uint32_t i = 0; strings != NULL && i < VGM_INDEX_GD3_STRINGS; i++) {
+        names[1 + i] = strings;
+        strings += strlen(strings) + 1;
+    }
+    if(info == NULL) {
+        ESP_LOGW(TAG, "can not read(%s)", scan.path);
+    }
+
+    return append_vgm_index(&scan_table, names, scan.mtime, scan.size, info != NULL ? info : &blank);
+}
+
+/**
+ * Finish the scan, write the index file and use it
+ *
+ * The file is not written if no file has been added, changed or removed.
+ */
+bool end_vgm_index(void)
+{
+    if(scan.reading) {
+        add_vgm_index(NULL, NULL);
+    }
+    close_scan_vgm_index();
+    if(scan.failed) {
+        ESP_LOGE(TAG, "index out of memory(%u files)", (unsigned)scan.files);
+        free_table_vgm_index(&scan_table);
+        return false;
+    }
+    if(scan.reads == 0 && scan_table.count == index_table.count) {
+        free_table_vgm_index(&scan_table);
+        ESP_LOGI(TAG, "vgm index unchanged(%u files)", (unsigned)index_table.count);
+        return true;
+    }
+
+    // a table of no string is ""
+    if(scan_table.strings_size == 0) {
+        scan_table.strings = (char *)calloc(1, 1);
+        if(scan_table.strings == NULL) return false;
+        scan_table.strings_size = scan_table.strings_capacity = 1;
+    }
+    qsort(scan_table.records, scan_table.count, sizeof(vgm_index_record_t), compare_record_vgm_index);
+    bool result = write_vgm_index();
+    free_table_vgm_index(&index_table);
+    index_table = scan_table;
+    memset(&scan_table, 0, sizeof(scan_table));
+    ESP_LOGI(TAG, "vgm index: %s (%u files, %u read)",
+        index_file, (unsigned)index_table.count, (unsigned)scan.reads);
+
+    return result;
+}
+
+/**
+ * Stop the scan, the index is kept as it was
+ */
+void cancel_vgm_index(void)
+{
+    close_scan_vgm_index();
+    free_table_vgm_index(&scan_table);
+}
+
+uint32_t count_vgm_index(void)
+{
+    return index_table.count;
+}
+
+/**
+ * Find the record of an SD path, NULL if it is not indexed
+ *
+ * The record is valid until the next end_vgm_index.
+ */
+const vgm_index_record_t *find_vgm_index(const char *path)
+{
+    if(index_table.count == 0) return NULL;
+    return (const vgm_index_record_t *)bsearch(
+        path,
+        index_table.records,
+        index_table.count,
+        sizeof(vgm_index_record_t),
+        compare_path_vgm_index);
+}
+
+/**
+ * String of a record offset
+ */
+const char *string_vgm_index(uint32_t offset)
+{
+    if(offset >= index_table.strings_size) return "";
+    return index_table.strings + offset;
+}
+
+/**
+ * Estimated render time per play time in percent (see chip_costs)
+ *
+ * A dual chip costs twice. 0 if no chip is played (a file that could not be read).
+ */
+uint32_t cost_vgm_index(const vgm_index_info_t *info)
+{
+    if(info->chips == 0) return 0;
+    uint32_t cost = VGM_INDEX_PIPELINE_COST;
+    for(uint32_t bit = 0; bit < VGM_INDEX_CHIP_COSTS; bit++) {
+        if(info->chips & (1u << bit)) {
+            cost += chip_costs[bit] * (info->dual_chips & (1u << bit) ? 2 : 1);
+        }
+    }
+    return cost;
+}
@@ -0,0 +1,110 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/**
+ * Library index
+ *
+ * The .vgm/.vgz files under a directory of SD are listed in an index file
+ * of fixed size records sorted by path, followed by a string table
+ * addressed by offsets (offset 0 is ""). A rescan reads only the files
+ * added or changed (by mtime and size) since the index was written.
+ *
+ * The paths are SD paths (e.g. /M5Stack/VGM/30.vgm) as played.
+ */
+#define VGM_INDEX_MAGIC "CSIX"
+#define VGM_INDEX_VERSION 3
+#define VGM_INDEX_PATH_LEN 128
+#define VGM_INDEX_SAMPLE_RATE 44100
+
+/**
+ * Bits of vgm_index_info_t chips (VGM_META_CHIP_* of driver/vgmindex.rs)
+ */
+#define VGM_INDEX_CHIP_YM2612   (1 << 0)
+#define VGM_INDEX_CHIP_YM2151   (1 << 1)
+#define VGM_INDEX_CHIP_YM2203   (1 << 2)
+#define VGM_INDEX_CHIP_YM2413   (1 << 3)
+#define VGM_INDEX_CHIP_AY8910   (1 << 4)
+#define VGM_INDEX_CHIP_YM2608   (1 << 5)
+#define VGM_INDEX_CHIP_YM2610   (1 << 6)
+#define VGM_INDEX_CHIP_YM3812   (1 << 7)
+#define VGM_INDEX_CHIP_YM3526   (1 << 8)
+#define VGM_INDEX_CHIP_Y8950    (1 << 9)
+#define VGM_INDEX_CHIP_YMF262   (1 << 10)
+#define VGM_INDEX_CHIP_YMF278B  (1 << 11)
+#define VGM_INDEX_CHIP_SN76489  (1 << 12)
+#define VGM_INDEX_CHIP_PWM      (1 << 13)
+#define VGM_INDEX_CHIP_SEGAPCM  (1 << 14)
+#define VGM_INDEX_CHIP_OKIM6258 (1 << 15)
+#define VGM_INDEX_CHIP_C140     (1 << 16)
+#define VGM_INDEX_CHIP_C219     (1 << 17)
+#define VGM_INDEX_CHIP_OKIM6295 (1 << 18)
+#define VGM_INDEX_CHIP_OTHER    (1u << 31)
+
+/**
+ * VGM header summary (VgmMetaInfo of driver/vgmindex.rs)
+ *
+ *  version: BCD version as decimal (e.g. 171)
+ *  total_samples, loop_samples: at VGM_INDEX_SAMPLE_RATE (loop_samples 0 is no loop)
+ *  chips: VGM_INDEX_CHIP_* of the chips played
+ *  dual_chips: VGM_INDEX_CHIP_* of the chips played as two
+ */
+typedef struct vgm_index_info {
+    uint32_t version;
+    uint32_t total_samples;
+    uint32_t loop_samples;
+    uint32_t chips;
+    uint32_t dual_chips;
+} vgm_index_info_t;
+
+/**
+ * Index file header
+ *
+ *  count: records after the header
+ *  strings_size: bytes of the string table after the records
+ */
+typedef struct vgm_index_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t count;
+    uint32_t strings_size;
+    uint32_t reserved[2];
+} vgm_index_header_t;
+
+/**
+ * Index record
+ *
+ *  path .. date: offsets of the string table (GD3 names, "" if blank)
+ *  mtime, size: of the file when it was read
+ *  render_cost: estimated render time per play time in percent
+ *               (0 if the file could not be read)
+ */
+typedef struct vgm_index_record {
+    uint32_t path;
+    uint32_t title;
+    uint32_t game;
+    uint32_t system;
+    uint32_t author;
+    uint32_t date;
+    uint32_t mtime;
+    uint32_t size;
+    vgm_index_info_t info;
+    uint32_t render_cost;
+} vgm_index_record_t;
+
+bool init_vgm_index(const char *mount, const char *dir, const char *index_path);
+bool begin_vgm_index(void);
+bool step_vgm_index(const char **path);
+bool add_vgm_index(const vgm_index_info_t *info, const char *strings);
+bool end_vgm_index(void);
+void cancel_vgm_index(void);
+uint32_t count_vgm_index(void);
+const vgm_index_record_t *find_vgm_index(const char *path);
+const char *string_vgm_index(uint32_t offset);
+uint32_t cost_vgm_index(const vgm_index_info_t *info);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+"""
+Pack sample ROMs into a rom partition image (main/rom_partition.h)
+
+  tools/mkrompart.py -o rom.bin ym2608_rhythm=ym2608_adpcm_rom.bin ymf278b_wavetable=yrw801.rom
+  parttool.py write_partition --partition-name rom --input rom.bin
+"""
+import argparse
+import struct
+import sys
+
+MAGIC = b"CSRM"
+VERSION = 1
+MAX_IMAGES = 16
+NAME_LEN = 20
+# flash MMU page size, each image is mapped on its own
+ALIGN = 0x10000
+# size of the rom partition in partitions.csv
+PARTITION_SIZE = 0x300000
+
+# name: (chip_type in ymfmffi.cpp, VGM data block type)
+ROMS = {
+    "ym2608_rhythm": (4, 0x82),
+    "ymf278b_wavetable": (11, 0x84),
+}
+
+
+def align(value):
+    return (value + ALIGN - 1) // ALIGN * ALIGN
+
+
+def main():
+    parser = argparse.ArgumentParser(description="pack sample ROMs into a rom partition image")
+    parser.add_argument("-o", "--output", required=True, help="output image")
+    parser.add_argument("--size", type=lambda v: int(v, 0), default=PARTITION_SIZE, help="partition size")
+    parser.add_argument("roms", nargs="+", metavar="NAME=FILE", help="one of: " + ", ".join(ROMS))
+    args = parser.parse_args()
+
+    if len(args.roms) > MAX_IMAGES:
+        sys.exit("too many images")
+
+    images = []
+    for rom in args.roms:
+        name, _, path = rom.partition("=")
+        if name not in ROMS or not path:
+            sys.exit("unknown rom: {} (one of: {})".format(rom, ", ".join(ROMS)))
+        with open(path, "rb") as fp:
+            images.append((name, fp.read()))
+
+    header = MAGIC + struct.pack("<HH8x", VERSION, len(images))
+    directory = b""
+    body = b""
+    offset = align(len(header) + len(images) * (NAME_LEN + 12))
+    for name, data in images:
+        chip_num, access_type = ROMS[name]
+        directory += struct.pack("<{}sHHII".format(NAME_LEN), name.encode(), chip_num, access_type, offset, len(data))
+        body += data + b"\xff" * (align(len(data)) - len(data))
+        offset += align(len(data))
+
+    head = header + directory
+    image = head + b"\xff" * (align(len(head)) - len(head)) + body
+    if len(image) > args.size:
+        sys.exit("image is {} bytes, rom partition is {} bytes".format(len(image), args.size))
+    with open(args.output, "wb") as fp:
+        fp.write(image)
+    for name, data in images:
+        print("{}: {} bytes".format(name, len(data)))
+
+
+if __name__ == "__main__":
+    main()